@@ -32,7 +32,7 @@ cfa_create(const char *path, CFAFileFormat format, int *cfa_idp)
     CFA_CHECK(cfa_err);
 
     /* add the path, name to NULL */
-    cfa_node->path = strdup(path);
+    cfa_node->path = cfa_strdup(path);
     cfa_node->name = NULL;
 
     cfa_node->n_vars = 0;
@@ -190,6 +190,11 @@ cfa_get(const int cfa_id, AggregationContainer **agg_cont)
 }
 
 extern int cfa_free_cont(const int);
+extern int _cfa_netcdf_cache_drop(const int);
+extern int _cfa_data_cache_drop(const int, const int);
+extern int _cfa_prefetch_close(const int);
+extern int _cfa_read_requests_close(const int);
+extern int _cfa_zarr_drop(const int);
 
 /* close a CFA AggregationContainer container */
 int cfa_close(const int cfa_id)
@@ -211,6 +216,12 @@ int cfa_close(const int cfa_id)
     /* check that it is valid */
     CFA_CHECK(cfa_err);
 
+    /* wait for any Fragments being read ahead, or read asynchronously */
+    cfa_err = _cfa_prefetch_close(cfa_id);
+    CFA_CHECK(cfa_err);
+    cfa_err = _cfa_read_requests_close(cfa_id);
+    CFA_CHECK(cfa_err);
+
     /* close the file handled outside now */
     if (cfa_node)
     {
@@ -218,6 +229,15 @@ int cfa_close(const int cfa_id)
         cfa_err = cfa_free_cont(cfa_id);
         CFA_CHECK(cfa_err);
     }
+    /* remove the cached Fragment data for the container */
+    cfa_err = _cfa_data_cache_drop(cfa_id, -1);
+    CFA_CHECK(cfa_err);
+    /* close the Fragment files kept open by the handle cache for it */
+    cfa_err = _cfa_netcdf_cache_drop(cfa_id);
+    CFA_CHECK(cfa_err);
+    /* forget the metadata of the Zarr arrays read for it */
+    cfa_err = _cfa_zarr_drop(cfa_id);
+    CFA_CHECK(cfa_err);
     return CFA_NOERR;
 }
 
@@ -22,6 +22,13 @@
 #define CONVENTIONS    ("Conventions")
 #define AGGREGATED_DIMENSIONS ("aggregated_dimensions")
 #define AGGREGATED_DATA ("aggregated_data")
+#define SCALE_FACTOR ("scale_factor")
+#define ADD_OFFSET ("add_offset")
+#define FILL_VALUE ("_FillValue")
+/* non-standard terms of the Fragment statistics */
+#define FRAGMENT_MIN ("fragment_min")
+#define FRAGMENT_MAX ("fragment_max")
+#define FRAGMENT_COUNT ("fragment_count")
 
 /* Fixed size of arrays */
 #define MAX_VARS 256
@@ -57,6 +64,16 @@ typedef struct {
     int size;
 } FragmentDatum;
 
+/* the way the data of a Fragment was last read */
+typedef enum {
+    CFA_READ_NONE=-1,       /* not read yet */
+    CFA_READ_STAGED=0,      /* into a staging buffer, then copied */
+    CFA_READ_ZERO_COPY=1,   /* straight into the output buffer */
+    CFA_READ_CACHED=2,      /* via the data cache */
+    CFA_READ_FILL=3,        /* no data, filled with the fill value */
+    CFA_READ_SKIPPED=4      /* no values match the predicate, filled */
+} CFAReadPath;
+
 /* Fragment */
 typedef struct {
     size_t *location;
@@ -64,6 +81,9 @@ typedef struct {
     DynamicArray *cfa_fragdatsp;    
     /* helper variable - linear index into 1D arrays */
     int linear_index;
+    /* CFAReadPath of the last read, set atomically as Fragments are read by
+    several threads */
+    int read_path;
 } Fragment;
 
 /* AggregationInstruction - singular */
@@ -86,8 +106,20 @@ typedef struct {
     char *name;
     int length;
     DataType type;
+    /* values of the dimension variable, as double, or NULL if they have not
+    been defined or read yet */
+    double *coords;
 } AggregatedDimension;
 
+/* packing of the data of a variable with the scale_factor and add_offset
+attributes.  The unpacked data is packed * scale_factor + add_offset */
+typedef struct {
+    bool packed;
+    cfa_type type;      /* type of the attributes, the unpacked type */
+    double scale_factor;
+    double add_offset;
+} CFAPacking;
+
 /* AggregationVariable */
 typedef struct {
     char *name;
@@ -100,14 +132,69 @@ typedef struct {
     AggregatedData *cfa_datap;
     int n_instr;
     AggregationInstruction cfa_instr[MAX_AGG_INSTR];
+    CFAPacking cfa_packing;
+    /* unpack the data when it is read */
+    bool cfa_unpack;
+    /* _FillValue, in the type of the variable, aligned so that it can be
+    converted in place */
+    bool cfa_has_fill;
+    _Alignas(long long) _Alignas(double)
+    unsigned char cfa_fill_value[sizeof(long long)];
 } AggregationVariable;
 
+/* FragmentRead - the part of a Fragment that overlaps a hyperslab of the
+AggregatedData.  The four arrays have one entry per dimension and are 
+allocated together as a single block of 4 * ndim */
+typedef struct {
+    Fragment *frag;
+    /* start, count and stride of the overlap, relative to the Fragment.  count
+    is the number of elements selected, and a NULL stride is a stride of 1 */
+    size_t *frag_start;
+    size_t *count;
+    size_t *stride;
+    /* start of the overlap, relative to the hyperslab */
+    size_t *out_start;
+} FragmentRead;
+
 /* File formats */
 typedef enum {
     CFA_UNKNOWN=-1,
     CFA_NETCDF=0
 } CFAFileFormat;
 
+/* driver reading, and optionally writing, the Fragments of one format.  Each
+Fragment is read with the driver registered for its "format" FragmentDatum.
+start, count and stride are relative to the Fragment, with one value for each
+AggregatedDimension, and stride may be NULL.  The functions are called from
+several threads at once when Fragments are read in parallel */
+typedef struct {
+    /* prepare a Fragment for the reads of one overlap, setting *handlep to
+    state passed to read and close.  Optional: the handle is NULL without it */
+    int (*open)(const int cfa_id, const Fragment *frag, void **handlep);
+    /* read a hyperslab of a Fragment into data, in type, and unpacked with
+    unpack if it is not NULL.  Required */
+    int (*read)(void *handle, const int cfa_id, const Fragment *frag,
+                const int ndim, const size_t *start, const size_t *count,
+                const size_t *stride, const cfa_type type,
+                const CFAPacking *unpack, void *data);
+    /* release the handle from open.  Optional */
+    int (*close)(void *handle);
+    /* write a hyperslab of a Fragment from data, in type.  create is set if
+    the file of the Fragment is new.  Optional: Fragments cannot be written
+    without it */
+    int (*write)(const int cfa_id, const int cfa_var_id, const Fragment *frag,
+                 const size_t *start, const size_t *count,
+                 const cfa_type type, const int create, const void *data);
+    /* hint that a Fragment is about to be read, from read-ahead.  Optional */
+    int (*prefetch)(const int cfa_id, const Fragment *frag);
+    /* get the minimum, maximum and number of the valid values of a Fragment,
+    as they are stored, without reading it, for cfa_var_def_frag_stats.
+    Returns CFA_FRAG_FORMAT_ERR if they are not known, and the Fragment is
+    read instead.  Optional */
+    int (*stat)(const int cfa_id, const Fragment *frag, double *minp,
+                double *maxp, long long *countp);
+} CFAFormatDriver;
+
 /* AggregationContainer */
 typedef struct AggregationContainer AggregationContainer;
 struct AggregationContainer {
@@ -193,6 +280,28 @@ extern int cfa_inq_dim_ids(const int cfa_id, int **dimids);
 extern int cfa_get_dim(const int cfa_id, const int cfa_dim_id, 
                        AggregatedDimension **agg_dim);
 
+/* define the values of the dimension variable of an AggregatedDimension, one
+per element.  They must be strictly increasing or decreasing, and are written
+by cfa_serialise */
+extern int cfa_dim_put_coords(const int cfa_id, const int cfa_dim_id,
+                              const double *coords);
+
+/* get the start and count of the elements of an AggregatedDimension whose
+coordinates are between lo and hi, inclusive, by binary search.  The
+coordinates of a loaded file are read from its dimension variable when they
+are first needed and then kept.  A NaN bound is unbounded, and if both are NaN
+the whole dimension is selected without the coordinates.  count is 0 if no
+coordinates are in the range */
+extern int cfa_dim_coord_range(const int cfa_id, const int cfa_dim_id,
+                               const double lo, const double hi,
+                               size_t *startp, size_t *countp);
+
+/* get the hyperslab of a variable for a range of coordinate values in each
+dimension, as cfa_dim_coord_range, to pass to cfa_var_get_vara */
+extern int cfa_var_coord_hyperslab(const int cfa_id, const int cfa_var_id,
+                                   const double *lo, const double *hi,
+                                   size_t *start, size_t *count);
+
 /* create an AggregationVariable container, attach it to a cfa_id and one 
 or more cfa_dim_ids and assign it to a cfavarid */
 extern int cfa_def_var(const int cfa_id, const char *name, 
@@ -218,6 +327,35 @@ extern int cfa_var_get_agg_instr(const int cfa_id, const int cfa_var_id,
                                  const char *term,
                                  AggregationInstruction **agg_instr);
 
+/* define the packing of the data of a variable, i.e. the scale_factor and
+add_offset attributes.  type is the type of the attributes, which is the type
+of the unpacked data.  The packing is read from the attributes when a
+CFA-netCDF file is loaded */
+extern int cfa_var_def_packing(const int cfa_id, const int cfa_var_id,
+                               const cfa_type type, const double scale_factor,
+                               const double add_offset);
+
+/* get the packing of the data of a variable */
+extern int cfa_var_get_packing(const int cfa_id, const int cfa_var_id,
+                               CFAPacking **packing);
+
+/* set whether the data of a packed variable is unpacked when it is read.  The
+unpacking is done as the data of each Fragment is converted to the type being
+read, which must then be CFA_FLOAT or CFA_DOUBLE.  Off by default */
+extern int cfa_var_set_unpack(const int cfa_id, const int cfa_var_id,
+                              const bool unpack);
+
+/* define the _FillValue of a variable.  fill_value is a single value of the
+type of the variable.  The _FillValue is read from the attribute when a
+CFA-netCDF file is loaded */
+extern int cfa_var_def_fill(const int cfa_id, const int cfa_var_id,
+                            const void *fill_value);
+
+/* get the _FillValue of a variable.  has_fill is false if it has not been
+defined, in which case fill_value is not set */
+extern int cfa_var_get_fill(const int cfa_id, const int cfa_var_id,
+                            bool *has_fill, void *fill_value);
+
 /* get the identifier of an AggregationVariable by name */
 extern int cfa_inq_var_id(const int cfa_id, const char *name, 
                           int *cfa_dim_idp);
@@ -267,6 +405,340 @@ extern int cfa_var_get1_frag(const int cfa_id, const int cfa_var_id,
                              const char *term,
                              void **data);
 
+/* read a hyperslab of the AggregatedData of a variable.  Only the Fragments 
+that intersect the hyperslab are read, and the data in each overlap is copied 
+into buf, converting to type.  buf is ordered in the same way as the 
+AggregatedDimensions of the variable and must be large enough to hold the 
+product of count elements */
+extern int cfa_var_get_vara(const int cfa_id, const int cfa_var_id,
+                            const size_t *start, const size_t *count,
+                            const cfa_type type, void *buf);
+
+/* callback for an asynchronous read, called with the request id and the error
+of the read on the thread that completed it.  It is called before the request
+is marked done, so it must not call cfa_wait for the request */
+typedef void (*cfa_callback)(const int req_id, const int err,
+                             void *user_data);
+
+/* start an asynchronous read of a hyperslab of the AggregatedData of a
+variable.  The Fragments are read in the background by the same threads and
+caches as cfa_var_get_vara, and callback, if not NULL, is called when the read
+completes.  buf must not be used until the read completes.  The request id
+returned in req_idp must be released by cfa_wait, or by cfa_test returning
+done, before the AggregationContainer is closed */
+extern int cfa_var_get_vara_async(const int cfa_id, const int cfa_var_id,
+                                  const size_t *start, const size_t *count,
+                                  const cfa_type type, void *buf,
+                                  cfa_callback callback, void *user_data,
+                                  int *req_idp);
+
+/* wait for an asynchronous read to complete and release the request.  Returns
+the error of the read */
+extern int cfa_wait(const int req_id);
+
+/* test whether an asynchronous read has completed.  If it has, donep is set to
+1, the request is released and the error of the read is returned */
+extern int cfa_test(const int req_id, int *donep);
+
+/* read a strided hyperslab of the AggregatedData of a variable.  Every stride
+element along each dimension is read, starting at start, for count elements.
+Only the Fragments that contain a selected element are read, and only the
+selected elements are read from them.  A NULL stride is a stride of 1 */
+extern int cfa_var_get_vars(const int cfa_id, const int cfa_var_id,
+                            const size_t *start, const size_t *count,
+                            const size_t *stride,
+                            const cfa_type type, void *buf);
+
+/* read the values of the AggregatedData of a variable at npoints points.
+points holds the index of each point along every dimension, npoints * ndim
+values with the dimensions of a point varying fastest, and the values are
+written to buf in the same order.  The points are grouped by the Fragment that
+contains them, so that each Fragment is read once */
+extern int cfa_var_get_points(const int cfa_id, const int cfa_var_id,
+                              const size_t npoints, const size_t *points,
+                              const cfa_type type, void *buf);
+
+/* read a series of count values along the dimension dim of a variable,
+starting at the point index, which holds the index along every dimension.  The
+series is read from each Fragment it crosses as a single run, straight into
+buf, with the runs read on the worker pool.  Fragment files are kept open by
+the handle cache, which can be enlarged with cfa_set_handle_cache_size for
+series that are read repeatedly */
+extern int cfa_var_get_series(const int cfa_id, const int cfa_var_id,
+                              const size_t *index, const int dim,
+                              const size_t count, const cfa_type type,
+                              void *buf);
+
+/* a hyperslab of one variable, for cfa_var_get_vara_multi */
+typedef struct {
+    int cfa_var_id;
+    const size_t *start;
+    const size_t *count;
+    cfa_type type;
+    void *buf;
+} CFAVarRead;
+
+/* read a hyperslab of each of nreads variables, as cfa_var_get_vara.  The
+Fragments of all the variables are grouped by their "file", and the reads from
+each file are made together, so that variables that share Fragment files, with
+different addresses, open each file once while it is in the handle cache */
+extern int cfa_var_get_vara_multi(const int cfa_id, const int nreads,
+                                  const CFAVarRead *reads);
+
+/* read a tile of the AggregatedData of a variable, as cfa_var_get_vara, with a
+halo of halo[d] elements on either side of it along each dimension, so that buf
+has count[d] + 2 * halo[d] elements along each dimension.  The halo wraps
+around the dimensions for which periodic[d] is non-zero, which can then have a
+halo no longer than the dimension, and is the fill value beyond the ends of the
+others.  Only the strips of the neighbouring Fragments in the halo are read.  A
+NULL halo or periodic is no halo, or no periodic dimensions */
+extern int cfa_var_get_vara_halo(const int cfa_id, const int cfa_var_id,
+                                 const size_t *start, const size_t *count,
+                                 const size_t *halo, const int *periodic,
+                                 const cfa_type type, void *buf);
+
+/* read a hyperslab of the AggregatedData of a variable, as cfa_var_get_vara,
+with its dimensions permuted, so that dimension i of buf is dimension perm[i]
+of the variable and has count[perm[i]] elements.  The overlap of each Fragment
+is transposed into buf as it is read, so the data is only copied once.  An
+invalid permutation is CFA_PERM_ERR */
+extern int cfa_var_get_vara_perm(const int cfa_id, const int cfa_var_id,
+                                 const size_t *start, const size_t *count,
+                                 const int *perm, const cfa_type type,
+                                 void *buf);
+
+/* comparisons for cfa_var_get_vara_where */
+typedef enum {
+    CFA_WHERE_LT=0,
+    CFA_WHERE_LE=1,
+    CFA_WHERE_GT=2,
+    CFA_WHERE_GE=3,
+    CFA_WHERE_EQ=4,
+    CFA_WHERE_NE=5
+} CFAWhereOp;
+
+/* a predicate on the values of a variable, value op where->value */
+typedef struct {
+    CFAWhereOp op;
+    double value;
+} CFAPredicate;
+
+/* read a hyperslab of the AggregatedData of a variable, as cfa_var_get_vara,
+keeping only the values that match a predicate and replacing the others with
+the fill value.  The values are compared as double, after unpacking if
+unpacking is on.  Fragments whose statistics, from cfa_var_def_frag_stats, show
+that none of their values match are filled without being read */
+extern int cfa_var_get_vara_where(const int cfa_id, const int cfa_var_id,
+                                  const size_t *start, const size_t *count,
+                                  const CFAPredicate *where,
+                                  const cfa_type type, void *buf);
+
+/* compute the minimum, maximum and number of valid values of each Fragment of a
+variable, in parallel, and keep them as the non-standard FragmentDatums
+"fragment_min", "fragment_max" (double) and "fragment_count" (long long).  The
+statistics are of the values as stored, before unpacking, and leave out
+missing values as cfa_var_reduce does.  The AggregationInstructions for the
+terms are defined, with variables named after the variable, e.g.
+"tas_fragment_min", so they are written by cfa_serialise and read back by
+cfa_load.  They must already be defined if the AggregationContainer has been
+serialised.  cfa_var_put_vara marks the statistics of the Fragments it writes
+as out of date, with a count of -1 */
+extern int cfa_var_def_frag_stats(const int cfa_id, const int cfa_var_id);
+
+/* reductions of the AggregatedData of a variable for cfa_var_reduce */
+typedef enum {
+    CFA_REDUCE_MIN=0,       /* double */
+    CFA_REDUCE_MAX=1,       /* double */
+    CFA_REDUCE_SUM=2,       /* double */
+    CFA_REDUCE_COUNT=3,     /* size_t, the number of valid values */
+    CFA_REDUCE_MEAN=4,      /* double */
+    CFA_REDUCE_HISTOGRAM=5, /* size_t[nbins] */
+    CFA_REDUCE_USER=6       /* partial_size bytes */
+} CFAReduceOp;
+
+/* add n values to a partial result of a user reduction.  Returns CFA_NOERR, or
+an error that stops the reduction */
+typedef int (*cfa_reduce_fn)(const double *data, const size_t n,
+                             void *partial, void *user_data);
+
+/* combine a partial result of a user reduction into the result */
+typedef int (*cfa_combine_fn)(void *result, const void *partial,
+                              void *user_data);
+
+/* a reduction.  A histogram has nbins bins of equal width over [lo, hi), and
+values outside of it are not counted.  A user reduction keeps a partial result
+of partial_size bytes for each thread, which starts as a copy of the result
+passed to cfa_var_reduce, so that must hold the identity of the reduction.
+reduce is called on several threads at once, but never with the same partial
+result, and combine is called on the calling thread */
+typedef struct {
+    CFAReduceOp op;
+    int nbins;
+    double lo;
+    double hi;
+    size_t partial_size;
+    cfa_reduce_fn reduce;
+    cfa_combine_fn combine;
+    void *user_data;
+} CFAReducer;
+
+/* reduce a hyperslab of the AggregatedData of a variable without reading it
+all into memory.  The Fragments are reduced in parallel on the threads set by
+cfa_set_nthreads, each read as double in chunks of at most 65536 values, and
+the partial results are combined into result, whose type depends on the op of
+the reducer.  Missing values, i.e. the values that Fragments with no data are
+read as and NaN, are left out, and the min, max and mean of no values are NaN.
+The data is unpacked if unpacking is on for the variable */
+extern int cfa_var_reduce(const int cfa_id, const int cfa_var_id,
+                          const size_t *start, const size_t *count,
+                          const CFAReducer *reducer, void *result);
+
+/* write a hyperslab of the AggregatedData of a variable into the Fragments
+defined by cfa_var_def_frag_num.  The overlap of each Fragment is converted from
+type to the type of the variable and written to the Fragment file, in parallel
+on the threads set by cfa_set_nthreads.  Fragments with no data are given a new
+netCDF file, named after the CFA file, the variable and the Fragment, e.g.
+"agg_tas_3.nc" next to "agg.nc", unless their "file" has been defined, and the
+"file", "format" and "address" FragmentDatums are filled in.  Fragments that
+have not been defined are given their location, so the variable should be
+written before cfa_serialise.  buf holds the data as it is stored, i.e. packed
+for a packed variable, and any cached data of the variable is discarded */
+extern int cfa_var_put_vara(const int cfa_id, const int cfa_var_id,
+                            const size_t *start, const size_t *count,
+                            const cfa_type type, const void *buf);
+
+/* get the way the data of a Fragment was last read by cfa_var_get_vara and
+the other read functions.  A Fragment is read straight into the output buffer
+(CFA_READ_ZERO_COPY) when its overlap with the hyperslab is one contiguous run
+of the output, e.g. when only the first dimension is split into Fragments.
+Either frag_location or data_location is used to find the Fragment, as in
+cfa_var_get1_frag */
+extern int cfa_var_inq_read_path(const int cfa_id, const int cfa_var_id,
+                                 const size_t *frag_location,
+                                 const size_t *data_location,
+                                 CFAReadPath *pathp);
+
+/* get which of the Fragments that contain an element of a strided hyperslab
+have data.  Fragments with a missing or empty "address" have no data, and are
+read as the _FillValue of the variable, or the default netCDF fill value of
+the type read if it has none, without any I/O.  The Fragments are ordered by
+their index, with the last FragmentDimension varying fastest, and bit i of
+bitmap (bitmap[i / 8] & (1 << (i % 8))) is set if Fragment i has data.  The
+number of Fragments is returned in nfragsp.  bitmap may be NULL to get the
+number of Fragments, otherwise it must hold (*nfragsp + 7) / 8 bytes */
+extern int cfa_var_inq_frag_presence(const int cfa_id, const int cfa_var_id,
+                                     const size_t *start, const size_t *count,
+                                     const size_t *stride, size_t *nfragsp,
+                                     unsigned char *bitmap);
+
+/* order in which a Fragment iterator visits the Fragments of a variable */
+typedef enum {
+    CFA_ITER_LINEAR=0,      /* by index, last FragmentDimension fastest */
+    CFA_ITER_FILE=1,        /* grouped by "file", aggregation file first */
+    CFA_ITER_LOCATION=2     /* by location, first AggregatedDimension fastest */
+} CFAIterOrder;
+
+/* create an iterator over the Fragments of a variable, visiting them in order.
+No Fragments are read until cfa_frag_iter_next, which reads them from the file
+in batches, a hyperslab of Fragments at a time.  CFA_ITER_FILE and
+CFA_ITER_LOCATION read all the Fragments on the first call to sort them.  The
+iterator must be released by cfa_frag_iter_end before the AggregationContainer
+is closed */
+extern int cfa_frag_iter_begin(const int cfa_id, const int cfa_var_id,
+                               const CFAIterOrder order, int *iter_idp);
+
+/* get the next Fragment of an iterator, with its location, index and all of
+its FragmentDatums.  fragp is set to NULL when all the Fragments have been
+visited.  Fragments that have not been defined are skipped */
+extern int cfa_frag_iter_next(const int iter_id, const Fragment **fragp);
+
+/* release a Fragment iterator */
+extern int cfa_frag_iter_end(const int iter_id);
+
+/* get a FragmentDatum of a Fragment, e.g. one returned by cfa_frag_iter_next,
+by its term */
+extern int cfa_frag_get_datum(const Fragment *frag, const char *term,
+                              const FragmentDatum **frag_datp);
+
+/* set the number of threads used to read the Fragments in cfa_var_get_vara,
+including the calling thread.  The default, 1, reads the Fragments serially.
+Calls into netCDF are serialised, as netCDF-C is not thread safe, but the
+copies into buf are done in parallel.  Do not call while a read is in
+progress */
+extern int cfa_set_nthreads(const int nthreads);
+
+/* get the number of threads used to read the Fragments */
+extern int cfa_inq_nthreads(int *nthreadsp);
+
+/* set the maximum number of Fragment files kept open between reads.  Files are
+keyed by the resolved "file" FragmentDatum, and the least recently used file is
+closed when the cache is full.  0 disables the cache.  Any open files are
+closed.  The cache is shared by all of the open containers, and cfa_close only
+closes the files that were last read for the container being closed */
+extern int cfa_set_handle_cache_size(const int nfiles);
+
+/* close all of the Fragment files kept open by the handle cache, and unmap all
+of the memory-mapped ones, whichever containers they were read for */
+extern int cfa_close_frag_files(void);
+
+/* get the number of Fragment file opens served by the handle cache (hits) and
+the number that opened the file (misses) */
+extern int cfa_inq_handle_cache_stats(size_t *hitsp, size_t *missesp);
+
+/* turn memory-mapped reads of Fragments in netCDF-3 classic files on or off.
+The header of each file is parsed once and the overlaps of non-record
+variables are copied straight out of the mapped file, without going through
+netCDF.  Other Fragments are read with netCDF.  On by default.  Mapped files
+are unmapped by cfa_close of the container they were last read for, by
+cfa_close_frag_files, and before a Fragment file is written to */
+extern int cfa_set_mmap_reads(const int enable);
+
+/* get the number of Fragment reads served from a memory-mapped file (reads)
+and the number of reads of Fragment files that fell back to netCDF
+(fallbacks) */
+extern int cfa_inq_mmap_stats(size_t *readsp, size_t *fallbacksp);
+
+/* set the number of bytes of decoded Fragment data cached between reads.  Whole
+Fragments are cached, keyed by container, variable, Fragment and the type they
+were read as, and are evicted with the CLOCK algorithm when the cache is full.
+0, the default, disables the cache.  The cached data for a container is freed
+by cfa_close */
+extern int cfa_set_data_cache_size(const size_t nbytes);
+
+/* get the number of Fragment reads served by the data cache (hits), the number
+that read the Fragment (misses) and the number of bytes cached */
+extern int cfa_inq_data_cache_stats(size_t *hitsp, size_t *missesp,
+                                    size_t *nbytesp);
+
+/* set the read-ahead for sequential reads.  When successive calls to
+cfa_var_get_vara walk forward along the first dimension of a variable, the
+next depth Fragments along the first FragmentDimension are read into the data
+cache in the background.  At most max_bytes are read ahead at once, 0 limits
+read-ahead only by the size of the data cache.  Read-ahead needs the data cache
+and more than one thread.  depth 0, the default, disables read-ahead */
+extern int cfa_set_prefetch(const int depth, const size_t max_bytes);
+
+/* get the number of Fragments read ahead (issued) and the number of those that
+were then used by a read (hits) */
+extern int cfa_inq_prefetch_stats(size_t *issuedp, size_t *hitsp);
+
+/* get the number of .zarray files read (meta_reads) and of chunks read
+(chunk_reads) by the "zarr" driver */
+extern int cfa_inq_zarr_stats(size_t *meta_readsp, size_t *chunk_readsp);
+
+/* register the driver for the Fragments whose "format" FragmentDatum is format,
+replacing any driver already registered for it.  "nc" and "netCDF" are read
+with netCDF, "raw" as flat binary files and "zarr" as arrays in local Zarr v2
+stores, until they are replaced */
+extern int cfa_register_format_driver(const char *format,
+                                      const CFAFormatDriver *driver);
+
+/* remove the driver for a format, so that its Fragments cannot be read */
+extern int cfa_unregister_format_driver(const char *format);
+
+/* get a copy of the driver registered for a format */
+extern int cfa_inq_format_driver(const char *format, CFAFormatDriver *driver);
+
 /* info / output command - output the structure of a container, including the
 dimensions, variables and any sub-containers
   level dictates how much info is output
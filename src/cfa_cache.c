@@ -0,0 +1,355 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+/*
+cache of decoded Fragment data.  Each entry holds the whole of a Fragment,
+converted to the type it was read as, so that repeated reads of the same region
+of a variable do not go back to the Fragment files.  The cache is limited to a
+number of bytes and entries are evicted with the CLOCK algorithm.  Entries that
+are being copied from are pinned and cannot be evicted.
+*/
+
+/* number of hash chains */
+#define CFA_DATA_CACHE_BUCKETS 1024
+
+typedef struct {
+    int cfa_id;
+    int cfa_var_id;
+    int frag;           /* linear_index of the Fragment */
+    cfa_type type;      /* type the Fragment was converted to */
+} DataCacheKey;
+
+typedef struct {
+    DataCacheKey key;
+    void *data;         /* NULL if the entry is free */
+    size_t size;
+    int ref;            /* CLOCK reference bit */
+    int pins;           /* number of readers copying from the entry */
+    int prefetched;     /* read ahead and not yet used */
+    int next;           /* next entry in the hash chain, or in the free list */
+} DataCacheEntry;
+
+static pthread_mutex_t cfa_data_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static DataCacheEntry *cfa_data_cache = NULL;
+static int cfa_data_cache_n = 0;        /* number of entries allocated */
+static int cfa_data_cache_used = 0;     /* number of entries holding data */
+static int cfa_data_cache_free = -1;    /* head of the free list */
+static int cfa_data_cache_hand = 0;     /* CLOCK hand */
+static int cfa_data_cache_buckets[CFA_DATA_CACHE_BUCKETS];
+static size_t cfa_data_cache_budget = 0;
+static size_t cfa_data_cache_bytes = 0;
+static size_t cfa_data_cache_hits = 0;
+static size_t cfa_data_cache_misses = 0;
+static size_t cfa_data_cache_prefetch_hits = 0;
+
+/*
+get the hash chain for a key
+*/
+static int
+_cfa_data_cache_bucket(const DataCacheKey *key)
+{
+    unsigned int h = (unsigned int)(key->cfa_id);
+    h = h * 31 + (unsigned int)(key->cfa_var_id);
+    h = h * 31 + (unsigned int)(key->frag);
+    h = h * 31 + (unsigned int)(key->type);
+    return (int)(h % CFA_DATA_CACHE_BUCKETS);
+}
+
+/*
+find the entry for a key, returning -1 if it is not in the cache
+*/
+static int
+_cfa_data_cache_find(const DataCacheKey *key)
+{
+    if (!cfa_data_cache)
+        return -1;
+    int e = cfa_data_cache_buckets[_cfa_data_cache_bucket(key)];
+    while (e != -1)
+    {
+        DataCacheKey *ekey = &(cfa_data_cache[e].key);
+        if (ekey->cfa_id == key->cfa_id &&
+            ekey->cfa_var_id == key->cfa_var_id &&
+            ekey->frag == key->frag && ekey->type == key->type)
+            return e;
+        e = cfa_data_cache[e].next;
+    }
+    return -1;
+}
+
+/*
+remove an entry from the cache and free its data
+*/
+static void
+_cfa_data_cache_evict(const int e)
+{
+    DataCacheEntry *entry = &(cfa_data_cache[e]);
+    /* unlink from the hash chain */
+    int b = _cfa_data_cache_bucket(&(entry->key));
+    int *link = &(cfa_data_cache_buckets[b]);
+    while (*link != e)
+        link = &(cfa_data_cache[*link].next);
+    *link = entry->next;
+    /* free the data and add to the free list */
+    cfa_free(entry->data, entry->size);
+    cfa_data_cache_bytes -= entry->size;
+    cfa_data_cache_used--;
+    entry->data = NULL;
+    entry->next = cfa_data_cache_free;
+    cfa_data_cache_free = e;
+}
+
+/*
+free all of the entries, once none of them hold data
+*/
+static void
+_cfa_data_cache_release_all(void)
+{
+    if (!cfa_data_cache || cfa_data_cache_used > 0)
+        return;
+    cfa_free(cfa_data_cache, sizeof(DataCacheEntry) * cfa_data_cache_n);
+    cfa_data_cache = NULL;
+    cfa_data_cache_n = 0;
+    cfa_data_cache_free = -1;
+    cfa_data_cache_hand = 0;
+}
+
+/*
+evict entries, with the CLOCK algorithm, until size bytes fit in the budget.
+Returns 0 if there is not enough memory that can be evicted
+*/
+static int
+_cfa_data_cache_make_room(const size_t size)
+{
+    if (size > cfa_data_cache_budget)
+        return 0;
+    /* two sweeps clear every reference bit, so a third finds nothing new */
+    int sweeps = 2 * cfa_data_cache_n + 1;
+    while (cfa_data_cache_bytes + size > cfa_data_cache_budget && sweeps-- > 0)
+    {
+        DataCacheEntry *entry = &(cfa_data_cache[cfa_data_cache_hand]);
+        if (entry->data && entry->pins == 0)
+        {
+            if (entry->ref)
+                entry->ref = 0;
+            else
+                _cfa_data_cache_evict(cfa_data_cache_hand);
+        }
+        cfa_data_cache_hand = (cfa_data_cache_hand + 1) % cfa_data_cache_n;
+    }
+    return cfa_data_cache_bytes + size <= cfa_data_cache_budget;
+}
+
+/*
+get a free entry, growing the cache if there are none
+*/
+static int
+_cfa_data_cache_alloc(void)
+{
+    if (cfa_data_cache_free == -1)
+    {
+        int n = cfa_data_cache_n ? cfa_data_cache_n * 2 : 16;
+        DataCacheEntry *entries = NULL;
+        if (!cfa_data_cache)
+        {
+            entries = cfa_malloc(sizeof(DataCacheEntry) * n);
+            for (int b=0; b<CFA_DATA_CACHE_BUCKETS; b++)
+                cfa_data_cache_buckets[b] = -1;
+        }
+        else
+            entries = cfa_realloc(cfa_data_cache,
+                                  sizeof(DataCacheEntry) * cfa_data_cache_n,
+                                  sizeof(DataCacheEntry) * n);
+        if (!entries)
+            return -1;
+        /* link the new entries into the free list */
+        for (int e=cfa_data_cache_n; e<n; e++)
+        {
+            entries[e].data = NULL;
+            entries[e].next = (e+1 < n) ? e+1 : -1;
+        }
+        cfa_data_cache_free = cfa_data_cache_n;
+        cfa_data_cache = entries;
+        cfa_data_cache_n = n;
+    }
+    int e = cfa_data_cache_free;
+    cfa_data_cache_free = cfa_data_cache[e].next;
+    return e;
+}
+
+/*
+check whether a Fragment of size bytes can be held in the cache
+*/
+int
+_cfa_data_cache_fits(const size_t size)
+{
+    pthread_mutex_lock(&cfa_data_cache_lock);
+    int fits = size > 0 && size <= cfa_data_cache_budget;
+    pthread_mutex_unlock(&cfa_data_cache_lock);
+    return fits;
+}
+
+/*
+look up a Fragment in the cache.  On a hit the entry is pinned, its number is
+returned in slot and its data in data.  On a miss slot is set to -1
+*/
+int
+_cfa_data_cache_get(const int cfa_id, const int cfa_var_id, const int frag,
+                    const cfa_type type, int *slot, void **data)
+{
+    DataCacheKey key = {cfa_id, cfa_var_id, frag, type};
+    pthread_mutex_lock(&cfa_data_cache_lock);
+    *slot = _cfa_data_cache_find(&key);
+    if (*slot == -1)
+        cfa_data_cache_misses++;
+    else
+    {
+        DataCacheEntry *entry = &(cfa_data_cache[*slot]);
+        entry->ref = 1;
+        entry->pins++;
+        *data = entry->data;
+        cfa_data_cache_hits++;
+        if (entry->prefetched)
+        {
+            entry->prefetched = 0;
+            cfa_data_cache_prefetch_hits++;
+        }
+    }
+    pthread_mutex_unlock(&cfa_data_cache_lock);
+    return CFA_NOERR;
+}
+
+/*
+check whether a Fragment is in the cache, without counting a hit or a miss
+*/
+int
+_cfa_data_cache_contains(const int cfa_id, const int cfa_var_id,
+                         const int frag, const cfa_type type)
+{
+    DataCacheKey key = {cfa_id, cfa_var_id, frag, type};
+    pthread_mutex_lock(&cfa_data_cache_lock);
+    int found = _cfa_data_cache_find(&key) != -1;
+    pthread_mutex_unlock(&cfa_data_cache_lock);
+    return found;
+}
+
+/*
+add the data for a Fragment to the cache.  prefetched marks data that was read
+ahead of being requested.  The cache takes ownership of data and the entry is
+returned pinned in slot.  If the Fragment was added by another
+thread in the meantime, data is freed and replaced with the cached copy.  If the
+data cannot be cached then slot is set to -1 and the caller keeps ownership of
+data
+*/
+int
+_cfa_data_cache_put(const int cfa_id, const int cfa_var_id, const int frag,
+                    const cfa_type type, void **data, const size_t size,
+                    const int prefetched, int *slot)
+{
+    DataCacheKey key = {cfa_id, cfa_var_id, frag, type};
+    pthread_mutex_lock(&cfa_data_cache_lock);
+    *slot = _cfa_data_cache_find(&key);
+    if (*slot != -1)
+    {
+        DataCacheEntry *entry = &(cfa_data_cache[*slot]);
+        entry->pins++;
+        cfa_free(*data, size);
+        *data = entry->data;
+    }
+    else if (_cfa_data_cache_make_room(size) &&
+             (*slot = _cfa_data_cache_alloc()) != -1)
+    {
+        int b = _cfa_data_cache_bucket(&key);
+        DataCacheEntry *entry = &(cfa_data_cache[*slot]);
+        entry->key = key;
+        entry->data = *data;
+        entry->size = size;
+        entry->ref = 1;
+        entry->pins = 1;
+        entry->prefetched = prefetched;
+        entry->next = cfa_data_cache_buckets[b];
+        cfa_data_cache_buckets[b] = *slot;
+        cfa_data_cache_bytes += size;
+        cfa_data_cache_used++;
+    }
+    pthread_mutex_unlock(&cfa_data_cache_lock);
+    return CFA_NOERR;
+}
+
+/*
+unpin an entry once the data has been copied from it
+*/
+int
+_cfa_data_cache_release(const int slot)
+{
+    pthread_mutex_lock(&cfa_data_cache_lock);
+    cfa_data_cache[slot].pins--;
+    pthread_mutex_unlock(&cfa_data_cache_lock);
+    return CFA_NOERR;
+}
+
+/*
+remove all of the entries for an AggregationContainer, or for one variable in
+it if cfa_var_id is not -1
+*/
+int
+_cfa_data_cache_drop(const int cfa_id, const int cfa_var_id)
+{
+    pthread_mutex_lock(&cfa_data_cache_lock);
+    for (int e=0; e<cfa_data_cache_n; e++)
+    {
+        DataCacheEntry *entry = &(cfa_data_cache[e]);
+        if (entry->data && entry->pins == 0 && entry->key.cfa_id == cfa_id &&
+            (cfa_var_id == -1 || entry->key.cfa_var_id == cfa_var_id))
+            _cfa_data_cache_evict(e);
+    }
+    _cfa_data_cache_release_all();
+    pthread_mutex_unlock(&cfa_data_cache_lock);
+    return CFA_NOERR;
+}
+
+/*
+set the number of bytes of decoded Fragment data that can be cached.  0, the
+default, disables the cache
+*/
+int
+cfa_set_data_cache_size(const size_t nbytes)
+{
+    pthread_mutex_lock(&cfa_data_cache_lock);
+    cfa_data_cache_budget = nbytes;
+    if (cfa_data_cache)
+        _cfa_data_cache_make_room(0);
+    _cfa_data_cache_release_all();
+    pthread_mutex_unlock(&cfa_data_cache_lock);
+    return CFA_NOERR;
+}
+
+/*
+get the number of Fragment reads served from the cache (hits), the number that
+read the Fragment (misses) and the number of bytes in the cache
+*/
+int
+cfa_inq_data_cache_stats(size_t *hitsp, size_t *missesp, size_t *nbytesp)
+{
+    pthread_mutex_lock(&cfa_data_cache_lock);
+    *hitsp = cfa_data_cache_hits;
+    *missesp = cfa_data_cache_misses;
+    *nbytesp = cfa_data_cache_bytes;
+    pthread_mutex_unlock(&cfa_data_cache_lock);
+    return CFA_NOERR;
+}
+
+/*
+get the number of cache hits on Fragments that were read ahead
+*/
+int
+_cfa_data_cache_inq_prefetch_hits(size_t *hitsp)
+{
+    pthread_mutex_lock(&cfa_data_cache_lock);
+    *hitsp = cfa_data_cache_prefetch_hits;
+    pthread_mutex_unlock(&cfa_data_cache_lock);
+    return CFA_NOERR;
+}
@@ -33,7 +33,7 @@ cfa_def_cont(const int cfa_id, const char* name, int *cfa_cont_idp)
     CFA_CHECK(cfa_err);
 
     /* assign the name, path to NULL */
-    cont_node->name = strdup(name),
+    cont_node->name = cfa_strdup(name),
     cont_node->path = NULL;
 
     /* set number of vars, dims and containers to 0 */
@@ -0,0 +1,464 @@
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cfa.h"
+
+/*
+conversion of Fragment data between the CFA numeric types.  There is one kernel
+for each pair of types, chosen once for a Fragment, which converts the whole
+Fragment in a single loop.  The loops are written to be vectorised by the
+compiler and, on x86-64, each kernel is compiled for AVX2, SSE4.1 and the
+baseline instruction set, with the best one for the CPU chosen when the library
+is loaded.
+
+The output regions of Fragments with no data are filled with a single value,
+by kernels for each size of type, which are compiled in the same way.  So are
+the kernels swapping the byte order of Fragment data that is read straight out
+of a file, and those transposing Fragment data for permuted reads.
+
+Packed data can be unpacked, with a scale_factor and add_offset, in the same
+pass as the conversion.  Unpacked data is always floating point.
+
+As with the netCDF-C type conversions, values that are out of the range of the
+type converted to are converted anyway, and CFA_RANGE_ERR is returned
+*/
+
+/* the resolvers choosing between the clones run before the sanitizers are
+initialised, so sanitizer builds only use the baseline kernels */
+#if defined(__x86_64__) && defined(__has_attribute) && \
+    !defined(__SANITIZE_THREAD__) && !defined(__SANITIZE_ADDRESS__)
+#if __has_attribute(target_clones)
+#define CFA_SIMD __attribute__((target_clones("avx2", "sse4.1", "default")))
+#endif
+#endif
+#ifndef CFA_SIMD
+#define CFA_SIMD
+#endif
+
+/* the range checks are always true for many pairs of types */
+#pragma GCC diagnostic ignored "-Wtype-limits"
+
+/* conversion kernel - converts n values from src into dst */
+typedef int (*cfa_convert_fn)(const void*, void*, const size_t);
+
+/* range of each type converted to, for signed integer (S), unsigned integer
+(U) and floating point (F) values.  The floating point limits of the 64 bit
+integers are the largest doubles that convert without overflow */
+#define byte_SLO SCHAR_MIN
+#define byte_SHI SCHAR_MAX
+#define byte_UHI SCHAR_MAX
+#define byte_FLO SCHAR_MIN
+#define byte_FHI SCHAR_MAX
+#define short_SLO SHRT_MIN
+#define short_SHI SHRT_MAX
+#define short_UHI SHRT_MAX
+#define short_FLO SHRT_MIN
+#define short_FHI SHRT_MAX
+#define int_SLO INT_MIN
+#define int_SHI INT_MAX
+#define int_UHI INT_MAX
+#define int_FLO INT_MIN
+#define int_FHI INT_MAX
+#define float_SLO LLONG_MIN
+#define float_SHI LLONG_MAX
+#define float_UHI ULLONG_MAX
+#define float_FLO (-FLT_MAX)
+#define float_FHI FLT_MAX
+#define double_SLO LLONG_MIN
+#define double_SHI LLONG_MAX
+#define double_UHI ULLONG_MAX
+#define double_FLO (-INFINITY)
+#define double_FHI INFINITY
+#define ubyte_SLO 0
+#define ubyte_SHI UCHAR_MAX
+#define ubyte_UHI UCHAR_MAX
+#define ubyte_FLO 0
+#define ubyte_FHI UCHAR_MAX
+#define ushort_SLO 0
+#define ushort_SHI USHRT_MAX
+#define ushort_UHI USHRT_MAX
+#define ushort_FLO 0
+#define ushort_FHI USHRT_MAX
+#define uint_SLO 0
+#define uint_SHI UINT_MAX
+#define uint_UHI UINT_MAX
+#define uint_FLO 0
+#define uint_FHI UINT_MAX
+#define int64_SLO LLONG_MIN
+#define int64_SHI LLONG_MAX
+#define int64_UHI LLONG_MAX
+#define int64_FLO (-9223372036854775808.0)
+#define int64_FHI 9223372036854774784.0
+#define uint64_SLO 0
+#define uint64_SHI LLONG_MAX
+#define uint64_UHI ULLONG_MAX
+#define uint64_FLO 0
+#define uint64_FHI 18446744073709549568.0
+
+/* check that a value of a signed (S), unsigned (U) or floating point (F) type
+is in the range of the type DN.  Like netCDF-C, NaN is not out of range.  The
+comparisons are combined with & and | rather than && and || so that there are
+no branches in the loops */
+#define CFA_IN_RANGE_S(v, DN) \
+    (((long long)(v) >= DN##_SLO) & ((long long)(v) <= DN##_SHI))
+#define CFA_IN_RANGE_U(v, DN) \
+    ((unsigned long long)(v) <= (unsigned long long)(DN##_UHI))
+#define CFA_IN_RANGE_F(v, DN) \
+    (!(((double)(v) < (double)(DN##_FLO)) |  \
+       ((double)(v) > (double)(DN##_FHI))))
+
+/* define the kernel converting type S, of kind K, to type D */
+#define CFA_CONVERT(SN, S, K, DN, D)                                          \
+static CFA_SIMD int                                                           \
+_cfa_convert_##SN##_##DN(const void *src, void *dst, const size_t n)          \
+{                                                                             \
+    const S *restrict s = (const S*)(src);                                    \
+    D *restrict d = (D*)(dst);                                                \
+    int out = 0;                                                              \
+    for (size_t i=0; i<n; i++)                                                \
+    {                                                                         \
+        out |= !CFA_IN_RANGE_##K(s[i], DN);                                   \
+        d[i] = (D)(s[i]);                                                     \
+    }                                                                         \
+    return out ? CFA_RANGE_ERR : CFA_NOERR;                                   \
+}
+
+/* define the kernels converting type S to all of the numeric types */
+#define CFA_CONVERT_FROM(SN, S, K)                                            \
+    CFA_CONVERT(SN, S, K, byte, signed char)                                  \
+    CFA_CONVERT(SN, S, K, short, short)                                       \
+    CFA_CONVERT(SN, S, K, int, int)                                           \
+    CFA_CONVERT(SN, S, K, float, float)                                       \
+    CFA_CONVERT(SN, S, K, double, double)                                     \
+    CFA_CONVERT(SN, S, K, ubyte, unsigned char)                               \
+    CFA_CONVERT(SN, S, K, ushort, unsigned short)                             \
+    CFA_CONVERT(SN, S, K, uint, unsigned int)                                 \
+    CFA_CONVERT(SN, S, K, int64, long long)                                   \
+    CFA_CONVERT(SN, S, K, uint64, unsigned long long)
+
+CFA_CONVERT_FROM(byte, signed char, S)
+CFA_CONVERT_FROM(short, short, S)
+CFA_CONVERT_FROM(int, int, S)
+CFA_CONVERT_FROM(float, float, F)
+CFA_CONVERT_FROM(double, double, F)
+CFA_CONVERT_FROM(ubyte, unsigned char, U)
+CFA_CONVERT_FROM(ushort, unsigned short, U)
+CFA_CONVERT_FROM(uint, unsigned int, U)
+CFA_CONVERT_FROM(int64, long long, S)
+CFA_CONVERT_FROM(uint64, unsigned long long, U)
+
+/* characters can only be converted to characters */
+static int
+_cfa_convert_char_char(const void *src, void *dst, const size_t n)
+{
+    memcpy(dst, src, n);
+    return CFA_NOERR;
+}
+
+/* the row of the table for the kernels converting from type SN */
+#define CFA_CONVERT_ROW(SN)                                                   \
+    {NULL, _cfa_convert_##SN##_byte, NULL, _cfa_convert_##SN##_short,         \
+     _cfa_convert_##SN##_int, _cfa_convert_##SN##_float,                      \
+     _cfa_convert_##SN##_double, _cfa_convert_##SN##_ubyte,                   \
+     _cfa_convert_##SN##_ushort, _cfa_convert_##SN##_uint,                    \
+     _cfa_convert_##SN##_int64, _cfa_convert_##SN##_uint64}
+
+/* kernels indexed by the type converted from and the type converted to */
+#define CFA_CONVERT_NTYPES (CFA_UINT64 + 1)
+static const cfa_convert_fn
+cfa_convert_table[CFA_CONVERT_NTYPES][CFA_CONVERT_NTYPES] = {
+    {NULL},                                     /* CFA_NAT */
+    CFA_CONVERT_ROW(byte),
+    {NULL, NULL, _cfa_convert_char_char},       /* CFA_CHAR */
+    CFA_CONVERT_ROW(short),
+    CFA_CONVERT_ROW(int),
+    CFA_CONVERT_ROW(float),
+    CFA_CONVERT_ROW(double),
+    CFA_CONVERT_ROW(ubyte),
+    CFA_CONVERT_ROW(ushort),
+    CFA_CONVERT_ROW(uint),
+    CFA_CONVERT_ROW(int64),
+    CFA_CONVERT_ROW(uint64)
+};
+
+/*
+convert n values of src_type in src to dst_type in dst.  The kernel is chosen
+once for all of the values
+*/
+int
+_cfa_convert(const void *src, const cfa_type src_type,
+             void *dst, const cfa_type dst_type, const size_t n)
+{
+    if (src_type < 0 || src_type >= CFA_CONVERT_NTYPES ||
+        dst_type < 0 || dst_type >= CFA_CONVERT_NTYPES)
+        return CFA_NAT_ERR;
+    cfa_convert_fn fn = cfa_convert_table[src_type][dst_type];
+    if (!fn)
+        return CFA_NAT_ERR;
+    return fn(src, dst, n);
+}
+
+/* unpacking kernel - converts n packed values from src into dst */
+typedef int (*cfa_unpack_fn)(const void*, void*, const size_t, const double,
+                             const double);
+
+/* define the kernel unpacking type S to type D.  The arithmetic is done in
+type D */
+#define CFA_UNPACK(SN, S, DN, D)                                              \
+static CFA_SIMD int                                                           \
+_cfa_unpack_##SN##_##DN(const void *src, void *dst, const size_t n,           \
+                        const double scale_factor, const double add_offset)   \
+{                                                                             \
+    const S *restrict s = (const S*)(src);                                    \
+    D *restrict d = (D*)(dst);                                                \
+    const D scale = (D)(scale_factor);                                        \
+    const D offset = (D)(add_offset);                                         \
+    for (size_t i=0; i<n; i++)                                                \
+        d[i] = (D)(s[i]) * scale + offset;                                    \
+    return CFA_NOERR;                                                         \
+}
+
+/* define the kernels unpacking type S */
+#define CFA_UNPACK_FROM(SN, S)                                                \
+    CFA_UNPACK(SN, S, float, float)                                           \
+    CFA_UNPACK(SN, S, double, double)
+
+CFA_UNPACK_FROM(byte, signed char)
+CFA_UNPACK_FROM(short, short)
+CFA_UNPACK_FROM(int, int)
+CFA_UNPACK_FROM(float, float)
+CFA_UNPACK_FROM(double, double)
+CFA_UNPACK_FROM(ubyte, unsigned char)
+CFA_UNPACK_FROM(ushort, unsigned short)
+CFA_UNPACK_FROM(uint, unsigned int)
+CFA_UNPACK_FROM(int64, long long)
+CFA_UNPACK_FROM(uint64, unsigned long long)
+
+/* kernels indexed by the packed type, unpacking to float and to double */
+#define CFA_UNPACK_ROW(SN) {_cfa_unpack_##SN##_float, _cfa_unpack_##SN##_double}
+static const cfa_unpack_fn cfa_unpack_table[CFA_CONVERT_NTYPES][2] = {
+    {NULL, NULL},                               /* CFA_NAT */
+    CFA_UNPACK_ROW(byte),
+    {NULL, NULL},                               /* CFA_CHAR */
+    CFA_UNPACK_ROW(short),
+    CFA_UNPACK_ROW(int),
+    CFA_UNPACK_ROW(float),
+    CFA_UNPACK_ROW(double),
+    CFA_UNPACK_ROW(ubyte),
+    CFA_UNPACK_ROW(ushort),
+    CFA_UNPACK_ROW(uint),
+    CFA_UNPACK_ROW(int64),
+    CFA_UNPACK_ROW(uint64)
+};
+
+/*
+unpack n values of src_type in src to dst_type, which must be CFA_FLOAT or
+CFA_DOUBLE, in dst.  The kernel is chosen once for all of the values
+*/
+int
+_cfa_unpack(const void *src, const cfa_type src_type,
+            void *dst, const cfa_type dst_type, const size_t n,
+            const CFAPacking *packing)
+{
+    if (src_type < 0 || src_type >= CFA_CONVERT_NTYPES ||
+        (dst_type != CFA_FLOAT && dst_type != CFA_DOUBLE))
+        return CFA_NAT_ERR;
+    cfa_unpack_fn fn = cfa_unpack_table[src_type][dst_type == CFA_DOUBLE];
+    if (!fn)
+        return CFA_NAT_ERR;
+    return fn(src, dst, n, packing->scale_factor, packing->add_offset);
+}
+
+/* define the kernel filling n values of type T, which is the size of the type
+being filled */
+#define CFA_FILL(TN, T)                                                       \
+static CFA_SIMD void                                                          \
+_cfa_fill_##TN(void *dst, const void *value, const size_t n)                  \
+{                                                                             \
+    T *restrict d = (T*)(dst);                                                \
+    T v;                                                                      \
+    memcpy(&v, value, sizeof(T));                                             \
+    for (size_t i=0; i<n; i++)                                                \
+        d[i] = v;                                                             \
+}
+
+CFA_FILL(8, unsigned char)
+CFA_FILL(16, unsigned short)
+CFA_FILL(32, unsigned int)
+CFA_FILL(64, unsigned long long)
+
+/*
+fill n values of size tsize in dst with value
+*/
+void
+_cfa_fill(void *dst, const void *value, const size_t n, const size_t tsize)
+{
+    switch (tsize)
+    {
+        case 1:
+            _cfa_fill_8(dst, value, n);
+            break;
+        case 2:
+            _cfa_fill_16(dst, value, n);
+            break;
+        case 4:
+            _cfa_fill_32(dst, value, n);
+            break;
+        case 8:
+            _cfa_fill_64(dst, value, n);
+            break;
+        default:
+            for (size_t i=0; i<n; i++)
+                memcpy((char*)(dst) + i * tsize, value, tsize);
+    }
+}
+
+/* define the kernel reversing the bytes of n values of type T in place */
+#define CFA_BSWAP(TN, T)                                                      \
+static CFA_SIMD void                                                          \
+_cfa_byteswap_##TN(void *buf, const size_t n)                                 \
+{                                                                             \
+    T *restrict b = (T*)(buf);                                                \
+    for (size_t i=0; i<n; i++)                                                \
+        b[i] = __builtin_bswap##TN(b[i]);                                     \
+}
+
+CFA_BSWAP(16, unsigned short)
+CFA_BSWAP(32, unsigned int)
+CFA_BSWAP(64, unsigned long long)
+
+/*
+reverse the bytes of n values of size tsize in buf, converting them between
+big-endian and little-endian
+*/
+void
+_cfa_byteswap(void *buf, const size_t n, const size_t tsize)
+{
+    switch (tsize)
+    {
+        case 1:
+            break;
+        case 2:
+            _cfa_byteswap_16(buf, n);
+            break;
+        case 4:
+            _cfa_byteswap_32(buf, n);
+            break;
+        case 8:
+            _cfa_byteswap_64(buf, n);
+            break;
+        default:
+            for (size_t i=0; i<n; i++)
+            {
+                unsigned char *v = (unsigned char*)(buf) + i * tsize;
+                for (size_t b=0; b<(tsize >> 1); b++)
+                {
+                    unsigned char t = v[b];
+                    v[b] = v[tsize-1-b];
+                    v[tsize-1-b] = t;
+                }
+            }
+    }
+}
+
+/* side, in elements, of the square tiles of a transpose.  A tile of the
+largest type is 8 KiB, so the rows of the source and the destination that a
+tile touches stay in the L1 cache while it is copied */
+#define CFA_TRANSPOSE_BLOCK 32
+
+/* define the kernel transposing a block of n_rows by n_cols values of type T,
+with rows src_stride apart in src, into dst, with rows dst_stride apart.  The
+block is copied a tile at a time, writing each row of a tile contiguously */
+#define CFA_TRANSPOSE(TN, T)                                                  \
+static CFA_SIMD void                                                          \
+_cfa_transpose_##TN(void *dst, const size_t dst_stride, const void *src,      \
+                    const size_t src_stride, const size_t n_rows,             \
+                    const size_t n_cols)                                      \
+{                                                                             \
+    T *restrict d = (T*)(dst);                                                \
+    const T *restrict s = (const T*)(src);                                    \
+    for (size_t ib=0; ib<n_rows; ib+=CFA_TRANSPOSE_BLOCK)                     \
+    {                                                                         \
+        size_t ie = n_rows - ib < CFA_TRANSPOSE_BLOCK ?                       \
+                    n_rows : ib + CFA_TRANSPOSE_BLOCK;                        \
+        for (size_t jb=0; jb<n_cols; jb+=CFA_TRANSPOSE_BLOCK)                 \
+        {                                                                     \
+            size_t je = n_cols - jb < CFA_TRANSPOSE_BLOCK ?                   \
+                        n_cols : jb + CFA_TRANSPOSE_BLOCK;                    \
+            for (size_t j=jb; j<je; j++)                                      \
+                for (size_t i=ib; i<ie; i++)                                  \
+                    d[j * dst_stride + i] = s[i * src_stride + j];            \
+        }                                                                     \
+    }                                                                         \
+}
+
+CFA_TRANSPOSE(8, unsigned char)
+CFA_TRANSPOSE(16, unsigned short)
+CFA_TRANSPOSE(32, unsigned int)
+CFA_TRANSPOSE(64, unsigned long long)
+
+/*
+transpose a block of n_rows by n_cols values of size tsize, with rows
+src_stride elements apart in src, into dst, with rows dst_stride elements
+apart, so that dst[j * dst_stride + i] is src[i * src_stride + j]
+*/
+void
+_cfa_transpose(void *dst, const size_t dst_stride, const void *src,
+               const size_t src_stride, const size_t n_rows,
+               const size_t n_cols, const size_t tsize)
+{
+    switch (tsize)
+    {
+        case 1:
+            _cfa_transpose_8(dst, dst_stride, src, src_stride, n_rows, n_cols);
+            break;
+        case 2:
+            _cfa_transpose_16(dst, dst_stride, src, src_stride, n_rows,
+                              n_cols);
+            break;
+        case 4:
+            _cfa_transpose_32(dst, dst_stride, src, src_stride, n_rows,
+                              n_cols);
+            break;
+        case 8:
+            _cfa_transpose_64(dst, dst_stride, src, src_stride, n_rows,
+                              n_cols);
+            break;
+        default:
+            for (size_t i=0; i<n_rows; i++)
+                for (size_t j=0; j<n_cols; j++)
+                    memcpy((char*)(dst) + (j * dst_stride + i) * tsize,
+                           (const char*)(src) + (i * src_stride + j) * tsize,
+                           tsize);
+    }
+}
+
+/*
+get the default netCDF fill value of a type
+*/
+int
+_cfa_default_fill(const cfa_type type, void *value)
+{
+    switch (type)
+    {
+        case CFA_BYTE: *(signed char*)(value) = NC_FILL_BYTE; break;
+        case CFA_CHAR: *(char*)(value) = NC_FILL_CHAR; break;
+        case CFA_SHORT: *(short*)(value) = NC_FILL_SHORT; break;
+        case CFA_INT: *(int*)(value) = NC_FILL_INT; break;
+        case CFA_FLOAT: *(float*)(value) = NC_FILL_FLOAT; break;
+        case CFA_DOUBLE: *(double*)(value) = NC_FILL_DOUBLE; break;
+        case CFA_UBYTE: *(unsigned char*)(value) = NC_FILL_UBYTE; break;
+        case CFA_USHORT: *(unsigned short*)(value) = NC_FILL_USHORT; break;
+        case CFA_UINT: *(unsigned int*)(value) = NC_FILL_UINT; break;
+        case CFA_INT64: *(long long*)(value) = NC_FILL_INT64; break;
+        case CFA_UINT64:
+            *(unsigned long long*)(value) = NC_FILL_UINT64;
+            break;
+        default:
+            return CFA_NAT_ERR;
+    }
+    return CFA_NOERR;
+}
@@ -1,3 +1,5 @@
+#include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -11,6 +13,11 @@ DynamicArray *cfa_dims = NULL;
 
 extern void __free_str_via_pointer(char**);
 
+/* the coordinates of a loaded file are read by the Parser */
+extern pthread_mutex_t cfa_nc_lock;
+extern int cfa_netcdf_read_coords(const int, const AggregatedDimension*,
+                                  double*);
+
 /*
 create an AggregatedDimension, attach it to a cfa_id
 */
@@ -39,11 +46,12 @@ cfa_def_dim(const int cfa_id, const char *name, const int len,
 
     /* copy the length and name to the dimension */
     dim_node->length = len;
-    dim_node->name = strdup(name);
+    dim_node->name = cfa_strdup(name);
 
     /* assign the type */
     dim_node->type.type = dtype;
     dim_node->type.size = get_type_size(dtype);
+    dim_node->coords = NULL;
 
     /* get the length of the AggregatedDimension array - the id is len-1 */
     int cfa_ndim = 0;
@@ -176,6 +184,178 @@ cfa_get_dim(const int cfa_id, const int cfa_dim_id,
     return CFA_NOERR;
 }
 
+/*
+check that coordinates are strictly increasing or decreasing.  NaNs fail both
+*/
+int
+_cfa_coords_monotonic(const double *coords, const int n)
+{
+    if (n < 2)
+        return n == 1 ? !isnan(coords[0]) : 1;
+    int inc = coords[1] > coords[0];
+    for (int i=1; i<n; i++)
+        if (inc ? !(coords[i] > coords[i-1]) : !(coords[i] < coords[i-1]))
+            return 0;
+    return 1;
+}
+
+/*
+define the coordinates of an AggregatedDimension
+*/
+int
+cfa_dim_put_coords(const int cfa_id, const int cfa_dim_id,
+                   const double *coords)
+{
+    AggregatedDimension *agg_dim = NULL;
+    int cfa_err = cfa_get_dim(cfa_id, cfa_dim_id, &agg_dim);
+    CFA_CHECK(cfa_err);
+    if (!_cfa_coords_monotonic(coords, agg_dim->length))
+        return CFA_COORD_ERR;
+    size_t size = sizeof(double) * agg_dim->length;
+    pthread_mutex_lock(&cfa_nc_lock);
+    if (!agg_dim->coords)
+        agg_dim->coords = cfa_malloc(size);
+    if (agg_dim->coords)
+        memcpy(agg_dim->coords, coords, size);
+    pthread_mutex_unlock(&cfa_nc_lock);
+    if (!agg_dim->coords)
+        return CFA_MEM_ERR;
+    return CFA_NOERR;
+}
+
+/*
+get the coordinates of an AggregatedDimension, reading them from the
+dimension variable of a loaded file the first time.  This is under the netCDF
+lock, which also stops two threads reading them at once
+*/
+int
+_cfa_dim_get_coords(const int cfa_id, const int cfa_dim_id,
+                    const double **coordsp)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    AggregatedDimension *agg_dim = NULL;
+    cfa_err = cfa_get_dim(cfa_id, cfa_dim_id, &agg_dim);
+    CFA_CHECK(cfa_err);
+
+    pthread_mutex_lock(&cfa_nc_lock);
+    if (!agg_dim->coords && agg_cont->x_id == -1)
+        cfa_err = CFA_COORD_ERR;
+    else if (!agg_dim->coords)
+    {
+        size_t size = sizeof(double) * agg_dim->length;
+        double *coords = cfa_malloc(size);
+        if (!coords)
+            cfa_err = CFA_MEM_ERR;
+        else
+        {
+            switch (agg_cont->format)
+            {
+                case CFA_NETCDF:
+                    cfa_err = cfa_netcdf_read_coords(agg_cont->x_id, agg_dim,
+                                                     coords);
+                break;
+                case CFA_UNKNOWN:
+                default:
+                    cfa_err = CFA_UNKNOWN_FILE_FORMAT;
+            }
+            if (cfa_err == CFA_NOERR &&
+                !_cfa_coords_monotonic(coords, agg_dim->length))
+                cfa_err = CFA_COORD_ERR;
+            if (cfa_err == CFA_NOERR)
+                agg_dim->coords = coords;
+            else
+                cfa_free(coords, size);
+        }
+    }
+    *coordsp = agg_dim->coords;
+    pthread_mutex_unlock(&cfa_nc_lock);
+    return cfa_err;
+}
+
+/*
+get the index of the first coordinate that is not before v, or after it if
+after is set, in the order of the coordinates
+*/
+size_t
+_cfa_coord_search(const double *coords, const size_t n, const double v,
+                  const int after)
+{
+    int inc = n < 2 || coords[1] > coords[0];
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + ((hi - lo) >> 1);
+        double c = inc ? coords[mid] : -coords[mid];
+        double w = inc ? v : -v;
+        if (after ? c <= w : c < w)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+get the elements of an AggregatedDimension with coordinates in a range
+*/
+int
+cfa_dim_coord_range(const int cfa_id, const int cfa_dim_id,
+                    const double lo, const double hi,
+                    size_t *startp, size_t *countp)
+{
+    AggregatedDimension *agg_dim = NULL;
+    int cfa_err = cfa_get_dim(cfa_id, cfa_dim_id, &agg_dim);
+    CFA_CHECK(cfa_err);
+    size_t n = agg_dim->length;
+    *startp = 0;
+    *countp = n;
+    if (isnan(lo) && isnan(hi))
+        return CFA_NOERR;
+
+    const double *coords = NULL;
+    cfa_err = _cfa_dim_get_coords(cfa_id, cfa_dim_id, &coords);
+    CFA_CHECK(cfa_err);
+    /* the bounds in the order of the coordinates */
+    double first = isnan(lo) ? -INFINITY : lo;
+    double last = isnan(hi) ? INFINITY : hi;
+    if (n > 1 && coords[1] < coords[0])
+    {
+        double t = first;
+        first = last;
+        last = t;
+    }
+    size_t start = _cfa_coord_search(coords, n, first, 0);
+    size_t end = _cfa_coord_search(coords, n, last, 1);
+    *startp = start;
+    *countp = end > start ? end - start : 0;
+    if (*countp == 0)
+        *startp = 0;
+    return CFA_NOERR;
+}
+
+/*
+get the hyperslab of a variable for a range of coordinates in each dimension
+*/
+int
+cfa_var_coord_hyperslab(const int cfa_id, const int cfa_var_id,
+                        const double *lo, const double *hi,
+                        size_t *start, size_t *count)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    for (int d=0; d<agg_var->cfa_ndim; d++)
+    {
+        cfa_err = cfa_dim_coord_range(cfa_id, agg_var->cfa_dim_idp[d], lo[d],
+                                      hi[d], start+d, count+d);
+        CFA_CHECK(cfa_err);
+    }
+    return CFA_NOERR;
+}
+
 /*
 free the memory used by the CFA dimensions
 */
@@ -196,6 +376,11 @@ cfa_free_dims(const int cfa_id)
                                  (void**)(&agg_dim));
         CFA_CHECK(cfa_err);
         __free_str_via_pointer(&(agg_dim->name));
+        if (agg_dim->coords)
+        {
+            cfa_free(agg_dim->coords, sizeof(double) * agg_dim->length);
+            agg_dim->coords = NULL;
+        }
     }
     /* check whether all cfa_dims are free (name=NULL) and free the DynamicArray
     holding all the AggregatedDimensions if they are */
@@ -0,0 +1,216 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "cfa.h"
+
+/*
+registry of the Fragment format drivers.  Each Fragment is read, and written,
+by the driver registered for the value of its "format" FragmentDatum, or for
+the format of its AggregationContainer if it has none.  The built-in drivers
+are registered to start with, and can be replaced.  Lookups copy the driver
+under the lock, so that drivers can be registered while Fragments are read
+*/
+
+/* maximum number of registered formats, and length of their names */
+#define CFA_MAX_DRIVERS 32
+#define CFA_FORMAT_LENGTH 64
+
+extern int _cfa_var_get_frag_datum(const Fragment*, const char*,
+                                   const FragmentDatum**);
+
+/* the built-in drivers */
+extern int cfa_netcdf_read_frag(const int, const int, const Fragment*,
+                                const int, const size_t*, const size_t*,
+                                const size_t*, const cfa_type,
+                                const CFAPacking*, void*);
+extern int cfa_netcdf_write_frag(const int, const int, const Fragment*,
+                                 const size_t*, const size_t*, const cfa_type,
+                                 const int, const void*);
+extern int cfa_raw_open(const int, const Fragment*, void**);
+extern int cfa_raw_read(void*, const int, const Fragment*, const int,
+                        const size_t*, const size_t*, const size_t*,
+                        const cfa_type, const CFAPacking*, void*);
+extern int cfa_raw_close(void*);
+extern int cfa_raw_write_frag(const int, const int, const Fragment*,
+                              const size_t*, const size_t*, const cfa_type,
+                              const int, const void*);
+extern int cfa_raw_prefetch(const int, const Fragment*);
+extern int cfa_zarr_open(const int, const Fragment*, void**);
+extern int cfa_zarr_read(void*, const int, const Fragment*, const int,
+                         const size_t*, const size_t*, const size_t*,
+                         const cfa_type, const CFAPacking*, void*);
+extern int cfa_zarr_close(void*);
+
+/*
+read a Fragment with netCDF, which keeps its own cache of open files, from the
+CFA-netCDF file of the AggregationContainer
+*/
+static int
+_cfa_netcdf_driver_read(void *handle, const int cfa_id, const Fragment *frag,
+                        const int ndim, const size_t *start,
+                        const size_t *count, const size_t *stride,
+                        const cfa_type type, const CFAPacking *unpack,
+                        void *data)
+{
+    (void)(handle);
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    return cfa_netcdf_read_frag(cfa_id, agg_cont->x_id, frag, ndim, start,
+                                count, stride, type, unpack, data);
+}
+
+/* a registered driver, with an empty format if the slot is free */
+typedef struct {
+    char format[CFA_FORMAT_LENGTH];
+    CFAFormatDriver driver;
+} FormatDriver;
+
+static pthread_mutex_t cfa_driver_lock = PTHREAD_MUTEX_INITIALIZER;
+static FormatDriver cfa_drivers[CFA_MAX_DRIVERS] = {
+    {"nc", {NULL, _cfa_netcdf_driver_read, NULL, cfa_netcdf_write_frag,
+            NULL, NULL}},
+    {"netCDF", {NULL, _cfa_netcdf_driver_read, NULL, cfa_netcdf_write_frag,
+                NULL, NULL}},
+    {"raw", {cfa_raw_open, cfa_raw_read, cfa_raw_close, cfa_raw_write_frag,
+             cfa_raw_prefetch, NULL}},
+    {"zarr", {cfa_zarr_open, cfa_zarr_read, cfa_zarr_close, NULL, NULL,
+              NULL}},
+};
+
+/*
+find the slot of a format.  Must be called with cfa_driver_lock held
+*/
+static FormatDriver*
+_cfa_find_driver(const char *format)
+{
+    for (int i=0; i<CFA_MAX_DRIVERS; i++)
+        if (cfa_drivers[i].format[0] &&
+            strcmp(cfa_drivers[i].format, format) == 0)
+            return &(cfa_drivers[i]);
+    return NULL;
+}
+
+/*
+register the driver for a format, replacing any that is already registered
+*/
+int
+cfa_register_format_driver(const char *format, const CFAFormatDriver *driver)
+{
+    if (!format || !driver || !driver->read || strlen(format) == 0 ||
+        strlen(format) >= CFA_FORMAT_LENGTH)
+        return CFA_DRIVER_ERR;
+    int cfa_err = CFA_NOERR;
+    pthread_mutex_lock(&cfa_driver_lock);
+    FormatDriver *slot = _cfa_find_driver(format);
+    for (int i=0; i<CFA_MAX_DRIVERS && !slot; i++)
+        if (!cfa_drivers[i].format[0])
+            slot = &(cfa_drivers[i]);
+    if (slot)
+    {
+        strcpy(slot->format, format);
+        slot->driver = *driver;
+    }
+    else
+        cfa_err = CFA_DRIVER_ERR;
+    pthread_mutex_unlock(&cfa_driver_lock);
+    return cfa_err;
+}
+
+/*
+remove the driver for a format
+*/
+int
+cfa_unregister_format_driver(const char *format)
+{
+    int cfa_err = CFA_FRAG_FORMAT_ERR;
+    pthread_mutex_lock(&cfa_driver_lock);
+    FormatDriver *slot = _cfa_find_driver(format);
+    if (slot)
+    {
+        memset(slot, 0, sizeof(FormatDriver));
+        cfa_err = CFA_NOERR;
+    }
+    pthread_mutex_unlock(&cfa_driver_lock);
+    return cfa_err;
+}
+
+/*
+get a copy of the driver for a format
+*/
+int
+cfa_inq_format_driver(const char *format, CFAFormatDriver *driver)
+{
+    int cfa_err = CFA_FRAG_FORMAT_ERR;
+    pthread_mutex_lock(&cfa_driver_lock);
+    FormatDriver *slot = _cfa_find_driver(format);
+    if (slot)
+    {
+        *driver = slot->driver;
+        cfa_err = CFA_NOERR;
+    }
+    pthread_mutex_unlock(&cfa_driver_lock);
+    return cfa_err;
+}
+
+/*
+get the driver for a Fragment from its "format" FragmentDatum.  A missing
+format is the same as the format of the AggregationContainer
+*/
+int
+_cfa_get_frag_driver(const AggregationContainer *agg_cont,
+                     const Fragment *frag, CFAFormatDriver *driver)
+{
+    const FragmentDatum *frag_dat = NULL;
+    int cfa_err = _cfa_var_get_frag_datum(frag, "format", &frag_dat);
+    const char *format = NULL;
+    if (cfa_err == CFA_VAR_FRAGDAT_NOT_FOUND ||
+        strlen((const char*)(frag_dat->data)) == 0)
+    {
+        if (agg_cont->format != CFA_NETCDF)
+            return CFA_FRAG_FORMAT_ERR;
+        format = "nc";
+    }
+    else
+    {
+        CFA_CHECK(cfa_err);
+        format = (const char*)(frag_dat->data);
+    }
+    return cfa_inq_format_driver(format, driver);
+}
+
+/*
+pass the hint that a Fragment is about to be read to its driver
+*/
+int
+_cfa_driver_prefetch(const int cfa_id, const Fragment *frag)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    CFAFormatDriver driver;
+    cfa_err = _cfa_get_frag_driver(agg_cont, frag, &driver);
+    CFA_CHECK(cfa_err);
+    if (!driver.prefetch)
+        return CFA_NOERR;
+    return driver.prefetch(cfa_id, frag);
+}
+
+/*
+get the statistics of a Fragment from its driver.  Returns CFA_FRAG_FORMAT_ERR
+if the driver does not know them
+*/
+int
+_cfa_driver_stat(const int cfa_id, const Fragment *frag, double *minp,
+                 double *maxp, long long *countp)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    CFAFormatDriver driver;
+    cfa_err = _cfa_get_frag_driver(agg_cont, frag, &driver);
+    CFA_CHECK(cfa_err);
+    if (!driver.stat)
+        return CFA_FRAG_FORMAT_ERR;
+    return driver.stat(cfa_id, frag, minp, maxp, countp);
+}
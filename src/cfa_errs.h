@@ -20,6 +20,7 @@ the file */
 #define CFA_VAR_NO_FRAG            (-535) /* Fragment not defined */
 #define CFA_VAR_NO_FRAG_INDEX      (-536) /* either the frag_location or data_location not set */
 #define CFA_VAR_FRAGDAT_NOT_FOUND  (-537) /* The FragmentDatum could not be found */
+#define CFA_VAR_HYPERSLAB_ERR      (-538) /* start / count outside the AggregatedDimensions */
 #define CFA_UNKNOWN_FILE_FORMAT    (-540) /* Unsupported CFA file format */
 #define CFA_NOT_CFA_FILE           (-541) /* Not a CFA file - does not contain relevant metadata */
 #define CFA_UNSUPPORTED_VERSION    (-542) /* Unsupported version of CFA-netCDF */
@@ -29,5 +30,20 @@ the file */
 #define CFA_AGG_DIM_ERR            (-551) /* Something went wrong parsing the "aggregated_dimensions" attribute */
 #define CFA_AGG_NOT_DEFINED        (-552) /* aggregation instructions have not been defined */
 #define CFA_AGG_NOT_RECOGNISED     (-553) /* unrecognised aggregation instruction*/
+#define CFA_FRAG_FORMAT_ERR        (-560) /* Unsupported Fragment format */
+#define CFA_FRAG_SHAPE_ERR         (-561) /* Fragment variable does not match the Fragment location */
+#define CFA_HANDLE_CACHE_ERR       (-562) /* Invalid size for the Fragment file cache */
+#define CFA_PREFETCH_ERR           (-563) /* Invalid read-ahead depth */
+#define CFA_REQUEST_ERR            (-564) /* Invalid or too many asynchronous read requests */
+#define CFA_RANGE_ERR              (-565) /* Fragment data out of the range of the type read as */
+#define CFA_ITER_ERR               (-566) /* Invalid or too many Fragment iterators */
+#define CFA_REDUCE_ERR             (-567) /* Invalid reduction */
+#define CFA_WHERE_ERR              (-568) /* Invalid predicate */
+#define CFA_COORD_ERR              (-569) /* Missing or non-monotonic coordinates */
+#define CFA_THREAD_ERR             (-570) /* Cannot create the worker threads */
+#define CFA_RAW_ADDRESS_ERR        (-571) /* Invalid raw Fragment file or address */
+#define CFA_DRIVER_ERR             (-572) /* Invalid or too many format drivers */
+#define CFA_ZARR_ERR               (-573) /* Invalid or unsupported Zarr array */
+#define CFA_PERM_ERR               (-574) /* Invalid dimension permutation */
 
 #endif
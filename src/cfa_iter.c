@@ -0,0 +1,303 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+extern int _cfa_var_get_frags(const int, const int, const int, int*);
+extern int _cfa_var_get_frag_datum(const Fragment*, const char*,
+                                   const FragmentDatum**);
+
+/*
+Fragment iterators.  An iterator visits the Fragments of a variable one at a
+time, reading them from the Parser in batches as it reaches them.  Iterators
+are identified by their index in a fixed table, in the same way as the
+asynchronous read requests
+*/
+#define CFA_MAX_ITERS 256
+/* maximum number of Fragments read from the Parser at once */
+#define CFA_ITER_BATCH 256
+
+typedef struct {
+    int cfa_id;
+    int cfa_var_id;
+    CFAIterOrder order;
+    int n_frags;
+    /* the Fragments with linear index below n_read have been read */
+    int n_read;
+    /* position of the next Fragment in the order */
+    int pos;
+    /* linear indices of the Fragments in the order, created by the first
+    cfa_frag_iter_next for orders other than CFA_ITER_LINEAR */
+    int *visit;
+} FragIter;
+
+static pthread_mutex_t cfa_iter_lock = PTHREAD_MUTEX_INITIALIZER;
+static FragIter *cfa_iters[CFA_MAX_ITERS];
+
+/* a Fragment and its sort key */
+typedef struct {
+    const Fragment *frag;
+    const char *file;
+    int ndim;
+} IterKey;
+
+/*
+order the Fragments by their "file", with the Fragments in the aggregation file
+first, and then by their linear index
+*/
+int
+_cfa_iter_cmp_file(const void *a, const void *b)
+{
+    const IterKey *ka = (const IterKey*)(a);
+    const IterKey *kb = (const IterKey*)(b);
+    int c = strcmp(ka->file, kb->file);
+    if (c)
+        return c;
+    return ka->frag->linear_index - kb->frag->linear_index;
+}
+
+/*
+order the Fragments by their location, with the first dimension varying
+fastest
+*/
+int
+_cfa_iter_cmp_location(const void *a, const void *b)
+{
+    const IterKey *ka = (const IterKey*)(a);
+    const IterKey *kb = (const IterKey*)(b);
+    for (int d=ka->ndim-1; d>=0; d--)
+    {
+        size_t la = ka->frag->location[d<<1];
+        size_t lb = kb->frag->location[d<<1];
+        if (la != lb)
+            return la < lb ? -1 : 1;
+    }
+    return ka->frag->linear_index - kb->frag->linear_index;
+}
+
+/*
+read the next batch of Fragments, in linear order
+*/
+int
+_cfa_iter_read_batch(FragIter *iter)
+{
+    int n = iter->n_frags - iter->n_read;
+    if (n > CFA_ITER_BATCH)
+        n = CFA_ITER_BATCH;
+    int cfa_err = _cfa_var_get_frags(iter->cfa_id, iter->cfa_var_id,
+                                     iter->n_read, &n);
+    CFA_CHECK(cfa_err);
+    iter->n_read += n;
+    return CFA_NOERR;
+}
+
+/*
+read all the Fragments and sort them into the order of the iterator.  Fragments
+that have not been defined are left out
+*/
+int
+_cfa_iter_sort(FragIter *iter, AggregationVariable *agg_var)
+{
+    int cfa_err = CFA_NOERR;
+    while (iter->n_read < iter->n_frags)
+    {
+        cfa_err = _cfa_iter_read_batch(iter);
+        CFA_CHECK(cfa_err);
+    }
+
+    IterKey *keys = cfa_malloc(sizeof(IterKey) * iter->n_frags);
+    if (!keys)
+        return CFA_MEM_ERR;
+    int n_keys = 0;
+    for (int L=0; L<iter->n_frags; L++)
+    {
+        Fragment *frag = NULL;
+        cfa_err = get_array_node(&(agg_var->cfa_datap->cfa_fragmentsp), L,
+                                 (void**)(&frag));
+        if (cfa_err)
+            break;
+        if (!frag->location)
+            continue;
+        frag->linear_index = L;
+        IterKey *key = &(keys[n_keys++]);
+        key->frag = frag;
+        key->ndim = agg_var->cfa_ndim;
+        /* a missing or empty "file" is the aggregation file */
+        key->file = "";
+        const FragmentDatum *frag_dat = NULL;
+        if (frag->cfa_fragdatsp &&
+            _cfa_var_get_frag_datum(frag, "file", &frag_dat) == CFA_NOERR &&
+            frag_dat->data)
+            key->file = (const char*)(frag_dat->data);
+    }
+    if (cfa_err == CFA_NOERR)
+    {
+        if (iter->order == CFA_ITER_FILE)
+            qsort(keys, n_keys, sizeof(IterKey), _cfa_iter_cmp_file);
+        else
+            qsort(keys, n_keys, sizeof(IterKey), _cfa_iter_cmp_location);
+        iter->visit = cfa_malloc(sizeof(int) * iter->n_frags);
+        if (!iter->visit)
+            cfa_err = CFA_MEM_ERR;
+    }
+    if (cfa_err == CFA_NOERR)
+    {
+        for (int k=0; k<n_keys; k++)
+            iter->visit[k] = keys[k].frag->linear_index;
+        /* the undefined Fragments are marked as the end */
+        for (int k=n_keys; k<iter->n_frags; k++)
+            iter->visit[k] = -1;
+    }
+    cfa_free(keys, sizeof(IterKey) * iter->n_frags);
+    return cfa_err;
+}
+
+/*
+get an iterator from its id
+*/
+int
+_cfa_get_iter(const int iter_id, FragIter **iter)
+{
+    if (iter_id < 0 || iter_id >= CFA_MAX_ITERS)
+        return CFA_ITER_ERR;
+    pthread_mutex_lock(&cfa_iter_lock);
+    *iter = cfa_iters[iter_id];
+    pthread_mutex_unlock(&cfa_iter_lock);
+    if (!(*iter))
+        return CFA_ITER_ERR;
+    return CFA_NOERR;
+}
+
+/*
+create an iterator over the Fragments of a variable
+*/
+int
+cfa_frag_iter_begin(const int cfa_id, const int cfa_var_id,
+                    const CFAIterOrder order, int *iter_idp)
+{
+    *iter_idp = -1;
+    if (order != CFA_ITER_LINEAR && order != CFA_ITER_FILE &&
+        order != CFA_ITER_LOCATION)
+        return CFA_ITER_ERR;
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    if (!(agg_var->cfa_datap->cfa_fragmentsp))
+        return CFA_VAR_FRAGS_UNDEF;
+    int n_frags = 0;
+    cfa_err = get_array_length(&(agg_var->cfa_datap->cfa_fragmentsp),
+                               &n_frags);
+    CFA_CHECK(cfa_err);
+
+    FragIter *iter = cfa_malloc(sizeof(FragIter));
+    if (!iter)
+        return CFA_MEM_ERR;
+    iter->cfa_id = cfa_id;
+    iter->cfa_var_id = cfa_var_id;
+    iter->order = order;
+    iter->n_frags = n_frags;
+    iter->n_read = 0;
+    iter->pos = 0;
+    iter->visit = NULL;
+
+    pthread_mutex_lock(&cfa_iter_lock);
+    for (int i=0; i<CFA_MAX_ITERS && *iter_idp == -1; i++)
+        if (!cfa_iters[i])
+        {
+            cfa_iters[i] = iter;
+            *iter_idp = i;
+        }
+    pthread_mutex_unlock(&cfa_iter_lock);
+    if (*iter_idp == -1)
+    {
+        cfa_free(iter, sizeof(FragIter));
+        return CFA_ITER_ERR;
+    }
+    return CFA_NOERR;
+}
+
+/*
+get the next Fragment of an iterator, reading the next batch of Fragments if it
+has not been read
+*/
+int
+cfa_frag_iter_next(const int iter_id, const Fragment **fragp)
+{
+    FragIter *iter = NULL;
+    int cfa_err = _cfa_get_iter(iter_id, &iter);
+    CFA_CHECK(cfa_err);
+    AggregationVariable *agg_var = NULL;
+    cfa_err = cfa_get_var(iter->cfa_id, iter->cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+
+    *fragp = NULL;
+    if (iter->order != CFA_ITER_LINEAR && !iter->visit)
+    {
+        cfa_err = _cfa_iter_sort(iter, agg_var);
+        CFA_CHECK(cfa_err);
+    }
+    while (iter->pos < iter->n_frags)
+    {
+        int L = iter->pos;
+        if (iter->visit)
+        {
+            L = iter->visit[iter->pos];
+            if (L == -1)
+            {
+                iter->pos = iter->n_frags;
+                break;
+            }
+        }
+        else if (L >= iter->n_read)
+        {
+            cfa_err = _cfa_iter_read_batch(iter);
+            CFA_CHECK(cfa_err);
+        }
+        iter->pos++;
+        Fragment *frag = NULL;
+        cfa_err = get_array_node(&(agg_var->cfa_datap->cfa_fragmentsp), L,
+                                 (void**)(&frag));
+        CFA_CHECK(cfa_err);
+        /* skip Fragments that have not been defined */
+        if (!frag->location)
+            continue;
+        frag->linear_index = L;
+        *fragp = frag;
+        break;
+    }
+    return CFA_NOERR;
+}
+
+/*
+release an iterator
+*/
+int
+cfa_frag_iter_end(const int iter_id)
+{
+    FragIter *iter = NULL;
+    int cfa_err = _cfa_get_iter(iter_id, &iter);
+    CFA_CHECK(cfa_err);
+    pthread_mutex_lock(&cfa_iter_lock);
+    cfa_iters[iter_id] = NULL;
+    pthread_mutex_unlock(&cfa_iter_lock);
+    if (iter->visit)
+        cfa_free(iter->visit, sizeof(int) * iter->n_frags);
+    cfa_free(iter, sizeof(FragIter));
+    return CFA_NOERR;
+}
+
+/*
+get a FragmentDatum of a Fragment by its term
+*/
+int
+cfa_frag_get_datum(const Fragment *frag, const char *term,
+                   const FragmentDatum **frag_datp)
+{
+    if (!frag->cfa_fragdatsp)
+        return CFA_VAR_FRAGDAT_NOT_FOUND;
+    int cfa_err = _cfa_var_get_frag_datum(frag, term, frag_datp);
+    CFA_CHECK(cfa_err);
+    return CFA_NOERR;
+}
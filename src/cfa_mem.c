@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdatomic.h>
 
 #include "cfa.h"
 #include "cfa_mem.h"
@@ -24,11 +25,12 @@ default dynamic array size
 const int DARRAY_SIZE=32;
 
 /*
-static count of used memory, number of calls to cfa_malloc and cfa_free
+static count of used memory, number of calls to cfa_malloc and cfa_free.
+atomic as Fragments can be read by more than one thread
 */
-static size_t cfa_used_mem=0;
-static int cfa_n_malloc=0;
-static int cfa_n_free=0;
+static _Atomic size_t cfa_used_mem=0;
+static _Atomic int cfa_n_malloc=0;
+static _Atomic int cfa_n_free=0;
 
 /*
 functions to allocate memory and add to the cfa_used_mem
@@ -263,7 +265,7 @@ strstrip(char *s)
 duplicate a string
 */
 char*
-strdup(const char *s)
+cfa_strdup(const char *s)
 {
     /* allocate memory, use strcpy */
     char* r = cfa_malloc(strlen(s)+1);
@@ -0,0 +1,292 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+/*
+worker pool used to read Fragments concurrently.  Work is submitted as a job,
+which is a loop over a number of tasks.  The tasks of a job are claimed, one
+at a time, by the workers in the pool and by the thread that submitted the job
+*/
+
+/* task function - called with the argument of the job, the task number and
+   the number of the worker running the task (0 for the calling thread) */
+typedef int (*cfa_task_fn)(void*, const int, const int);
+/* completion function for jobs run in the background - called with the
+   argument of the job and the first error returned by a task */
+typedef void (*cfa_done_fn)(void*, const int);
+
+typedef struct CFAJob CFAJob;
+struct CFAJob {
+    cfa_task_fn fn;
+    void *arg;
+    int n_tasks;
+    int next_task;      /* next task to be claimed */
+    int n_done;         /* number of tasks completed */
+    int err;            /* first error returned by a task */
+    cfa_done_fn done;   /* NULL for jobs waited on by the submitting thread */
+    CFAJob *next;       /* next job in the queue */
+};
+
+/* lock serialising the calls into libraries that are not thread safe, i.e.
+   netCDF-C */
+pthread_mutex_t cfa_nc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t cfa_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cfa_pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cfa_pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_t *cfa_workers = NULL;
+static int cfa_n_workers = 0;
+static int cfa_pool_stop = 0;
+static CFAJob *cfa_job_head = NULL;
+static CFAJob *cfa_job_tail = NULL;
+
+/*
+add a job to the end of the queue.  Called with the pool lock held
+*/
+static void
+_cfa_job_enqueue(CFAJob *job)
+{
+    job->next = NULL;
+    if (cfa_job_tail)
+        cfa_job_tail->next = job;
+    else
+        cfa_job_head = job;
+    cfa_job_tail = job;
+}
+
+/*
+remove a job from the queue, once all of its tasks have been claimed.  Called
+with the pool lock held
+*/
+static void
+_cfa_job_dequeue(CFAJob *job)
+{
+    CFAJob *prev = NULL;
+    CFAJob *cjob = cfa_job_head;
+    while (cjob && cjob != job)
+    {
+        prev = cjob;
+        cjob = cjob->next;
+    }
+    if (!cjob)
+        return;
+    if (prev)
+        prev->next = job->next;
+    else
+        cfa_job_head = job->next;
+    if (cfa_job_tail == job)
+        cfa_job_tail = prev;
+    job->next = NULL;
+}
+
+/*
+claim and run the next task of a job.  Called, and returns, with the pool lock
+held.  Once a task has failed the remaining tasks are skipped.  Returns 1 if
+the task was the last one of a background job, which the caller then completes
+with _cfa_job_complete
+*/
+static int
+_cfa_job_run_task(CFAJob *job, const int worker)
+{
+    int task = job->next_task++;
+    if (job->next_task == job->n_tasks)
+        _cfa_job_dequeue(job);
+    int skip = job->err != CFA_NOERR;
+    pthread_mutex_unlock(&cfa_pool_lock);
+    int err = CFA_NOERR;
+    if (!skip)
+        err = job->fn(job->arg, task, worker);
+    pthread_mutex_lock(&cfa_pool_lock);
+    if (err && job->err == CFA_NOERR)
+        job->err = err;
+    job->n_done++;
+    if (job->n_done < job->n_tasks)
+        return 0;
+    if (job->done)
+        return 1;
+    pthread_cond_broadcast(&cfa_pool_done);
+    return 0;
+}
+
+/*
+call the completion function of a background job, whose tasks have all
+completed, and free it.  Called, and returns, with the pool lock held
+*/
+static void
+_cfa_job_complete(CFAJob *job)
+{
+    pthread_mutex_unlock(&cfa_pool_lock);
+    job->done(job->arg, job->err);
+    free(job);
+    pthread_mutex_lock(&cfa_pool_lock);
+}
+
+/*
+worker thread - runs tasks from the job at the head of the queue until the
+pool is stopped and the queue is empty
+*/
+static void*
+_cfa_pool_worker(void *arg)
+{
+    int worker = (int)(intptr_t)(arg);
+    pthread_mutex_lock(&cfa_pool_lock);
+    while (1)
+    {
+        while (!cfa_pool_stop && !cfa_job_head)
+            pthread_cond_wait(&cfa_pool_work, &cfa_pool_lock);
+        if (!cfa_job_head)
+            break;
+        CFAJob *job = cfa_job_head;
+        if (_cfa_job_run_task(job, worker))
+            _cfa_job_complete(job);
+    }
+    pthread_mutex_unlock(&cfa_pool_lock);
+    return NULL;
+}
+
+/*
+stop and join all of the workers in the pool
+*/
+static void
+_cfa_pool_stop_workers(void)
+{
+    if (cfa_n_workers == 0)
+        return;
+    pthread_mutex_lock(&cfa_pool_lock);
+    cfa_pool_stop = 1;
+    pthread_cond_broadcast(&cfa_pool_work);
+    pthread_mutex_unlock(&cfa_pool_lock);
+    for (int w=0; w<cfa_n_workers; w++)
+        pthread_join(cfa_workers[w], NULL);
+    /* the pool lives for the whole process, so it is not tracked by
+    cfa_malloc */
+    free(cfa_workers);
+    cfa_workers = NULL;
+    cfa_n_workers = 0;
+    cfa_pool_stop = 0;
+}
+
+/*
+set the number of threads used to read Fragments, including the calling
+thread.  1 reads the Fragments serially on the calling thread
+*/
+int
+cfa_set_nthreads(const int nthreads)
+{
+    if (nthreads < 1)
+        return CFA_THREAD_ERR;
+    if (nthreads - 1 == cfa_n_workers)
+        return CFA_NOERR;
+    _cfa_pool_stop_workers();
+    if (nthreads == 1)
+        return CFA_NOERR;
+
+    cfa_workers = malloc(sizeof(pthread_t) * (nthreads - 1));
+    if (!cfa_workers)
+        return CFA_MEM_ERR;
+    /* workers are numbered from 1, the calling thread is 0 */
+    for (int w=0; w<nthreads-1; w++)
+    {
+        if (pthread_create(&(cfa_workers[w]), NULL, _cfa_pool_worker,
+                           (void*)(intptr_t)(w+1)) != 0)
+        {
+            _cfa_pool_stop_workers();
+            return CFA_THREAD_ERR;
+        }
+        cfa_n_workers++;
+    }
+    return CFA_NOERR;
+}
+
+/*
+get the number of threads used to read Fragments
+*/
+int
+cfa_inq_nthreads(int *nthreadsp)
+{
+    *nthreadsp = cfa_n_workers + 1;
+    return CFA_NOERR;
+}
+
+/*
+run the tasks 0..n_tasks-1 on the pool, and the calling thread, returning when
+they have all completed.  The first error returned by a task is returned
+*/
+int
+_cfa_pool_run(const int n_tasks, cfa_task_fn fn, void *arg)
+{
+    int cfa_err = CFA_NOERR;
+    /* run on the calling thread if there are no workers */
+    if (cfa_n_workers == 0 || n_tasks == 1)
+    {
+        for (int t=0; t<n_tasks; t++)
+        {
+            cfa_err = fn(arg, t, 0);
+            CFA_CHECK(cfa_err);
+        }
+        return CFA_NOERR;
+    }
+    if (n_tasks == 0)
+        return CFA_NOERR;
+
+    CFAJob job = {fn, arg, n_tasks, 0, 0, CFA_NOERR, NULL, NULL};
+    pthread_mutex_lock(&cfa_pool_lock);
+    _cfa_job_enqueue(&job);
+    pthread_cond_broadcast(&cfa_pool_work);
+    /* the calling thread works on its own job while it waits */
+    while (job.next_task < job.n_tasks)
+        _cfa_job_run_task(&job, 0);
+    while (job.n_done < job.n_tasks)
+        pthread_cond_wait(&cfa_pool_done, &cfa_pool_lock);
+    pthread_mutex_unlock(&cfa_pool_lock);
+    return job.err;
+}
+
+/*
+run the tasks 0..n_tasks-1 in the background and return without waiting.  done
+is called when all of the tasks have completed.  With no workers in the pool
+the tasks, and done, are run on the calling thread before returning
+*/
+int
+_cfa_pool_submit(const int n_tasks, cfa_task_fn fn, void *arg,
+                 cfa_done_fn done)
+{
+    if (cfa_n_workers == 0 || n_tasks == 0)
+    {
+        int cfa_err = CFA_NOERR;
+        for (int t=0; t<n_tasks && cfa_err == CFA_NOERR; t++)
+            cfa_err = fn(arg, t, 0);
+        done(arg, cfa_err);
+        return CFA_NOERR;
+    }
+    /* the job outlives the call, so it is freed by the pool, and is not
+    tracked by cfa_malloc */
+    CFAJob *job = malloc(sizeof(CFAJob));
+    if (!job)
+        return CFA_MEM_ERR;
+    job->fn = fn;
+    job->arg = arg;
+    job->n_tasks = n_tasks;
+    job->next_task = 0;
+    job->n_done = 0;
+    job->err = CFA_NOERR;
+    job->done = done;
+    pthread_mutex_lock(&cfa_pool_lock);
+    _cfa_job_enqueue(job);
+    pthread_cond_broadcast(&cfa_pool_work);
+    pthread_mutex_unlock(&cfa_pool_lock);
+    return CFA_NOERR;
+}
+
+/*
+get the number of threads that can run a task at once - this is the size of
+any per-worker arrays
+*/
+int
+_cfa_pool_size(void)
+{
+    return cfa_n_workers + 1;
+}
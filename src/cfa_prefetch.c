@@ -0,0 +1,377 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+/*
+sequential read-ahead.  Reads of a variable that walk forward along its first
+dimension are detected, and the Fragments following the read, along the first
+FragmentDimension, are read in the background into the data cache so that they
+are already decoded when they are requested.  Read-ahead needs the data cache
+and more than one thread.
+*/
+
+extern DynamicArray *cfa_frag_dims;
+
+extern int get_type_size(const cfa_type);
+extern int _multidim_to_linear_index(const AggregationVariable*,
+                                     const size_t*, int*);
+extern int _linear_index_to_multidim(const AggregationVariable*, const int,
+                                     size_t*);
+extern int _cfa_var_get_frag(const int, const int, AggregationVariable*,
+                             const int, Fragment**);
+extern int _cfa_read_frag(const int, const int, const FragmentRead*,
+                          const int, const cfa_type, void*);
+extern int _cfa_frag_has_data(const Fragment*);
+extern int _cfa_data_cache_fits(const size_t);
+extern int _cfa_data_cache_contains(const int, const int, const int,
+                                    const cfa_type);
+extern int _cfa_data_cache_put(const int, const int, const int, const cfa_type,
+                               void**, const size_t, const int, int*);
+extern int _cfa_data_cache_release(const int);
+extern int _cfa_data_cache_inq_prefetch_hits(size_t*);
+extern int _cfa_pool_submit(const int, int (*)(void*, const int, const int),
+                            void*, void (*)(void*, const int));
+extern int _cfa_pool_size(void);
+extern int _cfa_driver_prefetch(const int, const Fragment*);
+
+/* number of variables whose access pattern is tracked at once */
+#define CFA_PREFETCH_STREAMS 16
+
+/* access pattern of a variable */
+typedef struct {
+    int valid;
+    int cfa_id;
+    int cfa_var_id;
+    size_t last_start;  /* extent of the last read along the first dimension */
+    size_t last_end;
+    size_t next_frag;   /* first Fragment index, along the first
+                           FragmentDimension, that has not been read ahead */
+} PrefetchStream;
+
+/* a batch of Fragments being read ahead */
+typedef struct {
+    int cfa_id;
+    int cfa_var_id;
+    int ndim;
+    cfa_type type;
+    size_t nbytes;
+    int n_frags;
+    Fragment **frags;
+} PrefetchJob;
+
+static pthread_mutex_t cfa_prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cfa_prefetch_done = PTHREAD_COND_INITIALIZER;
+static PrefetchStream cfa_prefetch_streams[CFA_PREFETCH_STREAMS];
+static int cfa_prefetch_next_stream = 0;
+static int cfa_prefetch_depth = 0;
+static size_t cfa_prefetch_max_bytes = 0;
+static size_t cfa_prefetch_bytes = 0;   /* bytes being read ahead */
+static int cfa_prefetch_n_jobs = 0;     /* jobs in flight */
+static size_t cfa_prefetch_issued = 0;  /* number of Fragments read ahead */
+
+/*
+get the size, in bytes, of a whole Fragment
+*/
+static size_t
+_cfa_frag_size(const Fragment *frag, const int ndim, const size_t tsize)
+{
+    size_t size = tsize;
+    for (int d=0; d<ndim; d++)
+        size *= frag->location[(d<<1)+1] - frag->location[d<<1];
+    return size;
+}
+
+/*
+task - read one Fragment of a PrefetchJob into the data cache
+*/
+static int
+_cfa_prefetch_frag(void *arg, const int t, const int worker)
+{
+    (void)(worker);
+    PrefetchJob *job = (PrefetchJob*)(arg);
+    Fragment *frag = job->frags[t];
+    if (_cfa_data_cache_contains(job->cfa_id, job->cfa_var_id,
+                                 frag->linear_index, job->type))
+        return CFA_NOERR;
+
+    int ndim = job->ndim;
+    size_t frag_shape[MAX_DIMS];
+    size_t frag_start[MAX_DIMS];
+    for (int d=0; d<ndim; d++)
+    {
+        frag_shape[d] = frag->location[(d<<1)+1] - frag->location[d<<1];
+        frag_start[d] = 0;
+    }
+    size_t size = _cfa_frag_size(frag, ndim, get_type_size(job->type));
+    void *data = cfa_malloc(size);
+    if (!data)
+        return CFA_MEM_ERR;
+    FragmentRead whole = {frag, frag_start, frag_shape, NULL, frag_start};
+    int slot = -1;
+    int cfa_err = _cfa_read_frag(job->cfa_id, job->cfa_var_id, &whole, ndim,
+                                 job->type, data);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_data_cache_put(job->cfa_id, job->cfa_var_id,
+                                      frag->linear_index, job->type,
+                                      &data, size, 1, &slot);
+    if (slot == -1)
+        cfa_free(data, size);
+    else
+        cfa_err = _cfa_data_cache_release(slot);
+    return cfa_err;
+}
+
+/*
+completion of a PrefetchJob.  Errors are not reported, as the Fragment will be
+read again, and the error returned, if it is requested
+*/
+static void
+_cfa_prefetch_job_done(void *arg, const int err)
+{
+    (void)(err);
+    PrefetchJob *job = (PrefetchJob*)(arg);
+    pthread_mutex_lock(&cfa_prefetch_lock);
+    cfa_prefetch_bytes -= job->nbytes;
+    cfa_prefetch_n_jobs--;
+    pthread_cond_broadcast(&cfa_prefetch_done);
+    pthread_mutex_unlock(&cfa_prefetch_lock);
+    cfa_free(job->frags, sizeof(Fragment*) * job->n_frags);
+    cfa_free(job, sizeof(PrefetchJob));
+}
+
+/*
+find the stream for a variable, or start a new one, replacing the oldest
+*/
+static PrefetchStream*
+_cfa_prefetch_stream(const int cfa_id, const int cfa_var_id, int *found)
+{
+    for (int s=0; s<CFA_PREFETCH_STREAMS; s++)
+    {
+        PrefetchStream *stream = &(cfa_prefetch_streams[s]);
+        if (stream->valid && stream->cfa_id == cfa_id &&
+            stream->cfa_var_id == cfa_var_id)
+        {
+            *found = 1;
+            return stream;
+        }
+    }
+    PrefetchStream *stream = &(cfa_prefetch_streams[cfa_prefetch_next_stream]);
+    cfa_prefetch_next_stream = (cfa_prefetch_next_stream + 1) %
+                               CFA_PREFETCH_STREAMS;
+    stream->valid = 1;
+    stream->cfa_id = cfa_id;
+    stream->cfa_var_id = cfa_var_id;
+    stream->next_frag = 0;
+    *found = 0;
+    return stream;
+}
+
+/*
+record a read of a variable and, if the reads are walking forward along the
+first dimension, read ahead the next Fragments.  reads is the plan of the read
+*/
+int
+_cfa_prefetch(const int cfa_id, const int cfa_var_id,
+              AggregationVariable *agg_var, const size_t *start,
+              const size_t *count, DynamicArray **reads, const cfa_type type)
+{
+    int ndim = agg_var->cfa_ndim;
+    if (ndim == 0)
+        return CFA_NOERR;
+
+    /* detect a forward walk - the read starts inside, or at the end of, the
+    last read */
+    pthread_mutex_lock(&cfa_prefetch_lock);
+    int found = 0;
+    PrefetchStream *stream = _cfa_prefetch_stream(cfa_id, cfa_var_id, &found);
+    int sequential = found && start[0] > stream->last_start &&
+                     start[0] <= stream->last_end;
+    stream->last_start = start[0];
+    stream->last_end = start[0] + count[0];
+    int depth = cfa_prefetch_depth;
+    size_t next_frag = stream->next_frag;
+    pthread_mutex_unlock(&cfa_prefetch_lock);
+    if (!sequential || depth == 0 || _cfa_pool_size() == 1 ||
+        !_cfa_data_cache_fits(1))
+        return CFA_NOERR;
+
+    /* range of Fragment indices in the read */
+    int n_reads = 0;
+    int cfa_err = get_array_length(reads, &n_reads);
+    CFA_CHECK(cfa_err);
+    if (n_reads == 0)
+        return CFA_NOERR;
+    size_t lo[MAX_DIMS];
+    size_t hi[MAX_DIMS];
+    size_t frag_index[MAX_DIMS];
+    for (int r=0; r<n_reads; r++)
+    {
+        FragmentRead *read = NULL;
+        cfa_err = get_array_node(reads, r, (void**)(&read));
+        CFA_CHECK(cfa_err);
+        cfa_err = _linear_index_to_multidim(agg_var, read->frag->linear_index,
+                                            frag_index);
+        CFA_CHECK(cfa_err);
+        for (int d=0; d<ndim; d++)
+        {
+            if (r == 0 || frag_index[d] < lo[d])
+                lo[d] = frag_index[d];
+            if (r == 0 || frag_index[d] > hi[d])
+                hi[d] = frag_index[d];
+        }
+    }
+
+    /* read ahead the next depth Fragments along the first FragmentDimension,
+    skipping those already read ahead */
+    FragmentDimension *frag_dim = NULL;
+    cfa_err = get_array_node(&cfa_frag_dims, agg_var->cfa_frag_dim_idp[0],
+                             (void**)(&frag_dim));
+    CFA_CHECK(cfa_err);
+    size_t first = hi[0] + 1 > next_frag ? hi[0] + 1 : next_frag;
+    size_t last = hi[0] + depth;
+    if (last >= (size_t)(frag_dim->length))
+        last = frag_dim->length - 1;
+    if (first > last)
+        return CFA_NOERR;
+    lo[0] = first;
+    hi[0] = last;
+
+    int n_frags = 1;
+    for (int d=0; d<ndim; d++)
+        n_frags *= hi[d] - lo[d] + 1;
+    PrefetchJob *job = cfa_malloc(sizeof(PrefetchJob));
+    if (!job)
+        return CFA_MEM_ERR;
+    job->frags = cfa_malloc(sizeof(Fragment*) * n_frags);
+    if (!(job->frags))
+    {
+        cfa_free(job, sizeof(PrefetchJob));
+        return CFA_MEM_ERR;
+    }
+    job->cfa_id = cfa_id;
+    job->cfa_var_id = cfa_var_id;
+    job->ndim = ndim;
+    job->type = type;
+    job->nbytes = 0;
+    job->n_frags = n_frags;
+
+    /* the Fragment metadata is read here, on the calling thread, so that the
+    background tasks only read the Fragment data.  Stop at the memory cap */
+    size_t tsize = get_type_size(type);
+    int n = 0;
+    memcpy(frag_index, lo, sizeof(size_t) * ndim);
+    int d = 0;
+    pthread_mutex_lock(&cfa_prefetch_lock);
+    size_t avail = cfa_prefetch_max_bytes == 0 ? (size_t)(-1) :
+                   (cfa_prefetch_bytes < cfa_prefetch_max_bytes ?
+                    cfa_prefetch_max_bytes - cfa_prefetch_bytes : 0);
+    pthread_mutex_unlock(&cfa_prefetch_lock);
+    while (d >= 0 && cfa_err == CFA_NOERR)
+    {
+        int L = 0;
+        Fragment *frag = NULL;
+        cfa_err = _multidim_to_linear_index(agg_var, frag_index, &L);
+        if (cfa_err == CFA_NOERR)
+            cfa_err = _cfa_var_get_frag(cfa_id, cfa_var_id, agg_var, L, &frag);
+        if (cfa_err)
+            break;
+        size_t size = _cfa_frag_size(frag, ndim, tsize);
+        if (job->nbytes + size > avail)
+            break;
+        /* Fragments with no data are filled, so are not worth reading ahead */
+        if (_cfa_frag_has_data(frag) && _cfa_data_cache_fits(size) &&
+            !_cfa_data_cache_contains(cfa_id, cfa_var_id, L, type))
+        {
+            job->frags[n++] = frag;
+            job->nbytes += size;
+            /* let the driver start reading the Fragment before the worker
+            does.  It is only a hint, so it may fail */
+            _cfa_driver_prefetch(cfa_id, frag);
+        }
+        /* only whole slabs along the first dimension count as read ahead */
+        if (frag_index[ndim-1] == hi[ndim-1])
+        {
+            int slab_done = 1;
+            for (int dd=1; dd<ndim; dd++)
+                if (frag_index[dd] != hi[dd])
+                    slab_done = 0;
+            if (slab_done)
+                next_frag = frag_index[0] + 1;
+        }
+        for (d=ndim-1; d>=0; d--)
+        {
+            if (++frag_index[d] <= hi[d])
+                break;
+            frag_index[d] = lo[d];
+        }
+    }
+    if (cfa_err || n == 0)
+    {
+        cfa_free(job->frags, sizeof(Fragment*) * n_frags);
+        cfa_free(job, sizeof(PrefetchJob));
+        return cfa_err;
+    }
+
+    pthread_mutex_lock(&cfa_prefetch_lock);
+    stream->next_frag = next_frag;
+    cfa_prefetch_bytes += job->nbytes;
+    cfa_prefetch_n_jobs++;
+    cfa_prefetch_issued += n;
+    pthread_mutex_unlock(&cfa_prefetch_lock);
+    cfa_err = _cfa_pool_submit(n, _cfa_prefetch_frag, job,
+                               _cfa_prefetch_job_done);
+    if (cfa_err)
+        _cfa_prefetch_job_done(job, cfa_err);
+    return cfa_err;
+}
+
+/*
+wait for the Fragments being read ahead for an AggregationContainer and forget
+the access patterns of its variables.  Called by cfa_close
+*/
+int
+_cfa_prefetch_close(const int cfa_id)
+{
+    pthread_mutex_lock(&cfa_prefetch_lock);
+    while (cfa_prefetch_n_jobs > 0)
+        pthread_cond_wait(&cfa_prefetch_done, &cfa_prefetch_lock);
+    for (int s=0; s<CFA_PREFETCH_STREAMS; s++)
+        if (cfa_prefetch_streams[s].cfa_id == cfa_id)
+            cfa_prefetch_streams[s].valid = 0;
+    pthread_mutex_unlock(&cfa_prefetch_lock);
+    return CFA_NOERR;
+}
+
+/*
+set the number of Fragments, along the first FragmentDimension, read ahead of
+a sequential read, and the maximum number of bytes being read ahead at once.
+depth 0, the default, disables read-ahead.  max_bytes 0 limits read-ahead only
+by the size of the data cache
+*/
+int
+cfa_set_prefetch(const int depth, const size_t max_bytes)
+{
+    if (depth < 0)
+        return CFA_PREFETCH_ERR;
+    pthread_mutex_lock(&cfa_prefetch_lock);
+    cfa_prefetch_depth = depth;
+    cfa_prefetch_max_bytes = max_bytes;
+    pthread_mutex_unlock(&cfa_prefetch_lock);
+    return CFA_NOERR;
+}
+
+/*
+get the number of Fragments read ahead (issued) and the number of reads that
+were served by a Fragment that was read ahead (hits)
+*/
+int
+cfa_inq_prefetch_stats(size_t *issuedp, size_t *hitsp)
+{
+    pthread_mutex_lock(&cfa_prefetch_lock);
+    *issuedp = cfa_prefetch_issued;
+    pthread_mutex_unlock(&cfa_prefetch_lock);
+    return _cfa_data_cache_inq_prefetch_hits(hitsp);
+}
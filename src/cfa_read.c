@@ -0,0 +1,2348 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+extern DynamicArray *cfa_frag_dims;
+
+extern int get_type_size(const cfa_type);
+extern int _data_location_to_fragment_index(const AggregationVariable*,
+                                            const size_t*, size_t*);
+extern int _multidim_to_linear_index(const AggregationVariable*,
+                                     const size_t*, int*);
+extern int _get_linear_index(AggregationVariable*, const size_t*,
+                             const size_t*, int*);
+extern int _cfa_var_get_frag(const int, const int, AggregationVariable*,
+                             const int, Fragment**);
+extern int _cfa_var_get_frags(const int, const int, const int, int*);
+extern int _cfa_var_get_frag_datum(const Fragment*, const char*,
+                                   const FragmentDatum**);
+extern int _cfa_write_frag_location(const int, const AggregationVariable*,
+                                    const size_t*, size_t*);
+
+/* Fragments are read by the driver for their format */
+extern int _cfa_get_frag_driver(const AggregationContainer*, const Fragment*,
+                                CFAFormatDriver*);
+
+/* decoded Fragments are kept in the data cache */
+extern int _cfa_data_cache_fits(const size_t);
+extern int _cfa_data_cache_get(const int, const int, const int, const cfa_type,
+                               int*, void**);
+extern int _cfa_data_cache_put(const int, const int, const int, const cfa_type,
+                               void**, const size_t, const int, int*);
+extern int _cfa_data_cache_release(const int);
+
+/* Fragment data is converted, unpacked and filled by the kernels */
+extern int _cfa_convert(const void*, const cfa_type, void*, const cfa_type,
+                        const size_t);
+extern int _cfa_unpack(const void*, const cfa_type, void*, const cfa_type,
+                       const size_t, const CFAPacking*);
+extern void _cfa_fill(void*, const void*, const size_t, const size_t);
+extern void _cfa_transpose(void*, const size_t, const void*, const size_t,
+                           const size_t, const size_t, const size_t);
+extern int _cfa_default_fill(const cfa_type, void*);
+
+/* sequential reads are followed by reading ahead */
+extern int _cfa_prefetch(const int, const int, AggregationVariable*,
+                         const size_t*, const size_t*, DynamicArray**,
+                         const cfa_type);
+
+/* Fragments are read by the worker pool */
+extern int _cfa_pool_run(const int, int (*)(void*, const int, const int),
+                         void*);
+extern int _cfa_pool_size(void);
+extern int _cfa_pool_submit(const int, int (*)(void*, const int, const int),
+                            void*, void (*)(void*, const int));
+
+/*
+check that a hyperslab, with an optional stride, lies inside the
+AggregatedDimensions of a variable
+*/
+int
+_cfa_var_check_hyperslab(const int cfa_id, const AggregationVariable *agg_var,
+                         const size_t *start, const size_t *count,
+                         const size_t *stride)
+{
+    AggregatedDimension *agg_dim = NULL;
+    int cfa_err = CFA_NOERR;
+    for (int d=0; d<agg_var->cfa_ndim; d++)
+    {
+        cfa_err = cfa_get_dim(cfa_id, agg_var->cfa_dim_idp[d], &agg_dim);
+        CFA_CHECK(cfa_err);
+        size_t step = stride ? stride[d] : 1;
+        if (step == 0)
+            return CFA_VAR_HYPERSLAB_ERR;
+        if (count[d] == 0)
+        {
+            if (start[d] > (size_t)(agg_dim->length))
+                return CFA_VAR_HYPERSLAB_ERR;
+        }
+        else if (start[d] + (count[d] - 1) * step >= (size_t)(agg_dim->length))
+            return CFA_VAR_HYPERSLAB_ERR;
+    }
+    return CFA_NOERR;
+}
+
+/*
+add a FragmentRead to the plan if the Fragment contains at least one element of
+the hyperslab.  Along each dimension the selected elements are
+start + i * stride, for i in 0..count-1, and those in the Fragment are the ones
+with i in [i_lo, i_hi)
+*/
+int
+_cfa_add_frag_read(Fragment *frag, const int ndim,
+                   const size_t *start, const size_t *count,
+                   const size_t *stride, DynamicArray **reads)
+{
+    size_t i_lo[MAX_DIMS];
+    size_t i_hi[MAX_DIMS];
+    /* the location is a (start, end) pair for each dimension */
+    for (int d=0; d<ndim; d++)
+    {
+        size_t lo = frag->location[d<<1];
+        size_t hi = frag->location[(d<<1)+1];
+        size_t step = stride ? stride[d] : 1;
+        if (hi <= start[d])
+            return CFA_NOERR;
+        i_lo[d] = lo > start[d] ? (lo - start[d] + step - 1) / step : 0;
+        i_hi[d] = (hi - start[d] + step - 1) / step;
+        if (i_hi[d] > count[d])
+            i_hi[d] = count[d];
+        if (i_lo[d] >= i_hi[d])
+            return CFA_NOERR;
+    }
+    FragmentRead *read = NULL;
+    int cfa_err = create_array_node(reads, (void**)(&read));
+    CFA_CHECK(cfa_err);
+    read->frag = frag;
+    /* allocate the four arrays as a single block */
+    read->frag_start = cfa_malloc(sizeof(size_t) * 4 * ndim);
+    if (!(read->frag_start))
+        return CFA_MEM_ERR;
+    read->count = read->frag_start + ndim;
+    read->stride = read->frag_start + 2 * ndim;
+    read->out_start = read->frag_start + 3 * ndim;
+    for (int d=0; d<ndim; d++)
+    {
+        size_t step = stride ? stride[d] : 1;
+        read->frag_start[d] = start[d] + i_lo[d] * step - frag->location[d<<1];
+        read->count[d] = i_hi[d] - i_lo[d];
+        read->stride[d] = step;
+        read->out_start[d] = i_lo[d];
+    }
+    return CFA_NOERR;
+}
+
+/*
+get the location of the Fragment at a Fragment index, as a (start, end) pair
+for each dimension.  Fragments that have not been defined, in an
+AggregationContainer that has not been loaded or serialised, have the location
+they are given when they are written
+*/
+int
+_cfa_var_frag_index_location(const int cfa_id, const int cfa_var_id,
+                             AggregationVariable *agg_var,
+                             const size_t *frag_index, size_t *location)
+{
+    int L = 0;
+    int cfa_err = _multidim_to_linear_index(agg_var, frag_index, &L);
+    CFA_CHECK(cfa_err);
+    Fragment *frag = NULL;
+    cfa_err = get_array_node(&(agg_var->cfa_datap->cfa_fragmentsp), L,
+                             (void**)(&frag));
+    CFA_CHECK(cfa_err);
+    if (!frag->location)
+    {
+        AggregationContainer *agg_cont = NULL;
+        cfa_err = cfa_get(cfa_id, &agg_cont);
+        CFA_CHECK(cfa_err);
+        if (agg_cont->x_id == -1)
+            return _cfa_write_frag_location(cfa_id, agg_var, frag_index,
+                                            location);
+        cfa_err = _cfa_var_get_frag(cfa_id, cfa_var_id, agg_var, L, &frag);
+        CFA_CHECK(cfa_err);
+    }
+    memcpy(location, frag->location, (sizeof(size_t) << 1) * agg_var->cfa_ndim);
+    return CFA_NOERR;
+}
+
+/*
+find the index of the Fragment that contains a point.  The index is estimated
+assuming equal spans, and then moved along each dimension until the location
+of the Fragment contains the point, so that Fragments with uneven spans are
+found too
+*/
+int
+_cfa_var_find_frag_index(const int cfa_id, const int cfa_var_id,
+                         AggregationVariable *agg_var, const size_t *point,
+                         size_t *frag_index)
+{
+    int cfa_err = _data_location_to_fragment_index(agg_var, point, frag_index);
+    CFA_CHECK(cfa_err);
+    FragmentDimension *frag_dim = NULL;
+    size_t location[MAX_DIMS<<1];
+    for (int d=0; d<agg_var->cfa_ndim; d++)
+    {
+        cfa_err = get_array_node(&cfa_frag_dims, agg_var->cfa_frag_dim_idp[d],
+                                 (void**)(&frag_dim));
+        CFA_CHECK(cfa_err);
+        while (1)
+        {
+            cfa_err = _cfa_var_frag_index_location(cfa_id, cfa_var_id, agg_var,
+                                                   frag_index, location);
+            CFA_CHECK(cfa_err);
+            if (point[d] < location[d<<1] && frag_index[d] > 0)
+                frag_index[d]--;
+            else if (point[d] >= location[(d<<1)+1] &&
+                     frag_index[d] + 1 < (size_t)(frag_dim->length))
+                frag_index[d]++;
+            else
+                break;
+        }
+        if (point[d] < location[d<<1] || point[d] >= location[(d<<1)+1])
+            return CFA_VAR_HYPERSLAB_ERR;
+    }
+    return CFA_NOERR;
+}
+
+/*
+create the FragmentReads for all of the Fragments that contain an element of
+the hyperslab.  The FragmentReads are added to *reads if it has already been
+created
+*/
+int
+_cfa_var_plan_read(const int cfa_id, const int cfa_var_id,
+                   const size_t *start, const size_t *count,
+                   const size_t *stride, DynamicArray **reads)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    int ndim = agg_var->cfa_ndim;
+
+    /* the range of Fragments to search runs from the Fragment containing the
+    first element of the hyperslab to the one containing the last */
+    size_t last[MAX_DIMS];
+    size_t lo[MAX_DIMS];
+    size_t hi[MAX_DIMS];
+    for (int d=0; d<ndim; d++)
+        last[d] = start[d] + (count[d] - 1) * (stride ? stride[d] : 1);
+    cfa_err = _cfa_var_find_frag_index(cfa_id, cfa_var_id, agg_var, start, lo);
+    CFA_CHECK(cfa_err);
+    cfa_err = _cfa_var_find_frag_index(cfa_id, cfa_var_id, agg_var, last, hi);
+    CFA_CHECK(cfa_err);
+
+    if (!(*reads))
+    {
+        cfa_err = create_array(reads, sizeof(FragmentRead));
+        CFA_CHECK(cfa_err);
+    }
+
+    /* loop over the fragment indices in the range, fastest varying dimension
+    last */
+    size_t frag_index[MAX_DIMS];
+    memcpy(frag_index, lo, sizeof(size_t) * ndim);
+    int d = 0;
+    while (d >= 0)
+    {
+        int L = 0;
+        cfa_err = _multidim_to_linear_index(agg_var, frag_index, &L);
+        CFA_CHECK(cfa_err);
+        Fragment *frag = NULL;
+        cfa_err = _cfa_var_get_frag(cfa_id, cfa_var_id, agg_var, L, &frag);
+        CFA_CHECK(cfa_err);
+        cfa_err = _cfa_add_frag_read(frag, ndim, start, count, stride,
+                                     reads);
+        CFA_CHECK(cfa_err);
+        /* increment the fragment index */
+        for (d=ndim-1; d>=0; d--)
+        {
+            if (++frag_index[d] <= hi[d])
+                break;
+            frag_index[d] = lo[d];
+        }
+    }
+    return CFA_NOERR;
+}
+
+/*
+free the FragmentReads created by _cfa_var_plan_read
+*/
+int
+_cfa_free_read_plan(DynamicArray **reads, const int ndim)
+{
+    if (!(*reads))
+        return CFA_NOERR;
+    int n_reads = 0;
+    int cfa_err = get_array_length(reads, &n_reads);
+    CFA_CHECK(cfa_err);
+    FragmentRead *read = NULL;
+    for (int r=0; r<n_reads; r++)
+    {
+        cfa_err = get_array_node(reads, r, (void**)(&read));
+        CFA_CHECK(cfa_err);
+        if (read->frag_start)
+            cfa_free(read->frag_start, sizeof(size_t) * 4 * ndim);
+    }
+    cfa_err = free_array(reads);
+    CFA_CHECK(cfa_err);
+    return CFA_NOERR;
+}
+
+/*
+copy a block of data with shape count, taken every src_step elements from the
+position src_start in an array with shape src_shape, into the position
+dst_start in an array with shape dst_shape.  A NULL src_step is a step of 1.
+The innermost dimensions that span both arrays are coalesced with the first one
+that does not, so that each memcpy is as long as possible
+*/
+void
+_cfa_copy_block(void *dst, const size_t *dst_shape, const size_t *dst_start,
+                const void *src, const size_t *src_shape,
+                const size_t *src_start, const size_t *src_step,
+                const size_t *count, const int ndim, const size_t tsize)
+{
+    if (ndim == 0)
+    {
+        memcpy(dst, src, tsize);
+        return;
+    }
+    /* strides of the source and destination, in elements, and the distance
+    between the selected elements in the source */
+    size_t dst_stride[MAX_DIMS];
+    size_t src_elem[MAX_DIMS];
+    size_t src_stride[MAX_DIMS];
+    dst_stride[ndim-1] = 1;
+    src_elem[ndim-1] = 1;
+    for (int d=ndim-2; d>=0; d--)
+    {
+        dst_stride[d] = dst_stride[d+1] * dst_shape[d+1];
+        src_elem[d] = src_elem[d+1] * src_shape[d+1];
+    }
+    src_stride[ndim-1] = src_step ? src_step[ndim-1] : 1;
+    for (int d=0; d<ndim-1; d++)
+        src_stride[d] = src_elem[d] * (src_step ? src_step[d] : 1);
+
+    /* dimensions k..ndim-1 are contiguous in both the source and the
+    destination.  k is ndim if the innermost dimension is not contiguous in
+    the source */
+    int k = ndim;
+    if (src_stride[ndim-1] == 1)
+    {
+        k = ndim - 1;
+        while (k > 0 && count[k] == dst_shape[k] && count[k] == src_shape[k] &&
+               src_stride[k-1] == src_elem[k-1])
+            k--;
+    }
+    size_t run = tsize;
+    for (int d=k; d<ndim; d++)
+        run *= count[d];
+
+    /* offsets of the first run and the number of runs */
+    size_t dst_base = 0;
+    size_t src_base = 0;
+    size_t n_runs = 1;
+    for (int d=0; d<ndim; d++)
+    {
+        dst_base += dst_start[d] * dst_stride[d];
+        src_base += src_start[d] * src_elem[d];
+    }
+    for (int d=0; d<k; d++)
+        n_runs *= count[d];
+
+    size_t idx[MAX_DIMS];
+    memset(idx, 0, sizeof(size_t) * ndim);
+    const char *s = (const char*)(src);
+    char *t = (char*)(dst);
+    for (size_t r=0; r<n_runs; r++)
+    {
+        size_t dst_off = dst_base;
+        size_t src_off = src_base;
+        for (int d=0; d<k; d++)
+        {
+            dst_off += idx[d] * dst_stride[d];
+            src_off += idx[d] * src_stride[d];
+        }
+        memcpy(t + dst_off * tsize, s + src_off * tsize, run);
+        for (int d=k-1; d>=0; d--)
+        {
+            if (++idx[d] < count[d])
+                break;
+            idx[d] = 0;
+        }
+    }
+}
+
+/*
+copy a block of data with shape src_count into a larger array with shape
+dst_count, at the position dst_start
+*/
+void
+_cfa_copy_hyperslab(void *dst, const size_t *dst_count,
+                    const size_t *dst_start,
+                    const void *src, const size_t *src_count,
+                    const int ndim, const size_t tsize)
+{
+    size_t src_start[MAX_DIMS];
+    memset(src_start, 0, sizeof(size_t) * MAX_DIMS);
+    _cfa_copy_block(dst, dst_count, dst_start, src, src_count, src_start,
+                    NULL, src_count, ndim, tsize);
+}
+
+/*
+fill a block with shape count, at the position dst_start in an array with shape
+dst_shape, with value.  As in _cfa_copy_block, the innermost dimensions that
+span the array are coalesced so that each fill is as long as possible
+*/
+void
+_cfa_fill_block(void *dst, const size_t *dst_shape, const size_t *dst_start,
+                const size_t *count, const int ndim, const size_t tsize,
+                const void *value)
+{
+    if (ndim == 0)
+    {
+        memcpy(dst, value, tsize);
+        return;
+    }
+    size_t dst_stride[MAX_DIMS];
+    dst_stride[ndim-1] = 1;
+    for (int d=ndim-2; d>=0; d--)
+        dst_stride[d] = dst_stride[d+1] * dst_shape[d+1];
+    int k = ndim - 1;
+    while (k > 0 && count[k] == dst_shape[k])
+        k--;
+    size_t run = 1;
+    for (int d=k; d<ndim; d++)
+        run *= count[d];
+    size_t dst_base = 0;
+    size_t n_runs = 1;
+    for (int d=0; d<ndim; d++)
+        dst_base += dst_start[d] * dst_stride[d];
+    for (int d=0; d<k; d++)
+        n_runs *= count[d];
+
+    size_t idx[MAX_DIMS];
+    memset(idx, 0, sizeof(size_t) * ndim);
+    char *t = (char*)(dst);
+    for (size_t r=0; r<n_runs; r++)
+    {
+        size_t dst_off = dst_base;
+        for (int d=0; d<k; d++)
+            dst_off += idx[d] * dst_stride[d];
+        _cfa_fill(t + dst_off * tsize, value, run, tsize);
+        for (int d=k-1; d>=0; d--)
+        {
+            if (++idx[d] < count[d])
+                break;
+            idx[d] = 0;
+        }
+    }
+}
+
+/*
+copy a block of data with shape count, from the position src_start in an array
+with shape src_shape, into dst, along whose dimensions the dimensions of the
+block step by dst_stride[d] elements.  The dimension inner of the block is the
+contiguous one in dst.  If it is also the last one, contiguous in the source,
+the block is copied in rows, otherwise each plane of those two dimensions is
+transposed in tiles that fit in the cache
+*/
+void
+_cfa_copy_permuted(void *dst, const size_t *dst_stride, const void *src,
+                   const size_t *src_shape, const size_t *src_start,
+                   const size_t *count, const int inner, const int ndim,
+                   const size_t tsize)
+{
+    if (ndim == 0)
+    {
+        memcpy(dst, src, tsize);
+        return;
+    }
+    size_t src_elem[MAX_DIMS];
+    src_elem[ndim-1] = 1;
+    for (int d=ndim-2; d>=0; d--)
+        src_elem[d] = src_elem[d+1] * src_shape[d+1];
+    size_t src_base = 0;
+    for (int d=0; d<ndim; d++)
+        src_base += src_start[d] * src_elem[d];
+
+    /* the outer loop is over every dimension but the two of the plane */
+    int last = ndim - 1;
+    size_t n_outer = 1;
+    for (int d=0; d<ndim; d++)
+        if (d != inner && d != last)
+            n_outer *= count[d];
+
+    size_t idx[MAX_DIMS];
+    memset(idx, 0, sizeof(size_t) * MAX_DIMS);
+    const char *s = (const char*)(src);
+    char *t = (char*)(dst);
+    for (size_t r=0; r<n_outer; r++)
+    {
+        size_t dst_off = 0;
+        size_t src_off = src_base;
+        for (int d=0; d<ndim; d++)
+        {
+            dst_off += idx[d] * dst_stride[d];
+            src_off += idx[d] * src_elem[d];
+        }
+        if (inner == last)
+            memcpy(t + dst_off * tsize, s + src_off * tsize,
+                   count[last] * tsize);
+        else
+            _cfa_transpose(t + dst_off * tsize, dst_stride[last],
+                           s + src_off * tsize, src_elem[inner],
+                           count[inner], count[last], tsize);
+        for (int d=ndim-1; d>=0; d--)
+        {
+            if (d == inner || d == last)
+                continue;
+            if (++idx[d] < count[d])
+                break;
+            idx[d] = 0;
+        }
+    }
+}
+
+/*
+check whether a Fragment has data.  A Fragment with a missing or empty
+"address" FragmentDatum has no data.  A missing "file" is not the same, as it
+means that the Fragment is in the aggregation file
+*/
+int
+_cfa_frag_has_data(const Fragment *frag)
+{
+    const FragmentDatum *addr_dat = NULL;
+    int cfa_err = _cfa_var_get_frag_datum(frag, "address", &addr_dat);
+    return cfa_err == CFA_NOERR && addr_dat->data &&
+           strlen((const char*)(addr_dat->data)) > 0;
+}
+
+/*
+get the value that Fragments with no data are read as, in the type being read.
+This is the _FillValue of the variable, converted and, if unpacking is on,
+unpacked in the same way as the data, or the default netCDF fill value of the
+type read if the variable has no _FillValue
+*/
+int
+_cfa_read_fill_value(const AggregationVariable *agg_var, const cfa_type type,
+                     void *fill)
+{
+    if (!agg_var->cfa_has_fill)
+        return _cfa_default_fill(type, fill);
+    if (agg_var->cfa_unpack && agg_var->cfa_packing.packed)
+        return _cfa_unpack(agg_var->cfa_fill_value, agg_var->cfa_dtype.type,
+                           fill, type, 1, &(agg_var->cfa_packing));
+    return _cfa_convert(agg_var->cfa_fill_value, agg_var->cfa_dtype.type,
+                        fill, type, 1);
+}
+
+/*
+read the overlap of a single Fragment into data with the driver for the format
+of the Fragment.  The data is unpacked with unpack, if it is not NULL
+*/
+int
+_cfa_read_frag_packed(const int cfa_id, const FragmentRead *read,
+                      const int ndim, const cfa_type type,
+                      const CFAPacking *unpack, void *data)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    CFAFormatDriver driver;
+    cfa_err = _cfa_get_frag_driver(agg_cont, read->frag, &driver);
+    CFA_CHECK(cfa_err);
+    void *handle = NULL;
+    if (driver.open)
+    {
+        cfa_err = driver.open(cfa_id, read->frag, &handle);
+        CFA_CHECK(cfa_err);
+    }
+    cfa_err = driver.read(handle, cfa_id, read->frag, ndim, read->frag_start,
+                          read->count, read->stride, type, unpack, data);
+    /* close the handle whether or not the read succeeded */
+    if (driver.close)
+    {
+        int cfa_err_c = driver.close(handle);
+        if (cfa_err == CFA_NOERR)
+            cfa_err = cfa_err_c;
+    }
+    return cfa_err;
+}
+
+/*
+read the overlap of a single Fragment into data.  The data is unpacked if
+unpacking is on for the variable
+*/
+int
+_cfa_read_frag(const int cfa_id, const int cfa_var_id,
+               const FragmentRead *read, const int ndim,
+               const cfa_type type, void *data)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    const CFAPacking *unpack = NULL;
+    if (agg_var->cfa_unpack && agg_var->cfa_packing.packed)
+        unpack = &(agg_var->cfa_packing);
+    return _cfa_read_frag_packed(cfa_id, read, ndim, type, unpack, data);
+}
+
+/*
+test whether a value matches a predicate
+*/
+int
+_cfa_where_match(const CFAPredicate *where, const double v)
+{
+    switch (where->op)
+    {
+        case CFA_WHERE_LT:
+            return v < where->value;
+        case CFA_WHERE_LE:
+            return v <= where->value;
+        case CFA_WHERE_GT:
+            return v > where->value;
+        case CFA_WHERE_GE:
+            return v >= where->value;
+        case CFA_WHERE_EQ:
+            return v == where->value;
+        case CFA_WHERE_NE:
+            return v != where->value;
+    }
+    return 0;
+}
+
+/*
+test whether any value of a Fragment may match a predicate, from the
+statistics of the Fragment.  A Fragment without statistics, or whose
+statistics are out of date, may match.  The statistics are of the values as
+they are stored, so they are unpacked if unpacking is on for the variable
+*/
+int
+_cfa_frag_may_match(const AggregationVariable *agg_var, const Fragment *frag,
+                    const CFAPredicate *where)
+{
+    const FragmentDatum *min_dat = NULL;
+    const FragmentDatum *max_dat = NULL;
+    const FragmentDatum *count_dat = NULL;
+    if (_cfa_var_get_frag_datum(frag, FRAGMENT_MIN, &min_dat) != CFA_NOERR ||
+        _cfa_var_get_frag_datum(frag, FRAGMENT_MAX, &max_dat) != CFA_NOERR ||
+        _cfa_var_get_frag_datum(frag, FRAGMENT_COUNT, &count_dat) !=
+            CFA_NOERR)
+        return 1;
+    long long count = *((const long long*)(count_dat->data));
+    if (count < 0)
+        return 1;
+    if (count == 0)
+        return 0;
+    double min = *((const double*)(min_dat->data));
+    double max = *((const double*)(max_dat->data));
+    if (agg_var->cfa_unpack && agg_var->cfa_packing.packed)
+    {
+        const CFAPacking *packing = &(agg_var->cfa_packing);
+        min = min * packing->scale_factor + packing->add_offset;
+        max = max * packing->scale_factor + packing->add_offset;
+        if (min > max)
+        {
+            double t = min;
+            min = max;
+            max = t;
+        }
+    }
+    switch (where->op)
+    {
+        case CFA_WHERE_LT:
+        case CFA_WHERE_LE:
+            return _cfa_where_match(where, min);
+        case CFA_WHERE_GT:
+        case CFA_WHERE_GE:
+            return _cfa_where_match(where, max);
+        case CFA_WHERE_EQ:
+            return min <= where->value && where->value <= max;
+        case CFA_WHERE_NE:
+            return min != where->value || max != where->value;
+    }
+    return 1;
+}
+
+/*
+replace the n values in buf, of type, that do not match a predicate with the
+fill value.  The values are compared as double, a block at a time
+*/
+int
+_cfa_mask_where(void *buf, const size_t n, const cfa_type type,
+                const void *fill, const CFAPredicate *where)
+{
+    double block[1024];
+    size_t tsize = get_type_size(type);
+    for (size_t i=0; i<n; i+=1024)
+    {
+        size_t m = n - i < 1024 ? n - i : 1024;
+        char *values = (char*)(buf) + i * tsize;
+        int cfa_err = _cfa_convert(values, type, block, CFA_DOUBLE, m);
+        CFA_CHECK(cfa_err);
+        for (size_t j=0; j<m; j++)
+            if (!_cfa_where_match(where, block[j]))
+                memcpy(values + j * tsize, fill, tsize);
+    }
+    return CFA_NOERR;
+}
+
+/*
+state shared by the threads executing a read plan
+*/
+typedef struct {
+    int cfa_id;
+    int cfa_var_id;
+    int ndim;
+    const size_t *count;
+    cfa_type type;
+    size_t tsize;
+    DynamicArray **reads;
+    void *buf;
+    void **stages;      /* staging buffer for each thread */
+    int n_stages;
+    size_t stage_size;
+    /* value of Fragments with no data, in type, or the error getting it */
+    unsigned char fill[sizeof(long long)];
+    int fill_err;
+    /* predicate of the read, NULL to read all the values */
+    const CFAPredicate *where;
+} ExecRead;
+
+/*
+get the whole of a Fragment, of size bytes, from the data cache, reading it and
+adding it to the cache if it is not there.  The cache entry is returned in
+*slot, to be released with _cfa_data_cache_release, or -1 if the data could not
+be cached and is to be freed by the caller
+*/
+int
+_cfa_get_frag_cached(const int cfa_id, const int cfa_var_id, Fragment *frag,
+                     const int ndim, const cfa_type type, const size_t size,
+                     int *slot, void **data)
+{
+    size_t frag_shape[MAX_DIMS];
+    size_t frag_start[MAX_DIMS];
+    for (int d=0; d<ndim; d++)
+    {
+        frag_shape[d] = frag->location[(d<<1)+1] - frag->location[d<<1];
+        frag_start[d] = 0;
+    }
+    int L = frag->linear_index;
+    *slot = -1;
+    int cfa_err = _cfa_data_cache_get(cfa_id, cfa_var_id, L, type, slot, data);
+    CFA_CHECK(cfa_err);
+    if (*slot != -1)
+        return CFA_NOERR;
+    /* read the whole Fragment and add it to the cache */
+    *data = cfa_malloc(size);
+    if (!(*data))
+        return CFA_MEM_ERR;
+    FragmentRead whole = {frag, frag_start, frag_shape, NULL, frag_start};
+    cfa_err = _cfa_read_frag(cfa_id, cfa_var_id, &whole, ndim, type, *data);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_data_cache_put(cfa_id, cfa_var_id, L, type, data, size,
+                                      0, slot);
+    if (cfa_err)
+    {
+        cfa_free(*data, size);
+        *data = NULL;
+    }
+    return cfa_err;
+}
+
+/*
+read one Fragment of a read plan via the data cache.  The whole Fragment is
+read and cached, and the overlap is copied from the cached copy.  Returns
+CFA_NOERR with *done set to 0 if the Fragment is too large to cache
+*/
+int
+_cfa_exec_frag_read_cached(ExecRead *exec, const FragmentRead *read, int *done)
+{
+    int ndim = exec->ndim;
+    size_t frag_shape[MAX_DIMS];
+    size_t size = exec->tsize;
+    for (int d=0; d<ndim; d++)
+    {
+        frag_shape[d] = read->frag->location[(d<<1)+1] -
+                        read->frag->location[d<<1];
+        size *= frag_shape[d];
+    }
+    *done = _cfa_data_cache_fits(size);
+    if (!(*done))
+        return CFA_NOERR;
+
+    int slot = -1;
+    void *data = NULL;
+    int cfa_err = _cfa_get_frag_cached(exec->cfa_id, exec->cfa_var_id,
+                                       read->frag, ndim, exec->type, size,
+                                       &slot, &data);
+    CFA_CHECK(cfa_err);
+    _cfa_copy_block(exec->buf, exec->count, read->out_start,
+                    data, frag_shape, read->frag_start, read->stride,
+                    read->count, ndim, exec->tsize);
+    __atomic_store_n(&(read->frag->read_path), CFA_READ_CACHED,
+                     __ATOMIC_RELAXED);
+    /* release the entry, or free the data if it could not be cached */
+    if (slot == -1)
+        cfa_free(data, size);
+    else
+        cfa_err = _cfa_data_cache_release(slot);
+    return cfa_err;
+}
+
+/*
+get the offset, in elements, of the overlap of a FragmentRead in a buffer
+holding a hyperslab with shape count, if the overlap is one contiguous run of
+the buffer.  This is the case if the dimensions before the first with a count
+of more than one are only one element long, and the dimensions after it span
+the whole buffer.  Returns 0 if the overlap is not contiguous
+*/
+int
+_cfa_overlap_contiguous(const int ndim, const size_t *count,
+                        const FragmentRead *read, size_t *offset)
+{
+    int k = 0;
+    while (k < ndim-1 && read->count[k] == 1)
+        k++;
+    for (int d=k+1; d<ndim; d++)
+        if (read->count[d] != count[d])
+            return 0;
+    *offset = 0;
+    for (int d=0; d<ndim; d++)
+        *offset = *offset * count[d] + read->out_start[d];
+    return 1;
+}
+
+/*
+read one Fragment of a read plan.  If the overlap is contiguous in the output
+buffer it is read straight into it, otherwise it is read into the staging
+buffer of the thread and copied into the output buffer.  The overlaps of the
+Fragments are disjoint, so the copies do not need to be serialised
+*/
+int
+_cfa_exec_frag_read(void *arg, const int r, const int worker)
+{
+    ExecRead *exec = (ExecRead*)(arg);
+    FragmentRead *read = NULL;
+    int cfa_err = get_array_node(exec->reads, r, (void**)(&read));
+    CFA_CHECK(cfa_err);
+    /* fill the overlap of a Fragment with no data, without any I/O */
+    if (!_cfa_frag_has_data(read->frag))
+    {
+        CFA_CHECK(exec->fill_err);
+        _cfa_fill_block(exec->buf, exec->count, read->out_start, read->count,
+                        exec->ndim, exec->tsize, exec->fill);
+        __atomic_store_n(&(read->frag->read_path), CFA_READ_FILL,
+                         __ATOMIC_RELAXED);
+        return CFA_NOERR;
+    }
+    /* and of a Fragment that has no values that match the predicate */
+    if (exec->where)
+    {
+        AggregationVariable *agg_var = NULL;
+        cfa_err = cfa_get_var(exec->cfa_id, exec->cfa_var_id, &agg_var);
+        CFA_CHECK(cfa_err);
+        if (!_cfa_frag_may_match(agg_var, read->frag, exec->where))
+        {
+            CFA_CHECK(exec->fill_err);
+            _cfa_fill_block(exec->buf, exec->count, read->out_start,
+                            read->count, exec->ndim, exec->tsize, exec->fill);
+            __atomic_store_n(&(read->frag->read_path), CFA_READ_SKIPPED,
+                             __ATOMIC_RELAXED);
+            return CFA_NOERR;
+        }
+    }
+    int done = 0;
+    cfa_err = _cfa_exec_frag_read_cached(exec, read, &done);
+    if (cfa_err || done)
+        return cfa_err;
+    size_t offset = 0;
+    if (_cfa_overlap_contiguous(exec->ndim, exec->count, read, &offset))
+    {
+        void *dst = (char*)(exec->buf) + offset * exec->tsize;
+        cfa_err = _cfa_read_frag(exec->cfa_id, exec->cfa_var_id, read,
+                                 exec->ndim, exec->type, dst);
+        CFA_CHECK(cfa_err);
+        __atomic_store_n(&(read->frag->read_path), CFA_READ_ZERO_COPY,
+                         __ATOMIC_RELAXED);
+        return CFA_NOERR;
+    }
+    if (!exec->stages[worker])
+    {
+        exec->stages[worker] = cfa_malloc(exec->stage_size);
+        if (!exec->stages[worker])
+            return CFA_MEM_ERR;
+    }
+    void *stage = exec->stages[worker];
+    cfa_err = _cfa_read_frag(exec->cfa_id, exec->cfa_var_id, read,
+                             exec->ndim, exec->type, stage);
+    CFA_CHECK(cfa_err);
+    _cfa_copy_hyperslab(exec->buf, exec->count, read->out_start,
+                        stage, read->count, exec->ndim, exec->tsize);
+    __atomic_store_n(&(read->frag->read_path), CFA_READ_STAGED,
+                     __ATOMIC_RELAXED);
+    return CFA_NOERR;
+}
+
+/*
+set up the state for carrying out the FragmentReads in a plan.  Each thread
+allocates its staging buffer once, at the size of the largest overlap, and
+reuses it for each Fragment it reads.  The fill value is found once, and any
+error getting it is only returned if a Fragment with no data is read
+*/
+int
+_cfa_exec_read_init(ExecRead *exec, const int cfa_id, const int cfa_var_id,
+                    const int ndim, const size_t *count, const cfa_type type,
+                    DynamicArray **reads, void *buf, int *n_reads)
+{
+    size_t tsize = get_type_size(type);
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    cfa_err = get_array_length(reads, n_reads);
+    CFA_CHECK(cfa_err);
+    FragmentRead *read = NULL;
+    size_t max_size = 0;
+    for (int r=0; r<*n_reads; r++)
+    {
+        cfa_err = get_array_node(reads, r, (void**)(&read));
+        CFA_CHECK(cfa_err);
+        size_t size = tsize;
+        for (int d=0; d<ndim; d++)
+            size *= read->count[d];
+        if (size > max_size)
+            max_size = size;
+    }
+    int n_stages = _cfa_pool_size();
+    void **stages = cfa_malloc(sizeof(void*) * n_stages);
+    if (!stages)
+        return CFA_MEM_ERR;
+    for (int w=0; w<n_stages; w++)
+        stages[w] = NULL;
+
+    ExecRead init = {cfa_id, cfa_var_id, ndim, count, type, tsize, reads, buf,
+                     stages, n_stages, max_size, {0}, CFA_NOERR, NULL};
+    *exec = init;
+    exec->fill_err = _cfa_read_fill_value(agg_var, type, exec->fill);
+    return CFA_NOERR;
+}
+
+/*
+free the staging buffers of an ExecRead
+*/
+void
+_cfa_exec_read_free(ExecRead *exec)
+{
+    for (int w=0; w<exec->n_stages; w++)
+        if (exec->stages[w])
+            cfa_free(exec->stages[w], exec->stage_size);
+    cfa_free(exec->stages, sizeof(void*) * exec->n_stages);
+    exec->stages = NULL;
+}
+
+/*
+check the arguments of a read.  empty is set if there is nothing to read
+*/
+int
+_cfa_var_check_read(const int cfa_id, const int cfa_var_id,
+                    const size_t *start, const size_t *count,
+                    const size_t *stride, const cfa_type type,
+                    AggregationVariable **agg_var, int *empty)
+{
+    /* get the variable */
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, agg_var);
+    CFA_CHECK(cfa_err);
+    /* check that the Fragments have been defined */
+    if (!((*agg_var)->cfa_datap->cfa_fragmentsp))
+        return CFA_VAR_FRAGS_UNDEF;
+    /* only numeric types can be read, and unpacked data is floating point */
+    if (type == CFA_STRING || get_type_size(type) == 0)
+        return CFA_NAT_ERR;
+    if ((*agg_var)->cfa_unpack && (*agg_var)->cfa_packing.packed &&
+        type != CFA_FLOAT && type != CFA_DOUBLE)
+        return CFA_NAT_ERR;
+    cfa_err = _cfa_var_check_hyperslab(cfa_id, *agg_var, start, count, stride);
+    CFA_CHECK(cfa_err);
+    /* nothing to read for an empty hyperslab */
+    *empty = 0;
+    for (int d=0; d<(*agg_var)->cfa_ndim; d++)
+        if (count[d] == 0)
+            *empty = 1;
+    return CFA_NOERR;
+}
+
+/*
+read a strided hyperslab of the AggregatedData of a variable, keeping only the
+values that match the predicate where, if it is not NULL
+*/
+int
+_cfa_var_get(const int cfa_id, const int cfa_var_id,
+             const size_t *start, const size_t *count,
+             const size_t *stride, const CFAPredicate *where,
+             const cfa_type type, void *buf)
+{
+    AggregationVariable *agg_var = NULL;
+    int empty = 0;
+    int cfa_err = _cfa_var_check_read(cfa_id, cfa_var_id, start, count, stride,
+                                      type, &agg_var, &empty);
+    CFA_CHECK(cfa_err);
+    if (empty)
+        return CFA_NOERR;
+
+    /* plan the reads and then carry them out on the worker pool */
+    DynamicArray *reads = NULL;
+    ExecRead exec;
+    int n_reads = 0;
+    cfa_err = _cfa_var_plan_read(cfa_id, cfa_var_id, start, count, stride,
+                                 &reads);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_exec_read_init(&exec, cfa_id, cfa_var_id,
+                                      agg_var->cfa_ndim, count, type,
+                                      &reads, buf, &n_reads);
+    if (cfa_err == CFA_NOERR)
+    {
+        exec.where = where;
+        cfa_err = _cfa_pool_run(n_reads, _cfa_exec_frag_read, &exec);
+        _cfa_exec_read_free(&exec);
+    }
+    if (cfa_err == CFA_NOERR && where)
+    {
+        /* the fill value is only needed if there are values to mask */
+        size_t n = 1;
+        for (int d=0; d<agg_var->cfa_ndim; d++)
+            n *= count[d];
+        cfa_err = exec.fill_err;
+        if (cfa_err == CFA_NOERR)
+            cfa_err = _cfa_mask_where(buf, n, type, exec.fill, where);
+    }
+    if (cfa_err == CFA_NOERR)
+    {
+        /* read-ahead works on the extent of the hyperslab */
+        size_t extent[MAX_DIMS];
+        for (int d=0; d<agg_var->cfa_ndim; d++)
+            extent[d] = (count[d] - 1) * (stride ? stride[d] : 1) + 1;
+        cfa_err = _cfa_prefetch(cfa_id, cfa_var_id, agg_var, start, extent,
+                                &reads, type);
+    }
+    /* free the plan whether or not the read succeeded */
+    int cfa_err_f = _cfa_free_read_plan(&reads, agg_var->cfa_ndim);
+    CFA_CHECK(cfa_err);
+    return cfa_err_f;
+}
+
+/*
+read a strided hyperslab of the AggregatedData of a variable
+*/
+int
+cfa_var_get_vars(const int cfa_id, const int cfa_var_id,
+                 const size_t *start, const size_t *count,
+                 const size_t *stride, const cfa_type type, void *buf)
+{
+    return _cfa_var_get(cfa_id, cfa_var_id, start, count, stride, NULL, type,
+                        buf);
+}
+
+/*
+read a hyperslab of the AggregatedData of a variable
+*/
+int
+cfa_var_get_vara(const int cfa_id, const int cfa_var_id,
+                 const size_t *start, const size_t *count,
+                 const cfa_type type, void *buf)
+{
+    return cfa_var_get_vars(cfa_id, cfa_var_id, start, count, NULL, type, buf);
+}
+
+/*
+read a hyperslab of the AggregatedData of a variable, keeping only the values
+that match a predicate
+*/
+int
+cfa_var_get_vara_where(const int cfa_id, const int cfa_var_id,
+                       const size_t *start, const size_t *count,
+                       const CFAPredicate *where,
+                       const cfa_type type, void *buf)
+{
+    if (where->op < CFA_WHERE_LT || where->op > CFA_WHERE_NE)
+        return CFA_WHERE_ERR;
+    return _cfa_var_get(cfa_id, cfa_var_id, start, count, NULL, where, type,
+                        buf);
+}
+
+/*
+gathering points.  The points are sorted by the Fragment that contains them,
+and the Fragments are read on the worker pool, each once for all of its
+points.  A Fragment is read whole via the data cache if it fits, otherwise the
+bounding box of its points is read if it is no more than
+CFA_POINTS_BOX_RATIO times the number of points, and otherwise the points are
+read one at a time
+*/
+#define CFA_POINTS_BOX_RATIO 64
+
+/* a point, with the Fragment that contains it and its offset in the Fragment,
+which it is sorted by */
+typedef struct {
+    int L;
+    size_t offset;
+    size_t index;       /* index of the point in the input and output */
+} PointRef;
+
+/* the points in a single Fragment */
+typedef struct {
+    Fragment *frag;
+    size_t first;       /* first and number of the sorted PointRefs */
+    size_t n;
+} PointGroup;
+
+/* state shared by the threads gathering points */
+typedef struct {
+    int cfa_id;
+    int cfa_var_id;
+    int ndim;
+    const size_t *points;
+    const PointRef *refs;
+    const PointGroup *groups;
+    cfa_type type;
+    size_t tsize;
+    void *buf;
+    unsigned char fill[sizeof(long long)];
+    int fill_err;
+} ExecPoints;
+
+static int
+_cfa_point_ref_cmp(const void *a, const void *b)
+{
+    const PointRef *pa = (const PointRef*)(a);
+    const PointRef *pb = (const PointRef*)(b);
+    if (pa->L != pb->L)
+        return pa->L < pb->L ? -1 : 1;
+    if (pa->offset != pb->offset)
+        return pa->offset < pb->offset ? -1 : 1;
+    return pa->index < pb->index ? -1 : pa->index > pb->index;
+}
+
+/*
+find the Fragment that contains a point
+*/
+int
+_cfa_var_find_point_frag(const int cfa_id, const int cfa_var_id,
+                         AggregationVariable *agg_var, const size_t *point,
+                         Fragment **frag)
+{
+    size_t frag_index[MAX_DIMS];
+    int cfa_err = _cfa_var_find_frag_index(cfa_id, cfa_var_id, agg_var, point,
+                                           frag_index);
+    CFA_CHECK(cfa_err);
+    int L = 0;
+    cfa_err = _multidim_to_linear_index(agg_var, frag_index, &L);
+    CFA_CHECK(cfa_err);
+    return _cfa_var_get_frag(cfa_id, cfa_var_id, agg_var, L, frag);
+}
+
+/*
+read the points in one Fragment, and scatter them into the output
+*/
+int
+_cfa_exec_points_read(void *arg, const int g, const int worker)
+{
+    (void)(worker);
+    ExecPoints *exec = (ExecPoints*)(arg);
+    const PointGroup *group = &(exec->groups[g]);
+    const PointRef *refs = exec->refs + group->first;
+    const Fragment *frag = group->frag;
+    int ndim = exec->ndim;
+    size_t tsize = exec->tsize;
+    char *buf = (char*)(exec->buf);
+
+    if (!_cfa_frag_has_data(frag))
+    {
+        CFA_CHECK(exec->fill_err);
+        for (size_t p=0; p<group->n; p++)
+            memcpy(buf + refs[p].index * tsize, exec->fill, tsize);
+        __atomic_store_n(&(group->frag->read_path), CFA_READ_FILL,
+                         __ATOMIC_RELAXED);
+        return CFA_NOERR;
+    }
+
+    /* the bounding box of the points, relative to the Fragment */
+    size_t box_start[MAX_DIMS];
+    size_t box_count[MAX_DIMS];
+    size_t out_start[MAX_DIMS];
+    size_t frag_size = tsize;
+    size_t box_n = 1;
+    for (int d=0; d<ndim; d++)
+    {
+        size_t lo = SIZE_MAX;
+        size_t hi = 0;
+        for (size_t p=0; p<group->n; p++)
+        {
+            size_t i = exec->points[refs[p].index * ndim + d] -
+                       frag->location[d<<1];
+            if (i < lo)
+                lo = i;
+            if (i > hi)
+                hi = i;
+        }
+        box_start[d] = lo;
+        box_count[d] = hi - lo + 1;
+        out_start[d] = 0;
+        box_n *= box_count[d];
+        frag_size *= frag->location[(d<<1)+1] - frag->location[d<<1];
+    }
+
+    int cfa_err = CFA_NOERR;
+    int slot = -1;
+    void *data = NULL;
+    size_t data_size = 0;
+    CFAReadPath path = CFA_READ_STAGED;
+    if (_cfa_data_cache_fits(frag_size))
+    {
+        /* the points are taken from the whole Fragment */
+        cfa_err = _cfa_get_frag_cached(exec->cfa_id, exec->cfa_var_id,
+                                       group->frag, ndim, exec->type,
+                                       frag_size, &slot, &data);
+        CFA_CHECK(cfa_err);
+        data_size = frag_size;
+        for (int d=0; d<ndim; d++)
+        {
+            box_start[d] = 0;
+            box_count[d] = frag->location[(d<<1)+1] - frag->location[d<<1];
+        }
+        path = CFA_READ_CACHED;
+    }
+    else if (box_n <= group->n * CFA_POINTS_BOX_RATIO)
+    {
+        data_size = box_n * tsize;
+        data = cfa_malloc(data_size);
+        if (!data)
+            return CFA_MEM_ERR;
+        FragmentRead box = {group->frag, box_start, box_count, NULL,
+                            out_start};
+        cfa_err = _cfa_read_frag(exec->cfa_id, exec->cfa_var_id, &box, ndim,
+                                 exec->type, data);
+    }
+    else
+    {
+        /* the points are too sparse for their bounding box to be read */
+        size_t one[MAX_DIMS];
+        for (int d=0; d<ndim; d++)
+            one[d] = 1;
+        FragmentRead point = {group->frag, box_start, one, NULL, out_start};
+        for (size_t p=0; p<group->n && cfa_err == CFA_NOERR; p++)
+        {
+            for (int d=0; d<ndim; d++)
+                box_start[d] = exec->points[refs[p].index * ndim + d] -
+                               frag->location[d<<1];
+            cfa_err = _cfa_read_frag(exec->cfa_id, exec->cfa_var_id, &point,
+                                     ndim, exec->type,
+                                     buf + refs[p].index * tsize);
+        }
+        CFA_CHECK(cfa_err);
+        __atomic_store_n(&(group->frag->read_path), CFA_READ_STAGED,
+                         __ATOMIC_RELAXED);
+        return CFA_NOERR;
+    }
+
+    /* scatter the points back to their places in the output */
+    if (cfa_err == CFA_NOERR)
+    {
+        for (size_t p=0; p<group->n; p++)
+        {
+            size_t offset = 0;
+            for (int d=0; d<ndim; d++)
+                offset = offset * box_count[d] +
+                         exec->points[refs[p].index * ndim + d] -
+                         frag->location[d<<1] - box_start[d];
+            memcpy(buf + refs[p].index * tsize,
+                   (const char*)(data) + offset * tsize, tsize);
+        }
+        __atomic_store_n(&(group->frag->read_path), path, __ATOMIC_RELAXED);
+    }
+    if (slot == -1)
+        cfa_free(data, data_size);
+    else
+    {
+        int cfa_err_r = _cfa_data_cache_release(slot);
+        if (cfa_err == CFA_NOERR)
+            cfa_err = cfa_err_r;
+    }
+    return cfa_err;
+}
+
+/*
+read the values of the AggregatedData of a variable at npoints points, each
+given by its index along every dimension
+*/
+int
+cfa_var_get_points(const int cfa_id, const int cfa_var_id,
+                   const size_t npoints, const size_t *points,
+                   const cfa_type type, void *buf)
+{
+    /* an empty hyperslab checks the variable and the type */
+    AggregationVariable *agg_var = NULL;
+    int empty = 0;
+    size_t zero[MAX_DIMS] = {0};
+    int cfa_err = _cfa_var_check_read(cfa_id, cfa_var_id, zero, zero, NULL,
+                                      type, &agg_var, &empty);
+    CFA_CHECK(cfa_err);
+    if (npoints == 0)
+        return CFA_NOERR;
+    int ndim = agg_var->cfa_ndim;
+    size_t length[MAX_DIMS];
+    AggregatedDimension *agg_dim = NULL;
+    for (int d=0; d<ndim; d++)
+    {
+        cfa_err = cfa_get_dim(cfa_id, agg_var->cfa_dim_idp[d], &agg_dim);
+        CFA_CHECK(cfa_err);
+        length[d] = agg_dim->length;
+    }
+
+    /* find the Fragment of each point, and sort the points by it */
+    PointRef *refs = cfa_malloc(sizeof(PointRef) * npoints);
+    if (!refs)
+        return CFA_MEM_ERR;
+    Fragment *frag = NULL;
+    for (size_t p=0; p<npoints && cfa_err == CFA_NOERR; p++)
+    {
+        const size_t *point = points + p * ndim;
+        for (int d=0; d<ndim; d++)
+            if (point[d] >= length[d])
+                cfa_err = CFA_VAR_HYPERSLAB_ERR;
+        /* consecutive points are often in the same Fragment */
+        int inside = cfa_err == CFA_NOERR && frag;
+        for (int d=0; d<ndim && inside; d++)
+            inside = point[d] >= frag->location[d<<1] &&
+                     point[d] < frag->location[(d<<1)+1];
+        if (cfa_err == CFA_NOERR && !inside)
+            cfa_err = _cfa_var_find_point_frag(cfa_id, cfa_var_id, agg_var,
+                                               point, &frag);
+        if (cfa_err)
+            break;
+        refs[p].L = frag->linear_index;
+        refs[p].index = p;
+        refs[p].offset = 0;
+        for (int d=0; d<ndim; d++)
+            refs[p].offset = refs[p].offset *
+                             (frag->location[(d<<1)+1] -
+                              frag->location[d<<1]) +
+                             point[d] - frag->location[d<<1];
+    }
+    if (cfa_err)
+    {
+        cfa_free(refs, sizeof(PointRef) * npoints);
+        return cfa_err;
+    }
+    qsort(refs, npoints, sizeof(PointRef), _cfa_point_ref_cmp);
+
+    /* group the sorted points by Fragment */
+    int n_groups = 0;
+    for (size_t p=0; p<npoints; p++)
+        if (p == 0 || refs[p].L != refs[p-1].L)
+            n_groups++;
+    PointGroup *groups = cfa_malloc(sizeof(PointGroup) * n_groups);
+    if (!groups)
+    {
+        cfa_free(refs, sizeof(PointRef) * npoints);
+        return CFA_MEM_ERR;
+    }
+    int g = -1;
+    for (size_t p=0; p<npoints && cfa_err == CFA_NOERR; p++)
+    {
+        if (p > 0 && refs[p].L == refs[p-1].L)
+        {
+            groups[g].n++;
+            continue;
+        }
+        g++;
+        cfa_err = _cfa_var_get_frag(cfa_id, cfa_var_id, agg_var, refs[p].L,
+                                    &(groups[g].frag));
+        groups[g].first = p;
+        groups[g].n = 1;
+    }
+
+    if (cfa_err == CFA_NOERR)
+    {
+        ExecPoints exec = {cfa_id, cfa_var_id, ndim, points, refs, groups,
+                           type, get_type_size(type), buf, {0}, CFA_NOERR};
+        exec.fill_err = _cfa_read_fill_value(agg_var, type, exec.fill);
+        cfa_err = _cfa_pool_run(n_groups, _cfa_exec_points_read, &exec);
+    }
+    cfa_free(groups, sizeof(PointGroup) * n_groups);
+    cfa_free(refs, sizeof(PointRef) * npoints);
+    return cfa_err;
+}
+
+/*
+reading series.  A series along one dimension, at a single point of the
+others, crosses a single column of Fragments, and the run of the series in each
+Fragment is contiguous in the output.  The whole column is planned in one pass,
+with the Fragments that have not been read from the Parser read in batches, and
+each run is read straight into the output on the worker pool.  The runs are
+only a few elements long, so the data cache is not used
+*/
+
+/* the run of a series in one Fragment */
+typedef struct {
+    Fragment *frag;
+    size_t frag_start;      /* along the series dimension, in the Fragment */
+    size_t count;
+    size_t out_start;
+} SeriesRead;
+
+/* state shared by the threads reading a series */
+typedef struct {
+    int cfa_id;
+    int cfa_var_id;
+    int ndim;
+    int dim;
+    const size_t *index;
+    const SeriesRead *reads;
+    cfa_type type;
+    size_t tsize;
+    void *buf;
+    unsigned char fill[sizeof(long long)];
+    int fill_err;
+} ExecSeries;
+
+/*
+read the run of a series in one Fragment
+*/
+int
+_cfa_exec_series_read(void *arg, const int r, const int worker)
+{
+    (void)(worker);
+    ExecSeries *exec = (ExecSeries*)(arg);
+    const SeriesRead *sread = &(exec->reads[r]);
+    Fragment *frag = sread->frag;
+    void *dst = (char*)(exec->buf) + sread->out_start * exec->tsize;
+    if (!_cfa_frag_has_data(frag))
+    {
+        CFA_CHECK(exec->fill_err);
+        _cfa_fill(dst, exec->fill, sread->count, exec->tsize);
+        __atomic_store_n(&(frag->read_path), CFA_READ_FILL, __ATOMIC_RELAXED);
+        return CFA_NOERR;
+    }
+    size_t frag_start[MAX_DIMS];
+    size_t count[MAX_DIMS];
+    size_t out_start[MAX_DIMS];
+    for (int d=0; d<exec->ndim; d++)
+    {
+        frag_start[d] = exec->index[d] - frag->location[d<<1];
+        count[d] = 1;
+        out_start[d] = 0;
+    }
+    frag_start[exec->dim] = sread->frag_start;
+    count[exec->dim] = sread->count;
+    FragmentRead read = {frag, frag_start, count, NULL, out_start};
+    int cfa_err = _cfa_read_frag(exec->cfa_id, exec->cfa_var_id, &read,
+                                 exec->ndim, exec->type, dst);
+    CFA_CHECK(cfa_err);
+    __atomic_store_n(&(frag->read_path), CFA_READ_ZERO_COPY, __ATOMIC_RELAXED);
+    return CFA_NOERR;
+}
+
+/*
+plan the reads of a series, one SeriesRead for each Fragment in the column that
+it crosses.  reads has room for one SeriesRead per Fragment along dim
+*/
+int
+_cfa_var_plan_series(const int cfa_id, const int cfa_var_id,
+                     AggregationVariable *agg_var, const size_t *index,
+                     const int dim, const size_t count, SeriesRead *reads,
+                     int *n_reads)
+{
+    int ndim = agg_var->cfa_ndim;
+    /* the linear indices of the Fragments in the column are a step apart */
+    int step = 1;
+    int length = 0;
+    FragmentDimension *frag_dim = NULL;
+    for (int d=ndim-1; d>=dim; d--)
+    {
+        int cfa_err = get_array_node(&cfa_frag_dims,
+                                     agg_var->cfa_frag_dim_idp[d],
+                                     (void**)(&frag_dim));
+        CFA_CHECK(cfa_err);
+        if (d > dim)
+            step *= frag_dim->length;
+        else
+            length = frag_dim->length;
+    }
+    Fragment *frag = NULL;
+    int cfa_err = _cfa_var_find_point_frag(cfa_id, cfa_var_id, agg_var, index,
+                                           &frag);
+    CFA_CHECK(cfa_err);
+    int L = frag->linear_index;
+    int k = (L / step) % length;
+    size_t pos = index[dim];
+    size_t end = index[dim] + count;
+    *n_reads = 0;
+    while (pos < end)
+    {
+        if (k >= length)
+            return CFA_VAR_HYPERSLAB_ERR;
+        /* Fragments next to each other in the file are read in one batch */
+        cfa_err = get_array_node(&(agg_var->cfa_datap->cfa_fragmentsp), L,
+                                 (void**)(&frag));
+        CFA_CHECK(cfa_err);
+        if (!frag->location && step == 1)
+        {
+            int n = length - k;
+            cfa_err = _cfa_var_get_frags(cfa_id, cfa_var_id, L, &n);
+            CFA_CHECK(cfa_err);
+        }
+        cfa_err = _cfa_var_get_frag(cfa_id, cfa_var_id, agg_var, L, &frag);
+        CFA_CHECK(cfa_err);
+        size_t lo = frag->location[dim<<1];
+        size_t hi = frag->location[(dim<<1)+1];
+        if (pos < lo || pos >= hi)
+            return CFA_VAR_HYPERSLAB_ERR;
+        SeriesRead *sread = &(reads[(*n_reads)++]);
+        sread->frag = frag;
+        sread->frag_start = pos - lo;
+        sread->count = (hi < end ? hi : end) - pos;
+        sread->out_start = pos - index[dim];
+        pos += sread->count;
+        L += step;
+        k++;
+    }
+    return CFA_NOERR;
+}
+
+/*
+read count values along the dimension dim of a variable, starting at the point
+index
+*/
+int
+cfa_var_get_series(const int cfa_id, const int cfa_var_id,
+                   const size_t *index, const int dim, const size_t count,
+                   const cfa_type type, void *buf)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    if (dim < 0 || dim >= agg_var->cfa_ndim)
+        return CFA_DIM_NOT_FOUND_ERR;
+    size_t counts[MAX_DIMS];
+    for (int d=0; d<agg_var->cfa_ndim; d++)
+        counts[d] = d == dim ? count : 1;
+    int empty = 0;
+    cfa_err = _cfa_var_check_read(cfa_id, cfa_var_id, index, counts, NULL,
+                                  type, &agg_var, &empty);
+    CFA_CHECK(cfa_err);
+    if (empty)
+        return CFA_NOERR;
+
+    FragmentDimension *frag_dim = NULL;
+    cfa_err = get_array_node(&cfa_frag_dims, agg_var->cfa_frag_dim_idp[dim],
+                             (void**)(&frag_dim));
+    CFA_CHECK(cfa_err);
+    size_t size = sizeof(SeriesRead) * frag_dim->length;
+    SeriesRead *reads = cfa_malloc(size);
+    if (!reads)
+        return CFA_MEM_ERR;
+    int n_reads = 0;
+    cfa_err = _cfa_var_plan_series(cfa_id, cfa_var_id, agg_var, index, dim,
+                                   count, reads, &n_reads);
+    if (cfa_err == CFA_NOERR)
+    {
+        ExecSeries exec = {cfa_id, cfa_var_id, agg_var->cfa_ndim, dim, index,
+                           reads, type, get_type_size(type), buf, {0},
+                           CFA_NOERR};
+        exec.fill_err = _cfa_read_fill_value(agg_var, type, exec.fill);
+        cfa_err = _cfa_pool_run(n_reads, _cfa_exec_series_read, &exec);
+    }
+    cfa_free(reads, size);
+    return cfa_err;
+}
+
+/*
+co-reading variables.  The reads of all the variables are planned, and the
+FragmentReads are sorted by the "file" of their Fragment, so that the reads
+from each file are carried out together, as a single task on the worker pool,
+while the file is open in the handle cache
+*/
+
+/* a FragmentRead of one of the variables, keyed by the file of its Fragment */
+typedef struct {
+    const char *file;
+    int v;
+    int r;
+} MultiRead;
+
+/* state shared by the threads co-reading variables */
+typedef struct {
+    ExecRead *execs;
+    const MultiRead *mreads;
+    const int *groups;      /* first MultiRead of each file, and the end */
+} ExecMulti;
+
+static int
+_cfa_multi_read_cmp(const void *a, const void *b)
+{
+    const MultiRead *ma = (const MultiRead*)(a);
+    const MultiRead *mb = (const MultiRead*)(b);
+    int c = strcmp(ma->file, mb->file);
+    if (c != 0)
+        return c;
+    if (ma->v != mb->v)
+        return ma->v - mb->v;
+    return ma->r - mb->r;
+}
+
+/*
+carry out all the FragmentReads from one file
+*/
+int
+_cfa_exec_multi_read(void *arg, const int g, const int worker)
+{
+    ExecMulti *exec = (ExecMulti*)(arg);
+    for (int m=exec->groups[g]; m<exec->groups[g+1]; m++)
+    {
+        const MultiRead *mread = &(exec->mreads[m]);
+        int cfa_err = _cfa_exec_frag_read(&(exec->execs[mread->v]), mread->r,
+                                          worker);
+        CFA_CHECK(cfa_err);
+    }
+    return CFA_NOERR;
+}
+
+/*
+read a hyperslab of each of nreads variables, with the reads from each Fragment
+file carried out together
+*/
+int
+cfa_var_get_vara_multi(const int cfa_id, const int nreads,
+                       const CFAVarRead *reads)
+{
+    if (nreads < 0)
+        return CFA_VAR_HYPERSLAB_ERR;
+    if (nreads == 0)
+        return CFA_NOERR;
+    int cfa_err = CFA_NOERR;
+    AggregationVariable *agg_var = NULL;
+    int empty = 0;
+
+    /* plan the reads of all the variables */
+    DynamicArray **plans = cfa_malloc(sizeof(DynamicArray*) * nreads);
+    ExecRead *execs = cfa_malloc(sizeof(ExecRead) * nreads);
+    int *n_reads = cfa_malloc(sizeof(int) * nreads);
+    if (!plans || !execs || !n_reads)
+    {
+        if (plans)
+            cfa_free(plans, sizeof(DynamicArray*) * nreads);
+        if (execs)
+            cfa_free(execs, sizeof(ExecRead) * nreads);
+        if (n_reads)
+            cfa_free(n_reads, sizeof(int) * nreads);
+        return CFA_MEM_ERR;
+    }
+    for (int v=0; v<nreads; v++)
+    {
+        plans[v] = NULL;
+        execs[v].stages = NULL;
+        n_reads[v] = 0;
+    }
+    int n_mreads = 0;
+    for (int v=0; v<nreads && cfa_err == CFA_NOERR; v++)
+    {
+        cfa_err = _cfa_var_check_read(cfa_id, reads[v].cfa_var_id,
+                                      reads[v].start, reads[v].count, NULL,
+                                      reads[v].type, &agg_var, &empty);
+        if (cfa_err || empty)
+            continue;
+        cfa_err = _cfa_var_plan_read(cfa_id, reads[v].cfa_var_id,
+                                     reads[v].start, reads[v].count, NULL,
+                                     &(plans[v]));
+        if (cfa_err == CFA_NOERR)
+            cfa_err = _cfa_exec_read_init(&(execs[v]), cfa_id,
+                                          reads[v].cfa_var_id,
+                                          agg_var->cfa_ndim, reads[v].count,
+                                          reads[v].type, &(plans[v]),
+                                          reads[v].buf, &(n_reads[v]));
+        n_mreads += n_reads[v];
+    }
+
+    /* sort the FragmentReads by file, and run each file as a task */
+    MultiRead *mreads = NULL;
+    int *groups = NULL;
+    int n_groups = 0;
+    if (cfa_err == CFA_NOERR && n_mreads > 0)
+    {
+        mreads = cfa_malloc(sizeof(MultiRead) * n_mreads);
+        groups = cfa_malloc(sizeof(int) * (n_mreads + 1));
+        if (!mreads || !groups)
+            cfa_err = CFA_MEM_ERR;
+    }
+    if (mreads && groups)
+    {
+        int m = 0;
+        for (int v=0; v<nreads && cfa_err == CFA_NOERR; v++)
+            for (int r=0; r<n_reads[v] && cfa_err == CFA_NOERR; r++)
+            {
+                FragmentRead *read = NULL;
+                cfa_err = get_array_node(&(plans[v]), r, (void**)(&read));
+                if (cfa_err)
+                    break;
+                /* a missing "file" is the aggregation file */
+                const FragmentDatum *file_dat = NULL;
+                mreads[m].file = "";
+                if (_cfa_var_get_frag_datum(read->frag, "file", &file_dat) ==
+                    CFA_NOERR && file_dat->data)
+                    mreads[m].file = (const char*)(file_dat->data);
+                mreads[m].v = v;
+                mreads[m].r = r;
+                m++;
+            }
+        if (cfa_err == CFA_NOERR)
+        {
+            qsort(mreads, n_mreads, sizeof(MultiRead), _cfa_multi_read_cmp);
+            for (m=0; m<n_mreads; m++)
+                if (m == 0 || strcmp(mreads[m].file, mreads[m-1].file) != 0)
+                    groups[n_groups++] = m;
+            groups[n_groups] = n_mreads;
+            ExecMulti exec = {execs, mreads, groups};
+            cfa_err = _cfa_pool_run(n_groups, _cfa_exec_multi_read, &exec);
+        }
+    }
+    if (mreads)
+        cfa_free(mreads, sizeof(MultiRead) * n_mreads);
+    if (groups)
+        cfa_free(groups, sizeof(int) * (n_mreads + 1));
+
+    /* free the plans whether or not the reads succeeded */
+    for (int v=0; v<nreads; v++)
+    {
+        if (execs[v].stages)
+            _cfa_exec_read_free(&(execs[v]));
+        if (!plans[v] ||
+            cfa_get_var(cfa_id, reads[v].cfa_var_id, &agg_var) != CFA_NOERR)
+            continue;
+        int cfa_err_f = _cfa_free_read_plan(&(plans[v]), agg_var->cfa_ndim);
+        if (cfa_err == CFA_NOERR)
+            cfa_err = cfa_err_f;
+    }
+    cfa_free(plans, sizeof(DynamicArray*) * nreads);
+    cfa_free(execs, sizeof(ExecRead) * nreads);
+    cfa_free(n_reads, sizeof(int) * nreads);
+    return cfa_err;
+}
+
+/*
+halo reads.  Along each dimension the tile, widened by its halo, is split into
+at most three segments: the part inside the variable, and the parts of the
+halo beyond either end, which wrap around if the dimension is periodic and are
+the fill value if it is not.  Each box of segments inside the variable is
+planned as a hyperslab, with its FragmentReads placed at the position of the
+box in the output, so that only the strips of the neighbouring Fragments that
+are in the halo are read
+*/
+
+/* a segment of the widened tile along one dimension */
+typedef struct {
+    size_t start;       /* in the variable */
+    size_t count;
+    size_t out_start;
+    int fill;           /* outside a dimension that is not periodic */
+} HaloSegment;
+
+/*
+split the widened tile along one dimension into segments
+*/
+int
+_cfa_halo_segments(const size_t start, const size_t count, const size_t halo,
+                   const int periodic, const size_t length,
+                   HaloSegment *segs, int *n_segs)
+{
+    if (periodic && halo > length)
+        return CFA_VAR_HYPERSLAB_ERR;
+    *n_segs = 0;
+    size_t n = count + 2 * halo;
+    /* the position along the widened tile, and in the variable */
+    size_t out = 0;
+    while (out < n)
+    {
+        HaloSegment *seg = &(segs[(*n_segs)++]);
+        seg->out_start = out;
+        seg->fill = 0;
+        if (out + start < halo)
+        {
+            /* before the start of the variable */
+            seg->count = halo - start - out;
+            seg->start = length - seg->count;
+            seg->fill = !periodic;
+        }
+        else if (out + start - halo >= length)
+        {
+            /* after the end of the variable */
+            seg->count = n - out;
+            seg->start = 0;
+            seg->fill = !periodic;
+        }
+        else
+        {
+            seg->start = out + start - halo;
+            seg->count = length - seg->start;
+            if (seg->count > n - out)
+                seg->count = n - out;
+        }
+        out += seg->count;
+    }
+    return CFA_NOERR;
+}
+
+/*
+read a tile of the AggregatedData of a variable, with a halo of halo[d]
+elements on either side along each dimension
+*/
+int
+cfa_var_get_vara_halo(const int cfa_id, const int cfa_var_id,
+                      const size_t *start, const size_t *count,
+                      const size_t *halo, const int *periodic,
+                      const cfa_type type, void *buf)
+{
+    AggregationVariable *agg_var = NULL;
+    int empty = 0;
+    int cfa_err = _cfa_var_check_read(cfa_id, cfa_var_id, start, count, NULL,
+                                      type, &agg_var, &empty);
+    CFA_CHECK(cfa_err);
+    if (empty)
+        return CFA_NOERR;
+    int ndim = agg_var->cfa_ndim;
+
+    /* the segments along each dimension, and the shape of the output */
+    HaloSegment segs[MAX_DIMS][3];
+    int n_segs[MAX_DIMS];
+    size_t out_count[MAX_DIMS];
+    AggregatedDimension *agg_dim = NULL;
+    for (int d=0; d<ndim; d++)
+    {
+        cfa_err = cfa_get_dim(cfa_id, agg_var->cfa_dim_idp[d], &agg_dim);
+        CFA_CHECK(cfa_err);
+        size_t h = halo ? halo[d] : 0;
+        cfa_err = _cfa_halo_segments(start[d], count[d], h,
+                                     periodic && periodic[d],
+                                     agg_dim->length, segs[d], &(n_segs[d]));
+        CFA_CHECK(cfa_err);
+        out_count[d] = count[d] + 2 * h;
+    }
+    unsigned char fill[sizeof(long long)];
+    int fill_err = _cfa_read_fill_value(agg_var, type, fill);
+    size_t tsize = get_type_size(type);
+
+    /* fill or plan each box of segments */
+    DynamicArray *reads = NULL;
+    int seg[MAX_DIMS] = {0};
+    int d = 0;
+    while (d >= 0 && cfa_err == CFA_NOERR)
+    {
+        size_t box_start[MAX_DIMS];
+        size_t box_count[MAX_DIMS];
+        size_t box_out[MAX_DIMS];
+        int box_fill = 0;
+        for (int e=0; e<ndim; e++)
+        {
+            const HaloSegment *s = &(segs[e][seg[e]]);
+            box_start[e] = s->start;
+            box_count[e] = s->count;
+            box_out[e] = s->out_start;
+            box_fill |= s->fill;
+        }
+        if (box_fill)
+        {
+            cfa_err = fill_err;
+            if (cfa_err == CFA_NOERR)
+                _cfa_fill_block(buf, out_count, box_out, box_count, ndim,
+                                tsize, fill);
+        }
+        else
+        {
+            /* place the new FragmentReads at the box in the output */
+            int n0 = 0;
+            int n1 = 0;
+            if (reads)
+                cfa_err = get_array_length(&reads, &n0);
+            if (cfa_err == CFA_NOERR)
+                cfa_err = _cfa_var_plan_read(cfa_id, cfa_var_id, box_start,
+                                             box_count, NULL, &reads);
+            if (cfa_err == CFA_NOERR)
+                cfa_err = get_array_length(&reads, &n1);
+            for (int r=n0; r<n1 && cfa_err == CFA_NOERR; r++)
+            {
+                FragmentRead *read = NULL;
+                cfa_err = get_array_node(&reads, r, (void**)(&read));
+                if (cfa_err)
+                    break;
+                for (int e=0; e<ndim; e++)
+                    read->out_start[e] += box_out[e];
+            }
+        }
+        /* the next box, last dimension fastest */
+        for (d=ndim-1; d>=0; d--)
+        {
+            if (++seg[d] < n_segs[d])
+                break;
+            seg[d] = 0;
+        }
+    }
+
+    /* read the strips of the Fragments on the worker pool */
+    ExecRead exec;
+    int n_reads = 0;
+    if (cfa_err == CFA_NOERR && reads)
+    {
+        cfa_err = _cfa_exec_read_init(&exec, cfa_id, cfa_var_id, ndim,
+                                      out_count, type, &reads, buf, &n_reads);
+        if (cfa_err == CFA_NOERR)
+        {
+            cfa_err = _cfa_pool_run(n_reads, _cfa_exec_frag_read, &exec);
+            _cfa_exec_read_free(&exec);
+        }
+    }
+    int cfa_err_f = _cfa_free_read_plan(&reads, ndim);
+    CFA_CHECK(cfa_err);
+    return cfa_err_f;
+}
+
+/*
+state shared by the threads executing a permuted read plan.  The plan is in
+the order of the dimensions of the variable, and the output is in the order of
+the permutation
+*/
+typedef struct {
+    ExecRead exec;      /* first, as the read is passed to the tasks as their
+                           ExecRead */
+    const int *perm;
+    size_t out_count[MAX_DIMS];     /* in the order of the output */
+    size_t dst_stride[MAX_DIMS];    /* in the order of the variable */
+} PermRead;
+
+/*
+read one Fragment of a permuted read plan.  The overlap is read into the
+staging buffer of the thread, or found in the data cache, and transposed into
+the output buffer in a single pass
+*/
+int
+_cfa_exec_perm_read(void *arg, const int r, const int worker)
+{
+    PermRead *pread = (PermRead*)(arg);
+    ExecRead *exec = &(pread->exec);
+    FragmentRead *read = NULL;
+    int cfa_err = get_array_node(exec->reads, r, (void**)(&read));
+    CFA_CHECK(cfa_err);
+    int ndim = exec->ndim;
+    size_t offset = 0;
+    for (int d=0; d<ndim; d++)
+        offset += read->out_start[d] * pread->dst_stride[d];
+    char *dst = (char*)(exec->buf) + offset * exec->tsize;
+
+    /* fill the overlap of a Fragment with no data, in the output order */
+    if (!_cfa_frag_has_data(read->frag))
+    {
+        CFA_CHECK(exec->fill_err);
+        size_t out_start[MAX_DIMS];
+        size_t out_count[MAX_DIMS];
+        for (int i=0; i<ndim; i++)
+        {
+            out_start[i] = read->out_start[pread->perm[i]];
+            out_count[i] = read->count[pread->perm[i]];
+        }
+        _cfa_fill_block(exec->buf, pread->out_count, out_start, out_count,
+                        ndim, exec->tsize, exec->fill);
+        __atomic_store_n(&(read->frag->read_path), CFA_READ_FILL,
+                         __ATOMIC_RELAXED);
+        return CFA_NOERR;
+    }
+    int inner = pread->perm[ndim-1];
+
+    /* transpose the overlap straight out of the cached Fragment */
+    size_t frag_shape[MAX_DIMS];
+    size_t size = exec->tsize;
+    for (int d=0; d<ndim; d++)
+    {
+        frag_shape[d] = read->frag->location[(d<<1)+1] -
+                        read->frag->location[d<<1];
+        size *= frag_shape[d];
+    }
+    if (_cfa_data_cache_fits(size))
+    {
+        int slot = -1;
+        void *data = NULL;
+        cfa_err = _cfa_get_frag_cached(exec->cfa_id, exec->cfa_var_id,
+                                       read->frag, ndim, exec->type, size,
+                                       &slot, &data);
+        CFA_CHECK(cfa_err);
+        _cfa_copy_permuted(dst, pread->dst_stride, data, frag_shape,
+                           read->frag_start, read->count, inner, ndim,
+                           exec->tsize);
+        __atomic_store_n(&(read->frag->read_path), CFA_READ_CACHED,
+                         __ATOMIC_RELAXED);
+        if (slot == -1)
+            cfa_free(data, size);
+        else
+            cfa_err = _cfa_data_cache_release(slot);
+        return cfa_err;
+    }
+
+    if (!exec->stages[worker])
+    {
+        exec->stages[worker] = cfa_malloc(exec->stage_size);
+        if (!exec->stages[worker])
+            return CFA_MEM_ERR;
+    }
+    void *stage = exec->stages[worker];
+    cfa_err = _cfa_read_frag(exec->cfa_id, exec->cfa_var_id, read, ndim,
+                             exec->type, stage);
+    CFA_CHECK(cfa_err);
+    size_t stage_start[MAX_DIMS];
+    memset(stage_start, 0, sizeof(size_t) * MAX_DIMS);
+    _cfa_copy_permuted(dst, pread->dst_stride, stage, read->count,
+                       stage_start, read->count, inner, ndim, exec->tsize);
+    __atomic_store_n(&(read->frag->read_path), CFA_READ_STAGED,
+                     __ATOMIC_RELAXED);
+    return CFA_NOERR;
+}
+
+/*
+read a hyperslab of the AggregatedData of a variable into buf with its
+dimensions permuted, so that dimension i of buf is dimension perm[i] of the
+variable
+*/
+int
+cfa_var_get_vara_perm(const int cfa_id, const int cfa_var_id,
+                      const size_t *start, const size_t *count,
+                      const int *perm, const cfa_type type, void *buf)
+{
+    AggregationVariable *agg_var = NULL;
+    int empty = 0;
+    int cfa_err = _cfa_var_check_read(cfa_id, cfa_var_id, start, count, NULL,
+                                      type, &agg_var, &empty);
+    CFA_CHECK(cfa_err);
+    int ndim = agg_var->cfa_ndim;
+
+    /* check that perm is a permutation, and whether it is the identity */
+    if (!perm)
+        return CFA_PERM_ERR;
+    int seen[MAX_DIMS] = {0};
+    int identity = 1;
+    for (int i=0; i<ndim; i++)
+    {
+        if (perm[i] < 0 || perm[i] >= ndim || seen[perm[i]])
+            return CFA_PERM_ERR;
+        seen[perm[i]] = 1;
+        identity &= perm[i] == i;
+    }
+    if (empty)
+        return CFA_NOERR;
+    if (identity)
+        return cfa_var_get_vara(cfa_id, cfa_var_id, start, count, type, buf);
+
+    /* the shape of the output, and the stride of each dimension of the
+    variable in it */
+    PermRead pread;
+    pread.perm = perm;
+    for (int i=0; i<ndim; i++)
+        pread.out_count[i] = count[perm[i]];
+    size_t out_stride = 1;
+    for (int i=ndim-1; i>=0; i--)
+    {
+        pread.dst_stride[perm[i]] = out_stride;
+        out_stride *= pread.out_count[i];
+    }
+
+    DynamicArray *reads = NULL;
+    int n_reads = 0;
+    cfa_err = _cfa_var_plan_read(cfa_id, cfa_var_id, start, count, NULL,
+                                 &reads);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_exec_read_init(&(pread.exec), cfa_id, cfa_var_id,
+                                      ndim, count, type, &reads, buf,
+                                      &n_reads);
+    if (cfa_err == CFA_NOERR)
+    {
+        cfa_err = _cfa_pool_run(n_reads, _cfa_exec_perm_read, &pread);
+        _cfa_exec_read_free(&(pread.exec));
+    }
+    int cfa_err_f = _cfa_free_read_plan(&reads, ndim);
+    CFA_CHECK(cfa_err);
+    return cfa_err_f;
+}
+
+/*
+get the way the data of a Fragment was last read
+*/
+int
+cfa_var_inq_read_path(const int cfa_id, const int cfa_var_id,
+                      const size_t *frag_location, const size_t *data_location,
+                      CFAReadPath *pathp)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    if (!(agg_var->cfa_datap->cfa_fragmentsp))
+        return CFA_VAR_FRAGS_UNDEF;
+    int L = 0;
+    cfa_err = _get_linear_index(agg_var, frag_location, data_location, &L);
+    CFA_CHECK(cfa_err);
+    Fragment *frag = NULL;
+    cfa_err = get_array_node(&(agg_var->cfa_datap->cfa_fragmentsp), L,
+                             (void**)(&frag));
+    CFA_CHECK(cfa_err);
+    *pathp = (CFAReadPath)(__atomic_load_n(&(frag->read_path),
+                                           __ATOMIC_RELAXED));
+    return CFA_NOERR;
+}
+
+/*
+get which of the Fragments that contain an element of a strided hyperslab
+have data
+*/
+int
+cfa_var_inq_frag_presence(const int cfa_id, const int cfa_var_id,
+                          const size_t *start, const size_t *count,
+                          const size_t *stride, size_t *nfragsp,
+                          unsigned char *bitmap)
+{
+    AggregationVariable *agg_var = NULL;
+    int empty = 0;
+    int cfa_err = _cfa_var_check_read(cfa_id, cfa_var_id, start, count, stride,
+                                      CFA_DOUBLE, &agg_var, &empty);
+    CFA_CHECK(cfa_err);
+    *nfragsp = 0;
+    if (empty)
+        return CFA_NOERR;
+
+    DynamicArray *reads = NULL;
+    int n_reads = 0;
+    cfa_err = _cfa_var_plan_read(cfa_id, cfa_var_id, start, count, stride,
+                                 &reads);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = get_array_length(&reads, &n_reads);
+    if (cfa_err == CFA_NOERR && bitmap)
+    {
+        memset(bitmap, 0, (n_reads + 7) / 8);
+        FragmentRead *read = NULL;
+        for (int r=0; r<n_reads && cfa_err == CFA_NOERR; r++)
+        {
+            cfa_err = get_array_node(&reads, r, (void**)(&read));
+            if (cfa_err == CFA_NOERR && _cfa_frag_has_data(read->frag))
+                bitmap[r >> 3] |= (unsigned char)(1 << (r & 7));
+        }
+    }
+    *nfragsp = n_reads;
+    int cfa_err_f = _cfa_free_read_plan(&reads, agg_var->cfa_ndim);
+    CFA_CHECK(cfa_err);
+    return cfa_err_f;
+}
+
+/*
+asynchronous reads.  The read is planned on the calling thread and the
+FragmentReads are run in the background on the worker pool, sharing the caches
+with the synchronous reads.  Requests are identified by their index in a fixed
+table
+*/
+#define CFA_MAX_REQUESTS 1024
+
+typedef struct {
+    ExecRead exec;      /* first, as the request is passed to the tasks as
+                           their ExecRead */
+    DynamicArray *reads;
+    size_t count[MAX_DIMS];
+    int ndim;
+    int req_id;
+    int done;
+    int err;
+    cfa_callback callback;
+    void *user_data;
+} ReadRequest;
+
+static pthread_mutex_t cfa_req_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cfa_req_done = PTHREAD_COND_INITIALIZER;
+static ReadRequest *cfa_requests[CFA_MAX_REQUESTS];
+
+/*
+completion of the FragmentReads of a request - called on the thread that
+finished the last one.  The callback is called before the request is marked
+done, so that cfa_wait and cfa_test return after it
+*/
+void
+_cfa_read_request_done(void *arg, const int err)
+{
+    ReadRequest *req = (ReadRequest*)(arg);
+    _cfa_exec_read_free(&(req->exec));
+    if (req->callback)
+        req->callback(req->req_id, err, req->user_data);
+    pthread_mutex_lock(&cfa_req_lock);
+    req->done = 1;
+    req->err = err;
+    pthread_cond_broadcast(&cfa_req_done);
+    pthread_mutex_unlock(&cfa_req_lock);
+}
+
+/*
+free a completed request, returning the error of the read
+*/
+int
+_cfa_read_request_release(const int req_id)
+{
+    pthread_mutex_lock(&cfa_req_lock);
+    ReadRequest *req = cfa_requests[req_id];
+    cfa_requests[req_id] = NULL;
+    pthread_mutex_unlock(&cfa_req_lock);
+    int cfa_err = req->err;
+    int cfa_err_f = _cfa_free_read_plan(&(req->reads), req->ndim);
+    cfa_free(req, sizeof(ReadRequest));
+    CFA_CHECK(cfa_err);
+    return cfa_err_f;
+}
+
+/*
+start an asynchronous read of a hyperslab of the AggregatedData of a variable
+*/
+int
+cfa_var_get_vara_async(const int cfa_id, const int cfa_var_id,
+                       const size_t *start, const size_t *count,
+                       const cfa_type type, void *buf,
+                       cfa_callback callback, void *user_data,
+                       int *req_idp)
+{
+    AggregationVariable *agg_var = NULL;
+    int empty = 0;
+    int cfa_err = _cfa_var_check_read(cfa_id, cfa_var_id, start, count, NULL,
+                                      type, &agg_var, &empty);
+    CFA_CHECK(cfa_err);
+
+    /* allocate the request and reserve a slot for it */
+    ReadRequest *req = cfa_malloc(sizeof(ReadRequest));
+    if (!req)
+        return CFA_MEM_ERR;
+    req->reads = NULL;
+    /* the AggregationContainer is set first, for cfa_close to find the
+    request by */
+    req->exec.cfa_id = cfa_id;
+    req->ndim = agg_var->cfa_ndim;
+    req->done = 0;
+    req->err = CFA_NOERR;
+    req->callback = callback;
+    req->user_data = user_data;
+    memcpy(req->count, count, sizeof(size_t) * req->ndim);
+    pthread_mutex_lock(&cfa_req_lock);
+    *req_idp = -1;
+    for (int r=0; r<CFA_MAX_REQUESTS && *req_idp == -1; r++)
+        if (!cfa_requests[r])
+        {
+            cfa_requests[r] = req;
+            *req_idp = r;
+        }
+    pthread_mutex_unlock(&cfa_req_lock);
+    if (*req_idp == -1)
+    {
+        cfa_free(req, sizeof(ReadRequest));
+        return CFA_REQUEST_ERR;
+    }
+    req->req_id = *req_idp;
+
+    /* plan the reads - an empty plan is submitted so that the request
+    completes, and the callback is called, in the same way as any other */
+    if (!empty)
+        cfa_err = _cfa_var_plan_read(cfa_id, cfa_var_id, start, count, NULL,
+                                     &(req->reads));
+    else
+        cfa_err = create_array(&(req->reads), sizeof(FragmentRead));
+    /* read ahead before submitting, as the request may be released as soon as
+    it is submitted */
+    if (cfa_err == CFA_NOERR && !empty)
+        cfa_err = _cfa_prefetch(cfa_id, cfa_var_id, agg_var, start, count,
+                                &(req->reads), type);
+    int n_reads = 0;
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_exec_read_init(&(req->exec), cfa_id, cfa_var_id,
+                                      req->ndim, req->count, type,
+                                      &(req->reads), buf, &n_reads);
+    if (cfa_err == CFA_NOERR)
+    {
+        cfa_err = _cfa_pool_submit(n_reads, _cfa_exec_frag_read, req,
+                                   _cfa_read_request_done);
+        if (cfa_err)
+            _cfa_exec_read_free(&(req->exec));
+    }
+    if (cfa_err)
+    {
+        req->err = cfa_err;
+        _cfa_read_request_release(*req_idp);
+        *req_idp = -1;
+        return cfa_err;
+    }
+    return CFA_NOERR;
+}
+
+/*
+get a request from its id
+*/
+int
+_cfa_get_request(const int req_id, ReadRequest **req)
+{
+    if (req_id < 0 || req_id >= CFA_MAX_REQUESTS)
+        return CFA_REQUEST_ERR;
+    pthread_mutex_lock(&cfa_req_lock);
+    *req = cfa_requests[req_id];
+    pthread_mutex_unlock(&cfa_req_lock);
+    if (!(*req))
+        return CFA_REQUEST_ERR;
+    return CFA_NOERR;
+}
+
+/*
+wait for an asynchronous read to complete, release the request and return the
+error of the read
+*/
+int
+cfa_wait(const int req_id)
+{
+    ReadRequest *req = NULL;
+    int cfa_err = _cfa_get_request(req_id, &req);
+    CFA_CHECK(cfa_err);
+    pthread_mutex_lock(&cfa_req_lock);
+    while (!(req->done))
+        pthread_cond_wait(&cfa_req_done, &cfa_req_lock);
+    pthread_mutex_unlock(&cfa_req_lock);
+    return _cfa_read_request_release(req_id);
+}
+
+/*
+test whether an asynchronous read has completed.  If it has, the request is
+released and the error of the read is returned
+*/
+int
+cfa_test(const int req_id, int *donep)
+{
+    ReadRequest *req = NULL;
+    int cfa_err = _cfa_get_request(req_id, &req);
+    CFA_CHECK(cfa_err);
+    pthread_mutex_lock(&cfa_req_lock);
+    *donep = req->done;
+    pthread_mutex_unlock(&cfa_req_lock);
+    if (!(*donep))
+        return CFA_NOERR;
+    return _cfa_read_request_release(req_id);
+}
+
+/*
+wait for the asynchronous reads of an AggregationContainer to complete, so
+that its Fragments are not freed while they are being read.  The requests are
+left for cfa_wait or cfa_test to release.  Called by cfa_close
+*/
+int
+_cfa_read_requests_close(const int cfa_id)
+{
+    pthread_mutex_lock(&cfa_req_lock);
+    for (int r=0; r<CFA_MAX_REQUESTS; r++)
+        while (cfa_requests[r] && cfa_requests[r]->exec.cfa_id == cfa_id &&
+               !(cfa_requests[r]->done))
+            pthread_cond_wait(&cfa_req_done, &cfa_req_lock);
+    pthread_mutex_unlock(&cfa_req_lock);
+    return CFA_NOERR;
+}
@@ -0,0 +1,606 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+extern int _cfa_var_check_read(const int, const int, const size_t*,
+                               const size_t*, const size_t*, const cfa_type,
+                               AggregationVariable**, int*);
+extern int _cfa_var_plan_read(const int, const int, const size_t*,
+                              const size_t*, const size_t*, DynamicArray**);
+extern int _cfa_free_read_plan(DynamicArray**, const int);
+extern int _cfa_read_frag_packed(const int, const FragmentRead*, const int,
+                                 const cfa_type, const CFAPacking*, void*);
+extern int _cfa_frag_has_data(const Fragment*);
+extern int _cfa_read_fill_value(const AggregationVariable*, const cfa_type,
+                                void*);
+extern int _cfa_convert(const void*, const cfa_type, void*, const cfa_type,
+                        const size_t);
+extern int _cfa_default_fill(const cfa_type, void*);
+extern int _cfa_driver_stat(const int, const Fragment*, double*, double*,
+                            long long*);
+
+/* the statistics of each Fragment are kept as FragmentDatums */
+extern int _cfa_var_get_agg_instr(const AggregationVariable*, const char*,
+                                  AggregationInstruction**);
+extern int _cfa_var_assign_datum_to_frag(AggregationVariable*, Fragment*,
+                                         const char*, const void*, int);
+extern int _cfa_var_write1_frag(const int, const int, Fragment*);
+
+/* Fragments are reduced by the worker pool */
+extern int _cfa_pool_run(const int, int (*)(void*, const int, const int),
+                         void*);
+extern int _cfa_pool_size(void);
+
+#define STR_LENGTH 256
+
+/* maximum number of elements of a Fragment read at once */
+#ifndef CFA_REDUCE_CHUNK
+#define CFA_REDUCE_CHUNK (1 << 16)
+#endif
+
+/* the built-in statistics of the overlap of one Fragment */
+typedef struct {
+    double min;
+    double max;
+    double sum;
+    size_t count;
+} ReduceStat;
+
+/*
+state shared by the threads executing a reduction.  The statistics are kept
+for each Fragment, and combined in order so that the result does not depend on
+the number of threads.  The histogram and user partial results are kept for
+each thread
+*/
+typedef struct {
+    int cfa_id;
+    int cfa_var_id;
+    int ndim;
+    const CFAReducer *reducer;
+    const void *init;       /* initial user partial result */
+    DynamicArray **reads;
+    ReduceStat *stats;      /* for each FragmentRead */
+    size_t **hists;         /* histogram for each thread */
+    void **partials;        /* user partial result for each thread */
+    double **chunks;        /* chunk buffer for each thread */
+    int n_workers;
+    size_t chunk_size;      /* elements in each chunk buffer */
+    const CFAPacking *unpack;
+    double fill;
+    int driver_stats;       /* take the statistics of whole Fragments from
+                               their drivers, where they know them */
+} ExecReduce;
+
+/*
+add a chunk of values to the statistics of a Fragment and the partial results
+of a thread.  Missing values, the fill value and NaN, are removed, packing the
+valid values at the start of the chunk for the user reduction
+*/
+int
+_cfa_reduce_chunk(ExecReduce *exec, const int r, const int worker,
+                  double *data, const size_t n)
+{
+    const CFAReducer *reducer = exec->reducer;
+    ReduceStat *stat = &(exec->stats[r]);
+    size_t n_valid = 0;
+    for (size_t i=0; i<n; i++)
+    {
+        double v = data[i];
+        if (v != v || v == exec->fill)
+            continue;
+        data[n_valid++] = v;
+        if (stat->count == 0 || v < stat->min)
+            stat->min = v;
+        if (stat->count == 0 || v > stat->max)
+            stat->max = v;
+        stat->sum += v;
+        stat->count++;
+    }
+    if (reducer->op == CFA_REDUCE_HISTOGRAM)
+    {
+        size_t *hist = exec->hists[worker];
+        double scale = reducer->nbins / (reducer->hi - reducer->lo);
+        for (size_t i=0; i<n_valid; i++)
+        {
+            if (data[i] < reducer->lo || data[i] >= reducer->hi)
+                continue;
+            int bin = (int)((data[i] - reducer->lo) * scale);
+            /* rounding can put values just below hi in the bin above */
+            if (bin >= reducer->nbins)
+                bin = reducer->nbins - 1;
+            hist[bin]++;
+        }
+    }
+    else if (reducer->op == CFA_REDUCE_USER && n_valid > 0)
+        return reducer->reduce(data, n_valid, exec->partials[worker],
+                               reducer->user_data);
+    return CFA_NOERR;
+}
+
+/*
+reduce the overlap of one Fragment, reading it in chunks of at most
+chunk_size elements.  The chunks run along the outermost dimension whose inner
+dimensions fit in a chunk, one element at a time along the dimensions before it
+*/
+int
+_cfa_exec_frag_reduce(void *arg, const int r, const int worker)
+{
+    ExecReduce *exec = (ExecReduce*)(arg);
+    FragmentRead *read = NULL;
+    int cfa_err = get_array_node(exec->reads, r, (void**)(&read));
+    CFA_CHECK(cfa_err);
+    /* Fragments with no data are all missing values */
+    if (!_cfa_frag_has_data(read->frag))
+    {
+        __atomic_store_n(&(read->frag->read_path), CFA_READ_FILL,
+                         __ATOMIC_RELAXED);
+        return CFA_NOERR;
+    }
+    if (exec->driver_stats)
+    {
+        double min = 0.0;
+        double max = 0.0;
+        long long count = 0;
+        cfa_err = _cfa_driver_stat(exec->cfa_id, read->frag, &min, &max,
+                                   &count);
+        if (cfa_err == CFA_NOERR && count >= 0)
+        {
+            ReduceStat *stat = &(exec->stats[r]);
+            stat->min = min;
+            stat->max = max;
+            stat->count = count;
+            return CFA_NOERR;
+        }
+        if (cfa_err != CFA_NOERR && cfa_err != CFA_FRAG_FORMAT_ERR)
+            return cfa_err;
+    }
+    if (!exec->chunks[worker])
+    {
+        exec->chunks[worker] = cfa_malloc(sizeof(double) * exec->chunk_size);
+        if (!exec->chunks[worker])
+            return CFA_MEM_ERR;
+    }
+    double *chunk = exec->chunks[worker];
+
+    int ndim = exec->ndim;
+    int k = ndim - 1;
+    size_t inner = 1;
+    while (k > 0 && inner * read->count[k] <= exec->chunk_size)
+    {
+        inner *= read->count[k];
+        k--;
+    }
+    size_t rows = exec->chunk_size / inner;
+
+    size_t pos[MAX_DIMS] = {0};
+    size_t sub_start[MAX_DIMS];
+    size_t sub_count[MAX_DIMS];
+    FragmentRead sub = {read->frag, sub_start, sub_count, NULL, NULL};
+    int d = 0;
+    while (d >= 0)
+    {
+        size_t n = 1;
+        for (int e=0; e<ndim; e++)
+        {
+            sub_start[e] = read->frag_start[e] + pos[e];
+            if (e < k)
+                sub_count[e] = 1;
+            else if (e == k)
+                sub_count[e] = read->count[e] - pos[e] < rows ?
+                               read->count[e] - pos[e] : rows;
+            else
+                sub_count[e] = read->count[e];
+            n *= sub_count[e];
+        }
+        cfa_err = _cfa_read_frag_packed(exec->cfa_id, &sub, ndim, CFA_DOUBLE,
+                                        exec->unpack, chunk);
+        CFA_CHECK(cfa_err);
+        cfa_err = _cfa_reduce_chunk(exec, r, worker, chunk, n);
+        CFA_CHECK(cfa_err);
+        /* move on to the next chunk */
+        pos[k] += rows;
+        for (d=k; d>=0; d--)
+        {
+            if (pos[d] < read->count[d])
+                break;
+            pos[d] = 0;
+            if (d > 0)
+                pos[d-1]++;
+        }
+    }
+    __atomic_store_n(&(read->frag->read_path), CFA_READ_STAGED,
+                     __ATOMIC_RELAXED);
+    return CFA_NOERR;
+}
+
+/*
+check a reducer
+*/
+int
+_cfa_check_reducer(const CFAReducer *reducer)
+{
+    switch (reducer->op)
+    {
+        case CFA_REDUCE_MIN:
+        case CFA_REDUCE_MAX:
+        case CFA_REDUCE_SUM:
+        case CFA_REDUCE_COUNT:
+        case CFA_REDUCE_MEAN:
+            return CFA_NOERR;
+        case CFA_REDUCE_HISTOGRAM:
+            if (reducer->nbins <= 0 || !(reducer->hi > reducer->lo))
+                return CFA_REDUCE_ERR;
+            return CFA_NOERR;
+        case CFA_REDUCE_USER:
+            if (!reducer->reduce || !reducer->combine ||
+                reducer->partial_size == 0)
+                return CFA_REDUCE_ERR;
+            return CFA_NOERR;
+        default:
+            return CFA_REDUCE_ERR;
+    }
+}
+
+/*
+allocate the partial results of each thread.  The user partial results start
+as a copy of the initial result
+*/
+int
+_cfa_exec_reduce_init(ExecReduce *exec, const int n_reads)
+{
+    const CFAReducer *reducer = exec->reducer;
+    int n_workers = exec->n_workers;
+    exec->stats = cfa_malloc(sizeof(ReduceStat) * (n_reads > 0 ? n_reads : 1));
+    if (!exec->stats)
+        return CFA_MEM_ERR;
+    memset(exec->stats, 0, sizeof(ReduceStat) * (n_reads > 0 ? n_reads : 1));
+    exec->hists = cfa_malloc(sizeof(size_t*) * n_workers);
+    exec->partials = cfa_malloc(sizeof(void*) * n_workers);
+    exec->chunks = cfa_malloc(sizeof(double*) * n_workers);
+    if (!exec->hists || !exec->partials || !exec->chunks)
+        return CFA_MEM_ERR;
+    for (int w=0; w<n_workers; w++)
+    {
+        exec->hists[w] = NULL;
+        exec->partials[w] = NULL;
+        exec->chunks[w] = NULL;
+    }
+    for (int w=0; w<n_workers; w++)
+    {
+        if (reducer->op == CFA_REDUCE_HISTOGRAM)
+        {
+            exec->hists[w] = cfa_malloc(sizeof(size_t) * reducer->nbins);
+            if (!exec->hists[w])
+                return CFA_MEM_ERR;
+            memset(exec->hists[w], 0, sizeof(size_t) * reducer->nbins);
+        }
+        else if (reducer->op == CFA_REDUCE_USER)
+        {
+            exec->partials[w] = cfa_malloc(reducer->partial_size);
+            if (!exec->partials[w])
+                return CFA_MEM_ERR;
+            memcpy(exec->partials[w], exec->init, reducer->partial_size);
+        }
+    }
+    return CFA_NOERR;
+}
+
+/*
+free the partial results and chunk buffers of an ExecReduce
+*/
+void
+_cfa_exec_reduce_free(ExecReduce *exec, const int n_reads)
+{
+    const CFAReducer *reducer = exec->reducer;
+    /* the arrays for each thread are only filled in if all were allocated */
+    for (int w=0; exec->hists && exec->partials && exec->chunks &&
+                    w<exec->n_workers; w++)
+    {
+        if (exec->hists[w])
+            cfa_free(exec->hists[w], sizeof(size_t) * reducer->nbins);
+        if (exec->partials[w])
+            cfa_free(exec->partials[w], reducer->partial_size);
+        if (exec->chunks[w])
+            cfa_free(exec->chunks[w], sizeof(double) * exec->chunk_size);
+    }
+    if (exec->stats)
+        cfa_free(exec->stats, sizeof(ReduceStat) * (n_reads > 0 ? n_reads : 1));
+    if (exec->hists)
+        cfa_free(exec->hists, sizeof(size_t*) * exec->n_workers);
+    if (exec->partials)
+        cfa_free(exec->partials, sizeof(void*) * exec->n_workers);
+    if (exec->chunks)
+        cfa_free(exec->chunks, sizeof(double*) * exec->n_workers);
+}
+
+/*
+combine the partial results into the result
+*/
+int
+_cfa_exec_reduce_combine(ExecReduce *exec, const int n_reads, void *result)
+{
+    const CFAReducer *reducer = exec->reducer;
+    ReduceStat total = {NAN, NAN, 0.0, 0};
+    for (int r=0; r<n_reads; r++)
+    {
+        ReduceStat *stat = &(exec->stats[r]);
+        if (stat->count == 0)
+            continue;
+        if (total.count == 0 || stat->min < total.min)
+            total.min = stat->min;
+        if (total.count == 0 || stat->max > total.max)
+            total.max = stat->max;
+        total.sum += stat->sum;
+        total.count += stat->count;
+    }
+    switch (reducer->op)
+    {
+        case CFA_REDUCE_MIN:
+            *((double*)(result)) = total.min;
+            break;
+        case CFA_REDUCE_MAX:
+            *((double*)(result)) = total.max;
+            break;
+        case CFA_REDUCE_SUM:
+            *((double*)(result)) = total.sum;
+            break;
+        case CFA_REDUCE_COUNT:
+            *((size_t*)(result)) = total.count;
+            break;
+        case CFA_REDUCE_MEAN:
+            *((double*)(result)) = total.count ? total.sum / total.count : NAN;
+            break;
+        case CFA_REDUCE_HISTOGRAM:
+        {
+            size_t *hist = (size_t*)(result);
+            memset(hist, 0, sizeof(size_t) * reducer->nbins);
+            for (int w=0; w<exec->n_workers; w++)
+                for (int b=0; b<reducer->nbins; b++)
+                    hist[b] += exec->hists[w][b];
+            break;
+        }
+        case CFA_REDUCE_USER:
+            for (int w=0; w<exec->n_workers; w++)
+            {
+                int cfa_err = reducer->combine(result, exec->partials[w],
+                                               reducer->user_data);
+                CFA_CHECK(cfa_err);
+            }
+            break;
+    }
+    return CFA_NOERR;
+}
+
+/*
+plan the reads of a hyperslab and reduce each Fragment on the worker pool.  The
+plan is returned in reads, to be freed by the caller whether or not this
+succeeds
+*/
+int
+_cfa_reduce_run(ExecReduce *exec, const size_t *start, const size_t *count,
+                const int empty, DynamicArray **reads, int *n_reads)
+{
+    int cfa_err = CFA_NOERR;
+    *n_reads = 0;
+    if (!empty)
+    {
+        cfa_err = _cfa_var_plan_read(exec->cfa_id, exec->cfa_var_id, start,
+                                     count, NULL, reads);
+        CFA_CHECK(cfa_err);
+        cfa_err = get_array_length(reads, n_reads);
+        CFA_CHECK(cfa_err);
+    }
+    /* the chunk buffers are no bigger than the largest overlap */
+    FragmentRead *read = NULL;
+    for (int r=0; r<*n_reads; r++)
+    {
+        cfa_err = get_array_node(reads, r, (void**)(&read));
+        CFA_CHECK(cfa_err);
+        size_t size = 1;
+        for (int d=0; d<exec->ndim; d++)
+            size *= read->count[d];
+        if (size > exec->chunk_size)
+            exec->chunk_size = size;
+    }
+    if (exec->chunk_size > CFA_REDUCE_CHUNK)
+        exec->chunk_size = CFA_REDUCE_CHUNK;
+    exec->reads = reads;
+    cfa_err = _cfa_exec_reduce_init(exec, *n_reads);
+    CFA_CHECK(cfa_err);
+    if (*n_reads > 0)
+    {
+        cfa_err = _cfa_pool_run(*n_reads, _cfa_exec_frag_reduce, exec);
+        CFA_CHECK(cfa_err);
+    }
+    return CFA_NOERR;
+}
+
+/*
+reduce a hyperslab of the AggregatedData of a variable
+*/
+int
+cfa_var_reduce(const int cfa_id, const int cfa_var_id,
+               const size_t *start, const size_t *count,
+               const CFAReducer *reducer, void *result)
+{
+    int cfa_err = _cfa_check_reducer(reducer);
+    CFA_CHECK(cfa_err);
+    AggregationVariable *agg_var = NULL;
+    int empty = 0;
+    cfa_err = _cfa_var_check_read(cfa_id, cfa_var_id, start, count, NULL,
+                                  CFA_DOUBLE, &agg_var, &empty);
+    CFA_CHECK(cfa_err);
+    int ndim = agg_var->cfa_ndim;
+
+    ExecReduce exec;
+    memset(&exec, 0, sizeof(ExecReduce));
+    exec.cfa_id = cfa_id;
+    exec.cfa_var_id = cfa_var_id;
+    exec.ndim = ndim;
+    exec.reducer = reducer;
+    exec.n_workers = _cfa_pool_size();
+    if (agg_var->cfa_unpack && agg_var->cfa_packing.packed)
+        exec.unpack = &(agg_var->cfa_packing);
+    /* the missing values are the values Fragments with no data are read as */
+    cfa_err = _cfa_read_fill_value(agg_var, CFA_DOUBLE, &(exec.fill));
+    CFA_CHECK(cfa_err);
+
+    /* the user partial results start as a copy of the initial result */
+    void *init = NULL;
+    if (reducer->op == CFA_REDUCE_USER)
+    {
+        init = cfa_malloc(reducer->partial_size);
+        if (!init)
+            return CFA_MEM_ERR;
+        memcpy(init, result, reducer->partial_size);
+        exec.init = init;
+    }
+
+    DynamicArray *reads = NULL;
+    int n_reads = 0;
+    cfa_err = _cfa_reduce_run(&exec, start, count, empty, &reads, &n_reads);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_exec_reduce_combine(&exec, n_reads, result);
+    _cfa_exec_reduce_free(&exec, n_reads);
+    if (init)
+        cfa_free(init, reducer->partial_size);
+    /* free the plan whether or not the reduction succeeded */
+    int cfa_err_f = _cfa_free_read_plan(&reads, ndim);
+    CFA_CHECK(cfa_err);
+    return cfa_err_f;
+}
+
+/*
+define an AggregationInstruction for a Fragment statistic, if it has not been
+defined.  The variable holding it is named after the AggregationVariable.
+defined is cleared if the AggregationInstruction had to be defined
+*/
+int
+_cfa_def_frag_stat_instr(const int cfa_id, const int cfa_var_id,
+                         AggregationVariable *agg_var, const char *term,
+                         const cfa_type type, const int define, int *defined)
+{
+    AggregationInstruction *agg_instr = NULL;
+    if (_cfa_var_get_agg_instr(agg_var, term, &agg_instr) == CFA_NOERR)
+        return CFA_NOERR;
+    *defined = 0;
+    if (!define)
+        return CFA_NOERR;
+    if (agg_var->n_instr >= MAX_AGG_INSTR)
+        return CFA_AGG_DATA_ERR;
+    char value[STR_LENGTH];
+    snprintf(value, STR_LENGTH, "%s_%s", agg_var->name, term);
+    return cfa_var_def_agg_instr(cfa_id, cfa_var_id, term, value, false, type);
+}
+
+/*
+compute the statistics of each Fragment of a variable
+*/
+int
+cfa_var_def_frag_stats(const int cfa_id, const int cfa_var_id)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    AggregationVariable *agg_var = NULL;
+    cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    if (!(agg_var->cfa_datap->cfa_fragmentsp))
+        return CFA_VAR_FRAGS_UNDEF;
+    /* the variables for the statistics cannot be added to a file that has
+    already been written */
+    int defined = 1;
+    cfa_err = _cfa_def_frag_stat_instr(cfa_id, cfa_var_id, agg_var,
+                                       FRAGMENT_MIN, CFA_DOUBLE, 0, &defined);
+    CFA_CHECK(cfa_err);
+    cfa_err = _cfa_def_frag_stat_instr(cfa_id, cfa_var_id, agg_var,
+                                       FRAGMENT_MAX, CFA_DOUBLE, 0, &defined);
+    CFA_CHECK(cfa_err);
+    cfa_err = _cfa_def_frag_stat_instr(cfa_id, cfa_var_id, agg_var,
+                                       FRAGMENT_COUNT, CFA_INT64, 0, &defined);
+    CFA_CHECK(cfa_err);
+    if (agg_cont->serialised && !defined)
+        return CFA_AGG_NOT_DEFINED;
+
+    /* reduce the whole of each Fragment, as stored */
+    int ndim = agg_var->cfa_ndim;
+    size_t start[MAX_DIMS];
+    size_t count[MAX_DIMS];
+    AggregatedDimension *agg_dim = NULL;
+    for (int d=0; d<ndim; d++)
+    {
+        cfa_err = cfa_get_dim(cfa_id, agg_var->cfa_dim_idp[d], &agg_dim);
+        CFA_CHECK(cfa_err);
+        start[d] = 0;
+        count[d] = agg_dim->length;
+    }
+    CFAReducer reducer = {CFA_REDUCE_COUNT, 0, 0.0, 0.0, 0, NULL, NULL, NULL};
+    ExecReduce exec;
+    memset(&exec, 0, sizeof(ExecReduce));
+    exec.cfa_id = cfa_id;
+    exec.cfa_var_id = cfa_var_id;
+    exec.ndim = ndim;
+    exec.reducer = &reducer;
+    exec.n_workers = _cfa_pool_size();
+    exec.driver_stats = 1;
+    /* the fill value is as stored, so it is not unpacked as in
+    _cfa_read_fill_value, and is converted from an aligned copy */
+    if (agg_var->cfa_has_fill)
+    {
+        long long fill_value = 0;
+        memcpy(&fill_value, agg_var->cfa_fill_value, agg_var->cfa_dtype.size);
+        cfa_err = _cfa_convert(&fill_value, agg_var->cfa_dtype.type,
+                               &(exec.fill), CFA_DOUBLE, 1);
+    }
+    else
+        cfa_err = _cfa_default_fill(CFA_DOUBLE, &(exec.fill));
+    CFA_CHECK(cfa_err);
+
+    /* the Fragments are all read by planning the reads, so the
+    AggregationInstructions can be defined once the reduction is done */
+    DynamicArray *reads = NULL;
+    int n_reads = 0;
+    cfa_err = _cfa_reduce_run(&exec, start, count, 0, &reads, &n_reads);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_def_frag_stat_instr(cfa_id, cfa_var_id, agg_var,
+                                           FRAGMENT_MIN, CFA_DOUBLE, 1,
+                                           &defined);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_def_frag_stat_instr(cfa_id, cfa_var_id, agg_var,
+                                           FRAGMENT_MAX, CFA_DOUBLE, 1,
+                                           &defined);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_def_frag_stat_instr(cfa_id, cfa_var_id, agg_var,
+                                           FRAGMENT_COUNT, CFA_INT64, 1,
+                                           &defined);
+    FragmentRead *read = NULL;
+    for (int r=0; r<n_reads && cfa_err == CFA_NOERR; r++)
+    {
+        cfa_err = get_array_node(&reads, r, (void**)(&read));
+        if (cfa_err)
+            break;
+        ReduceStat *stat = &(exec.stats[r]);
+        double min = stat->count ? stat->min : NAN;
+        double max = stat->count ? stat->max : NAN;
+        long long n = stat->count;
+        cfa_err = _cfa_var_assign_datum_to_frag(agg_var, read->frag,
+                                                FRAGMENT_MIN, &min, 1);
+        if (cfa_err == CFA_NOERR)
+            cfa_err = _cfa_var_assign_datum_to_frag(agg_var, read->frag,
+                                                    FRAGMENT_MAX, &max, 1);
+        if (cfa_err == CFA_NOERR)
+            cfa_err = _cfa_var_assign_datum_to_frag(agg_var, read->frag,
+                                                    FRAGMENT_COUNT, &n, 1);
+        /* write the statistics if the file has been written */
+        if (cfa_err == CFA_NOERR)
+            cfa_err = _cfa_var_write1_frag(cfa_id, cfa_var_id, read->frag);
+    }
+    _cfa_exec_reduce_free(&exec, n_reads);
+    int cfa_err_f = _cfa_free_read_plan(&reads, ndim);
+    CFA_CHECK(cfa_err);
+    return cfa_err_f;
+}
@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -16,6 +17,7 @@ DynamicArray *cfa_frag_dims = NULL;
 extern DynamicArray *cfa_dims;
 
 extern int get_type_size(const cfa_type);
+extern int _cfa_data_cache_drop(const int, const int);
 
 extern void __free_str_via_pointer(char**);
 
@@ -45,7 +47,7 @@ cfa_def_var(int cfa_id, const char *name, const cfa_type vtype,
     CFA_CHECK(cfa_err);
 
     /* assign the name */
-    var_node->name = strdup(name);
+    var_node->name = cfa_strdup(name);
 
     /* assign the type */
     var_node->cfa_dtype.type = vtype;
@@ -68,6 +70,15 @@ cfa_def_var(int cfa_id, const char *name, const cfa_type vtype,
 
     /* no fragments defined yet */
     var_node->cfa_frag_dim_idp[0] = -1;
+
+    /* not packed */
+    var_node->cfa_packing.packed = false;
+    var_node->cfa_packing.type = vtype;
+    var_node->cfa_packing.scale_factor = 1.0;
+    var_node->cfa_packing.add_offset = 0.0;
+    var_node->cfa_unpack = false;
+    /* no _FillValue */
+    var_node->cfa_has_fill = false;
     
     /* write back the cfa_var_id */
     *cfa_var_idp = cfa_nvar - 1;
@@ -157,8 +168,8 @@ cfa_var_def_agg_instr(const int cfa_id, const int cfa_var_id,
     /* get the position of the next AggregationInstruction */
     AggregationInstruction *pinst = &(agg_var->cfa_instr[agg_var->n_instr]);
     /* add details */
-    pinst->term = strdup(term);
-    pinst->value = strdup(value);
+    pinst->term = cfa_strdup(term);
+    pinst->value = cfa_strdup(value);
     pinst->scalar = scalar;
     pinst->type.type = inst_type;
     pinst->type.size = get_type_size(pinst->type.type);
@@ -199,6 +210,92 @@ int cfa_var_get_agg_instr(const int cfa_id, const int cfa_var_id,
     return CFA_NOERR;
 }
 
+/*
+define the packing of the data of a variable
+*/
+int
+cfa_var_def_packing(const int cfa_id, const int cfa_var_id,
+                    const cfa_type type, const double scale_factor,
+                    const double add_offset)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    if (type == CFA_STRING || get_type_size(type) == 0)
+        return CFA_NAT_ERR;
+    agg_var->cfa_packing.packed = true;
+    agg_var->cfa_packing.type = type;
+    agg_var->cfa_packing.scale_factor = scale_factor;
+    agg_var->cfa_packing.add_offset = add_offset;
+    /* cached data was read with the old packing */
+    return _cfa_data_cache_drop(cfa_id, cfa_var_id);
+}
+
+/*
+get the packing of the data of a variable
+*/
+int
+cfa_var_get_packing(const int cfa_id, const int cfa_var_id,
+                    CFAPacking **packing)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    *packing = &(agg_var->cfa_packing);
+    return CFA_NOERR;
+}
+
+/*
+set whether the data of a packed variable is unpacked when it is read
+*/
+int
+cfa_var_set_unpack(const int cfa_id, const int cfa_var_id, const bool unpack)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    if (agg_var->cfa_unpack == unpack)
+        return CFA_NOERR;
+    agg_var->cfa_unpack = unpack;
+    /* the data cache is keyed on the type read, which is the same for packed
+    and unpacked data */
+    return _cfa_data_cache_drop(cfa_id, cfa_var_id);
+}
+
+/*
+define the _FillValue of a variable
+*/
+int
+cfa_var_def_fill(const int cfa_id, const int cfa_var_id,
+                 const void *fill_value)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    if (agg_var->cfa_dtype.type == CFA_STRING ||
+        agg_var->cfa_dtype.size == 0)
+        return CFA_NAT_ERR;
+    memcpy(agg_var->cfa_fill_value, fill_value, agg_var->cfa_dtype.size);
+    agg_var->cfa_has_fill = true;
+    return CFA_NOERR;
+}
+
+/*
+get the _FillValue of a variable
+*/
+int
+cfa_var_get_fill(const int cfa_id, const int cfa_var_id,
+                 bool *has_fill, void *fill_value)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    *has_fill = agg_var->cfa_has_fill;
+    if (agg_var->cfa_has_fill)
+        memcpy(fill_value, agg_var->cfa_fill_value, agg_var->cfa_dtype.size);
+    return CFA_NOERR;
+}
+
 /*
 check whether a fragment name already exists
 */
@@ -245,8 +342,11 @@ _create_frag_dim_name(const char* var_name)
         suffix += 1;
     }
     cfa_free(frag_name, strlen(frag_name)+1);
+    /* the name is freed at the length it ends up with */
+    frag_name = cfa_strdup(new_frag_name);
+    cfa_free(new_frag_name, strlen(var_name)+9);
 
-    return new_frag_name;
+    return frag_name;
 }
 
 /*
@@ -318,8 +418,14 @@ _create_fragment_dimensions(int cfa_id, AggregationVariable *agg_varp,
         cfa_err = create_array_node(&(agg_varp->cfa_datap->cfa_fragmentsp),
                                     (void**)(&cfrag));
         CFA_CHECK(cfa_err);
-        /* set the FragmentDatum array pointer to NULL for each fragment */
+        /* set the location, index and FragmentDatum array pointers to NULL
+        for each fragment - nodes created by a resize of the array are not 
+        zeroed */
+        cfrag->location = NULL;
+        cfrag->index = NULL;
         cfrag->cfa_fragdatsp = NULL;
+        cfrag->linear_index = f;
+        cfrag->read_path = CFA_READ_NONE;
     }
     return CFA_NOERR;
 }
@@ -682,6 +788,7 @@ _get_linear_index(AggregationVariable *agg_var,
    external writing functions */
 extern int cfa_netcdf_write1_frag(const int, const int, const int, 
                                   const Fragment*);
+extern pthread_mutex_t cfa_nc_lock;
 
 /* assign the location and index of the fragment */
 int _cfa_var_assign_location_to_frag(Fragment *frag,
@@ -764,11 +871,31 @@ int _cfa_var_assign_datum_to_frag(AggregationVariable *agg_var,
         cfa_err = create_array(&(frag->cfa_fragdatsp), sizeof(FragmentDatum));
         CFA_CHECK(cfa_err);
     }
+    /* replace the data of an existing FragmentDatum for the term, so that a
+    term can be put more than once, e.g. by cfa_var_put_vara */
     FragmentDatum* fragd = NULL;
-    cfa_err = create_array_node(&(frag->cfa_fragdatsp), (void**)(&fragd));
+    int n_fds = 0;
+    cfa_err = get_array_length(&(frag->cfa_fragdatsp), &n_fds);
     CFA_CHECK(cfa_err);
-    /* copy the term */
-    fragd->term = strdup(term);
+    for (int fd=0; fd<n_fds; fd++)
+    {
+        FragmentDatum *efragd = NULL;
+        cfa_err = get_array_node(&(frag->cfa_fragdatsp), fd, (void**)(&efragd));
+        CFA_CHECK(cfa_err);
+        if (efragd->term && strcmp(efragd->term, term) == 0)
+        {
+            fragd = efragd;
+            cfa_free(fragd->data, fragd->size);
+            break;
+        }
+    }
+    if (!fragd)
+    {
+        cfa_err = create_array_node(&(frag->cfa_fragdatsp), (void**)(&fragd));
+        CFA_CHECK(cfa_err);
+        /* copy the term */
+        fragd->term = cfa_strdup(term);
+    }
     /* allocate the data and copy */
     int size = get_type_size(agg_instr->type.type) * length;
     fragd->data = cfa_malloc(size);
@@ -789,8 +916,11 @@ _cfa_var_write1_frag(const int cfa_id, const int cfa_var_id, Fragment *frag)
         switch (agg_cont->format)
         {
             case CFA_NETCDF:
+                /* Fragments may be read by other threads */
+                pthread_mutex_lock(&cfa_nc_lock);
                 cfa_err = cfa_netcdf_write1_frag(agg_cont->x_id, cfa_id, 
                                                  cfa_var_id, frag);
+                pthread_mutex_unlock(&cfa_nc_lock);
                 CFA_CHECK(cfa_err);
                 agg_cont->serialised = 1;
             break;
@@ -903,6 +1033,77 @@ _cfa_var_get_frag_datum(const Fragment *frag, const char *term,
     return CFA_VAR_FRAGDAT_NOT_FOUND;
 }
 
+/* get the Fragment at the linear index L, reading it from the Parser if it has
+not been read yet */
+int
+_cfa_var_get_frag(const int cfa_id, const int cfa_var_id,
+                  AggregationVariable *agg_var, const int L, Fragment **frag)
+{
+    /* get the fragment at the linear index */
+    int cfa_err = get_array_node(&(agg_var->cfa_datap->cfa_fragmentsp), L,
+                                 (void**)(frag));
+    CFA_CHECK(cfa_err);
+    (*frag)->linear_index = L;
+    /* if the fragment location is NULL then we have to fetch the fragment from
+    the Parser */
+    if ((*frag)->location != NULL)
+        return CFA_NOERR;
+
+    AggregationContainer *agg_cont = NULL;
+    cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+
+    switch (agg_cont->format)
+    {
+        case CFA_NETCDF:
+            /* Fragments may be read ahead by other threads */
+            pthread_mutex_lock(&cfa_nc_lock);
+            cfa_err = cfa_netcdf_read1_frag(agg_cont->x_id, cfa_id, 
+                                            cfa_var_id, *frag);
+            pthread_mutex_unlock(&cfa_nc_lock);
+            CFA_CHECK(cfa_err);
+        break;
+        case CFA_UNKNOWN:
+        default:
+            return CFA_UNKNOWN_FILE_FORMAT;
+    }
+    return CFA_NOERR;
+}
+
+/* read a batch of Fragments in a single call */
+extern int cfa_netcdf_read_frags(const int, const int, const int, const int,
+                                 int*);
+
+/* read up to *nfragsp Fragments from the Parser, starting at the linear index
+L.  *nfragsp is set to the number of Fragments in the batch, which may be fewer
+as the Parser reads them as a hyperslab.  Fragments that have not been defined
+in an AggregationContainer that was not loaded are left undefined */
+int
+_cfa_var_get_frags(const int cfa_id, const int cfa_var_id, const int L,
+                   int *nfragsp)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    if (agg_cont->x_id == -1)
+        return CFA_NOERR;
+
+    switch (agg_cont->format)
+    {
+        case CFA_NETCDF:
+            pthread_mutex_lock(&cfa_nc_lock);
+            cfa_err = cfa_netcdf_read_frags(agg_cont->x_id, cfa_id,
+                                            cfa_var_id, L, nfragsp);
+            pthread_mutex_unlock(&cfa_nc_lock);
+            CFA_CHECK(cfa_err);
+        break;
+        case CFA_UNKNOWN:
+        default:
+            return CFA_UNKNOWN_FILE_FORMAT;
+    }
+    return CFA_NOERR;
+}
+
 int 
 cfa_var_get1_frag(const int cfa_id, const int cfa_var_id,
                   const size_t *frag_location,
@@ -924,32 +1125,10 @@ cfa_var_get1_frag(const int cfa_id, const int cfa_var_id,
     cfa_err = _get_linear_index(agg_var, frag_location, data_location, &L);
     CFA_CHECK(cfa_err);
 
-    /* get the fragment at the linear index */
+    /* get the fragment at the linear index, reading it if necessary */
     Fragment *frag;
-    cfa_err = get_array_node(&(agg_var->cfa_datap->cfa_fragmentsp), L,
-                             (void**)(&frag));
-    CFA_CHECK(cfa_err);
-    frag->linear_index = L;
-    /* if the fragment location is NULL then we have to fetch the fragment from
-    the Parser */
-    AggregationContainer *agg_cont = NULL;
-    cfa_err = cfa_get(cfa_id, &agg_cont);
+    cfa_err = _cfa_var_get_frag(cfa_id, cfa_var_id, agg_var, L, &frag);
     CFA_CHECK(cfa_err);
-
-    if (frag->location == NULL)
-    {
-        switch (agg_cont->format)
-        {
-            case CFA_NETCDF:
-                cfa_err = cfa_netcdf_read1_frag(agg_cont->x_id, cfa_id, 
-                                                cfa_var_id, frag);
-                CFA_CHECK(cfa_err);
-            break;
-            case CFA_UNKNOWN:
-            default:
-                return CFA_UNKNOWN_FILE_FORMAT;
-        }
-    }
     /* return the location or the data_location */
     if (strcmp(term, "location") == 0)
     {
@@ -1075,7 +1254,7 @@ _cfa_free_fragments(AggregationVariable *agg_var)
             CFA_CHECK(cfa_err);
             if (frag_dim->name)
             {
-                cfa_free(frag_dim->name, strlen(frag_dim->name)+7);
+                cfa_free(frag_dim->name, strlen(frag_dim->name)+1);
                 frag_dim->name = NULL;
             }
         }
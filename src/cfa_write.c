@@ -0,0 +1,497 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+#define PATH_LENGTH 1024
+
+extern DynamicArray *cfa_frag_dims;
+
+extern int get_type_size(const cfa_type);
+extern int _multidim_to_linear_index(const AggregationVariable*,
+                                     const size_t*, int*);
+extern int _cfa_var_get_frag(const int, const int, AggregationVariable*,
+                             const int, Fragment**);
+extern int _cfa_var_get_frag_datum(const Fragment*, const char*,
+                                   const FragmentDatum**);
+extern int _cfa_var_assign_location_to_frag(Fragment*, AggregationVariable*,
+                                            const size_t*, const size_t*);
+extern int _cfa_var_assign_index_to_frag(Fragment*, AggregationVariable*, int,
+                                         const size_t*, const size_t*);
+extern int _cfa_var_assign_datum_to_frag(AggregationVariable*, Fragment*,
+                                         const char*, const void*, int);
+extern int _cfa_var_write1_frag(const int, const int, Fragment*);
+extern int _cfa_var_get_agg_instr(const AggregationVariable*, const char*,
+                                  AggregationInstruction**);
+
+/* the overlaps of the Fragments with the hyperslab are found in the same way as
+   for reading */
+extern int _cfa_var_check_hyperslab(const int, const AggregationVariable*,
+                                    const size_t*, const size_t*,
+                                    const size_t*);
+extern int _cfa_var_find_frag_index(const int, const int, AggregationVariable*,
+                                    const size_t*, size_t*);
+extern int _cfa_add_frag_read(Fragment*, const int, const size_t*,
+                              const size_t*, const size_t*, DynamicArray**);
+extern int _cfa_free_read_plan(DynamicArray**, const int);
+extern int _cfa_overlap_contiguous(const int, const size_t*,
+                                   const FragmentRead*, size_t*);
+extern void _cfa_copy_block(void*, const size_t*, const size_t*, const void*,
+                            const size_t*, const size_t*, const size_t*,
+                            const size_t*, const int, const size_t);
+extern int _cfa_frag_has_data(const Fragment*);
+extern int _cfa_get_frag_driver(const AggregationContainer*, const Fragment*,
+                                CFAFormatDriver*);
+extern int _cfa_convert(const void*, const cfa_type, void*, const cfa_type,
+                        const size_t);
+extern int _cfa_data_cache_drop(const int, const int);
+extern int _cfa_pool_run(const int, int (*)(void*, const int, const int),
+                         void*);
+
+/*
+get the location of a Fragment that has not been defined, from its index.  The
+span of each Fragment is the length of the AggregatedDimension divided by the
+length of the FragmentDimension, with the last Fragment one longer for odd
+lengths, which is how the locations are serialised and read back
+*/
+int
+_cfa_write_frag_location(const int cfa_id, const AggregationVariable *agg_var,
+                         const size_t *frag_index, size_t *location)
+{
+    AggregatedDimension *agg_dim = NULL;
+    FragmentDimension *frag_dim = NULL;
+    for (int d=0; d<agg_var->cfa_ndim; d++)
+    {
+        int cfa_err = cfa_get_dim(cfa_id, agg_var->cfa_dim_idp[d], &agg_dim);
+        CFA_CHECK(cfa_err);
+        cfa_err = get_array_node(&cfa_frag_dims, agg_var->cfa_frag_dim_idp[d],
+                                 (void**)(&frag_dim));
+        CFA_CHECK(cfa_err);
+        size_t span = agg_dim->length / frag_dim->length;
+        location[d<<1] = frag_index[d] * span;
+        if (agg_dim->length % 2 != 0 &&
+            frag_index[d] == (size_t)(frag_dim->length-1) &&
+            frag_dim->length != 1)
+            span++;
+        location[(d<<1)+1] = location[d<<1] + span;
+    }
+    return CFA_NOERR;
+}
+
+/*
+make the "file" of a new Fragment from the name of the CFA file, or of the
+container if it is a group, the name of the variable and the linear index of
+the Fragment, e.g. "agg_tas_3.nc" for Fragment 3 of the variable tas in
+"data/agg.nc".  This is relative to the directory of the CFA file
+*/
+void
+_cfa_write_frag_file(const AggregationContainer *agg_cont,
+                     const AggregationVariable *agg_var, const int L,
+                     char *file)
+{
+    file[0] = '\0';
+    const char *stem = agg_cont->path ? agg_cont->path : agg_cont->name;
+    if (stem)
+    {
+        const char *sep = strrchr(stem, '/');
+        strncat(file, sep ? sep+1 : stem, PATH_LENGTH - 1);
+        char *ext = strrchr(file, '.');
+        if (ext)
+            *ext = '\0';
+        strncat(file, "_", PATH_LENGTH - strlen(file) - 1);
+    }
+    char suffix[32];
+    sprintf(suffix, "_%i.nc", L);
+    strncat(file, agg_var->name, PATH_LENGTH - strlen(file) - 1);
+    strncat(file, suffix, PATH_LENGTH - strlen(file) - 1);
+}
+
+/*
+define the FragmentDatums of a Fragment that has no data, so that it can be
+written.  The Fragment is given a new file, unless its "file" has already been
+defined, the format of the AggregationContainer and the name of the variable as
+its "address".  create is set if the file is new
+*/
+int
+_cfa_write_def_frag(const int cfa_id, const int cfa_var_id,
+                    const AggregationContainer *agg_cont,
+                    const AggregationVariable *agg_var, Fragment *frag,
+                    int *create)
+{
+    *create = 0;
+    if (_cfa_frag_has_data(frag))
+        return CFA_NOERR;
+    /* copies, as cfa_var_put1_frag copies them into the Fragment */
+    int ndim = agg_var->cfa_ndim;
+    size_t index[MAX_DIMS];
+    size_t location[MAX_DIMS<<1];
+    memcpy(index, frag->index, sizeof(size_t) * ndim);
+    memcpy(location, frag->location, (sizeof(size_t) << 1) * ndim);
+
+    const FragmentDatum *frag_dat = NULL;
+    /* a Fragment with no FragmentDatums has no array to search */
+    int cfa_err = _cfa_var_get_frag_datum(frag, "file", &frag_dat);
+    if (cfa_err != CFA_NOERR ||
+        strlen((const char*)(frag_dat->data)) == 0)
+    {
+        char file[PATH_LENGTH];
+        _cfa_write_frag_file(agg_cont, agg_var, frag->linear_index, file);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, index, location,
+                                           "file", file);
+        CFA_CHECK(cfa_err);
+        *create = 1;
+    }
+    cfa_err = _cfa_var_get_frag_datum(frag, "format", &frag_dat);
+    if (cfa_err != CFA_NOERR ||
+        strlen((const char*)(frag_dat->data)) == 0)
+    {
+        switch (agg_cont->format)
+        {
+            case CFA_NETCDF:
+                cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, index,
+                                                   location, "format", "nc");
+                CFA_CHECK(cfa_err);
+            break;
+            case CFA_UNKNOWN:
+            default:
+                return CFA_UNKNOWN_FILE_FORMAT;
+        }
+    }
+    cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, index, location,
+                                       "address", agg_var->name);
+    CFA_CHECK(cfa_err);
+    return CFA_NOERR;
+}
+
+/*
+get a Fragment to write to.  Fragments that have not been defined, in an
+AggregationContainer that has not been loaded or serialised, are given their
+location from their index if they contain an element of the hyperslab.  frag
+is set to NULL if the Fragment does not contain an element of the hyperslab
+*/
+int
+_cfa_write_get_frag(const int cfa_id, const int cfa_var_id,
+                    const AggregationContainer *agg_cont,
+                    AggregationVariable *agg_var, const size_t *frag_index,
+                    const size_t *start, const size_t *count, Fragment **frag)
+{
+    int L = 0;
+    int cfa_err = _multidim_to_linear_index(agg_var, frag_index, &L);
+    CFA_CHECK(cfa_err);
+    cfa_err = get_array_node(&(agg_var->cfa_datap->cfa_fragmentsp), L,
+                             (void**)(frag));
+    CFA_CHECK(cfa_err);
+    if ((*frag)->location || agg_cont->x_id != -1)
+        return _cfa_var_get_frag(cfa_id, cfa_var_id, agg_var, L, frag);
+
+    int ndim = agg_var->cfa_ndim;
+    size_t location[MAX_DIMS<<1];
+    cfa_err = _cfa_write_frag_location(cfa_id, agg_var, frag_index, location);
+    CFA_CHECK(cfa_err);
+    for (int d=0; d<ndim; d++)
+    {
+        if (location[(d<<1)+1] <= start[d] ||
+            location[d<<1] >= start[d] + count[d])
+        {
+            *frag = NULL;
+            return CFA_NOERR;
+        }
+    }
+    (*frag)->linear_index = L;
+    cfa_err = _cfa_var_assign_location_to_frag(*frag, agg_var, NULL, location);
+    CFA_CHECK(cfa_err);
+    cfa_err = _cfa_var_assign_index_to_frag(*frag, agg_var, L, frag_index,
+                                            NULL);
+    CFA_CHECK(cfa_err);
+    return CFA_NOERR;
+}
+
+/*
+create the writes for all of the Fragments that contain an element of the
+hyperslab, defining the Fragments that have no data.  The overlap of a Fragment
+is the same for writing as for reading, so the writes are FragmentReads.
+creates holds, for each write, whether its file is new
+*/
+int
+_cfa_var_plan_write(const int cfa_id, const int cfa_var_id,
+                    const AggregationContainer *agg_cont,
+                    AggregationVariable *agg_var,
+                    const size_t *start, const size_t *count,
+                    DynamicArray **writes, DynamicArray **creates)
+{
+    int ndim = agg_var->cfa_ndim;
+    /* the range of Fragments to search is found as in _cfa_var_plan_read */
+    size_t last[MAX_DIMS];
+    size_t lo[MAX_DIMS];
+    size_t hi[MAX_DIMS];
+    for (int d=0; d<ndim; d++)
+        last[d] = start[d] + count[d] - 1;
+    int cfa_err = _cfa_var_find_frag_index(cfa_id, cfa_var_id, agg_var, start,
+                                           lo);
+    CFA_CHECK(cfa_err);
+    cfa_err = _cfa_var_find_frag_index(cfa_id, cfa_var_id, agg_var, last, hi);
+    CFA_CHECK(cfa_err);
+
+    cfa_err = create_array(writes, sizeof(FragmentRead));
+    CFA_CHECK(cfa_err);
+    cfa_err = create_array(creates, sizeof(int));
+    CFA_CHECK(cfa_err);
+
+    size_t frag_index[MAX_DIMS];
+    memcpy(frag_index, lo, sizeof(size_t) * ndim);
+    int d = 0;
+    while (d >= 0)
+    {
+        Fragment *frag = NULL;
+        cfa_err = _cfa_write_get_frag(cfa_id, cfa_var_id, agg_cont, agg_var,
+                                      frag_index, start, count, &frag);
+        CFA_CHECK(cfa_err);
+        int n_before = 0;
+        int n_after = 0;
+        cfa_err = get_array_length(writes, &n_before);
+        CFA_CHECK(cfa_err);
+        if (frag)
+        {
+            cfa_err = _cfa_add_frag_read(frag, ndim, start, count, NULL,
+                                         writes);
+            CFA_CHECK(cfa_err);
+        }
+        cfa_err = get_array_length(writes, &n_after);
+        CFA_CHECK(cfa_err);
+        if (n_after > n_before)
+        {
+            int *create = NULL;
+            cfa_err = create_array_node(creates, (void**)(&create));
+            CFA_CHECK(cfa_err);
+            cfa_err = _cfa_write_def_frag(cfa_id, cfa_var_id, agg_cont, agg_var,
+                                          frag, create);
+            CFA_CHECK(cfa_err);
+        }
+        /* increment the fragment index */
+        for (d=ndim-1; d>=0; d--)
+        {
+            if (++frag_index[d] <= hi[d])
+                break;
+            frag_index[d] = lo[d];
+        }
+    }
+    return CFA_NOERR;
+}
+
+/*
+write the overlap of a single Fragment from data, in type, with the driver for
+the format of the Fragment
+*/
+int
+_cfa_write_frag(const int cfa_id, const int cfa_var_id,
+                const FragmentRead *write, const int create,
+                const cfa_type type, const void *data)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    CFAFormatDriver driver;
+    cfa_err = _cfa_get_frag_driver(agg_cont, write->frag, &driver);
+    CFA_CHECK(cfa_err);
+    if (!driver.write)
+        return CFA_FRAG_FORMAT_ERR;
+    return driver.write(cfa_id, cfa_var_id, write->frag, write->frag_start,
+                        write->count, type, create, data);
+}
+
+/*
+state shared by the threads executing a write plan
+*/
+typedef struct {
+    int cfa_id;
+    int cfa_var_id;
+    int ndim;
+    const size_t *count;
+    cfa_type type;          /* type of buf */
+    size_t tsize;
+    cfa_type var_type;      /* type of the variable */
+    size_t var_tsize;
+    DynamicArray **writes;
+    DynamicArray **creates;
+    const void *buf;
+    int range_err;          /* set if a value was out of range of its Fragment */
+} ExecWrite;
+
+/*
+write one Fragment of a write plan.  The overlap is gathered from buf, unless
+it is one contiguous run of buf, and converted to the type of the variable by
+each thread, so that only the writes into the Fragment files are serialised.
+Values out of range of the type written to are written anyway, and the range
+error is kept for the end of the write, so that the other Fragments are written
+*/
+int
+_cfa_exec_frag_write(void *arg, const int w, const int worker)
+{
+    (void)(worker);
+    ExecWrite *exec = (ExecWrite*)(arg);
+    FragmentRead *write = NULL;
+    int cfa_err = get_array_node(exec->writes, w, (void**)(&write));
+    CFA_CHECK(cfa_err);
+    int *create = NULL;
+    cfa_err = get_array_node(exec->creates, w, (void**)(&create));
+    CFA_CHECK(cfa_err);
+
+    size_t n = 1;
+    for (int d=0; d<exec->ndim; d++)
+        n *= write->count[d];
+    const void *data = NULL;
+    void *gathered = NULL;
+    void *converted = NULL;
+    size_t offset = 0;
+    if (_cfa_overlap_contiguous(exec->ndim, exec->count, write, &offset))
+        data = (const char*)(exec->buf) + offset * exec->tsize;
+    else
+    {
+        gathered = cfa_malloc(n * exec->tsize);
+        if (!gathered)
+            return CFA_MEM_ERR;
+        size_t zero[MAX_DIMS];
+        memset(zero, 0, sizeof(size_t) * exec->ndim);
+        _cfa_copy_block(gathered, write->count, zero, exec->buf, exec->count,
+                        write->out_start, NULL, write->count, exec->ndim,
+                        exec->tsize);
+        data = gathered;
+    }
+    if (exec->type != exec->var_type)
+    {
+        converted = cfa_malloc(n * exec->var_tsize);
+        if (!converted)
+            cfa_err = CFA_MEM_ERR;
+        else
+            cfa_err = _cfa_convert(data, exec->type, converted,
+                                   exec->var_type, n);
+        data = converted;
+    }
+    int range_err = cfa_err == CFA_RANGE_ERR;
+    if (range_err)
+        cfa_err = CFA_NOERR;
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_write_frag(exec->cfa_id, exec->cfa_var_id, write,
+                                  *create, exec->var_type, data);
+    if (cfa_err == CFA_RANGE_ERR)
+    {
+        range_err = 1;
+        cfa_err = CFA_NOERR;
+    }
+    if (range_err)
+        __atomic_store_n(&(exec->range_err), CFA_RANGE_ERR, __ATOMIC_RELAXED);
+    if (gathered)
+        cfa_free(gathered, n * exec->tsize);
+    if (converted)
+        cfa_free(converted, n * exec->var_tsize);
+    return cfa_err;
+}
+
+/*
+check the arguments of a write.  empty is set if there is nothing to write
+*/
+int
+_cfa_var_check_write(const int cfa_id, const int cfa_var_id,
+                     const size_t *start, const size_t *count,
+                     const cfa_type type, AggregationVariable **agg_var,
+                     int *empty)
+{
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, agg_var);
+    CFA_CHECK(cfa_err);
+    if (!((*agg_var)->cfa_datap->cfa_fragmentsp))
+        return CFA_VAR_FRAGS_UNDEF;
+    if (type == CFA_STRING || get_type_size(type) == 0)
+        return CFA_NAT_ERR;
+    cfa_err = _cfa_var_check_hyperslab(cfa_id, *agg_var, start, count, NULL);
+    CFA_CHECK(cfa_err);
+    *empty = 0;
+    for (int d=0; d<(*agg_var)->cfa_ndim; d++)
+        if (count[d] == 0)
+            *empty = 1;
+    return CFA_NOERR;
+}
+
+/*
+mark the statistics of the Fragments that have been written as out of date,
+with a count of -1, so that reads with a predicate do not skip them
+*/
+int
+_cfa_write_drop_frag_stats(const int cfa_id, const int cfa_var_id,
+                           AggregationVariable *agg_var, DynamicArray **writes)
+{
+    AggregationInstruction *agg_instr = NULL;
+    if (_cfa_var_get_agg_instr(agg_var, FRAGMENT_COUNT, &agg_instr) !=
+        CFA_NOERR)
+        return CFA_NOERR;
+    int n_writes = 0;
+    int cfa_err = get_array_length(writes, &n_writes);
+    CFA_CHECK(cfa_err);
+    const long long unknown = -1;
+    FragmentRead *write = NULL;
+    for (int w=0; w<n_writes; w++)
+    {
+        cfa_err = get_array_node(writes, w, (void**)(&write));
+        CFA_CHECK(cfa_err);
+        cfa_err = _cfa_var_assign_datum_to_frag(agg_var, write->frag,
+                                                FRAGMENT_COUNT, &unknown, 1);
+        CFA_CHECK(cfa_err);
+        cfa_err = _cfa_var_write1_frag(cfa_id, cfa_var_id, write->frag);
+        CFA_CHECK(cfa_err);
+    }
+    return CFA_NOERR;
+}
+
+/*
+write a hyperslab of the AggregatedData of a variable into the Fragments
+*/
+int
+cfa_var_put_vara(const int cfa_id, const int cfa_var_id,
+                 const size_t *start, const size_t *count,
+                 const cfa_type type, const void *buf)
+{
+    AggregationVariable *agg_var = NULL;
+    int empty = 0;
+    int cfa_err = _cfa_var_check_write(cfa_id, cfa_var_id, start, count, type,
+                                       &agg_var, &empty);
+    CFA_CHECK(cfa_err);
+    if (empty)
+        return CFA_NOERR;
+    AggregationContainer *agg_cont = NULL;
+    cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+
+    /* plan the writes, defining the new Fragments on the calling thread, and
+    then carry them out on the worker pool */
+    DynamicArray *writes = NULL;
+    DynamicArray *creates = NULL;
+    int n_writes = 0;
+    int range_err = CFA_NOERR;
+    cfa_err = _cfa_var_plan_write(cfa_id, cfa_var_id, agg_cont, agg_var,
+                                  start, count, &writes, &creates);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = get_array_length(&writes, &n_writes);
+    if (cfa_err == CFA_NOERR)
+    {
+        ExecWrite exec = {cfa_id, cfa_var_id, agg_var->cfa_ndim, count,
+                          type, get_type_size(type),
+                          agg_var->cfa_dtype.type,
+                          get_type_size(agg_var->cfa_dtype.type),
+                          &writes, &creates, buf, CFA_NOERR};
+        cfa_err = _cfa_pool_run(n_writes, _cfa_exec_frag_write, &exec);
+        range_err = exec.range_err;
+    }
+    /* any cached data and statistics of the variable are stale, even if the
+    write failed */
+    int cfa_err_c = _cfa_data_cache_drop(cfa_id, cfa_var_id);
+    if (cfa_err_c == CFA_NOERR && writes)
+        cfa_err_c = _cfa_write_drop_frag_stats(cfa_id, cfa_var_id, agg_var,
+                                               &writes);
+    int cfa_err_f = _cfa_free_read_plan(&writes, agg_var->cfa_ndim);
+    if (creates)
+        free_array(&creates);
+    CFA_CHECK(cfa_err);
+    CFA_CHECK(cfa_err_c);
+    CFA_CHECK(cfa_err_f);
+    return range_err;
+}
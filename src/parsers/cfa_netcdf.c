@@ -12,6 +12,7 @@
 
 extern DynamicArray *cfa_frag_dims;
 extern int _has_standard_agg_instr(const int, const int);
+extern int get_type_size(const cfa_type);
 
 /*
 check this is a CFA-netCDF file
@@ -448,6 +449,62 @@ _parse_cfa_aggregation_instructions(const int ncid, const int ncvarid,
     return CFA_NOERR;
 }
 
+/*
+parse the packing of a variable from its scale_factor and add_offset attributes.
+The type of the attributes is the type of the unpacked data
+*/
+int
+_parse_cfa_packing_netcdf(const int ncid, const int ncvarid,
+                          const int cfa_id, const int cfa_var_id)
+{
+    nc_type scale_type = NC_NAT;
+    nc_type offset_type = NC_NAT;
+    double scale_factor = 1.0;
+    double add_offset = 0.0;
+    int err = nc_inq_atttype(ncid, ncvarid, SCALE_FACTOR, &scale_type);
+    if (err == NC_NOERR)
+        err = nc_get_att_double(ncid, ncvarid, SCALE_FACTOR, &scale_factor);
+    if (err != NC_NOERR && err != NC_ENOTATT)
+        return err;
+    err = nc_inq_atttype(ncid, ncvarid, ADD_OFFSET, &offset_type);
+    if (err == NC_NOERR)
+        err = nc_get_att_double(ncid, ncvarid, ADD_OFFSET, &add_offset);
+    if (err != NC_NOERR && err != NC_ENOTATT)
+        return err;
+    /* not packed */
+    if (scale_type == NC_NAT && offset_type == NC_NAT)
+        return CFA_NOERR;
+    err = cfa_var_def_packing(cfa_id, cfa_var_id,
+                              scale_type != NC_NAT ? scale_type : offset_type,
+                              scale_factor, add_offset);
+    CFA_CHECK(err);
+    return CFA_NOERR;
+}
+
+/*
+parse the fill value of a variable from its _FillValue attribute, which has the
+type of the variable
+*/
+int
+_parse_cfa_fill_netcdf(const int ncid, const int ncvarid,
+                       const int cfa_id, const int cfa_var_id,
+                       const nc_type vtype)
+{
+    nc_type fill_type = NC_NAT;
+    unsigned char fill_value[sizeof(long long)];
+    int err = nc_inq_atttype(ncid, ncvarid, FILL_VALUE, &fill_type);
+    if (err == NC_ENOTATT)
+        return CFA_NOERR;
+    CFA_CHECK(err);
+    if (fill_type != vtype)
+        return CFA_NAT_ERR;
+    err = nc_get_att(ncid, ncvarid, FILL_VALUE, fill_value);
+    CFA_CHECK(err);
+    err = cfa_var_def_fill(cfa_id, cfa_var_id, fill_value);
+    CFA_CHECK(err);
+    return CFA_NOERR;
+}
+
 /*
 parse an individual variable
 */
@@ -468,6 +525,12 @@ _parse_cfa_variable_netcdf(const int ncid, const int ncvarid, const int cfa_id)
     /* get the aggregation instructions */
     err = _parse_cfa_aggregation_instructions(ncid, ncvarid, cfa_id, cfa_var_id);
     CFA_CHECK(err);
+    /* get the packing, once, so that it is not read for every Fragment */
+    err = _parse_cfa_packing_netcdf(ncid, ncvarid, cfa_id, cfa_var_id);
+    CFA_CHECK(err);
+    /* get the fill value used for Fragments with no data */
+    err = _parse_cfa_fill_netcdf(ncid, ncvarid, cfa_id, cfa_var_id, vtype);
+    CFA_CHECK(err);
     /* get the aggregated dimensions */
     err = _parse_cfa_aggregated_dimensions(ncid, ncvarid, cfa_id, cfa_var_id);
     CFA_CHECK(err);
@@ -722,6 +785,9 @@ cfa_netcdf_read1_frag(const int nc_id,
             /* Read the FragmentDatum value (of any type) from the fragment in 
             the netCDF file */
             int length = 1;
+            /* strings are allocated by the netCDF library, rather than read
+            into data, which holds the other types */
+            char *str = NULL;
 
             /* Use the specific type netCDF functions to read the data */
             switch (agg_inst->type.type)
@@ -794,25 +860,237 @@ cfa_netcdf_read1_frag(const int nc_id,
                     break;
                 case CFA_STRING:
                     cfa_err = nc_get_var1_string(
-                        frag_grp_id, frag_var_id, frag->index, 
-                        (char**)&data
+                        frag_grp_id, frag_var_id, frag->index, &str
                     );
-                    length = strlen(data) + 1;
+                    if (cfa_err == NC_NOERR)
+                        length = strlen(str) + 1;
                     break;
             };
             CFA_CHECK(cfa_err);
             /* get the length if a string, otherwise length is 1 as above */
             cfa_err = _cfa_var_assign_datum_to_frag(
-                agg_var, frag, agg_inst->term, data, length
+                agg_var, frag, agg_inst->term, str ? str : data, length
             );
-            CFA_CHECK(cfa_err);
             /* clean up memory allocated by netCDF library */
+            if (str)
+                nc_free_string(1, &str);
+            CFA_CHECK(cfa_err);
         }
     }
     cfa_free(data, 1024);
     return CFA_NOERR;
 }
 
+/*
+get the largest hyperslab of the FragmentDimensions that starts at the Fragment
+with the linear index L and holds at most *nfragsp Fragments.  The trailing
+FragmentDimensions are taken whole, while the Fragment is at their start, and
+the hyperslab runs along the one before them, so that the Fragments in it have
+consecutive linear indices.  *nfragsp is set to the number of Fragments in it
+*/
+int
+_get_frag_hyperslab(const int cfa_id, const int cfa_var_id,
+                    const AggregationVariable *agg_var, const int L,
+                    size_t *frag_start, size_t *frag_count, int *nfragsp)
+{
+    int ndim = agg_var->cfa_ndim;
+    int cfa_err = _linear_index_to_multidim(agg_var, L, frag_start);
+    CFA_CHECK(cfa_err);
+    FragmentDimension *frag_dim = NULL;
+    int d = ndim;
+    int n = 1;
+    for (; d>0; d--)
+    {
+        cfa_err = cfa_var_get_frag_dim(cfa_id, cfa_var_id, d-1, &frag_dim);
+        CFA_CHECK(cfa_err);
+        if (frag_start[d-1] != 0 || n * frag_dim->length > *nfragsp)
+            break;
+        frag_count[d-1] = frag_dim->length;
+        n *= frag_dim->length;
+    }
+    if (d > 0)
+    {
+        /* run along the dimension before the whole ones */
+        int run = frag_dim->length - frag_start[d-1];
+        if (run > *nfragsp / n)
+            run = *nfragsp / n;
+        frag_count[d-1] = run;
+        n *= run;
+        for (int e=0; e<d-1; e++)
+            frag_count[e] = 1;
+    }
+    *nfragsp = n;
+    return CFA_NOERR;
+}
+
+/*
+read a batch of Fragments, starting at the linear index L, from the netCDF
+file.  At most *nfragsp Fragments are read, as a hyperslab of the
+FragmentDimensions, so that each FragmentDatum variable is read with a single
+call rather than one call per Fragment.  *nfragsp is set to the number of
+Fragments in the batch.  Fragments in the batch that have already been read are
+left as they are
+*/
+int
+cfa_netcdf_read_frags(const int nc_id,
+                      const int cfa_id, const int cfa_var_id,
+                      const int L, int *nfragsp)
+{
+    AggregationVariable *agg_var = NULL;
+    int cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+
+    size_t frag_start[MAX_DIMS];
+    size_t frag_count[MAX_DIMS];
+    cfa_err = _get_frag_hyperslab(cfa_id, cfa_var_id, agg_var, L,
+                                  frag_start, frag_count, nfragsp);
+    CFA_CHECK(cfa_err);
+    int n = *nfragsp;
+
+    /* get the Fragments, assigning the index of those to be read */
+    size_t size = sizeof(size_t) * agg_var->cfa_ndim;
+    Fragment **frags = cfa_malloc(sizeof(Fragment*) * n);
+    if (!frags)
+        return CFA_MEM_ERR;
+    int n_new = 0;
+    for (int f=0; f<n && cfa_err == CFA_NOERR; f++)
+    {
+        cfa_err = get_array_node(&(agg_var->cfa_datap->cfa_fragmentsp), L+f,
+                                 (void**)(&frags[f]));
+        if (cfa_err)
+            break;
+        frags[f]->linear_index = L+f;
+        if (frags[f]->location)
+        {
+            frags[f] = NULL;
+            continue;
+        }
+        n_new++;
+        if (frags[f]->index == NULL)
+            frags[f]->index = cfa_malloc(size);
+        if (!frags[f]->index)
+        {
+            cfa_err = CFA_MEM_ERR;
+            break;
+        }
+        cfa_err = _linear_index_to_multidim(agg_var, L+f, frags[f]->index);
+    }
+
+    /* a scalar FragmentDatum variable has one value for all the Fragments */
+    size_t scalar_start[MAX_DIMS] = {0};
+    size_t scalar_count[MAX_DIMS];
+    for (int d=0; d<MAX_DIMS; d++)
+        scalar_count[d] = 1;
+
+    AggregationInstruction *loc_inst = NULL;
+    for (int i=0; i<agg_var->n_instr && n_new > 0 && cfa_err == CFA_NOERR;
+         i++)
+    {
+        AggregationInstruction *agg_inst = &(agg_var->cfa_instr[i]);
+        int frag_grp_id = -1;
+        int frag_var_id = -1;
+        cfa_err = _get_nc_grp_var_ids_from_str(
+            nc_id, agg_inst->value, &frag_grp_id, &frag_var_id
+        );
+        if (cfa_err)
+            break;
+
+        /* the locations are read last, as a Fragment with a location has
+        been read */
+        if (strcmp(agg_inst->term, "location") == 0)
+        {
+            loc_inst = agg_inst;
+            continue;
+        }
+
+        const size_t *startp = agg_inst->scalar ? scalar_start : frag_start;
+        const size_t *countp = agg_inst->scalar ? scalar_count : frag_count;
+        int n_read = agg_inst->scalar ? 1 : n;
+        if (agg_inst->type.type == CFA_NAT)
+        {
+            cfa_err = CFA_NAT_ERR;
+            break;
+        }
+        if (agg_inst->type.type == CFA_STRING)
+        {
+            char **strs = cfa_malloc(sizeof(char*) * n_read);
+            if (!strs)
+            {
+                cfa_err = CFA_MEM_ERR;
+                break;
+            }
+            int err = nc_get_vara_string(frag_grp_id, frag_var_id, startp,
+                                         countp, strs);
+            cfa_err = err;
+            for (int f=0; f<n && cfa_err == CFA_NOERR; f++)
+            {
+                if (!frags[f])
+                    continue;
+                const char *str = strs[agg_inst->scalar ? 0 : f];
+                cfa_err = _cfa_var_assign_datum_to_frag(
+                    agg_var, frags[f], agg_inst->term, str, strlen(str) + 1
+                );
+            }
+            /* clean up memory allocated by netCDF library, which only
+            allocated the strings if the read succeeded */
+            if (err == NC_NOERR)
+                nc_free_string(n_read, strs);
+            cfa_free(strs, sizeof(char*) * n_read);
+        }
+        else
+        {
+            int type_size = get_type_size(agg_inst->type.type);
+            unsigned char *data = cfa_malloc(type_size * n_read);
+            if (!data)
+            {
+                cfa_err = CFA_MEM_ERR;
+                break;
+            }
+            cfa_err = nc_get_vara(frag_grp_id, frag_var_id, startp, countp,
+                                  data);
+            for (int f=0; f<n && cfa_err == CFA_NOERR; f++)
+            {
+                if (!frags[f])
+                    continue;
+                cfa_err = _cfa_var_assign_datum_to_frag(
+                    agg_var, frags[f], agg_inst->term,
+                    data + (agg_inst->scalar ? 0 : f * type_size), 1
+                );
+            }
+            cfa_free(data, type_size * n_read);
+        }
+    }
+
+    /* the locations are read per Fragment, as they are computed from the
+    index */
+    if (loc_inst && cfa_err == CFA_NOERR)
+    {
+        int frag_grp_id = -1;
+        int frag_var_id = -1;
+        cfa_err = _get_nc_grp_var_ids_from_str(
+            nc_id, loc_inst->value, &frag_grp_id, &frag_var_id
+        );
+        for (int f=0; f<n && cfa_err == CFA_NOERR; f++)
+        {
+            if (!frags[f])
+                continue;
+            if (loc_inst->scalar)
+                cfa_err = _read_scalar_location(frag_grp_id, frag_var_id,
+                                                frags[f]);
+            else
+#ifndef FAST_INDEX
+                cfa_err = _read_indexed_location(frag_grp_id, frag_var_id,
+                                                 agg_var, frags[f]);
+#else
+                cfa_err = _read_indexed_location(cfa_id, cfa_var_id,
+                                                 agg_var, frags[f]);
+#endif
+        }
+    }
+    cfa_free(frags, sizeof(Fragment*) * n);
+    return cfa_err;
+}
+
 /*
 load and parse a CFA-netCDF file
 */
@@ -864,6 +1142,29 @@ _serialise_cfa_dimension_netcdf(const int nc_id,
     err = nc_def_var(nc_id, agg_dim->name, agg_dim->type.type, 1,
                      &nc_dim_id, &nc_dimvar_id);
     CFA_CHECK(err);
+    /* write the coordinates, if they have been defined */
+    if (agg_dim->coords)
+    {
+        err = nc_put_var_double(nc_id, nc_dimvar_id, agg_dim->coords);
+        CFA_CHECK(err);
+    }
+    return CFA_NOERR;
+}
+
+/*
+read the coordinates of an AggregatedDimension from its dimension variable
+*/
+int
+cfa_netcdf_read_coords(const int nc_id, const AggregatedDimension *agg_dim,
+                       double *coords)
+{
+    int nc_dimvar_id = -1;
+    int err = nc_inq_varid(nc_id, agg_dim->name, &nc_dimvar_id);
+    if (err == NC_ENOTVAR)
+        return CFA_COORD_ERR;
+    CFA_CHECK(err);
+    err = nc_get_var_double(nc_id, nc_dimvar_id, coords);
+    CFA_CHECK(err);
     return CFA_NOERR;
 }
 
@@ -1411,6 +1712,24 @@ _serialise_cfa_variable_netcdf(const int nc_id,
                                                       cfa_id, cfa_varid);
         CFA_CHECK(err);
     }
+    /* add the packing, if the variable is packed */
+    if (agg_var->cfa_packing.packed)
+    {
+        const CFAPacking *packing = &(agg_var->cfa_packing);
+        err = nc_put_att_double(nc_id, nc_varid, SCALE_FACTOR, packing->type,
+                                1, &(packing->scale_factor));
+        CFA_CHECK(err);
+        err = nc_put_att_double(nc_id, nc_varid, ADD_OFFSET, packing->type,
+                                1, &(packing->add_offset));
+        CFA_CHECK(err);
+    }
+    /* add the fill value, if it has been defined */
+    if (agg_var->cfa_has_fill)
+    {
+        err = nc_put_att(nc_id, nc_varid, FILL_VALUE, agg_var->cfa_dtype.type,
+                         1, agg_var->cfa_fill_value);
+        CFA_CHECK(err);
+    }
   
     return CFA_NOERR;
 }
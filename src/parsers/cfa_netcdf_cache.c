@@ -0,0 +1,327 @@
+#include <netcdf.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+/*
+cache of open Fragment files, keyed by the resolved path of the "file"
+FragmentDatum.  Opening a file can cost more than reading the Fragment from it,
+so files are kept open between reads and the least recently used file is closed
+when the cache is full.  Each file also caches the group and variable ids of the
+"address" FragmentDatums that have been read from it, and the
+AggregationContainer it was last used for, so that closing a container only
+closes its own files.
+
+All of these functions, apart from the public ones, must be called with
+cfa_nc_lock held
+*/
+
+extern pthread_mutex_t cfa_nc_lock;
+extern int _get_nc_grp_var_ids_from_str(const int, const char*, int*, int*);
+extern int _cfa_netcdf_mmap_close(const char*);
+extern int _cfa_netcdf_mmap_flush(void);
+extern int _cfa_netcdf_mmap_drop(const int);
+
+/* default number of Fragment files kept open */
+#define CFA_HANDLE_CACHE_SIZE 16
+
+/* group and variable id for an "address" in a cached file */
+typedef struct {
+    char *address;
+    int grp_id;
+    int var_id;
+} CachedAddress;
+
+/* an open Fragment file */
+typedef struct {
+    char *path;             /* NULL if the slot is free */
+    int nc_id;
+    int cfa_id;             /* container the file was last used for */
+    unsigned long last_use;
+    DynamicArray *addrs;    /* array of CachedAddress */
+} CachedFile;
+
+static CachedFile *cfa_handle_cache = NULL;
+static int cfa_handle_cache_size = CFA_HANDLE_CACHE_SIZE;
+static unsigned long cfa_handle_cache_tick = 0;
+static size_t cfa_handle_cache_hits = 0;
+static size_t cfa_handle_cache_misses = 0;
+
+/*
+close the file in a cache slot and free the slot
+*/
+int
+_cfa_netcdf_cache_evict(CachedFile *cfile)
+{
+    if (!cfile->path)
+        return CFA_NOERR;
+    int err = nc_close(cfile->nc_id);
+    if (cfile->addrs)
+    {
+        int n_addrs = 0;
+        int cfa_err = get_array_length(&(cfile->addrs), &n_addrs);
+        CFA_CHECK(cfa_err);
+        for (int a=0; a<n_addrs; a++)
+        {
+            CachedAddress *caddr = NULL;
+            cfa_err = get_array_node(&(cfile->addrs), a, (void**)(&caddr));
+            CFA_CHECK(cfa_err);
+            cfa_free(caddr->address, strlen(caddr->address)+1);
+        }
+        cfa_err = free_array(&(cfile->addrs));
+        CFA_CHECK(cfa_err);
+    }
+    cfa_free(cfile->path, strlen(cfile->path)+1);
+    cfile->path = NULL;
+    cfile->addrs = NULL;
+    return err;
+}
+
+/*
+close all of the cached files and free the cache
+*/
+int
+_cfa_netcdf_cache_flush(void)
+{
+    if (!cfa_handle_cache)
+        return CFA_NOERR;
+    int cfa_err = CFA_NOERR;
+    for (int c=0; c<cfa_handle_cache_size; c++)
+    {
+        /* keep the first error, but close all of the files */
+        int err = _cfa_netcdf_cache_evict(&(cfa_handle_cache[c]));
+        if (cfa_err == CFA_NOERR)
+            cfa_err = err;
+    }
+    cfa_free(cfa_handle_cache, sizeof(CachedFile) * cfa_handle_cache_size);
+    cfa_handle_cache = NULL;
+    return cfa_err;
+}
+
+/*
+open a Fragment file for the AggregationContainer cfa_id, via the cache.  If
+the cache is disabled then the file is opened directly and owned is set to 1 so
+that the caller closes it
+*/
+int
+_cfa_netcdf_cache_open(const int cfa_id, const char *path, int *frag_nc_id,
+                       int *owned)
+{
+    int cfa_err = CFA_NOERR;
+    if (cfa_handle_cache_size == 0)
+    {
+        cfa_err = nc_open(path, NC_NOWRITE, frag_nc_id);
+        CFA_CHECK(cfa_err);
+        *owned = 1;
+        return CFA_NOERR;
+    }
+    *owned = 0;
+    if (!cfa_handle_cache)
+    {
+        cfa_handle_cache = cfa_malloc(sizeof(CachedFile) *
+                                      cfa_handle_cache_size);
+        if (!cfa_handle_cache)
+            return CFA_MEM_ERR;
+        for (int c=0; c<cfa_handle_cache_size; c++)
+        {
+            cfa_handle_cache[c].path = NULL;
+            cfa_handle_cache[c].addrs = NULL;
+        }
+    }
+
+    /* look for the file, and the least recently used slot */
+    CachedFile *lru = NULL;
+    for (int c=0; c<cfa_handle_cache_size; c++)
+    {
+        CachedFile *cfile = &(cfa_handle_cache[c]);
+        if (cfile->path && strcmp(cfile->path, path) == 0)
+        {
+            cfile->cfa_id = cfa_id;
+            cfile->last_use = ++cfa_handle_cache_tick;
+            cfa_handle_cache_hits++;
+            *frag_nc_id = cfile->nc_id;
+            return CFA_NOERR;
+        }
+        if (!lru || (lru->path && (!cfile->path ||
+                                   cfile->last_use < lru->last_use)))
+            lru = cfile;
+    }
+
+    /* not found - open the file into the least recently used slot */
+    cfa_handle_cache_misses++;
+    int nc_id = -1;
+    cfa_err = nc_open(path, NC_NOWRITE, &nc_id);
+    CFA_CHECK(cfa_err);
+    cfa_err = _cfa_netcdf_cache_evict(lru);
+    if (cfa_err)
+    {
+        nc_close(nc_id);
+        return cfa_err;
+    }
+    lru->path = cfa_strdup(path);
+    lru->nc_id = nc_id;
+    lru->cfa_id = cfa_id;
+    lru->last_use = ++cfa_handle_cache_tick;
+    lru->addrs = NULL;
+    *frag_nc_id = nc_id;
+    return CFA_NOERR;
+}
+
+/*
+close a Fragment file if it is in the cache, so that it can be opened for
+writing, and unmap it if it has been memory mapped.  It is opened again by the
+next read
+*/
+int
+_cfa_netcdf_cache_close(const char *path)
+{
+    int cfa_err = _cfa_netcdf_mmap_close(path);
+    CFA_CHECK(cfa_err);
+    for (int c=0; cfa_handle_cache && c<cfa_handle_cache_size; c++)
+    {
+        CachedFile *cfile = &(cfa_handle_cache[c]);
+        if (cfile->path && strcmp(cfile->path, path) == 0)
+            return _cfa_netcdf_cache_evict(cfile);
+    }
+    return CFA_NOERR;
+}
+
+/*
+get the group and variable ids of an "address" in a Fragment file, via the
+cache.  Files that are not in the cache, such as the CFA-netCDF file, are
+searched every time
+*/
+int
+_cfa_netcdf_cache_var(const int frag_nc_id, const char *address,
+                      int *grp_id, int *var_id)
+{
+    CachedFile *cfile = NULL;
+    for (int c=0; cfa_handle_cache && c<cfa_handle_cache_size; c++)
+    {
+        if (cfa_handle_cache[c].path && cfa_handle_cache[c].nc_id == frag_nc_id)
+        {
+            cfile = &(cfa_handle_cache[c]);
+            break;
+        }
+    }
+    if (!cfile)
+        return _get_nc_grp_var_ids_from_str(frag_nc_id, address,
+                                            grp_id, var_id);
+
+    int cfa_err = CFA_NOERR;
+    CachedAddress *caddr = NULL;
+    if (!cfile->addrs)
+    {
+        cfa_err = create_array(&(cfile->addrs), sizeof(CachedAddress));
+        CFA_CHECK(cfa_err);
+    }
+    int n_addrs = 0;
+    cfa_err = get_array_length(&(cfile->addrs), &n_addrs);
+    CFA_CHECK(cfa_err);
+    for (int a=0; a<n_addrs; a++)
+    {
+        cfa_err = get_array_node(&(cfile->addrs), a, (void**)(&caddr));
+        CFA_CHECK(cfa_err);
+        if (strcmp(caddr->address, address) == 0)
+        {
+            *grp_id = caddr->grp_id;
+            *var_id = caddr->var_id;
+            return CFA_NOERR;
+        }
+    }
+    cfa_err = _get_nc_grp_var_ids_from_str(frag_nc_id, address,
+                                           grp_id, var_id);
+    CFA_CHECK(cfa_err);
+    cfa_err = create_array_node(&(cfile->addrs), (void**)(&caddr));
+    CFA_CHECK(cfa_err);
+    caddr->address = cfa_strdup(address);
+    caddr->grp_id = *grp_id;
+    caddr->var_id = *var_id;
+    return CFA_NOERR;
+}
+
+/*
+set the maximum number of Fragment files that are kept open.  0 disables the
+cache.  Any files already open are closed
+*/
+int
+cfa_set_handle_cache_size(const int nfiles)
+{
+    if (nfiles < 0)
+        return CFA_HANDLE_CACHE_ERR;
+    pthread_mutex_lock(&cfa_nc_lock);
+    int cfa_err = _cfa_netcdf_cache_flush();
+    cfa_handle_cache_size = nfiles;
+    pthread_mutex_unlock(&cfa_nc_lock);
+    return cfa_err;
+}
+
+/*
+get the number of times a Fragment file was found in the cache (hits) and had
+to be opened (misses)
+*/
+int
+cfa_inq_handle_cache_stats(size_t *hitsp, size_t *missesp)
+{
+    pthread_mutex_lock(&cfa_nc_lock);
+    *hitsp = cfa_handle_cache_hits;
+    *missesp = cfa_handle_cache_misses;
+    pthread_mutex_unlock(&cfa_nc_lock);
+    return CFA_NOERR;
+}
+
+/*
+close all of the cached Fragment files, and unmap the memory-mapped ones
+*/
+int
+cfa_close_frag_files(void)
+{
+    pthread_mutex_lock(&cfa_nc_lock);
+    int cfa_err = _cfa_netcdf_cache_flush();
+    pthread_mutex_unlock(&cfa_nc_lock);
+    int cfa_err_m = _cfa_netcdf_mmap_flush();
+    CFA_CHECK(cfa_err);
+    return cfa_err_m;
+}
+
+/*
+close the cached Fragment files, and unmap the memory-mapped ones, that were
+last used for the AggregationContainer cfa_id.  Files that other containers
+also read from are opened again by their next read.  The cache is freed once
+it has no open files
+*/
+int
+_cfa_netcdf_cache_drop(const int cfa_id)
+{
+    int cfa_err = CFA_NOERR;
+    int n_open = 0;
+    pthread_mutex_lock(&cfa_nc_lock);
+    for (int c=0; cfa_handle_cache && c<cfa_handle_cache_size; c++)
+    {
+        CachedFile *cfile = &(cfa_handle_cache[c]);
+        if (!cfile->path)
+            continue;
+        if (cfile->cfa_id != cfa_id)
+        {
+            n_open++;
+            continue;
+        }
+        /* keep the first error, but close all of the files */
+        int err = _cfa_netcdf_cache_evict(cfile);
+        if (cfa_err == CFA_NOERR)
+            cfa_err = err;
+    }
+    if (n_open == 0)
+    {
+        int err = _cfa_netcdf_cache_flush();
+        if (cfa_err == CFA_NOERR)
+            cfa_err = err;
+    }
+    pthread_mutex_unlock(&cfa_nc_lock);
+    int cfa_err_m = _cfa_netcdf_mmap_drop(cfa_id);
+    CFA_CHECK(cfa_err);
+    return cfa_err_m;
+}
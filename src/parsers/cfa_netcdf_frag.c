@@ -0,0 +1,499 @@
+#include <netcdf.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+#include "parsers/cfa_netcdf.h"
+
+#define PATH_LENGTH 1024
+
+extern int _cfa_var_get_frag_datum(const Fragment*, const char*,
+                                   const FragmentDatum**);
+extern int _get_root_grp_id(const int, int*);
+extern int _get_nc_grp_var_ids_from_str(const int, const char*, int*, int*);
+extern pthread_mutex_t cfa_nc_lock;
+extern int _cfa_netcdf_cache_open(const int, const char*, int*, int*);
+extern int _cfa_netcdf_cache_var(const int, const char*, int*, int*);
+extern int _cfa_netcdf_cache_close(const char*);
+extern int _cfa_netcdf_mmap_read_frag(const int, const int, const Fragment*,
+                                      const int, const FragmentDatum*,
+                                      const size_t*,
+                                      const size_t*, const size_t*,
+                                      const cfa_type, const CFAPacking*,
+                                      void*, int*);
+extern int get_type_size(const cfa_type);
+extern int _cfa_convert(const void*, const cfa_type, void*, const cfa_type,
+                        const size_t);
+extern int _cfa_unpack(const void*, const cfa_type, void*, const cfa_type,
+                       const size_t, const CFAPacking*);
+
+/*
+resolve the "file" FragmentDatum to a path that can be opened.  Relative paths
+are relative to the directory containing the CFA-netCDF file
+*/
+int
+_resolve_frag_path(const int nc_id, const char *file, char *path)
+{
+    /* remove the URI scheme for local files */
+    if (strncmp(file, "file://", 7) == 0)
+        file += 7;
+    path[0] = '\0';
+    if (file[0] != '/' && nc_id != -1)
+    {
+        /* get the path of the CFA-netCDF file from the root group */
+        int root_id = -1;
+        int err = _get_root_grp_id(nc_id, &root_id);
+        CFA_CHECK(err);
+        size_t len = 0;
+        err = nc_inq_path(root_id, &len, NULL);
+        if (err == NC_NOERR && len < PATH_LENGTH)
+        {
+            err = nc_inq_path(root_id, &len, path);
+            CFA_CHECK(err);
+            path[len] = '\0';
+            /* keep the directory, including the trailing separator */
+            char *sep = strrchr(path, '/');
+            if (sep)
+                *(sep+1) = '\0';
+            else
+                path[0] = '\0';
+        }
+    }
+    strncat(path, file, PATH_LENGTH - strlen(path) - 1);
+    return CFA_NOERR;
+}
+
+/*
+open the netCDF file containing a Fragment of the AggregationContainer cfa_id,
+via the handle cache.  A Fragment with a missing "file" is stored in the
+CFA-netCDF file itself, in which case no file is opened.  owned is set to 1 if
+the caller must close the file
+*/
+int
+_cfa_netcdf_open_frag(const int cfa_id, const int nc_id, const Fragment *frag,
+                      int *frag_nc_id, int *owned)
+{
+    const FragmentDatum *file_dat = NULL;
+    int cfa_err = _cfa_var_get_frag_datum(frag, "file", &file_dat);
+    if (cfa_err == CFA_VAR_FRAGDAT_NOT_FOUND ||
+        strlen((const char*)(file_dat->data)) == 0)
+    {
+        *owned = 0;
+        return _get_root_grp_id(nc_id, frag_nc_id);
+    }
+    CFA_CHECK(cfa_err);
+    char path[PATH_LENGTH];
+    cfa_err = _resolve_frag_path(nc_id, (const char*)(file_dat->data), path);
+    CFA_CHECK(cfa_err);
+    return _cfa_netcdf_cache_open(cfa_id, path, frag_nc_id, owned);
+}
+
+/*
+map the start, count and stride of an overlap in the AggregatedDimensions onto
+the dimensions of the fragment variable.  Fragment variables may omit size 1
+dimensions, so these are dropped, in order, until the number of dimensions
+match
+*/
+int
+_map_frag_ndims(const int nc_ndim, const Fragment *frag, const int ndim,
+                const size_t *frag_start, const size_t *frag_count,
+                const size_t *frag_stride,
+                size_t *nc_start, size_t *nc_count, ptrdiff_t *nc_stride)
+{
+    if (nc_ndim > ndim)
+        return CFA_FRAG_SHAPE_ERR;
+    int n_drop = ndim - nc_ndim;
+    int nd = 0;
+    for (int d=0; d<ndim; d++)
+    {
+        size_t span = frag->location[(d<<1)+1] - frag->location[d<<1];
+        if (n_drop > 0 && span == 1)
+        {
+            n_drop--;
+            continue;
+        }
+        nc_start[nd] = frag_start[d];
+        nc_count[nd] = frag_count[d];
+        nc_stride[nd] = frag_stride ? (ptrdiff_t)(frag_stride[d]) : 1;
+        nd++;
+    }
+    if (n_drop > 0)
+        return CFA_FRAG_SHAPE_ERR;
+    return CFA_NOERR;
+}
+
+/*
+map an overlap onto the dimensions of a Fragment variable in a netCDF file
+*/
+int
+_map_frag_dims(const int grp_id, const int var_id,
+               const Fragment *frag, const int ndim,
+               const size_t *frag_start, const size_t *frag_count,
+               const size_t *frag_stride,
+               size_t *nc_start, size_t *nc_count, ptrdiff_t *nc_stride)
+{
+    int nc_ndim = -1;
+    int err = nc_inq_varndims(grp_id, var_id, &nc_ndim);
+    CFA_CHECK(err);
+    return _map_frag_ndims(nc_ndim, frag, ndim, frag_start, frag_count,
+                           frag_stride, nc_start, nc_count, nc_stride);
+}
+
+/*
+read the overlap of a Fragment from the netCDF file and variable named by the
+"file" and "address" FragmentDatums.  If the Fragment variable has the type
+being read, and the data is not being unpacked, then the data is read into
+data.  Otherwise it is read, in the type of the Fragment variable, into a
+buffer that is returned in *raw, with its type in raw_type and the number of
+values in n_raw, to be converted outside of the lock.  Must be called with
+cfa_nc_lock held
+*/
+int
+_cfa_netcdf_read_frag_locked(const int cfa_id, const int nc_id,
+                             const Fragment *frag, const int ndim, const FragmentDatum *addr_dat,
+                             const size_t *frag_start,
+                             const size_t *frag_count,
+                             const size_t *frag_stride,
+                             const cfa_type type, const bool unpack,
+                             void *data, void **raw, cfa_type *raw_type,
+                             size_t *n_raw)
+{
+    int frag_nc_id = -1;
+    int owned = 0;
+    int cfa_err = _cfa_netcdf_open_frag(cfa_id, nc_id, frag, &frag_nc_id,
+                                        &owned);
+    CFA_CHECK(cfa_err);
+
+    int grp_id = -1;
+    int var_id = -1;
+    nc_type frag_type = NC_NAT;
+    size_t nc_start[MAX_DIMS];
+    size_t nc_count[MAX_DIMS];
+    ptrdiff_t nc_stride[MAX_DIMS];
+    cfa_err = _cfa_netcdf_cache_var(
+        frag_nc_id, (const char*)(addr_dat->data), &grp_id, &var_id
+    );
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _map_frag_dims(grp_id, var_id, frag, ndim,
+                                 frag_start, frag_count, frag_stride,
+                                 nc_start, nc_count, nc_stride);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = nc_inq_vartype(grp_id, var_id, &frag_type);
+    /* the CFA types are the netCDF types, apart from strings */
+    if (cfa_err == CFA_NOERR && (frag_type < NC_BYTE || frag_type > NC_UINT64))
+        cfa_err = CFA_NAT_ERR;
+    if (cfa_err == CFA_NOERR)
+    {
+        void *dst = data;
+        if (frag_type != type || unpack)
+        {
+            *n_raw = 1;
+            for (int d=0; d<ndim; d++)
+                *n_raw *= frag_count[d];
+            *raw_type = frag_type;
+            *raw = cfa_malloc(*n_raw * get_type_size(frag_type));
+            dst = *raw;
+        }
+        if (!dst)
+            cfa_err = CFA_MEM_ERR;
+        else
+            cfa_err = nc_get_vars(grp_id, var_id, nc_start, nc_count,
+                                  nc_stride, dst);
+    }
+    /* close the file if it was opened here, keeping the first error */
+    if (owned)
+    {
+        int err = nc_close(frag_nc_id);
+        if (cfa_err == CFA_NOERR)
+            cfa_err = err;
+    }
+    return cfa_err;
+}
+
+/*
+read the overlap of a Fragment, with start, count and stride relative to the
+Fragment, from the netCDF file (and variable) named by the "file" and "address"
+FragmentDatums, converting to type and, if unpack is not NULL, unpacking.
+netCDF-C is not thread safe, so the calls into it are serialised when
+Fragments are read by more than one thread.  The data is read in the type of
+the Fragment variable, and converted after the lock is released so that the
+threads can convert Fragments concurrently.  Fragments in netCDF-3 classic
+files are read from a memory map instead, without the lock, if they can be
+*/
+int
+cfa_netcdf_read_frag(const int cfa_id, const int nc_id, const Fragment *frag,
+                     const int ndim, const size_t *frag_start, const size_t *frag_count,
+                     const size_t *frag_stride, const cfa_type type,
+                     const CFAPacking *unpack, void *data)
+{
+    const FragmentDatum *addr_dat = NULL;
+    int cfa_err = _cfa_var_get_frag_datum(frag, "address", &addr_dat);
+    CFA_CHECK(cfa_err);
+    int done = 0;
+    cfa_err = _cfa_netcdf_mmap_read_frag(cfa_id, nc_id, frag, ndim, addr_dat,
+                                         frag_start, frag_count, frag_stride,
+                                         type, unpack, data, &done);
+    if (cfa_err || done)
+        return cfa_err;
+
+    void *raw = NULL;
+    cfa_type raw_type = CFA_NAT;
+    size_t n_raw = 0;
+    pthread_mutex_lock(&cfa_nc_lock);
+    cfa_err = _cfa_netcdf_read_frag_locked(cfa_id, nc_id, frag, ndim,
+                                           addr_dat, frag_start, frag_count,
+                                           frag_stride, type, unpack != NULL,
+                                           data, &raw, &raw_type, &n_raw);
+    pthread_mutex_unlock(&cfa_nc_lock);
+    if (!raw)
+        return cfa_err;
+    if (cfa_err == CFA_NOERR && unpack)
+        cfa_err = _cfa_unpack(raw, raw_type, data, type, n_raw, unpack);
+    else if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_convert(raw, raw_type, data, type, n_raw);
+    cfa_free(raw, n_raw * get_type_size(raw_type));
+    return cfa_err;
+}
+
+/*
+resolve the "file" FragmentDatum of a Fragment that is being written.  Until
+the AggregationContainer has been serialised there is no CFA-netCDF file to be
+relative to, so relative paths are relative to the directory of the path the
+AggregationContainer was created with
+*/
+int
+_resolve_frag_write_path(const AggregationContainer *agg_cont,
+                         const char *file, char *path)
+{
+    if (agg_cont->x_id != -1)
+        return _resolve_frag_path(agg_cont->x_id, file, path);
+    if (strncmp(file, "file://", 7) == 0)
+        file += 7;
+    path[0] = '\0';
+    if (file[0] != '/' && agg_cont->path)
+    {
+        const char *sep = strrchr(agg_cont->path, '/');
+        size_t len = sep ? (size_t)(sep - agg_cont->path) + 1 : 0;
+        if (len >= PATH_LENGTH)
+            len = PATH_LENGTH - 1;
+        memcpy(path, agg_cont->path, len);
+        path[len] = '\0';
+    }
+    strncat(path, file, PATH_LENGTH - strlen(path) - 1);
+    return CFA_NOERR;
+}
+
+/*
+define the Fragment variable named by an "address" that is not in a Fragment
+file.  The variable has the type of the AggregationVariable, and a dimension for
+each AggregatedDimension, with the same name and the length of the Fragment.
+Existing dimensions with the same name and length are reused.  Must be called
+with cfa_nc_lock held
+*/
+int
+_cfa_netcdf_def_frag_var(const int grp_id, const int cfa_id,
+                         const AggregationVariable *agg_var,
+                         const Fragment *frag, const char *address,
+                         int *var_id)
+{
+    char var_name[NC_MAX_NAME+1] = "";
+    const char *sep = strrchr(address, '/');
+    strncpy(var_name, sep ? sep+1 : address, NC_MAX_NAME);
+    /* files opened for writing are in data mode */
+    int err = nc_redef(grp_id);
+    if (err != NC_NOERR && err != NC_EINDEFINE)
+        return err;
+    int dimids[MAX_DIMS];
+    AggregatedDimension *agg_dim = NULL;
+    for (int d=0; d<agg_var->cfa_ndim; d++)
+    {
+        err = cfa_get_dim(cfa_id, agg_var->cfa_dim_idp[d], &agg_dim);
+        CFA_CHECK(err);
+        size_t span = frag->location[(d<<1)+1] - frag->location[d<<1];
+        size_t len = 0;
+        if (nc_inq_dimid(grp_id, agg_dim->name, &(dimids[d])) == NC_NOERR)
+        {
+            err = nc_inq_dimlen(grp_id, dimids[d], &len);
+            CFA_CHECK(err);
+            if (len != span)
+                return CFA_FRAG_SHAPE_ERR;
+        }
+        else
+        {
+            err = nc_def_dim(grp_id, agg_dim->name, span, &(dimids[d]));
+            CFA_CHECK(err);
+        }
+    }
+    err = nc_def_var(grp_id, var_name, agg_var->cfa_dtype.type,
+                     agg_var->cfa_ndim, dimids, var_id);
+    CFA_CHECK(err);
+    if (agg_var->cfa_has_fill)
+    {
+        err = nc_put_att(grp_id, *var_id, FILL_VALUE, agg_var->cfa_dtype.type,
+                         1, agg_var->cfa_fill_value);
+        CFA_CHECK(err);
+    }
+    err = nc_enddef(grp_id);
+    CFA_CHECK(err);
+    return CFA_NOERR;
+}
+
+/*
+open the netCDF file containing a Fragment for writing.  A Fragment with a
+missing "file" is stored in the CFA-netCDF file itself, which must have been
+opened for writing.  The file is created, with create set, or if it cannot be
+opened.  owned is set to 1 if the caller must close the file.  Must be called
+with cfa_nc_lock held
+*/
+int
+_cfa_netcdf_open_frag_write(const AggregationContainer *agg_cont,
+                            const Fragment *frag, const int create,
+                            int *frag_nc_id, int *owned)
+{
+    const FragmentDatum *file_dat = NULL;
+    int cfa_err = _cfa_var_get_frag_datum(frag, "file", &file_dat);
+    if (cfa_err == CFA_VAR_FRAGDAT_NOT_FOUND ||
+        strlen((const char*)(file_dat->data)) == 0)
+    {
+        *owned = 0;
+        if (agg_cont->x_id == -1)
+            return CFA_NO_FILE;
+        return _get_root_grp_id(agg_cont->x_id, frag_nc_id);
+    }
+    CFA_CHECK(cfa_err);
+    char path[PATH_LENGTH];
+    cfa_err = _resolve_frag_write_path(agg_cont, (const char*)(file_dat->data),
+                                       path);
+    CFA_CHECK(cfa_err);
+    /* a file open for reading is closed before it is written to */
+    cfa_err = _cfa_netcdf_cache_close(path);
+    CFA_CHECK(cfa_err);
+    *owned = 1;
+    if (create)
+        return nc_create(path, NC_NETCDF4|NC_CLOBBER, frag_nc_id);
+    if (nc_open(path, NC_WRITE, frag_nc_id) == NC_NOERR)
+        return CFA_NOERR;
+    return nc_create(path, NC_NETCDF4|NC_NOCLOBBER, frag_nc_id);
+}
+
+/*
+write the overlap of a Fragment, with start and count relative to the Fragment,
+to the netCDF file and variable named by the "file" and "address"
+FragmentDatums.  data holds the overlap in type, and is converted if the
+Fragment variable has another type.  The variable is defined if it is not in
+the file.  Must be called with cfa_nc_lock held
+*/
+int
+_cfa_netcdf_write_frag_locked(const AggregationContainer *agg_cont,
+                              const int cfa_id,
+                              const AggregationVariable *agg_var,
+                              const Fragment *frag, const char *address,
+                              const size_t *frag_start,
+                              const size_t *frag_count, const cfa_type type,
+                              const int create, const void *data,
+                              void **raw, size_t *raw_size)
+{
+    int ndim = agg_var->cfa_ndim;
+    int frag_nc_id = -1;
+    int owned = 0;
+    int cfa_err = _cfa_netcdf_open_frag_write(agg_cont, frag, create,
+                                              &frag_nc_id, &owned);
+    CFA_CHECK(cfa_err);
+
+    int grp_id = -1;
+    int var_id = -1;
+    nc_type frag_type = NC_NAT;
+    int range_err = CFA_NOERR;
+    size_t nc_start[MAX_DIMS];
+    size_t nc_count[MAX_DIMS];
+    ptrdiff_t nc_stride[MAX_DIMS];
+    cfa_err = _get_nc_grp_var_ids_from_str(frag_nc_id, address,
+                                           &grp_id, &var_id);
+    if (cfa_err == NC_ENOTVAR)
+        cfa_err = _cfa_netcdf_def_frag_var(grp_id, cfa_id, agg_var, frag,
+                                           address, &var_id);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _map_frag_dims(grp_id, var_id, frag, ndim,
+                                 frag_start, frag_count, NULL,
+                                 nc_start, nc_count, nc_stride);
+    if (cfa_err == CFA_NOERR)
+        cfa_err = nc_inq_vartype(grp_id, var_id, &frag_type);
+    if (cfa_err == CFA_NOERR && (frag_type < NC_BYTE || frag_type > NC_UINT64))
+        cfa_err = CFA_NAT_ERR;
+    if (cfa_err == CFA_NOERR)
+    {
+        /* Fragment variables in existing files may have another type */
+        const void *src = data;
+        if (frag_type != type)
+        {
+            size_t n = 1;
+            for (int d=0; d<ndim; d++)
+                n *= frag_count[d];
+            *raw_size = n * get_type_size(frag_type);
+            *raw = cfa_malloc(*raw_size);
+            if (!(*raw))
+                cfa_err = CFA_MEM_ERR;
+            else
+                cfa_err = _cfa_convert(data, type, *raw, frag_type, n);
+            src = *raw;
+        }
+        /* out of range values are written anyway, before the range error is
+        returned */
+        if (cfa_err == CFA_RANGE_ERR)
+        {
+            range_err = cfa_err;
+            cfa_err = CFA_NOERR;
+        }
+        if (cfa_err == CFA_NOERR)
+            cfa_err = nc_put_vara(grp_id, var_id, nc_start, nc_count, src);
+    }
+    /* close the file if it was opened here, keeping the first error */
+    if (owned)
+    {
+        int err = nc_close(frag_nc_id);
+        if (cfa_err == CFA_NOERR)
+            cfa_err = err;
+    }
+    CFA_CHECK(cfa_err);
+    return range_err;
+}
+
+/*
+write the overlap of a Fragment to netCDF, serialising the calls into netCDF-C
+as for reading.  The caller converts data to the type of the
+AggregationVariable, outside of the lock, so only Fragment variables of another
+type are converted while it is held.  create is set for Fragments whose file is
+new, which is created even if it already exists
+*/
+int
+cfa_netcdf_write_frag(const int cfa_id, const int cfa_var_id,
+                      const Fragment *frag, const size_t *frag_start,
+                      const size_t *frag_count, const cfa_type type,
+                      const int create, const void *data)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    AggregationVariable *agg_var = NULL;
+    cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    const FragmentDatum *addr_dat = NULL;
+    cfa_err = _cfa_var_get_frag_datum(frag, "address", &addr_dat);
+    CFA_CHECK(cfa_err);
+
+    void *raw = NULL;
+    size_t raw_size = 0;
+    pthread_mutex_lock(&cfa_nc_lock);
+    cfa_err = _cfa_netcdf_write_frag_locked(agg_cont, cfa_id, agg_var, frag,
+                                            (const char*)(addr_dat->data),
+                                            frag_start, frag_count, type,
+                                            create, data, &raw, &raw_size);
+    pthread_mutex_unlock(&cfa_nc_lock);
+    if (raw)
+        cfa_free(raw, raw_size);
+    return cfa_err;
+}
@@ -0,0 +1,640 @@
+#include <fcntl.h>
+#include <netcdf.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+#define PATH_LENGTH 1024
+
+/*
+direct reader for Fragments in netCDF-3 classic files (CDF-1, CDF-2 and
+CDF-5).  The header of a file is parsed once and the file is memory mapped, so
+that the overlap of a non-record variable can be copied straight out of the map
+at offsets computed from its shape, byte-swapping from big-endian if needed.
+Anything else, including netCDF-4 files, record variables and variables in
+groups, is left to libnetcdf.
+
+The mapped files are kept in a small cache with its own lock, so Fragments can
+be read from them by several threads at once without cfa_nc_lock.  Entries are
+reference counted while they are being read from, and the least recently used
+entry that is not in use is replaced when the cache is full.  Files that are
+not netCDF-3 classic are kept in the cache too, so that they are only checked
+once.  Like the handle cache, each entry records the AggregationContainer it
+was last used for
+*/
+
+extern pthread_mutex_t cfa_nc_lock;
+extern int _cfa_var_get_frag_datum(const Fragment*, const char*,
+                                   const FragmentDatum**);
+extern int _resolve_frag_path(const int, const char*, char*);
+extern int _map_frag_ndims(const int, const Fragment*, const int,
+                           const size_t*, const size_t*, const size_t*,
+                           size_t*, size_t*, ptrdiff_t*);
+extern int get_type_size(const cfa_type);
+extern int _cfa_convert(const void*, const cfa_type, void*, const cfa_type,
+                        const size_t);
+extern int _cfa_unpack(const void*, const cfa_type, void*, const cfa_type,
+                       const size_t, const CFAPacking*);
+extern void _cfa_byteswap(void*, const size_t, const size_t);
+
+/* number of mapped files kept */
+#define CFA_MMAP_CACHE_SIZE 16
+
+/* tags of the lists in the header */
+#define NC3_DIMENSION 0x0A
+#define NC3_VARIABLE 0x0B
+#define NC3_ATTRIBUTE 0x0C
+
+/* a variable in a netCDF-3 file */
+typedef struct {
+    char name[NC_MAX_NAME+1];
+    nc_type type;
+    int ndim;
+    size_t shape[MAX_DIMS];
+    size_t begin;
+    /* record variables, and those with too many dimensions, are not read */
+    int direct;
+} MappedVar;
+
+/* a mapped netCDF-3 file */
+typedef struct {
+    char *path;             /* NULL if the slot is free */
+    unsigned char *base;    /* NULL if the file is not netCDF-3 classic */
+    size_t size;
+    MappedVar *vars;
+    int n_vars;
+    int refs;               /* number of reads using the entry */
+    int stale;              /* unmapped once the reads have finished */
+    int cfa_id;             /* container the file was last used for */
+    unsigned long last_use;
+} MappedFile;
+
+static pthread_mutex_t cfa_mmap_lock = PTHREAD_MUTEX_INITIALIZER;
+static MappedFile cfa_mmap_cache[CFA_MMAP_CACHE_SIZE];
+static int cfa_mmap_enabled = 1;
+static unsigned long cfa_mmap_tick = 0;
+static size_t cfa_mmap_reads = 0;
+static size_t cfa_mmap_fallbacks = 0;
+
+/* position in the header, which is cleared when it runs off the end */
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    int version;
+} HeaderCursor;
+
+/*
+read a big-endian unsigned integer of n bytes from the header
+*/
+static uint64_t
+_nc3_read_uint(HeaderCursor *cur, const int n)
+{
+    if (!cur->p || cur->end - cur->p < n)
+    {
+        cur->p = NULL;
+        return 0;
+    }
+    uint64_t v = 0;
+    for (int i=0; i<n; i++)
+        v = (v << 8) | cur->p[i];
+    cur->p += n;
+    return v;
+}
+
+/* counts and lengths are 64 bit in CDF-5 */
+static uint64_t
+_nc3_read_nonneg(HeaderCursor *cur)
+{
+    return _nc3_read_uint(cur, cur->version == 5 ? 8 : 4);
+}
+
+/* offsets are 64 bit in CDF-2 and CDF-5 */
+static uint64_t
+_nc3_read_offset(HeaderCursor *cur)
+{
+    return _nc3_read_uint(cur, cur->version == 1 ? 4 : 8);
+}
+
+/*
+skip n bytes of the header, rounded up to a multiple of 4
+*/
+static void
+_nc3_skip(HeaderCursor *cur, const uint64_t n)
+{
+    uint64_t padded = (n + 3) & ~(uint64_t)(3);
+    if (!cur->p || padded < n || (uint64_t)(cur->end - cur->p) < padded)
+        cur->p = NULL;
+    else
+        cur->p += padded;
+}
+
+/*
+read a name from the header into name, which is emptied if it is too long
+*/
+static void
+_nc3_read_name(HeaderCursor *cur, char *name)
+{
+    uint64_t len = _nc3_read_nonneg(cur);
+    const unsigned char *p = cur->p;
+    _nc3_skip(cur, len);
+    name[0] = '\0';
+    if (cur->p && len <= NC_MAX_NAME)
+    {
+        memcpy(name, p, len);
+        name[len] = '\0';
+    }
+}
+
+/*
+size of the netCDF types that can be in a netCDF-3 file, or 0
+*/
+static size_t
+_nc3_type_size(const nc_type type)
+{
+    switch (type)
+    {
+        case NC_BYTE:
+        case NC_CHAR:
+        case NC_UBYTE:
+            return 1;
+        case NC_SHORT:
+        case NC_USHORT:
+            return 2;
+        case NC_INT:
+        case NC_FLOAT:
+        case NC_UINT:
+            return 4;
+        case NC_DOUBLE:
+        case NC_INT64:
+        case NC_UINT64:
+            return 8;
+    }
+    return 0;
+}
+
+/*
+skip a list of attributes in the header
+*/
+static void
+_nc3_skip_atts(HeaderCursor *cur)
+{
+    _nc3_read_uint(cur, 4);
+    uint64_t n_atts = _nc3_read_nonneg(cur);
+    char name[NC_MAX_NAME+1];
+    for (uint64_t a=0; a<n_atts && cur->p; a++)
+    {
+        _nc3_read_name(cur, name);
+        nc_type type = (nc_type)(_nc3_read_uint(cur, 4));
+        uint64_t n = _nc3_read_nonneg(cur);
+        size_t tsize = _nc3_type_size(type);
+        if (!tsize || n > UINT64_MAX / tsize)
+            cur->p = NULL;
+        else
+            _nc3_skip(cur, n * tsize);
+    }
+}
+
+/*
+parse the header of a mapped netCDF-3 file into its variables.  A header that
+cannot be parsed leaves the file to libnetcdf
+*/
+static int
+_nc3_parse_header(MappedFile *mfile)
+{
+    HeaderCursor cur = {mfile->base + 4, mfile->base + mfile->size,
+                        mfile->base[3]};
+    _nc3_read_nonneg(&cur);     /* numrecs */
+
+    /* the lengths of the dimensions, with 0 for the record dimension */
+    uint64_t tag = _nc3_read_uint(&cur, 4);
+    uint64_t n_dims = _nc3_read_nonneg(&cur);
+    if (!cur.p || (tag != NC3_DIMENSION && n_dims != 0) ||
+        n_dims > NC_MAX_DIMS)
+        return CFA_FRAG_FORMAT_ERR;
+    size_t dim_lens[NC_MAX_DIMS];
+    char name[NC_MAX_NAME+1];
+    for (uint64_t d=0; d<n_dims; d++)
+    {
+        _nc3_read_name(&cur, name);
+        dim_lens[d] = _nc3_read_nonneg(&cur);
+    }
+    _nc3_skip_atts(&cur);
+
+    tag = _nc3_read_uint(&cur, 4);
+    uint64_t n_vars = _nc3_read_nonneg(&cur);
+    if (!cur.p || (tag != NC3_VARIABLE && n_vars != 0) ||
+        n_vars > (uint64_t)(cur.end - cur.p))
+        return CFA_FRAG_FORMAT_ERR;
+    if (n_vars == 0)
+        return CFA_NOERR;
+    mfile->vars = cfa_malloc(sizeof(MappedVar) * n_vars);
+    if (!mfile->vars)
+        return CFA_MEM_ERR;
+    mfile->n_vars = n_vars;
+    for (uint64_t v=0; v<n_vars && cur.p; v++)
+    {
+        MappedVar *mvar = &(mfile->vars[v]);
+        _nc3_read_name(&cur, mvar->name);
+        uint64_t ndim = _nc3_read_nonneg(&cur);
+        mvar->ndim = ndim;
+        mvar->direct = ndim <= MAX_DIMS;
+        for (uint64_t d=0; d<ndim && cur.p; d++)
+        {
+            uint64_t dimid = _nc3_read_nonneg(&cur);
+            if (dimid >= n_dims)
+                cur.p = NULL;
+            else if (d < MAX_DIMS)
+            {
+                mvar->shape[d] = dim_lens[dimid];
+                if (dim_lens[dimid] == 0)
+                    mvar->direct = 0;
+            }
+        }
+        _nc3_skip_atts(&cur);
+        mvar->type = (nc_type)(_nc3_read_uint(&cur, 4));
+        _nc3_read_nonneg(&cur);     /* vsize */
+        mvar->begin = _nc3_read_offset(&cur);
+        if (!_nc3_type_size(mvar->type))
+            mvar->direct = 0;
+    }
+    if (!cur.p)
+        return CFA_FRAG_FORMAT_ERR;
+    return CFA_NOERR;
+}
+
+/*
+unmap a file and free its cache slot.  Must be called with cfa_mmap_lock held
+*/
+static void
+_cfa_mmap_evict(MappedFile *mfile)
+{
+    if (!mfile->path)
+        return;
+    if (mfile->base)
+        munmap(mfile->base, mfile->size);
+    if (mfile->vars)
+        cfa_free(mfile->vars, sizeof(MappedVar) * mfile->n_vars);
+    cfa_free(mfile->path, strlen(mfile->path)+1);
+    memset(mfile, 0, sizeof(MappedFile));
+}
+
+/*
+map a file into a cache slot.  Files that cannot be mapped, or are not
+netCDF-3 classic, are given a NULL base.  Must be called with cfa_mmap_lock
+held
+*/
+static int
+_cfa_mmap_open(MappedFile *mfile, const char *path)
+{
+    mfile->path = cfa_strdup(path);
+    if (!mfile->path)
+        return CFA_MEM_ERR;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return CFA_NOERR;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= 8)
+    {
+        void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED)
+        {
+            mfile->base = base;
+            mfile->size = st.st_size;
+        }
+    }
+    close(fd);
+    if (!mfile->base)
+        return CFA_NOERR;
+
+    const unsigned char *magic = mfile->base;
+    int cfa_err = CFA_FRAG_FORMAT_ERR;
+    if (magic[0] == 'C' && magic[1] == 'D' && magic[2] == 'F' &&
+        (magic[3] == 1 || magic[3] == 2 || magic[3] == 5))
+        cfa_err = _nc3_parse_header(mfile);
+    if (cfa_err != CFA_NOERR)
+    {
+        if (mfile->vars)
+            cfa_free(mfile->vars, sizeof(MappedVar) * mfile->n_vars);
+        munmap(mfile->base, mfile->size);
+        mfile->base = NULL;
+        mfile->vars = NULL;
+        mfile->n_vars = 0;
+    }
+    return cfa_err == CFA_MEM_ERR ? cfa_err : CFA_NOERR;
+}
+
+/*
+get the cache entry for a file, for the AggregationContainer cfa_id, mapping it
+if it is not in the cache, and take a reference to it.  *mfilep is NULL if
+every slot is in use
+*/
+static int
+_cfa_mmap_acquire(const int cfa_id, const char *path, MappedFile **mfilep)
+{
+    *mfilep = NULL;
+    MappedFile *lru = NULL;
+    int cfa_err = CFA_NOERR;
+    pthread_mutex_lock(&cfa_mmap_lock);
+    for (int c=0; c<CFA_MMAP_CACHE_SIZE; c++)
+    {
+        MappedFile *mfile = &(cfa_mmap_cache[c]);
+        if (mfile->path && !mfile->stale && strcmp(mfile->path, path) == 0)
+        {
+            *mfilep = mfile;
+            break;
+        }
+        if (mfile->refs)
+            continue;
+        if (!lru || (lru->path && (!mfile->path ||
+                                   mfile->last_use < lru->last_use)))
+            lru = mfile;
+    }
+    if (!(*mfilep) && lru)
+    {
+        _cfa_mmap_evict(lru);
+        cfa_err = _cfa_mmap_open(lru, path);
+        if (cfa_err == CFA_NOERR)
+            *mfilep = lru;
+        else
+            _cfa_mmap_evict(lru);
+    }
+    if (*mfilep)
+    {
+        (*mfilep)->refs++;
+        (*mfilep)->cfa_id = cfa_id;
+        (*mfilep)->last_use = ++cfa_mmap_tick;
+    }
+    pthread_mutex_unlock(&cfa_mmap_lock);
+    return cfa_err;
+}
+
+/*
+release the reference to a cache entry taken by _cfa_mmap_acquire, counting
+whether the Fragment was read from it
+*/
+static void
+_cfa_mmap_release(MappedFile *mfile, const int done)
+{
+    pthread_mutex_lock(&cfa_mmap_lock);
+    if (done)
+        cfa_mmap_reads++;
+    else
+        cfa_mmap_fallbacks++;
+    if (--(mfile->refs) == 0 && mfile->stale)
+        _cfa_mmap_evict(mfile);
+    pthread_mutex_unlock(&cfa_mmap_lock);
+}
+
+/*
+swap the bytes of n values of size tsize in place, from big-endian to the byte
+order of the host
+*/
+static void
+_nc3_swap(unsigned char *buf, const size_t n, const size_t tsize)
+{
+    const uint16_t one = 1;
+    if (*((const unsigned char*)(&one)) == 1)
+        _cfa_byteswap(buf, n, tsize);
+}
+
+/*
+copy a strided hyperslab of a variable out of a mapped file into dst, in the
+byte order of the host.  done is cleared if the hyperslab is not in the file
+*/
+static void
+_nc3_copy(const MappedFile *mfile, const MappedVar *mvar,
+          const size_t *nc_start, const size_t *nc_count,
+          const ptrdiff_t *nc_stride, unsigned char *dst, int *done)
+{
+    int ndim = mvar->ndim;
+    size_t tsize = _nc3_type_size(mvar->type);
+    /* element strides of the dimensions, and the extent of the variable */
+    size_t dim_stride[MAX_DIMS];
+    size_t n_var = 1;
+    for (int d=ndim-1; d>=0; d--)
+    {
+        dim_stride[d] = n_var;
+        n_var *= mvar->shape[d];
+    }
+    for (int d=0; d<ndim; d++)
+        if (nc_count[d] == 0 || nc_stride[d] < 1 || nc_start[d] +
+            (nc_count[d] - 1) * nc_stride[d] >= mvar->shape[d])
+        {
+            *done = 0;
+            return;
+        }
+    if (mvar->begin > mfile->size ||
+        n_var > (mfile->size - mvar->begin) / tsize)
+    {
+        *done = 0;
+        return;
+    }
+
+    /* copy a row of the last dimension at a time */
+    const unsigned char *src = mfile->base + mvar->begin;
+    size_t row = ndim ? nc_count[ndim-1] : 1;
+    ptrdiff_t row_stride = ndim ? nc_stride[ndim-1] : 1;
+    size_t idx[MAX_DIMS] = {0};
+    size_t n = 0;
+    while (1)
+    {
+        size_t offset = 0;
+        for (int d=0; d<ndim; d++)
+            offset += (nc_start[d] + idx[d] * nc_stride[d]) * dim_stride[d];
+        const unsigned char *s = src + offset * tsize;
+        unsigned char *o = dst + n * tsize;
+        if (row_stride == 1)
+            memcpy(o, s, row * tsize);
+        else
+            for (size_t i=0; i<row; i++)
+                memcpy(o + i * tsize, s + i * row_stride * tsize, tsize);
+        n += row;
+        int d = ndim - 2;
+        for (; d>=0; d--)
+        {
+            if (++idx[d] < nc_count[d])
+                break;
+            idx[d] = 0;
+        }
+        if (d < 0)
+            break;
+    }
+    _nc3_swap(dst, n, tsize);
+    *done = 1;
+}
+
+/*
+read the overlap of a Fragment from a memory map of its file, if the file is
+netCDF-3 classic and the variable is not a record variable, converting to type
+and unpacking as cfa_netcdf_read_frag does.  done is set if the Fragment was
+read, and is clear if it has to be read with libnetcdf
+*/
+int
+_cfa_netcdf_mmap_read_frag(const int cfa_id, const int nc_id,
+                           const Fragment *frag,
+                           const int ndim, const FragmentDatum *addr_dat,
+                           const size_t *frag_start, const size_t *frag_count,
+                           const size_t *frag_stride, const cfa_type type,
+                           const CFAPacking *unpack, void *data, int *done)
+{
+    *done = 0;
+    if (!__atomic_load_n(&cfa_mmap_enabled, __ATOMIC_RELAXED))
+        return CFA_NOERR;
+    /* Fragments in the CFA-netCDF file, and in groups, are not mapped */
+    const FragmentDatum *file_dat = NULL;
+    if (_cfa_var_get_frag_datum(frag, "file", &file_dat) != CFA_NOERR ||
+        strlen((const char*)(file_dat->data)) == 0)
+        return CFA_NOERR;
+    const char *address = (const char*)(addr_dat->data);
+    if (address[0] == '/')
+        address++;
+    if (strchr(address, '/'))
+        return CFA_NOERR;
+
+    /* the path is relative to the CFA-netCDF file, which is asked of netCDF */
+    char path[PATH_LENGTH];
+    pthread_mutex_lock(&cfa_nc_lock);
+    int cfa_err = _resolve_frag_path(nc_id, (const char*)(file_dat->data),
+                                     path);
+    pthread_mutex_unlock(&cfa_nc_lock);
+    CFA_CHECK(cfa_err);
+    MappedFile *mfile = NULL;
+    cfa_err = _cfa_mmap_acquire(cfa_id, path, &mfile);
+    CFA_CHECK(cfa_err);
+    if (!mfile)
+        return CFA_NOERR;
+
+    const MappedVar *mvar = NULL;
+    for (int v=0; v<mfile->n_vars && !mvar; v++)
+        if (strcmp(mfile->vars[v].name, address) == 0)
+            mvar = &(mfile->vars[v]);
+    size_t nc_start[MAX_DIMS];
+    size_t nc_count[MAX_DIMS];
+    ptrdiff_t nc_stride[MAX_DIMS];
+    if (mvar && mvar->direct &&
+        _map_frag_ndims(mvar->ndim, frag, ndim, frag_start, frag_count,
+                        frag_stride, nc_start, nc_count,
+                        nc_stride) == CFA_NOERR)
+    {
+        size_t n = 1;
+        for (int d=0; d<ndim; d++)
+            n *= frag_count[d];
+        cfa_type raw_type = mvar->type;
+        size_t raw_size = n * get_type_size(raw_type);
+        void *raw = data;
+        if (raw_type != type || unpack)
+            raw = cfa_malloc(raw_size);
+        if (!raw)
+            cfa_err = CFA_MEM_ERR;
+        else
+            _nc3_copy(mfile, mvar, nc_start, nc_count, nc_stride, raw, done);
+        if (raw && raw != data)
+        {
+            if (*done && unpack)
+                cfa_err = _cfa_unpack(raw, raw_type, data, type, n, unpack);
+            else if (*done)
+                cfa_err = _cfa_convert(raw, raw_type, data, type, n);
+            cfa_free(raw, raw_size);
+        }
+    }
+    _cfa_mmap_release(mfile, *done);
+    /* a failed conversion is reported, rather than read again */
+    if (cfa_err)
+        *done = 1;
+    return cfa_err;
+}
+
+/*
+unmap a file, so that it is mapped again after it has been written to.  Files
+that are being read from are unmapped when the reads finish
+*/
+int
+_cfa_netcdf_mmap_close(const char *path)
+{
+    pthread_mutex_lock(&cfa_mmap_lock);
+    for (int c=0; c<CFA_MMAP_CACHE_SIZE; c++)
+    {
+        MappedFile *mfile = &(cfa_mmap_cache[c]);
+        if (!mfile->path || strcmp(mfile->path, path) != 0)
+            continue;
+        if (mfile->refs)
+            mfile->stale = 1;
+        else
+            _cfa_mmap_evict(mfile);
+    }
+    pthread_mutex_unlock(&cfa_mmap_lock);
+    return CFA_NOERR;
+}
+
+/*
+unmap all of the files that are not being read from
+*/
+int
+_cfa_netcdf_mmap_flush(void)
+{
+    pthread_mutex_lock(&cfa_mmap_lock);
+    for (int c=0; c<CFA_MMAP_CACHE_SIZE; c++)
+    {
+        MappedFile *mfile = &(cfa_mmap_cache[c]);
+        if (mfile->refs)
+            mfile->stale = 1;
+        else
+            _cfa_mmap_evict(mfile);
+    }
+    pthread_mutex_unlock(&cfa_mmap_lock);
+    return CFA_NOERR;
+}
+
+/*
+unmap the files that were last used for the AggregationContainer cfa_id
+*/
+int
+_cfa_netcdf_mmap_drop(const int cfa_id)
+{
+    pthread_mutex_lock(&cfa_mmap_lock);
+    for (int c=0; c<CFA_MMAP_CACHE_SIZE; c++)
+    {
+        MappedFile *mfile = &(cfa_mmap_cache[c]);
+        if (!mfile->path || mfile->cfa_id != cfa_id)
+            continue;
+        if (mfile->refs)
+            mfile->stale = 1;
+        else
+            _cfa_mmap_evict(mfile);
+    }
+    pthread_mutex_unlock(&cfa_mmap_lock);
+    return CFA_NOERR;
+}
+
+/*
+turn the memory-mapped reads of netCDF-3 classic Fragment files on or off
+*/
+int
+cfa_set_mmap_reads(const int enable)
+{
+    __atomic_store_n(&cfa_mmap_enabled, enable ? 1 : 0, __ATOMIC_RELAXED);
+    if (!enable)
+        return _cfa_netcdf_mmap_flush();
+    return CFA_NOERR;
+}
+
+/*
+get the number of Fragment reads from a memory map (reads) and the number of
+reads of Fragment files that were left to libnetcdf (fallbacks)
+*/
+int
+cfa_inq_mmap_stats(size_t *readsp, size_t *fallbacksp)
+{
+    pthread_mutex_lock(&cfa_mmap_lock);
+    *readsp = cfa_mmap_reads;
+    *fallbacksp = cfa_mmap_fallbacks;
+    pthread_mutex_unlock(&cfa_mmap_lock);
+    return CFA_NOERR;
+}
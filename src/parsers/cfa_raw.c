@@ -0,0 +1,554 @@
+/* posix_madvise and pwrite */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+#define PATH_LENGTH 1024
+
+/*
+driver for Fragments stored as flat binary files, with the "format" "raw".  The
+"address" of a raw Fragment describes where its values are in the file, as
+semicolon separated keys:
+
+    offset=<bytes>;dtype=<type>;shape=<length>,<length>,...
+
+offset defaults to 0 and shape to the shape of the Fragment, and either may
+leave out the dimensions of size 1, as netCDF Fragment variables may.  dtype is
+a NumPy style type string: an optional byte order ('<' little-endian, '>'
+big-endian, '=' or '|' the byte order of the host), followed by i, u or f and
+the size in bytes, e.g. "<f4" or ">i8".
+
+The part of the file holding the overlap is memory mapped for each read, and
+the kernel is told whether it will be read sequentially or sparsely.  The
+overlap is copied out a row at a time, swapping the bytes of each row if the
+file is not in the byte order of the host, and then converted and unpacked as
+netCDF Fragments are.  Writes go straight to the file with pwrite, extending
+it as needed.  Fragments that are read ahead are passed to posix_fadvise, so
+that the kernel starts reading them into the page cache
+*/
+
+extern pthread_mutex_t cfa_nc_lock;
+extern int _cfa_var_get_frag_datum(const Fragment*, const char*,
+                                   const FragmentDatum**);
+extern int _resolve_frag_write_path(const AggregationContainer*, const char*,
+                                    char*);
+extern int _map_frag_ndims(const int, const Fragment*, const int,
+                           const size_t*, const size_t*, const size_t*,
+                           size_t*, size_t*, ptrdiff_t*);
+extern int get_type_size(const cfa_type);
+extern int _cfa_convert(const void*, const cfa_type, void*, const cfa_type,
+                        const size_t);
+extern int _cfa_unpack(const void*, const cfa_type, void*, const cfa_type,
+                       const size_t, const CFAPacking*);
+extern void _cfa_byteswap(void*, const size_t, const size_t);
+
+/* the layout of a raw Fragment, parsed from its "address" */
+typedef struct {
+    size_t offset;
+    cfa_type type;
+    int swap;               /* the file is not in the byte order of the host */
+    int ndim;               /* -1 if the shape was not given */
+    size_t shape[MAX_DIMS];
+} RawAddress;
+
+/* the hyperslab of a raw Fragment being read or written */
+typedef struct {
+    int ndim;
+    size_t shape[MAX_DIMS];
+    size_t start[MAX_DIMS];
+    size_t count[MAX_DIMS];
+    ptrdiff_t stride[MAX_DIMS];
+    size_t tsize;
+    size_t n;               /* number of values in the hyperslab */
+    size_t first;           /* element offsets of the first and last values */
+    size_t last;
+} RawSlab;
+
+/*
+parse an unsigned decimal number between p and end
+*/
+int
+_cfa_raw_parse_size(const char *p, const char *end, size_t *v)
+{
+    if (p == end)
+        return CFA_RAW_ADDRESS_ERR;
+    *v = 0;
+    for (; p<end; p++)
+    {
+        if (*p < '0' || *p > '9' || *v > (SIZE_MAX - 9) / 10)
+            return CFA_RAW_ADDRESS_ERR;
+        *v = *v * 10 + (*p - '0');
+    }
+    return CFA_NOERR;
+}
+
+/*
+parse a NumPy style type string between p and end into the type, and whether
+the values have to be byte swapped to be in the byte order of the host
+*/
+int
+_cfa_parse_dtype(const char *p, const char *end, cfa_type *type, int *swap)
+{
+    const uint16_t one = 1;
+    int host_little = *((const unsigned char*)(&one)) == 1;
+    *swap = 0;
+    if (p < end && (*p == '<' || *p == '>' || *p == '=' || *p == '|'))
+    {
+        *swap = (*p == '<' && !host_little) || (*p == '>' && host_little);
+        p++;
+    }
+    if (end - p != 2)
+        return CFA_RAW_ADDRESS_ERR;
+    switch (p[0])
+    {
+        case 'i':
+            *type = p[1] == '1' ? CFA_BYTE : p[1] == '2' ? CFA_SHORT :
+                    p[1] == '4' ? CFA_INT : p[1] == '8' ? CFA_INT64 :
+                    CFA_NAT;
+            break;
+        case 'u':
+            *type = p[1] == '1' ? CFA_UBYTE : p[1] == '2' ? CFA_USHORT :
+                    p[1] == '4' ? CFA_UINT : p[1] == '8' ? CFA_UINT64 :
+                    CFA_NAT;
+            break;
+        case 'f':
+            *type = p[1] == '4' ? CFA_FLOAT : p[1] == '8' ? CFA_DOUBLE :
+                    CFA_NAT;
+            break;
+        default:
+            *type = CFA_NAT;
+    }
+    if (*type == CFA_NAT)
+        return CFA_RAW_ADDRESS_ERR;
+    return CFA_NOERR;
+}
+
+/*
+parse the "address" of a raw Fragment
+*/
+int
+_cfa_raw_parse_address(const char *address, RawAddress *raw)
+{
+    raw->offset = 0;
+    raw->type = CFA_NAT;
+    raw->swap = 0;
+    raw->ndim = -1;
+    int cfa_err = CFA_NOERR;
+    const char *p = address;
+    while (*p && cfa_err == CFA_NOERR)
+    {
+        const char *end = strchr(p, ';');
+        if (!end)
+            end = p + strlen(p);
+        const char *eq = memchr(p, '=', end - p);
+        if (!eq)
+            return CFA_RAW_ADDRESS_ERR;
+        size_t klen = eq - p;
+        if (klen == 6 && strncmp(p, "offset", 6) == 0)
+            cfa_err = _cfa_raw_parse_size(eq+1, end, &(raw->offset));
+        else if (klen == 5 && strncmp(p, "dtype", 5) == 0)
+            cfa_err = _cfa_parse_dtype(eq+1, end, &(raw->type),
+                                       &(raw->swap));
+        else if (klen == 5 && strncmp(p, "shape", 5) == 0)
+        {
+            raw->ndim = 0;
+            const char *s = eq+1;
+            while (cfa_err == CFA_NOERR && s <= end)
+            {
+                const char *sep = memchr(s, ',', end - s);
+                if (!sep)
+                    sep = end;
+                if (raw->ndim == MAX_DIMS)
+                    return CFA_RAW_ADDRESS_ERR;
+                cfa_err = _cfa_raw_parse_size(s, sep,
+                                              &(raw->shape[raw->ndim++]));
+                s = sep + 1;
+            }
+        }
+        else
+            return CFA_RAW_ADDRESS_ERR;
+        p = *end ? end + 1 : end;
+    }
+    CFA_CHECK(cfa_err);
+    if (raw->type == CFA_NAT)
+        return CFA_RAW_ADDRESS_ERR;
+    return CFA_NOERR;
+}
+
+/*
+get the path and the layout of a raw Fragment.  Raw Fragments must be in a file
+of their own
+*/
+int
+_cfa_raw_get_frag(const AggregationContainer *agg_cont, const Fragment *frag,
+                  char *path, RawAddress *raw)
+{
+    const FragmentDatum *file_dat = NULL;
+    int cfa_err = _cfa_var_get_frag_datum(frag, "file", &file_dat);
+    if (cfa_err == CFA_VAR_FRAGDAT_NOT_FOUND)
+        return CFA_RAW_ADDRESS_ERR;
+    CFA_CHECK(cfa_err);
+    if (!file_dat->data || strlen((const char*)(file_dat->data)) == 0)
+        return CFA_RAW_ADDRESS_ERR;
+    const FragmentDatum *addr_dat = NULL;
+    cfa_err = _cfa_var_get_frag_datum(frag, "address", &addr_dat);
+    CFA_CHECK(cfa_err);
+    cfa_err = _cfa_raw_parse_address((const char*)(addr_dat->data), raw);
+    CFA_CHECK(cfa_err);
+    /* the path of a serialised AggregationContainer is asked of netCDF */
+    pthread_mutex_lock(&cfa_nc_lock);
+    cfa_err = _resolve_frag_write_path(agg_cont,
+                                       (const char*)(file_dat->data), path);
+    pthread_mutex_unlock(&cfa_nc_lock);
+    return cfa_err;
+}
+
+/*
+map an overlap onto the dimensions of a raw Fragment, checking the shape in its
+address against the Fragment
+*/
+int
+_cfa_raw_map_slab(const RawAddress *raw, const Fragment *frag, const int ndim,
+                  const size_t *frag_start, const size_t *frag_count,
+                  const size_t *frag_stride, RawSlab *slab)
+{
+    size_t zero[MAX_DIMS] = {0};
+    size_t span[MAX_DIMS];
+    for (int d=0; d<ndim; d++)
+        span[d] = frag->location[(d<<1)+1] - frag->location[d<<1];
+    slab->ndim = raw->ndim == -1 ? ndim : raw->ndim;
+    int cfa_err = _map_frag_ndims(slab->ndim, frag, ndim, zero, span, NULL,
+                                  slab->start, slab->shape, slab->stride);
+    CFA_CHECK(cfa_err);
+    for (int d=0; d<raw->ndim; d++)
+        if (raw->shape[d] != slab->shape[d])
+            return CFA_FRAG_SHAPE_ERR;
+    cfa_err = _map_frag_ndims(slab->ndim, frag, ndim, frag_start, frag_count,
+                              frag_stride, slab->start, slab->count,
+                              slab->stride);
+    CFA_CHECK(cfa_err);
+
+    slab->tsize = get_type_size(raw->type);
+    slab->n = 1;
+    slab->first = 0;
+    slab->last = 0;
+    size_t dim_stride = 1;
+    for (int d=slab->ndim-1; d>=0; d--)
+    {
+        if (slab->count[d] == 0)
+        {
+            slab->n = 0;
+            return CFA_NOERR;
+        }
+        size_t end = slab->start[d] + (slab->count[d]-1) * slab->stride[d];
+        if (end >= slab->shape[d])
+            return CFA_VAR_HYPERSLAB_ERR;
+        slab->n *= slab->count[d];
+        slab->first += slab->start[d] * dim_stride;
+        slab->last += end * dim_stride;
+        dim_stride *= slab->shape[d];
+    }
+    return CFA_NOERR;
+}
+
+/*
+get the element offset of the row at idx in a hyperslab
+*/
+static size_t
+_cfa_raw_row_offset(const RawSlab *slab, const size_t *idx)
+{
+    size_t offset = 0;
+    size_t dim_stride = 1;
+    for (int d=slab->ndim-1; d>=0; d--)
+    {
+        offset += (slab->start[d] + idx[d] * slab->stride[d]) * dim_stride;
+        dim_stride *= slab->shape[d];
+    }
+    return offset;
+}
+
+/*
+move idx on to the next row of a hyperslab, returning 0 after the last row
+*/
+static int
+_cfa_raw_next_row(const RawSlab *slab, size_t *idx)
+{
+    for (int d=slab->ndim-2; d>=0; d--)
+    {
+        if (++idx[d] < slab->count[d])
+            return 1;
+        idx[d] = 0;
+    }
+    return 0;
+}
+
+/*
+copy the hyperslab out of the mapped part of a raw file into dst, in the byte
+order of the host.  src is the map, which starts at map_off in the file
+*/
+void
+_cfa_raw_copy(const RawAddress *raw, const RawSlab *slab,
+              const unsigned char *src, const size_t map_off,
+              unsigned char *dst)
+{
+    size_t tsize = slab->tsize;
+    size_t row = slab->ndim ? slab->count[slab->ndim-1] : 1;
+    ptrdiff_t row_stride = slab->ndim ? slab->stride[slab->ndim-1] : 1;
+    size_t idx[MAX_DIMS] = {0};
+    size_t n = 0;
+    do
+    {
+        const unsigned char *s = src + raw->offset - map_off +
+                                 _cfa_raw_row_offset(slab, idx) * tsize;
+        unsigned char *o = dst + n * tsize;
+        if (row_stride == 1)
+            memcpy(o, s, row * tsize);
+        else
+            for (size_t i=0; i<row; i++)
+                memcpy(o + i * tsize, s + i * row_stride * tsize, tsize);
+        /* swap each row while it is in the cache */
+        if (raw->swap)
+            _cfa_byteswap(o, row, tsize);
+        n += row;
+    } while (_cfa_raw_next_row(slab, idx));
+}
+
+/* the state of a raw Fragment between cfa_raw_open and cfa_raw_close */
+typedef struct {
+    char path[PATH_LENGTH];
+    RawAddress raw;
+} RawFrag;
+
+/*
+resolve the path and parse the address of a raw Fragment once, for all of the
+reads of an overlap
+*/
+int
+cfa_raw_open(const int cfa_id, const Fragment *frag, void **handlep)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    RawFrag *raw_frag = cfa_malloc(sizeof(RawFrag));
+    if (!raw_frag)
+        return CFA_MEM_ERR;
+    cfa_err = _cfa_raw_get_frag(agg_cont, frag, raw_frag->path,
+                                &(raw_frag->raw));
+    if (cfa_err)
+    {
+        cfa_free(raw_frag, sizeof(RawFrag));
+        return cfa_err;
+    }
+    *handlep = raw_frag;
+    return CFA_NOERR;
+}
+
+/*
+release the state of a raw Fragment
+*/
+int
+cfa_raw_close(void *handle)
+{
+    if (handle)
+        cfa_free(handle, sizeof(RawFrag));
+    return CFA_NOERR;
+}
+
+/*
+read the overlap of a raw Fragment into data, converting to type and, if unpack
+is not NULL, unpacking.  Only the pages holding the overlap are mapped.  Reads
+of contiguous rows that cover most of the mapped pages are advised as
+sequential, so that the kernel reads ahead, and anything sparser as random
+*/
+int
+cfa_raw_read(void *handle, const int cfa_id, const Fragment *frag,
+             const int ndim, const size_t *frag_start,
+             const size_t *frag_count, const size_t *frag_stride,
+             const cfa_type type, const CFAPacking *unpack, void *data)
+{
+    (void)(cfa_id);
+    const char *path = ((const RawFrag*)(handle))->path;
+    RawAddress raw = ((const RawFrag*)(handle))->raw;
+    RawSlab slab;
+    int cfa_err = _cfa_raw_map_slab(&raw, frag, ndim, frag_start, frag_count,
+                                    frag_stride, &slab);
+    CFA_CHECK(cfa_err);
+    if (slab.n == 0)
+        return CFA_NOERR;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return errno;
+    /* the bytes of the file holding the hyperslab */
+    size_t lo = raw.offset + slab.first * slab.tsize;
+    size_t hi = raw.offset + (slab.last + 1) * slab.tsize;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        cfa_err = errno;
+    else if (slab.last > (SIZE_MAX - raw.offset) / slab.tsize - 1 ||
+             hi > (size_t)(st.st_size))
+        cfa_err = CFA_RAW_ADDRESS_ERR;
+    void *base = MAP_FAILED;
+    size_t map_off = lo - lo % (size_t)(sysconf(_SC_PAGESIZE));
+    size_t map_len = hi - map_off;
+    if (cfa_err == CFA_NOERR)
+    {
+        base = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd,
+                    (off_t)(map_off));
+        if (base == MAP_FAILED)
+            cfa_err = errno;
+    }
+    close(fd);
+    CFA_CHECK(cfa_err);
+
+    int sequential = slab.stride[slab.ndim ? slab.ndim-1 : 0] == 1 &&
+                     slab.n * slab.tsize * 2 >= hi - lo;
+    posix_madvise(base, map_len, sequential ? POSIX_MADV_SEQUENTIAL :
+                                              POSIX_MADV_RANDOM);
+    void *buf = data;
+    size_t buf_size = slab.n * slab.tsize;
+    if (raw.type != type || unpack)
+        buf = cfa_malloc(buf_size);
+    if (!buf)
+        cfa_err = CFA_MEM_ERR;
+    else
+        _cfa_raw_copy(&raw, &slab, base, map_off, buf);
+    munmap(base, map_len);
+    if (buf && buf != data)
+    {
+        if (unpack)
+            cfa_err = _cfa_unpack(buf, raw.type, data, type, slab.n, unpack);
+        else
+            cfa_err = _cfa_convert(buf, raw.type, data, type, slab.n);
+        cfa_free(buf, buf_size);
+    }
+    return cfa_err;
+}
+
+/*
+write the overlap of a raw Fragment from data, in type, converting to the type
+and byte order of the file.  The file is created if it does not exist, and is
+truncated first if create is set
+*/
+int
+cfa_raw_write_frag(const int cfa_id, const int cfa_var_id,
+                   const Fragment *frag, const size_t *frag_start,
+                   const size_t *frag_count, const cfa_type type,
+                   const int create, const void *data)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    AggregationVariable *agg_var = NULL;
+    cfa_err = cfa_get_var(cfa_id, cfa_var_id, &agg_var);
+    CFA_CHECK(cfa_err);
+    char path[PATH_LENGTH];
+    RawAddress raw;
+    cfa_err = _cfa_raw_get_frag(agg_cont, frag, path, &raw);
+    CFA_CHECK(cfa_err);
+    RawSlab slab;
+    cfa_err = _cfa_raw_map_slab(&raw, frag, agg_var->cfa_ndim, frag_start,
+                                frag_count, NULL, &slab);
+    CFA_CHECK(cfa_err);
+    if (slab.n == 0)
+        return CFA_NOERR;
+
+    const unsigned char *src = data;
+    size_t buf_size = slab.n * slab.tsize;
+    unsigned char *buf = NULL;
+    int range_err = CFA_NOERR;
+    if (raw.type != type || raw.swap)
+    {
+        buf = cfa_malloc(buf_size);
+        if (!buf)
+            return CFA_MEM_ERR;
+        /* out of range values are written anyway, before the range error
+        is returned */
+        cfa_err = _cfa_convert(data, type, buf, raw.type, slab.n);
+        if (cfa_err == CFA_RANGE_ERR)
+        {
+            range_err = cfa_err;
+            cfa_err = CFA_NOERR;
+        }
+        if (cfa_err == CFA_NOERR && raw.swap)
+            _cfa_byteswap(buf, slab.n, slab.tsize);
+        src = buf;
+    }
+    int fd = -1;
+    if (cfa_err == CFA_NOERR)
+    {
+        fd = open(path, O_WRONLY | O_CREAT | (create ? O_TRUNC : 0), 0644);
+        if (fd == -1)
+            cfa_err = errno;
+    }
+    /* the rows of a write are contiguous in the last dimension */
+    size_t row = slab.ndim ? slab.count[slab.ndim-1] : 1;
+    size_t idx[MAX_DIMS] = {0};
+    size_t n = 0;
+    if (cfa_err == CFA_NOERR)
+        do
+        {
+            size_t len = row * slab.tsize;
+            off_t pos = raw.offset + _cfa_raw_row_offset(&slab, idx) *
+                        slab.tsize;
+            const unsigned char *s = src + n * slab.tsize;
+            while (len > 0 && cfa_err == CFA_NOERR)
+            {
+                ssize_t w = pwrite(fd, s, len, pos);
+                if (w == -1 && errno != EINTR)
+                    cfa_err = errno;
+                else if (w > 0)
+                {
+                    s += w;
+                    pos += w;
+                    len -= w;
+                }
+            }
+            n += row;
+        } while (cfa_err == CFA_NOERR && _cfa_raw_next_row(&slab, idx));
+    if (fd != -1 && close(fd) != 0 && cfa_err == CFA_NOERR)
+        cfa_err = errno;
+    if (buf)
+        cfa_free(buf, buf_size);
+    CFA_CHECK(cfa_err);
+    return range_err;
+}
+
+/*
+ask the kernel to start reading the whole of a raw Fragment, ahead of it being
+read
+*/
+int
+cfa_raw_prefetch(const int cfa_id, const Fragment *frag)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    char path[PATH_LENGTH];
+    RawAddress raw;
+    cfa_err = _cfa_raw_get_frag(agg_cont, frag, path, &raw);
+    CFA_CHECK(cfa_err);
+    /* without a shape the extent is not known here */
+    if (raw.ndim == -1)
+        return CFA_NOERR;
+    size_t len = get_type_size(raw.type);
+    for (int d=0; d<raw.ndim; d++)
+        len *= raw.shape[d];
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return errno;
+    posix_fadvise(fd, (off_t)(raw.offset), (off_t)(len), POSIX_FADV_WILLNEED);
+    close(fd);
+    return CFA_NOERR;
+}
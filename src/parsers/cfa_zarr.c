@@ -0,0 +1,840 @@
+/* pread */
+#define _POSIX_C_SOURCE 200809L
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "cfa.h"
+#include "cfa_mem.h"
+
+#define PATH_LENGTH 1024
+
+/*
+driver for Fragments in local Zarr v2 directory stores, with the "format"
+"zarr".  The "file" of a Fragment is the directory of the store and its
+"address" the path of the array in the store, which is empty for a store that
+is a single array.
+
+The .zarray metadata of an array is read once, and kept until cfa_close of the
+container it was last read for.  A
+read is mapped onto the chunks it covers, and the chunks are read and
+decompressed in parallel on the worker pool, each into the part of the output
+it covers.  Chunks that lie wholly inside a read, and are contiguous in the
+output, are decompressed straight into it.  Chunks that are missing are the
+fill_value of the array.  Chunks compressed with zlib or gzip are decompressed
+with zlib, and with blosc if libblosc can be loaded.  Filters, Fortran order
+and structured types are not supported
+*/
+
+extern pthread_mutex_t cfa_nc_lock;
+extern int _cfa_var_get_frag_datum(const Fragment*, const char*,
+                                   const FragmentDatum**);
+extern int _resolve_frag_write_path(const AggregationContainer*, const char*,
+                                    char*);
+extern int _map_frag_ndims(const int, const Fragment*, const int,
+                           const size_t*, const size_t*, const size_t*,
+                           size_t*, size_t*, ptrdiff_t*);
+extern int _cfa_parse_dtype(const char*, const char*, cfa_type*, int*);
+extern int get_type_size(const cfa_type);
+extern int _cfa_convert(const void*, const cfa_type, void*, const cfa_type,
+                        const size_t);
+extern int _cfa_unpack(const void*, const cfa_type, void*, const cfa_type,
+                       const size_t, const CFAPacking*);
+extern void _cfa_byteswap(void*, const size_t, const size_t);
+extern void _cfa_fill(void*, const void*, const size_t, const size_t);
+extern int _cfa_pool_run(const int, int (*)(void*, const int, const int),
+                         void*);
+
+/* number of arrays whose metadata is kept */
+#define CFA_ZARR_CACHE_SIZE 64
+/* maximum nesting of the values in the metadata */
+#define CFA_JSON_DEPTH 16
+
+typedef enum {
+    ZARR_NONE,
+    ZARR_ZLIB,              /* zlib and gzip */
+    ZARR_BLOSC
+} ZarrCompressor;
+
+/* the metadata of a Zarr array, from its .zarray */
+typedef struct {
+    int ndim;
+    size_t shape[MAX_DIMS];
+    size_t chunks[MAX_DIMS];
+    cfa_type type;
+    int swap;               /* the chunks are not in the byte order of the host */
+    size_t tsize;
+    ZarrCompressor compressor;
+    double fill;
+    char sep;               /* separator of the chunk indices in their keys */
+} ZarrMeta;
+
+/* an array, which is the handle of a Fragment between open and close */
+typedef struct {
+    char path[PATH_LENGTH];
+    ZarrMeta meta;
+    int cfa_id;             /* container the metadata was last read for */
+} ZarrArray;
+
+static pthread_mutex_t cfa_zarr_lock = PTHREAD_MUTEX_INITIALIZER;
+static ZarrArray *cfa_zarr_cache[CFA_ZARR_CACHE_SIZE];
+static int cfa_zarr_next = 0;
+static size_t cfa_zarr_meta_reads = 0;
+static size_t cfa_zarr_chunk_reads = 0;
+
+/* blosc_decompress_ctx, from libblosc if it can be loaded */
+typedef int (*blosc_decompress_fn)(const void*, void*, size_t, int);
+static pthread_once_t cfa_blosc_once = PTHREAD_ONCE_INIT;
+static blosc_decompress_fn cfa_blosc_decompress = NULL;
+
+static void
+_cfa_zarr_load_blosc(void)
+{
+    void *lib = dlopen("libblosc.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!lib)
+        lib = dlopen("libblosc.so", RTLD_NOW | RTLD_LOCAL);
+    if (lib)
+        *(void**)(&cfa_blosc_decompress) = dlsym(lib, "blosc_decompress_ctx");
+}
+
+/*
+skip the white space in JSON
+*/
+static const char*
+_json_ws(const char *p)
+{
+    while (p && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
+
+/*
+parse a JSON string into buf, of length len, if it is not NULL.  Escaped
+characters are copied without their backslash.  Returns the position after the
+string, or NULL if it is not a string
+*/
+static const char*
+_json_string(const char *p, char *buf, const size_t len)
+{
+    if (!p || *p != '"')
+        return NULL;
+    p++;
+    size_t n = 0;
+    while (*p && *p != '"')
+    {
+        if (*p == '\\' && !*(++p))
+            return NULL;
+        if (buf && n+1 < len)
+            buf[n++] = *p;
+        p++;
+    }
+    if (*p != '"')
+        return NULL;
+    if (buf)
+        buf[n] = '\0';
+    return p+1;
+}
+
+/*
+skip a JSON value, returning the position after it, or NULL if it is invalid
+*/
+static const char*
+_json_skip(const char *p, const int depth)
+{
+    p = _json_ws(p);
+    if (!p || depth > CFA_JSON_DEPTH)
+        return NULL;
+    if (*p == '"')
+        return _json_string(p, NULL, 0);
+    if (*p == '{' || *p == '[')
+    {
+        char close = *p == '{' ? '}' : ']';
+        p = _json_ws(p+1);
+        if (*p == close)
+            return p+1;
+        while (p)
+        {
+            if (close == '}')
+            {
+                p = _json_ws(_json_string(p, NULL, 0));
+                if (!p || *p != ':')
+                    return NULL;
+                p++;
+            }
+            p = _json_ws(_json_skip(p, depth+1));
+            if (!p)
+                return NULL;
+            if (*p == close)
+                return p+1;
+            if (*p != ',')
+                return NULL;
+            p = _json_ws(p+1);
+        }
+        return NULL;
+    }
+    /* numbers, true, false and null */
+    const char *s = p;
+    while (*p && strchr("+-.0123456789Eaeflnrstu", *p))
+        p++;
+    return p == s ? NULL : p;
+}
+
+/*
+parse a JSON array of unsigned integers, of at most MAX_DIMS values
+*/
+static const char*
+_json_size_array(const char *p, size_t *values, int *n)
+{
+    *n = 0;
+    if (*p != '[')
+        return NULL;
+    p = _json_ws(p+1);
+    if (*p == ']')
+        return p+1;
+    while (p && *n < MAX_DIMS)
+    {
+        if (*p < '0' || *p > '9')
+            return NULL;
+        char *end = NULL;
+        values[(*n)++] = strtoull(p, &end, 10);
+        p = _json_ws(end);
+        if (*p == ']')
+            return p+1;
+        if (*p != ',')
+            return NULL;
+        p = _json_ws(p+1);
+    }
+    return NULL;
+}
+
+/*
+parse the compressor of an array, which is null or an object with an "id"
+*/
+static const char*
+_cfa_zarr_parse_compressor(const char *p, ZarrMeta *meta)
+{
+    meta->compressor = ZARR_NONE;
+    if (strncmp(p, "null", 4) == 0)
+        return p+4;
+    if (*p != '{')
+        return NULL;
+    const char *end = _json_skip(p, 1);
+    p = _json_ws(p+1);
+    char id[32] = "";
+    while (p && p < end && *p != '}')
+    {
+        char key[32];
+        p = _json_ws(_json_string(p, key, sizeof(key)));
+        if (!p || *p != ':')
+            return NULL;
+        p = _json_ws(p+1);
+        if (strcmp(key, "id") == 0)
+            p = _json_string(p, id, sizeof(id));
+        else
+            p = _json_skip(p, 2);
+        p = _json_ws(p);
+        if (p && *p == ',')
+            p = _json_ws(p+1);
+    }
+    if (strcmp(id, "zlib") == 0 || strcmp(id, "gzip") == 0)
+        meta->compressor = ZARR_ZLIB;
+    else if (strcmp(id, "blosc") == 0)
+        meta->compressor = ZARR_BLOSC;
+    else
+        return NULL;
+    return end;
+}
+
+/*
+parse the .zarray metadata of an array
+*/
+int
+_cfa_zarr_parse_meta(const char *json, ZarrMeta *meta)
+{
+    memset(meta, 0, sizeof(ZarrMeta));
+    meta->ndim = -1;
+    meta->sep = '.';
+    int zarr_format = 0;
+    int n_chunks = -1;
+    int supported = 1;
+    const char *p = _json_ws(json);
+    if (*p != '{')
+        return CFA_ZARR_ERR;
+    p = _json_ws(p+1);
+    while (p && *p != '}')
+    {
+        char key[32];
+        char value[32] = "";
+        p = _json_ws(_json_string(p, key, sizeof(key)));
+        if (!p || *p != ':')
+            return CFA_ZARR_ERR;
+        p = _json_ws(p+1);
+        if (strcmp(key, "zarr_format") == 0)
+        {
+            zarr_format = atoi(p);
+            p = _json_skip(p, 1);
+        }
+        else if (strcmp(key, "shape") == 0)
+            p = _json_size_array(p, meta->shape, &(meta->ndim));
+        else if (strcmp(key, "chunks") == 0)
+            p = _json_size_array(p, meta->chunks, &n_chunks);
+        else if (strcmp(key, "dtype") == 0)
+        {
+            p = _json_string(p, value, sizeof(value));
+            if (p && _cfa_parse_dtype(value, value + strlen(value),
+                                      &(meta->type), &(meta->swap)))
+                supported = 0;
+        }
+        else if (strcmp(key, "compressor") == 0)
+        {
+            const char *next = _cfa_zarr_parse_compressor(p, meta);
+            if (!next)
+                supported = 0;
+            p = next ? next : _json_skip(p, 1);
+        }
+        else if (strcmp(key, "fill_value") == 0)
+        {
+            if (*p == '"')
+            {
+                p = _json_string(p, value, sizeof(value));
+                if (strcmp(value, "NaN") == 0)
+                    meta->fill = NAN;
+                else if (strcmp(value, "Infinity") == 0)
+                    meta->fill = INFINITY;
+                else if (strcmp(value, "-Infinity") == 0)
+                    meta->fill = -INFINITY;
+            }
+            else if (strncmp(p, "null", 4) == 0)
+                p += 4;
+            else
+            {
+                char *end = NULL;
+                meta->fill = strtod(p, &end);
+                p = end == p ? NULL : end;
+            }
+        }
+        else if (strcmp(key, "order") == 0)
+        {
+            p = _json_string(p, value, sizeof(value));
+            if (p && strcmp(value, "C") != 0)
+                supported = 0;
+        }
+        else if (strcmp(key, "filters") == 0)
+        {
+            const char *next = _json_skip(p, 1);
+            if (next && strncmp(p, "null", 4) != 0 &&
+                !(*p == '[' && *_json_ws(p+1) == ']'))
+                supported = 0;
+            p = next;
+        }
+        else if (strcmp(key, "dimension_separator") == 0)
+        {
+            p = _json_string(p, value, sizeof(value));
+            if (p && strcmp(value, ".") != 0 && strcmp(value, "/") != 0)
+                supported = 0;
+            meta->sep = value[0];
+        }
+        else
+            p = _json_skip(p, 1);
+        p = _json_ws(p);
+        if (p && *p == ',')
+            p = _json_ws(p+1);
+        else if (p && *p != '}')
+            p = NULL;
+    }
+    if (!p || zarr_format != 2 || !supported || meta->type == CFA_NAT ||
+        meta->ndim == -1 || n_chunks != meta->ndim)
+        return CFA_ZARR_ERR;
+    for (int d=0; d<meta->ndim; d++)
+        if (meta->chunks[d] == 0)
+            return CFA_ZARR_ERR;
+    meta->tsize = get_type_size(meta->type);
+    return CFA_NOERR;
+}
+
+/*
+read the whole of a file into a buffer, which is allocated with one more byte
+than the file, for a terminating zero.  *bufp is NULL if the file does not
+exist
+*/
+int
+_cfa_zarr_read_file(const char *path, unsigned char **bufp, size_t *sizep)
+{
+    *bufp = NULL;
+    *sizep = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return errno == ENOENT ? CFA_NOERR : errno;
+    int cfa_err = CFA_NOERR;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        cfa_err = errno;
+    else
+    {
+        *sizep = st.st_size;
+        *bufp = cfa_malloc(*sizep + 1);
+        if (!(*bufp))
+            cfa_err = CFA_MEM_ERR;
+    }
+    size_t got = 0;
+    while (cfa_err == CFA_NOERR && got < *sizep)
+    {
+        ssize_t r = pread(fd, *bufp + got, *sizep - got, got);
+        if (r == -1 && errno != EINTR)
+            cfa_err = errno;
+        else if (r == 0)
+            cfa_err = CFA_ZARR_ERR;
+        else if (r > 0)
+            got += r;
+    }
+    close(fd);
+    if (cfa_err && *bufp)
+    {
+        cfa_free(*bufp, *sizep + 1);
+        *bufp = NULL;
+    }
+    if (*bufp)
+        (*bufp)[*sizep] = '\0';
+    return cfa_err;
+}
+
+/*
+get the metadata of the array at path, for the AggregationContainer cfa_id,
+from the cache or by reading its .zarray
+*/
+int
+_cfa_zarr_get_meta(const int cfa_id, const char *path, ZarrMeta *meta)
+{
+    pthread_mutex_lock(&cfa_zarr_lock);
+    for (int c=0; c<CFA_ZARR_CACHE_SIZE; c++)
+        if (cfa_zarr_cache[c] && strcmp(cfa_zarr_cache[c]->path, path) == 0)
+        {
+            cfa_zarr_cache[c]->cfa_id = cfa_id;
+            *meta = cfa_zarr_cache[c]->meta;
+            pthread_mutex_unlock(&cfa_zarr_lock);
+            return CFA_NOERR;
+        }
+    pthread_mutex_unlock(&cfa_zarr_lock);
+
+    char meta_path[PATH_LENGTH];
+    snprintf(meta_path, PATH_LENGTH, "%s/.zarray", path);
+    unsigned char *json = NULL;
+    size_t size = 0;
+    int cfa_err = _cfa_zarr_read_file(meta_path, &json, &size);
+    CFA_CHECK(cfa_err);
+    if (!json)
+        return CFA_ZARR_ERR;
+    cfa_err = _cfa_zarr_parse_meta((const char*)(json), meta);
+    cfa_free(json, size + 1);
+    CFA_CHECK(cfa_err);
+
+    ZarrArray *arr = cfa_malloc(sizeof(ZarrArray));
+    if (!arr)
+        return CFA_MEM_ERR;
+    strncpy(arr->path, path, PATH_LENGTH-1);
+    arr->path[PATH_LENGTH-1] = '\0';
+    arr->meta = *meta;
+    arr->cfa_id = cfa_id;
+    pthread_mutex_lock(&cfa_zarr_lock);
+    cfa_zarr_meta_reads++;
+    ZarrArray **slot = &(cfa_zarr_cache[cfa_zarr_next]);
+    cfa_zarr_next = (cfa_zarr_next + 1) % CFA_ZARR_CACHE_SIZE;
+    if (*slot)
+        cfa_free(*slot, sizeof(ZarrArray));
+    *slot = arr;
+    pthread_mutex_unlock(&cfa_zarr_lock);
+    return CFA_NOERR;
+}
+
+/*
+resolve the path of the array of a Zarr Fragment, and get its metadata
+*/
+int
+cfa_zarr_open(const int cfa_id, const Fragment *frag, void **handlep)
+{
+    AggregationContainer *agg_cont = NULL;
+    int cfa_err = cfa_get(cfa_id, &agg_cont);
+    CFA_CHECK(cfa_err);
+    const FragmentDatum *file_dat = NULL;
+    cfa_err = _cfa_var_get_frag_datum(frag, "file", &file_dat);
+    if (cfa_err == CFA_VAR_FRAGDAT_NOT_FOUND)
+        return CFA_ZARR_ERR;
+    CFA_CHECK(cfa_err);
+    if (!file_dat->data || strlen((const char*)(file_dat->data)) == 0)
+        return CFA_ZARR_ERR;
+    const char *address = "";
+    const FragmentDatum *addr_dat = NULL;
+    if (_cfa_var_get_frag_datum(frag, "address", &addr_dat) == CFA_NOERR &&
+        addr_dat->data)
+        address = (const char*)(addr_dat->data);
+    while (address[0] == '/')
+        address++;
+
+    ZarrArray *arr = cfa_malloc(sizeof(ZarrArray));
+    if (!arr)
+        return CFA_MEM_ERR;
+    /* the path of a serialised AggregationContainer is asked of netCDF */
+    pthread_mutex_lock(&cfa_nc_lock);
+    cfa_err = _resolve_frag_write_path(agg_cont,
+                                       (const char*)(file_dat->data),
+                                       arr->path);
+    pthread_mutex_unlock(&cfa_nc_lock);
+    if (cfa_err == CFA_NOERR && address[0])
+    {
+        size_t len = strlen(arr->path);
+        snprintf(arr->path + len, PATH_LENGTH - len, "/%s", address);
+    }
+    if (cfa_err == CFA_NOERR)
+        cfa_err = _cfa_zarr_get_meta(cfa_id, arr->path, &(arr->meta));
+    if (cfa_err)
+    {
+        cfa_free(arr, sizeof(ZarrArray));
+        return cfa_err;
+    }
+    *handlep = arr;
+    return CFA_NOERR;
+}
+
+/*
+release the handle of a Zarr Fragment
+*/
+int
+cfa_zarr_close(void *handle)
+{
+    if (handle)
+        cfa_free(handle, sizeof(ZarrArray));
+    return CFA_NOERR;
+}
+
+/* state shared by the threads reading the chunks of a hyperslab */
+typedef struct {
+    const ZarrArray *arr;
+    size_t start[MAX_DIMS];
+    size_t count[MAX_DIMS];
+    ptrdiff_t stride[MAX_DIMS];
+    size_t c_lo[MAX_DIMS];      /* range of the chunk indices read */
+    size_t c_n[MAX_DIMS];
+    size_t out_stride[MAX_DIMS];
+    unsigned char *out;         /* in the type and byte order of the chunks */
+    unsigned char fill[8];      /* in the byte order of the chunks */
+} ZarrRead;
+
+/*
+decompress a chunk of n_dst bytes
+*/
+static int
+_cfa_zarr_decode(const ZarrMeta *meta, const unsigned char *src,
+                 const size_t n_src, unsigned char *dst, const size_t n_dst)
+{
+    switch (meta->compressor)
+    {
+        case ZARR_NONE:
+            if (n_src != n_dst)
+                return CFA_ZARR_ERR;
+            memcpy(dst, src, n_dst);
+            break;
+        case ZARR_ZLIB:
+        {
+            if (n_src > UINT_MAX || n_dst > UINT_MAX)
+                return CFA_ZARR_ERR;
+            z_stream zs;
+            memset(&zs, 0, sizeof(z_stream));
+            /* detect zlib and gzip headers */
+            if (inflateInit2(&zs, 32 + MAX_WBITS) != Z_OK)
+                return CFA_ZARR_ERR;
+            zs.next_in = (Bytef*)(src);
+            zs.avail_in = n_src;
+            zs.next_out = dst;
+            zs.avail_out = n_dst;
+            int zerr = inflate(&zs, Z_FINISH);
+            size_t n_out = zs.total_out;
+            inflateEnd(&zs);
+            if (zerr != Z_STREAM_END || n_out != n_dst)
+                return CFA_ZARR_ERR;
+            break;
+        }
+        case ZARR_BLOSC:
+            pthread_once(&cfa_blosc_once, _cfa_zarr_load_blosc);
+            if (!cfa_blosc_decompress || n_dst > INT_MAX ||
+                cfa_blosc_decompress(src, dst, n_dst, 1) != (int)(n_dst))
+                return CFA_ZARR_ERR;
+            break;
+    }
+    return CFA_NOERR;
+}
+
+/*
+copy the part of the hyperslab in chunk c out of the decompressed chunk, or
+fill it if chunk is NULL.  i_lo and i_n are the range of the hyperslab indices
+in the chunk
+*/
+static void
+_cfa_zarr_copy(const ZarrRead *zr, const size_t *c, const size_t *i_lo,
+               const size_t *i_n, const unsigned char *chunk)
+{
+    const ZarrMeta *meta = &(zr->arr->meta);
+    int ndim = meta->ndim;
+    size_t tsize = meta->tsize;
+    size_t chunk_stride[MAX_DIMS];
+    size_t n = 1;
+    for (int d=ndim-1; d>=0; d--)
+    {
+        chunk_stride[d] = n;
+        n *= meta->chunks[d];
+    }
+    size_t row = ndim ? i_n[ndim-1] : 1;
+    ptrdiff_t row_stride = ndim ? zr->stride[ndim-1] : 1;
+    size_t idx[MAX_DIMS] = {0};
+    while (1)
+    {
+        size_t src = 0;
+        size_t dst = 0;
+        for (int d=0; d<ndim; d++)
+        {
+            size_t i = i_lo[d] + idx[d];
+            dst += i * zr->out_stride[d];
+            src += (zr->start[d] + i * zr->stride[d] - c[d] * meta->chunks[d])
+                   * chunk_stride[d];
+        }
+        unsigned char *o = zr->out + dst * tsize;
+        if (!chunk)
+            _cfa_fill(o, zr->fill, row, tsize);
+        else if (row_stride == 1)
+            memcpy(o, chunk + src * tsize, row * tsize);
+        else
+            for (size_t k=0; k<row; k++)
+                memcpy(o + k * tsize, chunk + (src + k * row_stride) * tsize,
+                       tsize);
+        int d = ndim - 2;
+        for (; d>=0; d--)
+        {
+            if (++idx[d] < i_n[d])
+                break;
+            idx[d] = 0;
+        }
+        if (d < 0)
+            break;
+    }
+}
+
+/*
+read and decompress one chunk of a hyperslab into the output
+*/
+static int
+_cfa_zarr_read_chunk(void *arg, const int t, const int worker)
+{
+    (void)(worker);
+    const ZarrRead *zr = (const ZarrRead*)(arg);
+    const ZarrMeta *meta = &(zr->arr->meta);
+    int ndim = meta->ndim;
+
+    /* the chunk, and the range of the hyperslab indices inside it */
+    size_t c[MAX_DIMS];
+    size_t i_lo[MAX_DIMS];
+    size_t i_n[MAX_DIMS];
+    size_t rem = t;
+    for (int d=ndim-1; d>=0; d--)
+    {
+        c[d] = zr->c_lo[d] + rem % zr->c_n[d];
+        rem /= zr->c_n[d];
+    }
+    /* chunks wholly inside the hyperslab, and contiguous in the output, are
+    decompressed straight into it */
+    int direct = 1;
+    size_t n_chunk = 1;
+    for (int d=0; d<ndim; d++)
+    {
+        size_t c0 = c[d] * meta->chunks[d];
+        size_t c1 = c0 + meta->chunks[d];
+        size_t start = zr->start[d];
+        size_t stride = zr->stride[d];
+        size_t lo = c0 > start ? (c0 - start + stride - 1) / stride : 0;
+        size_t hi = c1 <= start ? 0 : (c1 - 1 - start) / stride + 1;
+        if (hi > zr->count[d])
+            hi = zr->count[d];
+        /* strided reads can step over a chunk */
+        if (lo >= hi)
+            return CFA_NOERR;
+        i_lo[d] = lo;
+        i_n[d] = hi - lo;
+        if (stride != 1 || i_n[d] != meta->chunks[d] ||
+            (d > 0 && zr->count[d] != meta->chunks[d]))
+            direct = 0;
+        n_chunk *= meta->chunks[d];
+    }
+
+    /* the key of the chunk is its indices joined by the separator */
+    char path[PATH_LENGTH];
+    int len = snprintf(path, PATH_LENGTH, "%s/", zr->arr->path);
+    for (int d=0; d<ndim && len < PATH_LENGTH - 1; d++)
+    {
+        if (d > 0)
+            path[len++] = meta->sep;
+        len += snprintf(path + len, PATH_LENGTH - len, "%zu", c[d]);
+    }
+    if (ndim == 0 && len < PATH_LENGTH)
+        len += snprintf(path + len, PATH_LENGTH - len, "0");
+    if (len >= PATH_LENGTH)
+        return CFA_ZARR_ERR;
+    unsigned char *src = NULL;
+    size_t n_src = 0;
+    int cfa_err = _cfa_zarr_read_file(path, &src, &n_src);
+    CFA_CHECK(cfa_err);
+    if (!src)
+    {
+        _cfa_zarr_copy(zr, c, i_lo, i_n, NULL);
+        return CFA_NOERR;
+    }
+    __atomic_add_fetch(&cfa_zarr_chunk_reads, 1, __ATOMIC_RELAXED);
+
+    size_t n_dst = n_chunk * meta->tsize;
+    if (direct)
+    {
+        size_t offset = ndim ? i_lo[0] * zr->out_stride[0] : 0;
+        cfa_err = _cfa_zarr_decode(meta, src, n_src,
+                                   zr->out + offset * meta->tsize, n_dst);
+    }
+    else if (meta->compressor == ZARR_NONE)
+    {
+        /* uncompressed chunks are copied from the file as it was read */
+        if (n_src != n_dst)
+            cfa_err = CFA_ZARR_ERR;
+        else
+            _cfa_zarr_copy(zr, c, i_lo, i_n, src);
+    }
+    else
+    {
+        unsigned char *chunk = cfa_malloc(n_dst);
+        if (!chunk)
+            cfa_err = CFA_MEM_ERR;
+        else
+        {
+            cfa_err = _cfa_zarr_decode(meta, src, n_src, chunk, n_dst);
+            if (cfa_err == CFA_NOERR)
+                _cfa_zarr_copy(zr, c, i_lo, i_n, chunk);
+            cfa_free(chunk, n_dst);
+        }
+    }
+    cfa_free(src, n_src + 1);
+    return cfa_err;
+}
+
+/*
+read the overlap of a Zarr Fragment into data, converting to type and, if
+unpack is not NULL, unpacking
+*/
+int
+cfa_zarr_read(void *handle, const int cfa_id, const Fragment *frag,
+              const int ndim, const size_t *frag_start,
+              const size_t *frag_count, const size_t *frag_stride,
+              const cfa_type type, const CFAPacking *unpack, void *data)
+{
+    (void)(cfa_id);
+    const ZarrArray *arr = (const ZarrArray*)(handle);
+    const ZarrMeta *meta = &(arr->meta);
+    ZarrRead zr;
+    memset(&zr, 0, sizeof(ZarrRead));
+    zr.arr = arr;
+
+    /* the shape of the array must be the shape of the Fragment, less any of
+    its dimensions of size 1 */
+    size_t zero[MAX_DIMS] = {0};
+    size_t span[MAX_DIMS];
+    size_t shape[MAX_DIMS];
+    for (int d=0; d<ndim; d++)
+        span[d] = frag->location[(d<<1)+1] - frag->location[d<<1];
+    int cfa_err = _map_frag_ndims(meta->ndim, frag, ndim, zero, span, NULL,
+                                  zr.start, shape, zr.stride);
+    CFA_CHECK(cfa_err);
+    for (int d=0; d<meta->ndim; d++)
+        if (shape[d] != meta->shape[d])
+            return CFA_FRAG_SHAPE_ERR;
+    cfa_err = _map_frag_ndims(meta->ndim, frag, ndim, frag_start, frag_count,
+                              frag_stride, zr.start, zr.count, zr.stride);
+    CFA_CHECK(cfa_err);
+
+    size_t n = 1;
+    int n_chunks = 1;
+    for (int d=meta->ndim-1; d>=0; d--)
+    {
+        if (zr.count[d] == 0)
+            return CFA_NOERR;
+        zr.out_stride[d] = n;
+        n *= zr.count[d];
+        size_t end = zr.start[d] + (zr.count[d] - 1) * zr.stride[d];
+        zr.c_lo[d] = zr.start[d] / meta->chunks[d];
+        zr.c_n[d] = end / meta->chunks[d] - zr.c_lo[d] + 1;
+        if (zr.c_n[d] > (size_t)(INT_MAX / n_chunks))
+            return CFA_ZARR_ERR;
+        n_chunks *= zr.c_n[d];
+    }
+    /* out of range fill values are converted anyway */
+    cfa_err = _cfa_convert(&(meta->fill), CFA_DOUBLE, zr.fill, meta->type, 1);
+    if (cfa_err && cfa_err != CFA_RANGE_ERR)
+        return cfa_err;
+    if (meta->swap)
+        _cfa_byteswap(zr.fill, 1, meta->tsize);
+
+    size_t out_size = n * meta->tsize;
+    zr.out = data;
+    if (meta->type != type || unpack)
+    {
+        zr.out = cfa_malloc(out_size);
+        if (!zr.out)
+            return CFA_MEM_ERR;
+    }
+    cfa_err = _cfa_pool_run(n_chunks, _cfa_zarr_read_chunk, &zr);
+    if (cfa_err == CFA_NOERR && meta->swap)
+        _cfa_byteswap(zr.out, n, meta->tsize);
+    if (zr.out != data)
+    {
+        if (cfa_err == CFA_NOERR && unpack)
+            cfa_err = _cfa_unpack(zr.out, meta->type, data, type, n, unpack);
+        else if (cfa_err == CFA_NOERR)
+            cfa_err = _cfa_convert(zr.out, meta->type, data, type, n);
+        cfa_free(zr.out, out_size);
+    }
+    return cfa_err;
+}
+
+/*
+forget the metadata of the arrays last read for the AggregationContainer
+cfa_id, so that it is read again.  Called by cfa_close
+*/
+int
+_cfa_zarr_drop(const int cfa_id)
+{
+    pthread_mutex_lock(&cfa_zarr_lock);
+    for (int c=0; c<CFA_ZARR_CACHE_SIZE; c++)
+        if (cfa_zarr_cache[c] && cfa_zarr_cache[c]->cfa_id == cfa_id)
+        {
+            cfa_free(cfa_zarr_cache[c], sizeof(ZarrArray));
+            cfa_zarr_cache[c] = NULL;
+        }
+    pthread_mutex_unlock(&cfa_zarr_lock);
+    return CFA_NOERR;
+}
+
+/*
+get the number of .zarray files read (meta_reads) and the number of chunks
+read (chunk_reads) by the Zarr driver
+*/
+int
+cfa_inq_zarr_stats(size_t *meta_readsp, size_t *chunk_readsp)
+{
+    pthread_mutex_lock(&cfa_zarr_lock);
+    *meta_readsp = cfa_zarr_meta_reads;
+    *chunk_readsp = __atomic_load_n(&cfa_zarr_chunk_reads, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cfa_zarr_lock);
+    return CFA_NOERR;
+}
@@ -0,0 +1,3086 @@
+#include <netcdf.h>
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cfa.h"
+
+const char* agg_path = "build/test_read.nc";
+const char* packed_path = "build/test_read_packed.nc";
+const char* sparse_path = "build/test_read_sparse.nc";
+const char* write_path = "build/test_write.nc";
+const char* stats_path = "build/test_read_stats.nc";
+const char* nc3_path = "build/test_read_nc3.nc";
+const char* nc3_frag_paths[2] = {"build/test_read_nc3_frag0.nc",
+                                 "build/test_read_nc3_frag1.nc"};
+const char* nc3_frag_files[2] = {"test_read_nc3_frag0.nc",
+                                 "test_read_nc3_frag1.nc"};
+const char* raw_path = "build/test_read_raw.nc";
+const char* raw_frag_paths[2] = {"build/test_read_raw_frag0.bin",
+                                 "build/test_read_raw_frag1.bin"};
+const char* raw_frag_files[2] = {"test_read_raw_frag0.bin",
+                                 "test_read_raw_frag1.bin"};
+const char* uneven_path = "build/test_read_uneven.nc";
+const char* uneven_frag_paths[4] = {"build/test_read_uneven_frag0.bin",
+                                    "build/test_read_uneven_frag1.bin",
+                                    "build/test_read_uneven_frag2.bin",
+                                    "build/test_read_uneven_frag3.bin"};
+const char* uneven_frag_files[4] = {"test_read_uneven_frag0.bin",
+                                    "test_read_uneven_frag1.bin",
+                                    "test_read_uneven_frag2.bin",
+                                    "test_read_uneven_frag3.bin"};
+const char* multi_path = "build/test_read_multi.nc";
+const char* zarr_path = "build/test_read_zarr.nc";
+const char* zarr_frag_paths[2] = {"build/test_read_zarr_frag0.zarr",
+                                  "build/test_read_zarr_frag1.zarr"};
+const char* zarr_frag_files[2] = {"test_read_zarr_frag0.zarr",
+                                  "test_read_zarr_frag1.zarr"};
+const char* frag_paths[2] = {"build/test_read_frag0.nc",
+                             "build/test_read_frag1.nc"};
+/* the "file" term is relative to the directory of the CFA-netCDF file */
+const char* frag_files[2] = {"test_read_frag0.nc", "test_read_frag1.nc"};
+
+#define NT 4
+#define NY 3
+#define NX 5
+
+/* coordinates of the dimensions, with latitude decreasing */
+const double time_coords[NT] = {0.0, 31.0, 59.0, 90.0};
+const double lat_coords[NY] = {60.0, 30.0, 0.0};
+const double lon_coords[NX] = {0.0, 72.0, 144.0, 216.0, 288.0};
+
+/* value of the AggregatedData at (t, y, x) */
+float
+expected_value(size_t t, size_t y, size_t x)
+{
+    return (float)(t * 100 + y * 10 + x);
+}
+
+void
+create_fragments(void)
+{
+    /* each fragment holds half of the time dimension */
+    int nc_id = -1;
+    int nc_dimids[3];
+    int nc_varid = -1;
+    float data[NT/2][NY][NX];
+    for (int f=0; f<2; f++)
+    {
+        int err = nc_create(frag_paths[f], NC_NETCDF4|NC_CLOBBER, &nc_id);
+        assert(err == NC_NOERR);
+        err = nc_def_dim(nc_id, "time", NT/2, nc_dimids);
+        assert(err == NC_NOERR);
+        err = nc_def_dim(nc_id, "latitude", NY, nc_dimids+1);
+        assert(err == NC_NOERR);
+        err = nc_def_dim(nc_id, "longitude", NX, nc_dimids+2);
+        assert(err == NC_NOERR);
+        err = nc_def_var(nc_id, "tas", NC_FLOAT, 3, nc_dimids, &nc_varid);
+        assert(err == NC_NOERR);
+        for (size_t t=0; t<NT/2; t++)
+            for (size_t y=0; y<NY; y++)
+                for (size_t x=0; x<NX; x++)
+                    data[t][y][x] = expected_value(f*NT/2 + t, y, x);
+        err = nc_put_var_float(nc_id, nc_varid, (float*)(data));
+        assert(err == NC_NOERR);
+        err = nc_close(nc_id);
+        assert(err == NC_NOERR);
+    }
+}
+
+/* write a CFA-netCDF file aggregating the Fragment files, with the packing
+defined if packed is set, and with no data for the second Fragment, and a
+_FillValue of -1, if sparse is set, and with the statistics of the Fragments if
+stats is set */
+void
+create_aggregation(const char *path, const int packed, const int sparse,
+                   const int stats)
+{
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int cfa_dimids[3];
+    int nc_id = -1;
+
+    int cfa_err = cfa_create(path, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "time", NT, CFA_DOUBLE, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "latitude", NY, CFA_DOUBLE, cfa_dimids+1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "longitude", NX, CFA_DOUBLE, cfa_dimids+2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_dim_put_coords(cfa_id, cfa_dimids[0], time_coords);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_dim_put_coords(cfa_id, cfa_dimids[1], lat_coords);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_dim_put_coords(cfa_id, cfa_dimids[2], lon_coords);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_var(cfa_id, "tas", CFA_FLOAT, &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_dims(cfa_id, cfa_var_id, 3, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+
+    /* add the aggregation instructions */
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "location",
+                                    "aggregation_location", false, CFA_INT);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "file",
+                                    "aggregation_file", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "format",
+                                    "aggregation_format", true, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "address",
+                                    "aggregation_address", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+
+    /* two Fragments along the time dimension */
+    const int frags[3] = {2, 1, 1};
+    cfa_err = cfa_var_def_frag_num(cfa_id, cfa_var_id, frags);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t f=0; f<2; f++)
+    {
+        size_t frag_location[3] = {f, 0, 0};
+        size_t data_location[6] = {f*NT/2, (f+1)*NT/2, 0, NY, 0, NX};
+        /* the statistics are computed before the CFA-netCDF file is written,
+        when the "file" of a Fragment is relative to the working directory */
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "file",
+                                           stats ? frag_paths[f] :
+                                                   frag_files[f]);
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "format", "nc");
+        assert(cfa_err == CFA_NOERR);
+        if (sparse && f == 1)
+            continue;
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "address", "tas");
+        assert(cfa_err == CFA_NOERR);
+    }
+
+    if (sparse)
+    {
+        const float fill_value = -1.0f;
+        cfa_err = cfa_var_def_fill(cfa_id, cfa_var_id, &fill_value);
+        assert(cfa_err == CFA_NOERR);
+    }
+    if (packed)
+    {
+        cfa_err = cfa_var_def_packing(cfa_id, cfa_var_id, CFA_DOUBLE, 0.5,
+                                      10.0);
+        assert(cfa_err == CFA_NOERR);
+    }
+
+    if (stats)
+    {
+        cfa_err = cfa_var_def_frag_stats(cfa_id, cfa_var_id);
+        assert(cfa_err == CFA_NOERR);
+    }
+
+    /* write the CFA-netCDF file */
+    cfa_err = nc_create(path, NC_NETCDF4|NC_CLOBBER, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_serialise(cfa_id, nc_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+}
+
+void
+test_cfa_var_get_vara(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+
+    /* load the CFA-netCDF file */
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* read the whole variable */
+    float data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                               CFA_FLOAT, data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+
+    /* read a hyperslab that spans both Fragments, converting to double */
+    double ddata[2][2][3];
+    size_t sstart[3] = {1, 1, 2};
+    size_t scount[3] = {2, 2, 3};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, sstart, scount,
+                               CFA_DOUBLE, ddata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<2; t++)
+        for (size_t y=0; y<2; y++)
+            for (size_t x=0; x<3; x++)
+                assert(ddata[t][y][x] ==
+                       expected_value(t+1, y+1, x+2));
+
+    /* read a hyperslab outside of the AggregatedDimensions */
+    size_t bstart[3] = {3, 0, 0};
+    size_t bcount[3] = {2, 1, 1};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, bstart, bcount,
+                               CFA_FLOAT, data);
+    assert(cfa_err == CFA_VAR_HYPERSLAB_ERR);
+
+    /* close and check the memory */
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_get_vara\n");
+}
+
+void
+test_cfa_var_get_vara_threads(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int nthreads = -1;
+
+    /* read the Fragments with a pool of threads */
+    int cfa_err = cfa_set_nthreads(4);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_nthreads(&nthreads);
+    assert(cfa_err == CFA_NOERR);
+    assert(nthreads == 4);
+    cfa_err = cfa_set_nthreads(0);
+    assert(cfa_err == CFA_THREAD_ERR);
+
+    cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* read the whole variable, repeatedly, to exercise the pool */
+    float data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    for (int i=0; i<16; i++)
+    {
+        memset(data, 0, sizeof(data));
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                                   CFA_FLOAT, data);
+        assert(cfa_err == CFA_NOERR);
+        for (size_t t=0; t<NT; t++)
+            for (size_t y=0; y<NY; y++)
+                for (size_t x=0; x<NX; x++)
+                    assert(data[t][y][x] == expected_value(t, y, x));
+    }
+
+    /* close, return to serial reads and check the memory */
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_nthreads(&nthreads);
+    assert(cfa_err == CFA_NOERR);
+    assert(nthreads == 1);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_get_vara_threads\n");
+}
+
+void
+test_cfa_handle_cache(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    size_t hits0, misses0, hits, misses;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    float data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+
+    /* the first read opens both Fragment files, the second reuses them */
+    cfa_err = cfa_inq_handle_cache_stats(&hits0, &misses0);
+    assert(cfa_err == CFA_NOERR);
+    for (int i=0; i<2; i++)
+    {
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                                   CFA_FLOAT, data);
+        assert(cfa_err == CFA_NOERR);
+    }
+    cfa_err = cfa_inq_handle_cache_stats(&hits, &misses);
+    assert(cfa_err == CFA_NOERR);
+    assert(misses - misses0 == 2);
+    assert(hits - hits0 == 2);
+
+    /* closing another container leaves the files of this one open */
+    int cfa_id2 = -1;
+    cfa_err = cfa_create("build/test_read_other.nc", CFA_NETCDF, &cfa_id2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_close(cfa_id2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                               CFA_FLOAT, data);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_handle_cache_stats(&hits, &misses);
+    assert(cfa_err == CFA_NOERR);
+    assert(misses - misses0 == 2);
+    assert(hits - hits0 == 4);
+
+    /* with room for one file, the files evict each other */
+    cfa_err = cfa_set_handle_cache_size(1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_handle_cache_stats(&hits0, &misses0);
+    assert(cfa_err == CFA_NOERR);
+    for (int i=0; i<2; i++)
+    {
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                                   CFA_FLOAT, data);
+        assert(cfa_err == CFA_NOERR);
+    }
+    cfa_err = cfa_inq_handle_cache_stats(&hits, &misses);
+    assert(cfa_err == CFA_NOERR);
+    assert(misses - misses0 == 4);
+    assert(hits == hits0);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+
+    /* disable the cache */
+    cfa_err = cfa_set_handle_cache_size(-1);
+    assert(cfa_err == CFA_HANDLE_CACHE_ERR);
+    cfa_err = cfa_set_handle_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                               CFA_FLOAT, data);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_handle_cache_stats(&hits0, &misses0);
+    assert(cfa_err == CFA_NOERR);
+    assert(hits0 == hits && misses0 == misses);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_handle_cache\n");
+}
+
+void
+test_cfa_data_cache(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    size_t hits0, misses0, hits, misses, nbytes;
+    const size_t frag_size = sizeof(float) * NT/2 * NY * NX;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* room for both Fragments */
+    cfa_err = cfa_set_data_cache_size(2 * frag_size);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_data_cache_stats(&hits0, &misses0, &nbytes);
+    assert(cfa_err == CFA_NOERR);
+    assert(nbytes == 0);
+
+    /* the first read fills the cache, the hyperslab is served from it */
+    float data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                               CFA_FLOAT, data);
+    assert(cfa_err == CFA_NOERR);
+    float sdata[2][2][3];
+    size_t sstart[3] = {1, 1, 2};
+    size_t scount[3] = {2, 2, 3};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, sstart, scount,
+                               CFA_FLOAT, sdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<2; t++)
+        for (size_t y=0; y<2; y++)
+            for (size_t x=0; x<3; x++)
+                assert(sdata[t][y][x] == expected_value(t+1, y+1, x+2));
+    cfa_err = cfa_inq_data_cache_stats(&hits, &misses, &nbytes);
+    assert(cfa_err == CFA_NOERR);
+    assert(misses - misses0 == 2);
+    assert(hits - hits0 == 2);
+    assert(nbytes == 2 * frag_size);
+
+    /* shrinking the cache evicts a Fragment */
+    cfa_err = cfa_set_data_cache_size(frag_size);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_data_cache_stats(&hits, &misses, &nbytes);
+    assert(cfa_err == CFA_NOERR);
+    assert(nbytes == frag_size);
+
+    /* cfa_close frees the cached data */
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_data_cache_stats(&hits, &misses, &nbytes);
+    assert(cfa_err == CFA_NOERR);
+    assert(nbytes == 0);
+    cfa_err = cfa_set_data_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_data_cache\n");
+}
+
+void
+test_cfa_prefetch(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    size_t issued, hits, cache_hits, cache_misses, nbytes;
+    const size_t frag_size = sizeof(float) * NT/2 * NY * NX;
+
+    /* read-ahead needs the data cache and a worker thread */
+    int cfa_err = cfa_set_prefetch(-1, 0);
+    assert(cfa_err == CFA_PREFETCH_ERR);
+    cfa_err = cfa_set_prefetch(1, 0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_data_cache_size(2 * frag_size);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_nthreads(2);
+    assert(cfa_err == CFA_NOERR);
+
+    cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* walk along time, one time step at a time.  The second step is in the
+    first Fragment and is sequential, so the second Fragment is read ahead */
+    float data[NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {1, NY, NX};
+    for (size_t t=0; t<NT/2; t++)
+    {
+        start[0] = t;
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                                   CFA_FLOAT, data);
+        assert(cfa_err == CFA_NOERR);
+    }
+    cfa_err = cfa_inq_prefetch_stats(&issued, &hits);
+    assert(cfa_err == CFA_NOERR);
+    assert(issued == 1);
+    assert(hits == 0);
+
+    /* wait for the second Fragment to arrive in the cache */
+    nbytes = 0;
+    while (nbytes < 2 * frag_size)
+    {
+        cfa_err = cfa_inq_data_cache_stats(&cache_hits, &cache_misses,
+                                           &nbytes);
+        assert(cfa_err == CFA_NOERR);
+    }
+
+    /* the rest of the walk is served by the read-ahead */
+    for (size_t t=NT/2; t<NT; t++)
+    {
+        start[0] = t;
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                                   CFA_FLOAT, data);
+        assert(cfa_err == CFA_NOERR);
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[y][x] == expected_value(t, y, x));
+    }
+    cfa_err = cfa_inq_prefetch_stats(&issued, &hits);
+    assert(cfa_err == CFA_NOERR);
+    assert(issued == 1);
+    assert(hits == 1);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_set_prefetch(0, 0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_data_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_prefetch\n");
+}
+
+void
+test_cfa_var_get_vars(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    size_t hits0, misses0, hits, misses, nbytes;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* every 3rd time, 2nd latitude and 2nd longitude, read from the Fragment
+    files and then from the data cache */
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {2, 2, 3};
+    size_t stride[3] = {3, 2, 2};
+    for (int cached=0; cached<2; cached++)
+    {
+        if (cached)
+        {
+            cfa_err = cfa_set_data_cache_size(sizeof(double) * NT * NY * NX);
+            assert(cfa_err == CFA_NOERR);
+            cfa_err = cfa_inq_data_cache_stats(&hits0, &misses0, &nbytes);
+            assert(cfa_err == CFA_NOERR);
+        }
+        double data[2][2][3];
+        cfa_err = cfa_var_get_vars(cfa_id, cfa_var_id, start, count, stride,
+                                   CFA_DOUBLE, data);
+        assert(cfa_err == CFA_NOERR);
+        for (size_t t=0; t<2; t++)
+            for (size_t y=0; y<2; y++)
+                for (size_t x=0; x<3; x++)
+                    assert(data[t][y][x] == expected_value(t*3, y*2, x*2));
+    }
+    cfa_err = cfa_inq_data_cache_stats(&hits, &misses, &nbytes);
+    assert(cfa_err == CFA_NOERR);
+    assert(misses - misses0 == 2);
+
+    /* the selection is inside the first Fragment, which is cached */
+    size_t fstart[3] = {1, 0, 1};
+    size_t fcount[3] = {1, 3, 2};
+    size_t fstride[3] = {4, 1, 3};
+    double fdata[3][2];
+    cfa_err = cfa_var_get_vars(cfa_id, cfa_var_id, fstart, fcount, fstride,
+                               CFA_DOUBLE, fdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t y=0; y<3; y++)
+        for (size_t x=0; x<2; x++)
+            assert(fdata[y][x] == expected_value(1, y, 1+x*3));
+    cfa_err = cfa_inq_data_cache_stats(&hits0, &misses0, &nbytes);
+    assert(cfa_err == CFA_NOERR);
+    assert(hits0 - hits == 1 && misses0 == misses);
+
+    /* a zero stride, and a stride that leaves the variable, are errors */
+    size_t zstride[3] = {0, 1, 1};
+    cfa_err = cfa_var_get_vars(cfa_id, cfa_var_id, start, count, zstride,
+                               CFA_DOUBLE, fdata);
+    assert(cfa_err == CFA_VAR_HYPERSLAB_ERR);
+    size_t bstride[3] = {4, 1, 1};
+    cfa_err = cfa_var_get_vars(cfa_id, cfa_var_id, start, count, bstride,
+                               CFA_DOUBLE, fdata);
+    assert(cfa_err == CFA_VAR_HYPERSLAB_ERR);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_data_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_get_vars\n");
+}
+
+void
+test_cfa_var_get_points(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    CFAReadPath path;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* points in both Fragments, out of order and with a repeat, read from the
+    Fragment files on two threads and then from the data cache */
+    const size_t points[6][3] = {{3, 2, 4}, {0, 0, 0}, {2, 1, 3},
+                                 {1, 2, 0}, {3, 0, 0}, {0, 0, 0}};
+    size_t frag_location[3] = {1, 0, 0};
+    cfa_err = cfa_set_nthreads(2);
+    assert(cfa_err == CFA_NOERR);
+    for (int cached=0; cached<2; cached++)
+    {
+        if (cached)
+        {
+            cfa_err = cfa_set_data_cache_size(sizeof(double) * NT * NY * NX);
+            assert(cfa_err == CFA_NOERR);
+        }
+        double data[6];
+        cfa_err = cfa_var_get_points(cfa_id, cfa_var_id, 6,
+                                     (const size_t*)(points), CFA_DOUBLE,
+                                     data);
+        assert(cfa_err == CFA_NOERR);
+        for (int p=0; p<6; p++)
+            assert(data[p] == expected_value(points[p][0], points[p][1],
+                                             points[p][2]));
+        cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location,
+                                        NULL, &path);
+        assert(cfa_err == CFA_NOERR);
+        assert(path == (cached ? CFA_READ_CACHED : CFA_READ_STAGED));
+    }
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+
+    /* a point outside the variable is an error */
+    const size_t bad[2][3] = {{0, 0, 0}, {0, NY, 0}};
+    float fdata[2];
+    cfa_err = cfa_var_get_points(cfa_id, cfa_var_id, 2,
+                                 (const size_t*)(bad), CFA_FLOAT, fdata);
+    assert(cfa_err == CFA_VAR_HYPERSLAB_ERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_data_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* points in a Fragment with no data are the fill value */
+    cfa_err = nc_open(sparse_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(sparse_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    float sdata[6];
+    cfa_err = cfa_var_get_points(cfa_id, cfa_var_id, 6,
+                                 (const size_t*)(points), CFA_FLOAT, sdata);
+    assert(cfa_err == CFA_NOERR);
+    for (int p=0; p<6; p++)
+        assert(sdata[p] == (points[p][0] < NT/2 ?
+                            expected_value(points[p][0], points[p][1],
+                                           points[p][2]) : -1.0f));
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_get_points\n");
+}
+
+void
+test_cfa_var_get_series(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    CFAReadPath path;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* the whole time series at one cell, and part of it, across both
+    Fragments on two threads */
+    cfa_err = cfa_set_nthreads(2);
+    assert(cfa_err == CFA_NOERR);
+    size_t index[3] = {0, 1, 3};
+    double data[NT];
+    cfa_err = cfa_var_get_series(cfa_id, cfa_var_id, index, 0, NT, CFA_DOUBLE,
+                                 data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        assert(data[t] == expected_value(t, 1, 3));
+    size_t frag_location[3] = {1, 0, 0};
+    cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location, NULL,
+                                    &path);
+    assert(cfa_err == CFA_NOERR && path == CFA_READ_ZERO_COPY);
+    index[0] = 1;
+    float fdata[NX];
+    cfa_err = cfa_var_get_series(cfa_id, cfa_var_id, index, 0, 2, CFA_FLOAT,
+                                 fdata);
+    assert(cfa_err == CFA_NOERR);
+    assert(fdata[0] == expected_value(1, 1, 3) &&
+           fdata[1] == expected_value(2, 1, 3));
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+
+    /* a series along longitude, inside a single Fragment */
+    size_t lindex[3] = {2, 0, 0};
+    cfa_err = cfa_var_get_series(cfa_id, cfa_var_id, lindex, 2, NX, CFA_FLOAT,
+                                 fdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t x=0; x<NX; x++)
+        assert(fdata[x] == expected_value(2, 0, x));
+
+    /* a dimension that the variable does not have, and a series that leaves
+    the variable, are errors */
+    cfa_err = cfa_var_get_series(cfa_id, cfa_var_id, lindex, 3, 1, CFA_FLOAT,
+                                 fdata);
+    assert(cfa_err == CFA_DIM_NOT_FOUND_ERR);
+    cfa_err = cfa_var_get_series(cfa_id, cfa_var_id, index, 0, NT, CFA_FLOAT,
+                                 fdata);
+    assert(cfa_err == CFA_VAR_HYPERSLAB_ERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* the run in a Fragment with no data is the fill value */
+    cfa_err = nc_open(sparse_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(sparse_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    index[0] = 0;
+    cfa_err = cfa_var_get_series(cfa_id, cfa_var_id, index, 0, NT, CFA_DOUBLE,
+                                 data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        assert(data[t] == (t < NT/2 ? expected_value(t, 1, 3) : -1.0));
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_get_series\n");
+}
+
+void
+test_cfa_var_get_vara_multi(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_ids[2];
+    int cfa_dimids[3];
+    const char *names[2] = {"tas", "tas_copy"};
+
+    /* two variables with the same Fragment files, read as different types */
+    int cfa_err = cfa_create(multi_path, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "time", NT, CFA_DOUBLE, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "latitude", NY, CFA_DOUBLE, cfa_dimids+1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "longitude", NX, CFA_DOUBLE, cfa_dimids+2);
+    assert(cfa_err == CFA_NOERR);
+    for (int v=0; v<2; v++)
+    {
+        cfa_err = cfa_def_var(cfa_id, names[v], CFA_FLOAT, &(cfa_var_ids[v]));
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_def_dims(cfa_id, cfa_var_ids[v], 3, cfa_dimids);
+        assert(cfa_err == CFA_NOERR);
+        /* the serialiser writes the instructions of each variable to its own
+        variables */
+        const char *terms[4] = {"location", "file", "format", "address"};
+        const cfa_type types[4] = {CFA_INT, CFA_STRING, CFA_STRING,
+                                   CFA_STRING};
+        for (int i=0; i<4; i++)
+        {
+            char instr[64];
+            snprintf(instr, sizeof(instr), "aggregation_%s%s", terms[i],
+                     v ? "_copy" : "");
+            cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_ids[v], terms[i],
+                                            instr, i == 2, types[i]);
+            assert(cfa_err == CFA_NOERR);
+        }
+        const int frags[3] = {2, 1, 1};
+        cfa_err = cfa_var_def_frag_num(cfa_id, cfa_var_ids[v], frags);
+        assert(cfa_err == CFA_NOERR);
+        for (size_t f=0; f<2; f++)
+        {
+            size_t frag_location[3] = {f, 0, 0};
+            size_t data_location[6] = {f*NT/2, (f+1)*NT/2, 0, NY, 0, NX};
+            cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_ids[v],
+                                               frag_location, data_location,
+                                               "file", frag_files[f]);
+            assert(cfa_err == CFA_NOERR);
+            cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_ids[v],
+                                               frag_location, data_location,
+                                               "format", "nc");
+            assert(cfa_err == CFA_NOERR);
+            cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_ids[v],
+                                               frag_location, data_location,
+                                               "address", "tas");
+            assert(cfa_err == CFA_NOERR);
+        }
+    }
+    cfa_err = nc_create(multi_path, NC_NETCDF4|NC_CLOBBER, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_serialise(cfa_id, nc_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    cfa_err = nc_open(multi_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(multi_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    for (int v=0; v<2; v++)
+    {
+        cfa_err = cfa_inq_var_id(cfa_id, names[v], &(cfa_var_ids[v]));
+        assert(cfa_err == CFA_NOERR);
+    }
+
+    /* with a single file kept open, each file is opened once, where reading
+    the variables one at a time would open each file twice */
+    cfa_err = cfa_set_handle_cache_size(1);
+    assert(cfa_err == CFA_NOERR);
+    size_t hits0 = 0;
+    size_t misses0 = 0;
+    cfa_err = cfa_inq_handle_cache_stats(&hits0, &misses0);
+    assert(cfa_err == CFA_NOERR);
+    float data[NT][NY][NX];
+    double ddata[NT-1][NY][2];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    size_t dstart[3] = {1, 0, 3};
+    size_t dcount[3] = {NT-1, NY, 2};
+    CFAVarRead reads[2] = {
+        {cfa_var_ids[0], start, count, CFA_FLOAT, data},
+        {cfa_var_ids[1], dstart, dcount, CFA_DOUBLE, ddata}
+    };
+    cfa_err = cfa_var_get_vara_multi(cfa_id, 2, reads);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+    for (size_t t=0; t<NT-1; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<2; x++)
+                assert(ddata[t][y][x] == expected_value(t+1, y, x+3));
+    size_t hits = 0;
+    size_t misses = 0;
+    cfa_err = cfa_inq_handle_cache_stats(&hits, &misses);
+    assert(cfa_err == CFA_NOERR);
+    assert(misses - misses0 == 2 && hits - hits0 == 2);
+
+    /* the variables are checked as in cfa_var_get_vara */
+    reads[1].count = count;
+    cfa_err = cfa_var_get_vara_multi(cfa_id, 2, reads);
+    assert(cfa_err == CFA_VAR_HYPERSLAB_ERR);
+    cfa_err = cfa_set_handle_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_get_vara_multi\n");
+}
+
+void
+test_cfa_var_get_vara_halo(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* a tile in the first Fragment, with a halo across into the second along
+    time, and wrapping around longitude, on two threads */
+    cfa_err = cfa_set_nthreads(2);
+    assert(cfa_err == CFA_NOERR);
+    size_t start[3] = {1, 1, 1};
+    size_t count[3] = {1, 1, 3};
+    size_t halo[3] = {1, 1, 2};
+    int periodic[3] = {0, 0, 1};
+    double data[3][3][7];
+    cfa_err = cfa_var_get_vara_halo(cfa_id, cfa_var_id, start, count, halo,
+                                    periodic, CFA_DOUBLE, data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<3; t++)
+        for (size_t y=0; y<3; y++)
+            for (size_t x=0; x<7; x++)
+                assert(data[t][y][x] == expected_value(t, y, (x + NX - 1) % NX));
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+
+    /* a periodic halo longer than the dimension is an error */
+    size_t lhalo[3] = {0, 0, NX+1};
+    cfa_err = cfa_var_get_vara_halo(cfa_id, cfa_var_id, start, count, lhalo,
+                                    periodic, CFA_DOUBLE, data);
+    assert(cfa_err == CFA_VAR_HYPERSLAB_ERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* the halo beyond the ends of dimensions that are not periodic, and over
+    a Fragment with no data, is the fill value */
+    cfa_err = nc_open(sparse_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(sparse_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    size_t fstart[3] = {0, 0, NX-1};
+    size_t fcount[3] = {NT, NY, 1};
+    size_t fhalo[3] = {1, 0, 1};
+    float fdata[NT+2][NY][3];
+    cfa_err = cfa_var_get_vara_halo(cfa_id, cfa_var_id, fstart, fcount, fhalo,
+                                    NULL, CFA_FLOAT, fdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT+2; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<3; x++)
+                if (t == 0 || t > NT/2 || x == 2)
+                    assert(fdata[t][y][x] == -1.0f);
+                else
+                    assert(fdata[t][y][x] == expected_value(t-1, y, NX-2+x));
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_get_vara_halo\n");
+}
+
+void
+test_cfa_var_get_vara_perm(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* the whole variable in (lon, lat, time) order, staged on two threads */
+    cfa_err = cfa_set_nthreads(2);
+    assert(cfa_err == CFA_NOERR);
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    int perm[3] = {2, 1, 0};
+    double data[NX][NY][NT];
+    cfa_err = cfa_var_get_vara_perm(cfa_id, cfa_var_id, start, count, perm,
+                                    CFA_DOUBLE, data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t x=0; x<NX; x++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t t=0; t<NT; t++)
+                assert(data[x][y][t] == expected_value(t, y, x));
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+
+    /* a hyperslab with the last two dimensions swapped, transposed out of
+    the data cache */
+    cfa_err = cfa_set_data_cache_size(sizeof(float) * NT * NY * NX);
+    assert(cfa_err == CFA_NOERR);
+    size_t sstart[3] = {1, 1, 1};
+    size_t scount[3] = {2, 2, 3};
+    int sperm[3] = {0, 2, 1};
+    float sdata[2][3][2];
+    cfa_err = cfa_var_get_vara_perm(cfa_id, cfa_var_id, sstart, scount, sperm,
+                                    CFA_FLOAT, sdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<2; t++)
+        for (size_t x=0; x<3; x++)
+            for (size_t y=0; y<2; y++)
+                assert(sdata[t][x][y] == expected_value(t+1, y+1, x+1));
+    size_t frag_location[3] = {0, 0, 0};
+    CFAReadPath path;
+    cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location, NULL,
+                                    &path);
+    assert(cfa_err == CFA_NOERR && path == CFA_READ_CACHED);
+    cfa_err = cfa_set_data_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+
+    /* swapping the outer dimensions copies whole rows */
+    int rperm[3] = {1, 0, 2};
+    float rdata[2][2][3];
+    cfa_err = cfa_var_get_vara_perm(cfa_id, cfa_var_id, sstart, scount, rperm,
+                                    CFA_FLOAT, rdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t y=0; y<2; y++)
+        for (size_t t=0; t<2; t++)
+            for (size_t x=0; x<3; x++)
+                assert(rdata[y][t][x] == expected_value(t+1, y+1, x+1));
+
+    /* a dimension repeated, or out of range, is not a permutation */
+    int bperm[3] = {0, 0, 1};
+    cfa_err = cfa_var_get_vara_perm(cfa_id, cfa_var_id, sstart, scount, bperm,
+                                    CFA_FLOAT, rdata);
+    assert(cfa_err == CFA_PERM_ERR);
+    bperm[1] = 3;
+    cfa_err = cfa_var_get_vara_perm(cfa_id, cfa_var_id, sstart, scount, bperm,
+                                    CFA_FLOAT, rdata);
+    assert(cfa_err == CFA_PERM_ERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* a Fragment with no data is filled in the permuted order */
+    cfa_err = nc_open(sparse_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(sparse_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    float fdata[NX][NY][NT];
+    cfa_err = cfa_var_get_vara_perm(cfa_id, cfa_var_id, start, count, perm,
+                                    CFA_FLOAT, fdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t x=0; x<NX; x++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t t=0; t<NT; t++)
+                if (t >= NT/2)
+                    assert(fdata[x][y][t] == -1.0f);
+                else
+                    assert(fdata[x][y][t] == expected_value(t, y, x));
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_get_vara_perm\n");
+}
+
+void
+test_cfa_read_path(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    CFAReadPath path;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    size_t frag_location[2][3] = {{0, 0, 0}, {1, 0, 0}};
+    cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location[0],
+                                    NULL, &path);
+    assert(cfa_err == CFA_NOERR && path == CFA_READ_NONE);
+
+    /* the Fragments only split the time dimension, so each one is a
+    contiguous part of a read of whole time steps */
+    double data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_DOUBLE,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+    for (int f=0; f<2; f++)
+    {
+        cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location[f],
+                                        NULL, &path);
+        assert(cfa_err == CFA_NOERR && path == CFA_READ_ZERO_COPY);
+    }
+
+    /* the overlaps of a latitude band are contiguous in the output too */
+    size_t lstart[3] = {1, 1, 0};
+    size_t lcount[3] = {2, 1, NX};
+    double ldata[2][1][NX];
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, lstart, lcount, CFA_DOUBLE,
+                               ldata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<2; t++)
+        for (size_t x=0; x<NX; x++)
+            assert(ldata[t][0][x] == expected_value(1+t, 1, x));
+    for (int f=0; f<2; f++)
+    {
+        cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location[f],
+                                        NULL, &path);
+        assert(cfa_err == CFA_NOERR && path == CFA_READ_ZERO_COPY);
+    }
+
+    /* a single time step from each Fragment is contiguous, even when strided
+    */
+    size_t sstart[3] = {1, 0, 0};
+    size_t scount[3] = {2, NY, NX};
+    size_t sstride[3] = {2, 1, 1};
+    cfa_err = cfa_var_get_vars(cfa_id, cfa_var_id, sstart, scount, sstride,
+                               CFA_DOUBLE, data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<2; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(1+t*2, y, x));
+    for (int f=0; f<2; f++)
+    {
+        cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location[f],
+                                        NULL, &path);
+        assert(cfa_err == CFA_NOERR && path == CFA_READ_ZERO_COPY);
+    }
+
+    /* the data cache takes precedence */
+    cfa_err = cfa_set_data_cache_size(sizeof(double) * NT * NY * NX);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_DOUBLE,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location[1],
+                                    NULL, &path);
+    assert(cfa_err == CFA_NOERR && path == CFA_READ_CACHED);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_data_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_read_path\n");
+}
+
+void
+test_cfa_read_convert(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* the Fragments are float, read them as every type that holds their
+    values */
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    union {
+        short s[NT*NY*NX];
+        int i[NT*NY*NX];
+        float f[NT*NY*NX];
+        double d[NT*NY*NX];
+        unsigned short us[NT*NY*NX];
+        unsigned int ui[NT*NY*NX];
+        long long ll[NT*NY*NX];
+        unsigned long long ull[NT*NY*NX];
+    } data;
+    const cfa_type types[8] = {CFA_SHORT, CFA_INT, CFA_FLOAT, CFA_DOUBLE,
+                               CFA_USHORT, CFA_UINT, CFA_INT64, CFA_UINT64};
+    for (int tp=0; tp<8; tp++)
+    {
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, types[tp],
+                                   &data);
+        assert(cfa_err == CFA_NOERR);
+        for (size_t t=0; t<NT; t++)
+            for (size_t y=0; y<NY; y++)
+                for (size_t x=0; x<NX; x++)
+                {
+                    size_t i = (t * NY + y) * NX + x;
+                    double v = 0.0;
+                    switch (types[tp])
+                    {
+                        case CFA_SHORT: v = data.s[i]; break;
+                        case CFA_INT: v = data.i[i]; break;
+                        case CFA_FLOAT: v = data.f[i]; break;
+                        case CFA_DOUBLE: v = data.d[i]; break;
+                        case CFA_USHORT: v = data.us[i]; break;
+                        case CFA_UINT: v = data.ui[i]; break;
+                        case CFA_INT64: v = data.ll[i]; break;
+                        case CFA_UINT64: v = data.ull[i]; break;
+                    }
+                    assert(v == expected_value(t, y, x));
+                }
+    }
+
+    /* the later time steps do not fit in a byte, and floats cannot be read as
+    characters */
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_BYTE,
+                               &data);
+    assert(cfa_err == CFA_RANGE_ERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_UBYTE,
+                               &data);
+    assert(cfa_err == CFA_RANGE_ERR);
+    count[0] = 1;
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_UBYTE,
+                               &data);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_CHAR,
+                               &data);
+    assert(cfa_err == CFA_NAT_ERR);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_read_convert\n");
+}
+
+void
+test_cfa_unpack(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+
+    create_aggregation(packed_path, 1, 0, 0);
+    int cfa_err = nc_open(packed_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(packed_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* the packing is read from the attributes */
+    CFAPacking *packing = NULL;
+    cfa_err = cfa_var_get_packing(cfa_id, cfa_var_id, &packing);
+    assert(cfa_err == CFA_NOERR);
+    assert(packing->packed && packing->type == CFA_DOUBLE);
+    assert(packing->scale_factor == 0.5 && packing->add_offset == 10.0);
+
+    /* the packed data is read unless unpacking is switched on, with the data
+    cache on to check that packed and unpacked data are not mixed up */
+    cfa_err = cfa_set_data_cache_size(sizeof(double) * NT * NY * NX);
+    assert(cfa_err == CFA_NOERR);
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    double data[NT][NY][NX];
+    float fdata[NT][NY][NX];
+    for (int unpack=0; unpack<2; unpack++)
+    {
+        cfa_err = cfa_var_set_unpack(cfa_id, cfa_var_id, unpack);
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                                   CFA_DOUBLE, data);
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count,
+                                   CFA_FLOAT, fdata);
+        assert(cfa_err == CFA_NOERR);
+        for (size_t t=0; t<NT; t++)
+            for (size_t y=0; y<NY; y++)
+                for (size_t x=0; x<NX; x++)
+                {
+                    double v = expected_value(t, y, x);
+                    if (unpack)
+                        v = v * 0.5 + 10.0;
+                    assert(data[t][y][x] == v && fdata[t][y][x] == v);
+                }
+    }
+
+    /* unpacked data cannot be read as an integer */
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_INT,
+                               data);
+    assert(cfa_err == CFA_NAT_ERR);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_data_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_unpack\n");
+}
+
+void
+test_cfa_fill(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    CFAReadPath path;
+
+    create_aggregation(sparse_path, 0, 1, 0);
+    int cfa_err = nc_open(sparse_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(sparse_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* the _FillValue is read from the attribute */
+    bool has_fill = false;
+    float fill_value = 0.0f;
+    cfa_err = cfa_var_get_fill(cfa_id, cfa_var_id, &has_fill, &fill_value);
+    assert(cfa_err == CFA_NOERR && has_fill && fill_value == -1.0f);
+
+    /* only the first Fragment has data */
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    size_t nfrags = 0;
+    unsigned char bitmap = 0;
+    cfa_err = cfa_var_inq_frag_presence(cfa_id, cfa_var_id, start, count, NULL,
+                                        &nfrags, NULL);
+    assert(cfa_err == CFA_NOERR && nfrags == 2);
+    cfa_err = cfa_var_inq_frag_presence(cfa_id, cfa_var_id, start, count, NULL,
+                                        &nfrags, &bitmap);
+    assert(cfa_err == CFA_NOERR && nfrags == 2 && bitmap == 0x01);
+
+    /* the second Fragment is filled, in the type that is read */
+    double data[NT][NY][NX];
+    float fdata[NT][NY][NX];
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_DOUBLE,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               fdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+            {
+                float v = t < NT/2 ? expected_value(t, y, x) : -1.0f;
+                assert(data[t][y][x] == v && fdata[t][y][x] == v);
+            }
+    size_t frag_location[3] = {1, 0, 0};
+    cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location, NULL,
+                                    &path);
+    assert(cfa_err == CFA_NOERR && path == CFA_READ_FILL);
+
+    /* a strided read that only touches the second Fragment */
+    size_t sstart[3] = {NT/2, 0, 1};
+    size_t scount[3] = {NT/2, NY, 2};
+    size_t sstride[3] = {1, 1, 2};
+    double sdata[NT/2][NY][2];
+    cfa_err = cfa_var_get_vars(cfa_id, cfa_var_id, sstart, scount, sstride,
+                               CFA_DOUBLE, sdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT/2; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<2; x++)
+                assert(sdata[t][y][x] == -1.0);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_fill\n");
+}
+
+void
+test_cfa_var_put_vara(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int cfa_dimids[3];
+
+    /* split time and longitude, which has an odd length, into Fragments that
+    are written by cfa_var_put_vara */
+    int cfa_err = cfa_create(write_path, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "time", NT, CFA_DOUBLE, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "latitude", NY, CFA_DOUBLE, cfa_dimids+1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "longitude", NX, CFA_DOUBLE, cfa_dimids+2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_var(cfa_id, "tas", CFA_FLOAT, &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_dims(cfa_id, cfa_var_id, 3, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "location",
+                                    "aggregation_location", false, CFA_INT);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "file",
+                                    "aggregation_file", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "format",
+                                    "aggregation_format", true, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "address",
+                                    "aggregation_address", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    const int frags[3] = {2, 1, 2};
+    cfa_err = cfa_var_def_frag_num(cfa_id, cfa_var_id, frags);
+    assert(cfa_err == CFA_NOERR);
+
+    /* write on two threads, half as double and half as float */
+    cfa_err = cfa_set_nthreads(2);
+    assert(cfa_err == CFA_NOERR);
+    double ddata[NT/2][NY][NX];
+    float fdata[NT/2][NY][NX];
+    for (size_t t=0; t<NT/2; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+            {
+                ddata[t][y][x] = expected_value(t, y, x);
+                fdata[t][y][x] = expected_value(NT/2 + t, y, x);
+            }
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT/2, NY, NX};
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, start, count, CFA_DOUBLE,
+                               ddata);
+    assert(cfa_err == CFA_NOERR);
+    start[0] = NT/2;
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               fdata);
+    assert(cfa_err == CFA_NOERR);
+
+    /* the FragmentDatums are filled in */
+    size_t frag_location[3] = {1, 0, 1};
+    char *file = NULL;
+    char *address = NULL;
+    cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location, NULL, "file",
+                                (void**)(&file));
+    assert(cfa_err == CFA_NOERR && strcmp(file, "test_write_tas_3.nc") == 0);
+    cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location, NULL,
+                                "address", (void**)(&address));
+    assert(cfa_err == CFA_NOERR && strcmp(address, "tas") == 0);
+
+    /* values that do not fit in the variable are written anyway, and a range
+    error is returned, as with netCDF-C.  The value is then put back */
+    double big = 1e300;
+    size_t one[3] = {1, 1, 1};
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, start, one, CFA_DOUBLE,
+                               &big);
+    assert(cfa_err == CFA_RANGE_ERR);
+    float value = expected_value(start[0], start[1], start[2]);
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, start, one, CFA_FLOAT,
+                               &value);
+    assert(cfa_err == CFA_NOERR);
+
+    cfa_err = nc_create(write_path, NC_NETCDF4|NC_CLOBBER, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_serialise(cfa_id, nc_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* read the aggregation back, then overwrite a block that spans the
+    Fragments, with the data cache on to check that it is not stale */
+    cfa_err = nc_open(write_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(write_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_data_cache_size(sizeof(float) * NT * NY * NX);
+    assert(cfa_err == CFA_NOERR);
+    float data[NT][NY][NX];
+    size_t all[3] = {NT, NY, NX};
+    start[0] = 0;
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, all, CFA_FLOAT, data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+
+    size_t bstart[3] = {1, 1, 1};
+    size_t bcount[3] = {2, 2, 3};
+    int block[2][2][3];
+    for (size_t t=0; t<2; t++)
+        for (size_t y=0; y<2; y++)
+            for (size_t x=0; x<3; x++)
+                block[t][y][x] = -(int)(t * 100 + y * 10 + x);
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, bstart, bcount, CFA_INT,
+                               block);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, all, CFA_FLOAT, data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+            {
+                float v = expected_value(t, y, x);
+                if (t >= 1 && t < 3 && y >= 1 && y < 3 && x >= 1 && x < 4)
+                    v = block[t-1][y-1][x-1];
+                assert(data[t][y][x] == v);
+            }
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_data_cache_size(0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_put_vara\n");
+}
+
+/* visit the Fragments with an iterator, and get the linear indices of the
+Fragments in the order they are visited */
+int
+iterate_frags(const int cfa_id, const int cfa_var_id, const CFAIterOrder order,
+              int *frag_ids)
+{
+    int iter_id = -1;
+    int n = 0;
+    int cfa_err = cfa_frag_iter_begin(cfa_id, cfa_var_id, order, &iter_id);
+    assert(cfa_err == CFA_NOERR);
+    const Fragment *frag = NULL;
+    cfa_err = cfa_frag_iter_next(iter_id, &frag);
+    assert(cfa_err == CFA_NOERR);
+    while (frag)
+    {
+        frag_ids[n++] = frag->linear_index;
+        cfa_err = cfa_frag_iter_next(iter_id, &frag);
+        assert(cfa_err == CFA_NOERR);
+    }
+    cfa_err = cfa_frag_iter_end(iter_id);
+    assert(cfa_err == CFA_NOERR);
+    return n;
+}
+
+void
+test_cfa_frag_iter(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int cfa_dimids[3];
+    int frag_ids[4];
+    int n = 0;
+
+    /* the Fragments written by test_cfa_var_put_vara are split along time and
+    longitude */
+    int cfa_err = nc_open(write_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(write_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* all the terms of each Fragment are read */
+    int iter_id = -1;
+    cfa_err = cfa_frag_iter_begin(cfa_id, cfa_var_id, CFA_ITER_LINEAR,
+                                  &iter_id);
+    assert(cfa_err == CFA_NOERR);
+    const Fragment *frag = NULL;
+    for (int L=0; L<4; L++)
+    {
+        cfa_err = cfa_frag_iter_next(iter_id, &frag);
+        assert(cfa_err == CFA_NOERR && frag && frag->linear_index == L);
+        size_t t = L / 2;
+        size_t x = L % 2;
+        assert(frag->index[0] == t && frag->index[2] == x);
+        assert(frag->location[0] == t * NT/2 &&
+               frag->location[1] == (t+1) * NT/2);
+        assert(frag->location[4] == x * 2 && frag->location[5] == x * 2 + 2 + x);
+        char file[64];
+        snprintf(file, 64, "test_write_tas_%i.nc", L);
+        const FragmentDatum *frag_dat = NULL;
+        cfa_err = cfa_frag_get_datum(frag, "file", &frag_dat);
+        assert(cfa_err == CFA_NOERR && strcmp(frag_dat->data, file) == 0);
+        cfa_err = cfa_frag_get_datum(frag, "format", &frag_dat);
+        assert(cfa_err == CFA_NOERR && strcmp(frag_dat->data, "nc") == 0);
+        cfa_err = cfa_frag_get_datum(frag, "address", &frag_dat);
+        assert(cfa_err == CFA_NOERR && strcmp(frag_dat->data, "tas") == 0);
+    }
+    cfa_err = cfa_frag_iter_next(iter_id, &frag);
+    assert(cfa_err == CFA_NOERR && frag == NULL);
+    cfa_err = cfa_frag_iter_end(iter_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_frag_iter_next(iter_id, &frag);
+    assert(cfa_err == CFA_ITER_ERR);
+
+    /* by location, with time varying fastest */
+    n = iterate_frags(cfa_id, cfa_var_id, CFA_ITER_LOCATION, frag_ids);
+    assert(n == 4 && frag_ids[0] == 0 && frag_ids[1] == 2 &&
+           frag_ids[2] == 1 && frag_ids[3] == 3);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* Fragments grouped by file, skipping the Fragment that is not defined */
+    cfa_err = cfa_create(write_path, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "time", NT, CFA_DOUBLE, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "latitude", NY, CFA_DOUBLE, cfa_dimids+1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "longitude", NX, CFA_DOUBLE, cfa_dimids+2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_var(cfa_id, "tas", CFA_FLOAT, &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_dims(cfa_id, cfa_var_id, 3, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "file",
+                                    "aggregation_file", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    const int frags[3] = {2, 1, 2};
+    cfa_err = cfa_var_def_frag_num(cfa_id, cfa_var_id, frags);
+    assert(cfa_err == CFA_NOERR);
+    const char *files[4] = {"b.nc", NULL, "a.nc", "a.nc"};
+    for (size_t L=0; L<4; L++)
+    {
+        if (!files[L])
+            continue;
+        size_t frag_location[3] = {L / 2, 0, L % 2};
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           NULL, "file", files[L]);
+        assert(cfa_err == CFA_NOERR);
+    }
+    n = iterate_frags(cfa_id, cfa_var_id, CFA_ITER_FILE, frag_ids);
+    assert(n == 3 && frag_ids[0] == 2 && frag_ids[1] == 3 &&
+           frag_ids[2] == 0);
+    n = iterate_frags(cfa_id, cfa_var_id, CFA_ITER_LINEAR, frag_ids);
+    assert(n == 3 && frag_ids[0] == 0 && frag_ids[1] == 2 &&
+           frag_ids[2] == 3);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_frag_iter\n");
+}
+
+/* user reduction: the sum of the squares of the values */
+int
+sum_squares(const double *data, const size_t n, void *partial,
+            void *user_data)
+{
+    (void)(user_data);
+    for (size_t i=0; i<n; i++)
+        *((double*)(partial)) += data[i] * data[i];
+    return CFA_NOERR;
+}
+
+int
+add_partial(void *result, const void *partial, void *user_data)
+{
+    (void)(user_data);
+    *((double*)(result)) += *((const double*)(partial));
+    return CFA_NOERR;
+}
+
+void
+test_cfa_var_reduce(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_nthreads(2);
+    assert(cfa_err == CFA_NOERR);
+
+    double sum = 0.0;
+    double sum2 = 0.0;
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+            {
+                sum += expected_value(t, y, x);
+                sum2 += expected_value(t, y, x) * expected_value(t, y, x);
+            }
+
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    CFAReducer reducer = {CFA_REDUCE_MIN, 0, 0.0, 0.0, 0, NULL, NULL, NULL};
+    double value = 0.0;
+    size_t n = 0;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer,
+                             &value);
+    assert(cfa_err == CFA_NOERR && value == 0.0);
+    reducer.op = CFA_REDUCE_MAX;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer,
+                             &value);
+    assert(cfa_err == CFA_NOERR &&
+           value == expected_value(NT-1, NY-1, NX-1));
+    reducer.op = CFA_REDUCE_SUM;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer,
+                             &value);
+    assert(cfa_err == CFA_NOERR && value == sum);
+    reducer.op = CFA_REDUCE_COUNT;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer, &n);
+    assert(cfa_err == CFA_NOERR && n == NT * NY * NX);
+    reducer.op = CFA_REDUCE_MEAN;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer,
+                             &value);
+    assert(cfa_err == CFA_NOERR && value == sum / (NT * NY * NX));
+
+    /* one bin for each time */
+    size_t hist[NT];
+    reducer.op = CFA_REDUCE_HISTOGRAM;
+    reducer.nbins = NT;
+    reducer.lo = 0.0;
+    reducer.hi = NT * 100.0;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer, hist);
+    assert(cfa_err == CFA_NOERR);
+    for (int b=0; b<NT; b++)
+        assert(hist[b] == NY * NX);
+    reducer.hi = reducer.lo;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer, hist);
+    assert(cfa_err == CFA_REDUCE_ERR);
+
+    /* a user reduction over a hyperslab that spans both Fragments */
+    reducer.op = CFA_REDUCE_USER;
+    reducer.partial_size = sizeof(double);
+    reducer.reduce = sum_squares;
+    reducer.combine = add_partial;
+    size_t sstart[3] = {1, 1, 2};
+    size_t scount[3] = {2, 1, 3};
+    double expected = 0.0;
+    for (size_t t=1; t<3; t++)
+        for (size_t x=2; x<5; x++)
+            expected += expected_value(t, 1, x) * expected_value(t, 1, x);
+    value = 0.0;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, sstart, scount, &reducer,
+                             &value);
+    assert(cfa_err == CFA_NOERR && value == expected);
+    value = 0.0;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer,
+                             &value);
+    assert(cfa_err == CFA_NOERR && value == sum2);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* the Fragment with no data is left out */
+    cfa_err = nc_open(sparse_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(sparse_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    reducer.op = CFA_REDUCE_COUNT;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer, &n);
+    assert(cfa_err == CFA_NOERR && n == NT/2 * NY * NX);
+    reducer.op = CFA_REDUCE_MAX;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, start, count, &reducer,
+                             &value);
+    assert(cfa_err == CFA_NOERR &&
+           value == expected_value(NT/2-1, NY-1, NX-1));
+    size_t tstart[3] = {NT/2, 0, 0};
+    size_t tcount[3] = {NT/2, NY, NX};
+    reducer.op = CFA_REDUCE_MEAN;
+    cfa_err = cfa_var_reduce(cfa_id, cfa_var_id, tstart, tcount, &reducer,
+                             &value);
+    assert(cfa_err == CFA_NOERR && value != value);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_reduce\n");
+}
+
+/* number of completed asynchronous reads, and their errors */
+int n_callbacks = 0;
+int callback_err = CFA_NOERR;
+
+void
+count_callback(const int req_id, const int err, void *user_data)
+{
+    (void)(req_id);
+    (void)(user_data);
+    __atomic_add_fetch(&n_callbacks, 1, __ATOMIC_SEQ_CST);
+    if (err != CFA_NOERR)
+        callback_err = err;
+}
+
+void
+test_cfa_var_get_vara_async(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int req_ids[NT];
+    int done = 0;
+
+    int cfa_err = cfa_set_nthreads(3);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    /* start a read for every time step, keeping them all in flight */
+    double data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {1, NY, NX};
+    for (size_t t=0; t<NT; t++)
+    {
+        start[0] = t;
+        cfa_err = cfa_var_get_vara_async(cfa_id, cfa_var_id, start, count,
+                                         CFA_DOUBLE, data[t], count_callback,
+                                         NULL, req_ids+t);
+        assert(cfa_err == CFA_NOERR);
+    }
+    /* poll the first request, and wait for the rest */
+    while (!done)
+    {
+        cfa_err = cfa_test(req_ids[0], &done);
+        assert(cfa_err == CFA_NOERR);
+    }
+    for (size_t t=1; t<NT; t++)
+    {
+        cfa_err = cfa_wait(req_ids[t]);
+        assert(cfa_err == CFA_NOERR);
+    }
+    assert(n_callbacks == NT);
+    assert(callback_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+
+    /* the requests have been released */
+    cfa_err = cfa_wait(req_ids[0]);
+    assert(cfa_err == CFA_REQUEST_ERR);
+    cfa_err = cfa_test(-1, &done);
+    assert(cfa_err == CFA_REQUEST_ERR);
+
+    /* errors in the arguments are returned straight away */
+    size_t bstart[3] = {NT, 0, 0};
+    int req_id = -1;
+    cfa_err = cfa_var_get_vara_async(cfa_id, cfa_var_id, bstart, count,
+                                     CFA_DOUBLE, data, NULL, NULL, &req_id);
+    assert(cfa_err == CFA_VAR_HYPERSLAB_ERR);
+
+    /* closing the AggregationContainer waits for the reads still in flight,
+    which are released afterwards */
+    memset(data, 0, sizeof(data));
+    for (size_t t=0; t<NT; t++)
+    {
+        start[0] = t;
+        cfa_err = cfa_var_get_vara_async(cfa_id, cfa_var_id, start, count,
+                                         CFA_DOUBLE, data[t], NULL, NULL,
+                                         req_ids+t);
+        assert(cfa_err == CFA_NOERR);
+    }
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+    {
+        cfa_err = cfa_test(req_ids[t], &done);
+        assert(cfa_err == CFA_NOERR && done);
+    }
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_var_get_vara_async\n");
+}
+
+void
+test_cfa_frag_stats(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    size_t frag_location[2][3] = {{0, 0, 0}, {1, 0, 0}};
+    CFAReadPath path;
+
+    /* the statistics are written with the aggregation variable, and are
+    enough to skip every Fragment without opening it */
+    int cfa_err = cfa_set_nthreads(2);
+    assert(cfa_err == CFA_NOERR);
+    create_aggregation(stats_path, 0, 0, 1);
+    cfa_err = nc_open(stats_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    int nc_varid = -1;
+    cfa_err = nc_inq_varid(nc_id, "tas_fragment_count", &nc_varid);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(stats_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    double *min = NULL;
+    double *max = NULL;
+    long long *n = NULL;
+    for (int f=0; f<2; f++)
+    {
+        cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location[f],
+                                    NULL, FRAGMENT_MIN, (void**)(&min));
+        assert(cfa_err == CFA_NOERR && *min == expected_value(f*NT/2, 0, 0));
+        cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location[f],
+                                    NULL, FRAGMENT_MAX, (void**)(&max));
+        assert(cfa_err == CFA_NOERR &&
+               *max == expected_value(f*NT/2 + 1, NY-1, NX-1));
+        cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location[f],
+                                    NULL, FRAGMENT_COUNT, (void**)(&n));
+        assert(cfa_err == CFA_NOERR && *n == NT/2 * NY * NX);
+    }
+    /* without a _FillValue the values that do not match are the default
+    netCDF fill value */
+    float data[NT][NY][NX];
+    const float fill = NC_FILL_FLOAT;
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    CFAPredicate where = {CFA_WHERE_GE, 1000.0};
+    cfa_err = cfa_var_get_vara_where(cfa_id, cfa_var_id, start, count, &where,
+                                     CFA_FLOAT, data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == fill);
+    for (int f=0; f<2; f++)
+    {
+        cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location[f],
+                                        NULL, &path);
+        assert(cfa_err == CFA_NOERR && path == CFA_READ_SKIPPED);
+    }
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* the statistics can be computed for a loaded file that does not have
+    them */
+    cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_frag_stats(cfa_id, cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location[1], NULL,
+                                FRAGMENT_MIN, (void**)(&min));
+    assert(cfa_err == CFA_NOERR && *min == expected_value(NT/2, 0, 0));
+
+    /* the first Fragment cannot match, so it is filled without being read */
+    where.op = CFA_WHERE_GT;
+    where.value = 250.0;
+    cfa_err = cfa_var_get_vara_where(cfa_id, cfa_var_id, start, count, &where,
+                                     CFA_FLOAT, data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                if (expected_value(t, y, x) > 250.0f)
+                    assert(data[t][y][x] == expected_value(t, y, x));
+                else
+                    assert(data[t][y][x] == fill);
+    cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location[0],
+                                    NULL, &path);
+    assert(cfa_err == CFA_NOERR && path == CFA_READ_SKIPPED);
+    cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location[1],
+                                    NULL, &path);
+    assert(cfa_err == CFA_NOERR && path != CFA_READ_SKIPPED);
+
+    /* writing to a Fragment leaves its statistics unknown, so it is read */
+    float wdata[1][NY][NX];
+    for (size_t y=0; y<NY; y++)
+        for (size_t x=0; x<NX; x++)
+            wdata[0][y][x] = expected_value(0, y, x);
+    size_t wcount[3] = {1, NY, NX};
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, start, wcount, CFA_FLOAT,
+                               wdata);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location[0], NULL,
+                                FRAGMENT_COUNT, (void**)(&n));
+    assert(cfa_err == CFA_NOERR && *n == -1);
+    cfa_err = cfa_var_get_vara_where(cfa_id, cfa_var_id, start, wcount, &where,
+                                     CFA_FLOAT, wdata);
+    assert(cfa_err == CFA_NOERR && wdata[0][0][0] == fill);
+    cfa_err = cfa_var_inq_read_path(cfa_id, cfa_var_id, frag_location[0],
+                                    NULL, &path);
+    assert(cfa_err == CFA_NOERR && path != CFA_READ_SKIPPED);
+
+    /* invalid predicates are rejected */
+    where.op = (CFAWhereOp)(6);
+    cfa_err = cfa_var_get_vara_where(cfa_id, cfa_var_id, start, count, &where,
+                                     CFA_FLOAT, data);
+    assert(cfa_err == CFA_WHERE_ERR);
+
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_frag_stats\n");
+}
+
+void
+test_cfa_coord_range(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int cfa_dim_id = -1;
+    size_t start[3];
+    size_t count[3];
+
+    /* the coordinates are read from the dimension variables */
+    int cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    const double lo[3] = {31.0, 0.0, NAN};
+    const double hi[3] = {60.0, 45.0, NAN};
+    cfa_err = cfa_var_coord_hyperslab(cfa_id, cfa_var_id, lo, hi, start,
+                                      count);
+    assert(cfa_err == CFA_NOERR);
+    assert(start[0] == 1 && count[0] == 2);
+    assert(start[1] == 1 && count[1] == 2);
+    assert(start[2] == 0 && count[2] == NX);
+    double data[2][2][NX];
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_DOUBLE,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<2; t++)
+        for (size_t y=0; y<2; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(1+t, 1+y, x));
+
+    /* the bounds are inclusive, a NaN bound is unbounded and a range with no
+    coordinates in it is empty */
+    size_t dstart = 0;
+    size_t dcount = 0;
+    cfa_err = cfa_inq_dim_id(cfa_id, "longitude", &cfa_dim_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_dim_coord_range(cfa_id, cfa_dim_id, 72.0, 216.0, &dstart,
+                                  &dcount);
+    assert(cfa_err == CFA_NOERR && dstart == 1 && dcount == 3);
+    cfa_err = cfa_dim_coord_range(cfa_id, cfa_dim_id, 200.0, NAN, &dstart,
+                                  &dcount);
+    assert(cfa_err == CFA_NOERR && dstart == 3 && dcount == 2);
+    cfa_err = cfa_dim_coord_range(cfa_id, cfa_dim_id, 73.0, 143.0, &dstart,
+                                  &dcount);
+    assert(cfa_err == CFA_NOERR && dcount == 0);
+    cfa_err = cfa_inq_dim_id(cfa_id, "latitude", &cfa_dim_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_dim_coord_range(cfa_id, cfa_dim_id, NAN, 30.0, &dstart,
+                                  &dcount);
+    assert(cfa_err == CFA_NOERR && dstart == 1 && dcount == 2);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* coordinates must be defined, and monotonic, before they can be used */
+    cfa_err = cfa_create(write_path, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "time", NT, CFA_DOUBLE, &cfa_dim_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_dim_coord_range(cfa_id, cfa_dim_id, 0.0, 1.0, &dstart,
+                                  &dcount);
+    assert(cfa_err == CFA_COORD_ERR);
+    cfa_err = cfa_dim_coord_range(cfa_id, cfa_dim_id, NAN, NAN, &dstart,
+                                  &dcount);
+    assert(cfa_err == CFA_NOERR && dstart == 0 && dcount == NT);
+    const double unsorted[NT] = {0.0, 2.0, 1.0, 3.0};
+    cfa_err = cfa_dim_put_coords(cfa_id, cfa_dim_id, unsorted);
+    assert(cfa_err == CFA_COORD_ERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_coord_range\n");
+}
+
+/* write a netCDF-3 Fragment file holding half of the time dimension, in the
+format given by mode and with the variable of type nc_type.  The time dimension
+is unlimited if record is set */
+void
+create_nc3_fragment(const int f, const int mode, const nc_type type,
+                    const int record)
+{
+    int nc_id = -1;
+    int nc_dimids[3];
+    int nc_varid = -1;
+    double data[NT/2][NY][NX];
+    int err = nc_create(nc3_frag_paths[f], mode|NC_CLOBBER, &nc_id);
+    assert(err == NC_NOERR);
+    err = nc_def_dim(nc_id, "time", record ? NC_UNLIMITED : NT/2, nc_dimids);
+    assert(err == NC_NOERR);
+    err = nc_def_dim(nc_id, "latitude", NY, nc_dimids+1);
+    assert(err == NC_NOERR);
+    err = nc_def_dim(nc_id, "longitude", NX, nc_dimids+2);
+    assert(err == NC_NOERR);
+    err = nc_def_var(nc_id, "tas", type, 3, nc_dimids, &nc_varid);
+    assert(err == NC_NOERR);
+    err = nc_enddef(nc_id);
+    assert(err == NC_NOERR);
+    for (size_t t=0; t<NT/2; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                data[t][y][x] = expected_value(f*NT/2 + t, y, x);
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT/2, NY, NX};
+    err = nc_put_vara_double(nc_id, nc_varid, start, count, (double*)(data));
+    assert(err == NC_NOERR);
+    err = nc_close(nc_id);
+    assert(err == NC_NOERR);
+}
+
+/* read the whole of the netCDF-3 aggregation, and every other longitude, and
+check the number of Fragments read from a memory map and by netCDF */
+void
+check_nc3_read(const size_t n_mmap, const size_t n_netcdf)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    size_t reads0 = 0;
+    size_t fallbacks0 = 0;
+    int cfa_err = cfa_inq_mmap_stats(&reads0, &fallbacks0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_open(nc3_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(nc3_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+
+    float data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+    double sdata[NT][NY][(NX+1)/2];
+    size_t scount[3] = {NT, NY, (NX+1)/2};
+    size_t sstride[3] = {1, 1, 2};
+    cfa_err = cfa_var_get_vars(cfa_id, cfa_var_id, start, scount, sstride,
+                               CFA_DOUBLE, sdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<(NX+1)/2; x++)
+                assert(sdata[t][y][x] == expected_value(t, y, x*2));
+
+    size_t reads = 0;
+    size_t fallbacks = 0;
+    cfa_err = cfa_inq_mmap_stats(&reads, &fallbacks);
+    assert(cfa_err == CFA_NOERR);
+    assert(reads - reads0 == n_mmap * 2);
+    assert(fallbacks - fallbacks0 == n_netcdf * 2);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+}
+
+void
+test_cfa_mmap(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int cfa_dimids[3];
+
+    /* CDF-1 and CDF-5 Fragment files, with types other than the variable */
+    create_nc3_fragment(0, NC_CLASSIC_MODEL, NC_SHORT, 0);
+    create_nc3_fragment(1, NC_64BIT_DATA, NC_DOUBLE, 0);
+    int cfa_err = cfa_create(nc3_path, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "time", NT, CFA_DOUBLE, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "latitude", NY, CFA_DOUBLE, cfa_dimids+1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "longitude", NX, CFA_DOUBLE, cfa_dimids+2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_var(cfa_id, "tas", CFA_FLOAT, &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_dims(cfa_id, cfa_var_id, 3, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "location",
+                                    "aggregation_location", false, CFA_INT);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "file",
+                                    "aggregation_file", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "format",
+                                    "aggregation_format", true, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "address",
+                                    "aggregation_address", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    const int frags[3] = {2, 1, 1};
+    cfa_err = cfa_var_def_frag_num(cfa_id, cfa_var_id, frags);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t f=0; f<2; f++)
+    {
+        size_t frag_location[3] = {f, 0, 0};
+        size_t data_location[6] = {f*NT/2, (f+1)*NT/2, 0, NY, 0, NX};
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "file",
+                                           nc3_frag_files[f]);
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "format", "nc");
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "address", "tas");
+        assert(cfa_err == CFA_NOERR);
+    }
+    cfa_err = nc_create(nc3_path, NC_NETCDF4|NC_CLOBBER, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_serialise(cfa_id, nc_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* both Fragments are read from memory maps, on one thread and on three */
+    check_nc3_read(2, 0);
+    cfa_err = cfa_set_nthreads(3);
+    assert(cfa_err == CFA_NOERR);
+    check_nc3_read(2, 0);
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+
+    /* values out of range of the short Fragment are written anyway, along
+    with the values in range, and a range error is returned */
+    cfa_err = nc_open(nc3_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(nc3_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    float wdata[2] = {40000.0f, -7.0f};
+    size_t wstart[3] = {0, 1, 2};
+    size_t wcount[3] = {1, 1, 2};
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, wstart, wcount, CFA_FLOAT,
+                               wdata);
+    assert(cfa_err == CFA_RANGE_ERR);
+    float rdata[2];
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, wstart, wcount, CFA_FLOAT,
+                               rdata);
+    assert(cfa_err == CFA_NOERR);
+    assert(rdata[0] != expected_value(0, 1, 2));
+    assert(rdata[1] == wdata[1]);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    create_nc3_fragment(0, NC_CLASSIC_MODEL, NC_SHORT, 0);
+
+    /* record variables are read by netCDF, as is everything when the memory
+    maps are off */
+    create_nc3_fragment(1, NC_64BIT_OFFSET, NC_FLOAT, 1);
+    check_nc3_read(1, 1);
+    cfa_err = cfa_set_mmap_reads(0);
+    assert(cfa_err == CFA_NOERR);
+    check_nc3_read(0, 0);
+    cfa_err = cfa_set_mmap_reads(1);
+    assert(cfa_err == CFA_NOERR);
+
+    /* the netCDF-4 Fragment files are left to netCDF */
+    size_t reads0 = 0;
+    size_t fallbacks0 = 0;
+    cfa_err = cfa_inq_mmap_stats(&reads0, &fallbacks0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    float data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    size_t reads = 0;
+    size_t fallbacks = 0;
+    cfa_err = cfa_inq_mmap_stats(&reads, &fallbacks);
+    assert(cfa_err == CFA_NOERR);
+    assert(reads == reads0 && fallbacks - fallbacks0 == 2);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_mmap\n");
+}
+
+/* write the raw Fragment files: the first as little-endian floats after a
+16 byte header, and the second as big-endian shorts with n_values values */
+void
+create_raw_fragments(const size_t n_values)
+{
+    FILE *fp = fopen(raw_frag_paths[0], "wb");
+    assert(fp);
+    unsigned char header[16] = {0};
+    fwrite(header, 1, 16, fp);
+    for (size_t t=0; t<NT/2; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+            {
+                float v = expected_value(t, y, x);
+                unsigned int u = 0;
+                memcpy(&u, &v, 4);
+                unsigned char b[4] = {u & 0xff, (u >> 8) & 0xff,
+                                      (u >> 16) & 0xff, u >> 24};
+                fwrite(b, 1, 4, fp);
+            }
+    fclose(fp);
+    fp = fopen(raw_frag_paths[1], "wb");
+    assert(fp);
+    for (size_t i=0; i<n_values; i++)
+    {
+        size_t t = NT/2 + i / (NY * NX);
+        short v = (short)(expected_value(t, (i / NX) % NY, i % NX));
+        unsigned char b[2] = {(v >> 8) & 0xff, v & 0xff};
+        fwrite(b, 1, 2, fp);
+    }
+    fclose(fp);
+}
+
+void
+test_cfa_raw(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int cfa_dimids[3];
+    const char *addresses[2] = {"offset=16;dtype=<f4;shape=2,3,5",
+                                "dtype=>i2"};
+
+    create_raw_fragments(NT/2 * NY * NX);
+    int cfa_err = cfa_create(raw_path, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "time", NT, CFA_DOUBLE, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "latitude", NY, CFA_DOUBLE, cfa_dimids+1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "longitude", NX, CFA_DOUBLE, cfa_dimids+2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_var(cfa_id, "tas", CFA_FLOAT, &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_dims(cfa_id, cfa_var_id, 3, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "location",
+                                    "aggregation_location", false, CFA_INT);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "file",
+                                    "aggregation_file", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "format",
+                                    "aggregation_format", true, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "address",
+                                    "aggregation_address", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    const int frags[3] = {2, 1, 1};
+    cfa_err = cfa_var_def_frag_num(cfa_id, cfa_var_id, frags);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t f=0; f<2; f++)
+    {
+        size_t frag_location[3] = {f, 0, 0};
+        size_t data_location[6] = {f*NT/2, (f+1)*NT/2, 0, NY, 0, NX};
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "file",
+                                           raw_frag_files[f]);
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "format", "raw");
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "address",
+                                           addresses[f]);
+        assert(cfa_err == CFA_NOERR);
+    }
+    cfa_err = nc_create(raw_path, NC_NETCDF4|NC_CLOBBER, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_serialise(cfa_id, nc_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* read the whole aggregation, and every other longitude, on two threads */
+    cfa_err = nc_open(raw_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(raw_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_nthreads(2);
+    assert(cfa_err == CFA_NOERR);
+    float data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+    double sdata[NT][NY][(NX+1)/2];
+    size_t scount[3] = {NT, NY, (NX+1)/2};
+    size_t sstride[3] = {1, 1, 2};
+    cfa_err = cfa_var_get_vars(cfa_id, cfa_var_id, start, scount, sstride,
+                               CFA_DOUBLE, sdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<(NX+1)/2; x++)
+                assert(sdata[t][y][x] == expected_value(t, y, x*2));
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+
+    /* write a hyperslab across both Fragments, in their own byte orders */
+    float wdata[2][1][2] = {{{-1.0f, -2.0f}}, {{-3.0f, -4.0f}}};
+    size_t wstart[3] = {NT/2-1, 1, 2};
+    size_t wcount[3] = {2, 1, 2};
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, wstart, wcount, CFA_FLOAT,
+                               wdata);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                if (t >= wstart[0] && t < wstart[0]+2 && y == 1 &&
+                    x >= 2 && x < 4)
+                    assert(data[t][y][x] == wdata[t-wstart[0]][0][x-2]);
+                else
+                    assert(data[t][y][x] == expected_value(t, y, x));
+    FILE *fp = fopen(raw_frag_paths[1], "rb");
+    assert(fp);
+    unsigned char b[2];
+    fseek(fp, (1 * NX + 2) * 2, SEEK_SET);
+    assert(fread(b, 1, 2, fp) == 2);
+    assert(b[0] == 0xff && b[1] == 0xfd);
+    fclose(fp);
+
+    /* values out of range of the variable, and of the short Fragment, are
+    written anyway, along with the values in range, and a range error is
+    returned */
+    double rdata[2][1][2] = {{{1e40, -5.0}}, {{40000.0, -6.0}}};
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, wstart, wcount, CFA_DOUBLE,
+                               rdata);
+    assert(cfa_err == CFA_RANGE_ERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    assert(isinf(data[NT/2-1][1][2]));
+    assert(data[NT/2-1][1][3] == -5.0f);
+    assert(data[NT/2][1][2] != wdata[1][0][0]);
+    assert(data[NT/2][1][3] == -6.0f);
+
+    /* a Fragment file that is too short for its address */
+    create_raw_fragments(NY * NX);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_RAW_ADDRESS_ERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_raw\n");
+}
+
+#define NU 100
+
+/* the spans of the Fragments of the uneven aggregation, which are far from
+the equal spans used to estimate which Fragment contains a point */
+const size_t uneven_locations[5] = {0, 97, 98, 99, NU};
+
+void
+test_cfa_uneven_frags(void)
+{
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int cfa_dimid = -1;
+
+    /* each raw Fragment holds the indices of its span, as little-endian
+    floats */
+    for (size_t f=0; f<4; f++)
+    {
+        FILE *fp = fopen(uneven_frag_paths[f], "wb");
+        assert(fp);
+        for (size_t i=uneven_locations[f]; i<uneven_locations[f+1]; i++)
+        {
+            float v = (float)i;
+            unsigned int u = 0;
+            memcpy(&u, &v, 4);
+            unsigned char b[4] = {u & 0xff, (u >> 8) & 0xff,
+                                  (u >> 16) & 0xff, u >> 24};
+            fwrite(b, 1, 4, fp);
+        }
+        fclose(fp);
+    }
+    int cfa_err = cfa_create(uneven_path, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "x", NU, CFA_DOUBLE, &cfa_dimid);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_var(cfa_id, "index", CFA_FLOAT, &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_dims(cfa_id, cfa_var_id, 1, &cfa_dimid);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "location",
+                                    "aggregation_location", false, CFA_INT);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "file",
+                                    "aggregation_file", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "format",
+                                    "aggregation_format", true, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "address",
+                                    "aggregation_address", true, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    const int frags[1] = {4};
+    cfa_err = cfa_var_def_frag_num(cfa_id, cfa_var_id, frags);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t f=0; f<4; f++)
+    {
+        size_t frag_location[1] = {f};
+        size_t data_location[2] = {uneven_locations[f],
+                                   uneven_locations[f+1]};
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "file",
+                                           uneven_frag_files[f]);
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "format", "raw");
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "address",
+                                           "dtype=<f4");
+        assert(cfa_err == CFA_NOERR);
+    }
+    /* the Fragments are read from the AggregationContainer as defined, as a
+    loaded AggregationContainer computes its locations from equal spans.  A
+    single element in the first Fragment, where equal spans put the third */
+    float data[NU];
+    data[0] = -1.0f;
+    size_t start = 50;
+    size_t count = 1;
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, &start, &count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    assert(data[0] == 50.0f);
+
+    /* hyperslabs ending in, and starting in, each of the Fragments */
+    for (size_t s=0; s<NU; s++)
+    {
+        for (size_t i=0; i<NU; i++)
+            data[i] = -1.0f;
+        start = s;
+        count = NU - s;
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, &start, &count,
+                                   CFA_FLOAT, data);
+        assert(cfa_err == CFA_NOERR);
+        for (size_t i=0; i<count; i++)
+            assert(data[i] == (float)(s + i));
+        start = 0;
+        count = s + 1;
+        cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, &start, &count,
+                                   CFA_FLOAT, data);
+        assert(cfa_err == CFA_NOERR);
+        for (size_t i=0; i<count; i++)
+            assert(data[i] == (float)i);
+    }
+
+    /* write a single element in the first Fragment, and a hyperslab across
+    the last three Fragments */
+    float wdata[4] = {-50.0f, -96.0f, -97.0f, -98.0f};
+    start = 50;
+    count = 1;
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, &start, &count, CFA_FLOAT,
+                               wdata);
+    assert(cfa_err == CFA_NOERR);
+    start = 96;
+    count = 3;
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, &start, &count, CFA_FLOAT,
+                               wdata+1);
+    assert(cfa_err == CFA_NOERR);
+    start = 0;
+    count = NU;
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, &start, &count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t i=0; i<NU; i++)
+        if (i == 50 || (i >= 96 && i < 99))
+            assert(data[i] == -(float)i);
+        else
+            assert(data[i] == (float)i);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_uneven_frags\n");
+}
+
+/* the test driver wraps the netCDF driver, counting the calls into it */
+CFAFormatDriver nc_driver;
+int n_opens = 0;
+int n_reads = 0;
+int n_closes = 0;
+
+int
+test_driver_open(const int cfa_id, const Fragment *frag, void **handlep)
+{
+    assert(cfa_id >= 0 && frag);
+    n_opens++;
+    *handlep = &n_opens;
+    return CFA_NOERR;
+}
+
+int
+test_driver_read(void *handle, const int cfa_id, const Fragment *frag,
+                 const int ndim, const size_t *start, const size_t *count,
+                 const size_t *stride, const cfa_type type,
+                 const CFAPacking *unpack, void *data)
+{
+    assert(handle == &n_opens);
+    n_reads++;
+    return nc_driver.read(NULL, cfa_id, frag, ndim, start, count, stride, type,
+                          unpack, data);
+}
+
+int
+test_driver_close(void *handle)
+{
+    assert(handle == &n_opens);
+    n_closes++;
+    return CFA_NOERR;
+}
+
+/* the statistics of the first Fragment are known without reading it */
+int
+test_driver_stat(const int cfa_id, const Fragment *frag, double *minp,
+                 double *maxp, long long *countp)
+{
+    assert(cfa_id >= 0);
+    if (frag->location[0] != 0)
+        return CFA_FRAG_FORMAT_ERR;
+    *minp = -5.0;
+    *maxp = 5.0;
+    *countp = 7;
+    return CFA_NOERR;
+}
+
+void
+test_cfa_format_driver(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+
+    int cfa_err = cfa_inq_format_driver("nc", &nc_driver);
+    assert(cfa_err == CFA_NOERR && nc_driver.read && nc_driver.write);
+    CFAFormatDriver driver;
+    cfa_err = cfa_inq_format_driver("grib", &driver);
+    assert(cfa_err == CFA_FRAG_FORMAT_ERR);
+    driver = nc_driver;
+    driver.read = NULL;
+    cfa_err = cfa_register_format_driver("nc", &driver);
+    assert(cfa_err == CFA_DRIVER_ERR);
+
+    /* each read of a Fragment opens, reads and closes it with the driver */
+    driver = nc_driver;
+    driver.open = test_driver_open;
+    driver.read = test_driver_read;
+    driver.close = test_driver_close;
+    driver.stat = test_driver_stat;
+    cfa_err = cfa_register_format_driver("nc", &driver);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_open(agg_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(agg_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    float data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_value(t, y, x));
+    assert(n_opens == 2 && n_reads == 2 && n_closes == 2);
+
+    /* the statistics the driver knows are used instead of reading */
+    cfa_err = cfa_var_def_frag_stats(cfa_id, cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    assert(n_reads == 3);
+    size_t frag_location[2][3] = {{0, 0, 0}, {1, 0, 0}};
+    double *min = NULL;
+    long long *n = NULL;
+    cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location[0], NULL,
+                                FRAGMENT_MIN, (void**)(&min));
+    assert(cfa_err == CFA_NOERR && *min == -5.0);
+    cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location[0], NULL,
+                                FRAGMENT_COUNT, (void**)(&n));
+    assert(cfa_err == CFA_NOERR && *n == 7);
+    cfa_err = cfa_var_get1_frag(cfa_id, cfa_var_id, frag_location[1], NULL,
+                                FRAGMENT_MIN, (void**)(&min));
+    assert(cfa_err == CFA_NOERR && *min == expected_value(NT/2, 0, 0));
+
+    /* Fragments of a format with no driver cannot be read */
+    cfa_err = cfa_unregister_format_driver("nc");
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_FRAG_FORMAT_ERR);
+    cfa_err = cfa_register_format_driver("nc", &nc_driver);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR && n_reads == 3);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_format_driver\n");
+}
+
+/* write a file in a Zarr store */
+void
+write_zarr_file(const char *store, const char *key, const void *data,
+                const size_t n)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/tas/%s", store, key);
+    FILE *fp = fopen(path, "wb");
+    assert(fp);
+    assert(fwrite(data, 1, n, fp) == n);
+    fclose(fp);
+}
+
+/* write the Zarr Fragments: the first as little-endian floats in zlib
+streams of chunks of (1, 2, 5), with the chunk of the last latitude at the
+second time missing, and the second as uncompressed big-endian shorts in a
+single chunk */
+void
+create_zarr_fragments(void)
+{
+    char path[256];
+    for (int f=0; f<2; f++)
+    {
+        mkdir(zarr_frag_paths[f], 0755);
+        snprintf(path, sizeof(path), "%s/tas", zarr_frag_paths[f]);
+        mkdir(path, 0755);
+    }
+    const char *zarray0 =
+        "{\n  \"chunks\": [1, 2, 5],\n"
+        "  \"compressor\": {\"id\": \"zlib\", \"level\": 1},\n"
+        "  \"dtype\": \"<f4\",\n  \"fill_value\": -9.0,\n"
+        "  \"filters\": null,\n  \"order\": \"C\",\n"
+        "  \"shape\": [2, 3, 5],\n  \"zarr_format\": 2\n}\n";
+    write_zarr_file(zarr_frag_paths[0], ".zarray", zarray0, strlen(zarray0));
+    for (size_t t=0; t<NT/2; t++)
+        for (size_t c=0; c<2; c++)
+        {
+            if (t == 1 && c == 1)
+                continue;
+            /* a zlib stream of a single stored block */
+            unsigned char z[2 + 5 + 40 + 4] = {0x78, 0x01, 0x01, 40, 0,
+                                               ~40 & 0xff, 0xff};
+            unsigned char *b = z + 7;
+            for (size_t y=c*2; y<c*2+2; y++)
+                for (size_t x=0; x<NX; x++, b+=4)
+                {
+                    float v = y < NY ? expected_value(t, y, x) : 0.0f;
+                    unsigned int u = 0;
+                    memcpy(&u, &v, 4);
+                    b[0] = u & 0xff;
+                    b[1] = (u >> 8) & 0xff;
+                    b[2] = (u >> 16) & 0xff;
+                    b[3] = u >> 24;
+                }
+            unsigned int s1 = 1;
+            unsigned int s2 = 0;
+            for (int i=0; i<40; i++)
+            {
+                s1 = (s1 + z[7+i]) % 65521;
+                s2 = (s2 + s1) % 65521;
+            }
+            unsigned int adler = (s2 << 16) | s1;
+            b[0] = adler >> 24;
+            b[1] = (adler >> 16) & 0xff;
+            b[2] = (adler >> 8) & 0xff;
+            b[3] = adler & 0xff;
+            char key[16];
+            snprintf(key, sizeof(key), "%zu.%zu.0", t, c);
+            write_zarr_file(zarr_frag_paths[0], key, z, sizeof(z));
+        }
+
+    const char *zarray1 =
+        "{\"zarr_format\": 2, \"shape\": [2, 3, 5], \"chunks\": [2, 3, 5],"
+        " \"dtype\": \">i2\", \"compressor\": null, \"fill_value\": 0,"
+        " \"order\": \"C\", \"filters\": [], \"dimension_separator\": \"/\","
+        " \"attributes\": {\"units\": [\"K\", {\"a\": 1.5e3}]}}";
+    write_zarr_file(zarr_frag_paths[1], ".zarray", zarray1, strlen(zarray1));
+    snprintf(path, sizeof(path), "%s/tas/0", zarr_frag_paths[1]);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/tas/0/0", zarr_frag_paths[1]);
+    mkdir(path, 0755);
+    unsigned char data[NT/2 * NY * NX * 2];
+    for (size_t i=0; i<NT/2 * NY * NX; i++)
+    {
+        short v = (short)(expected_value(NT/2 + i / (NY * NX),
+                                         (i / NX) % NY, i % NX));
+        data[i*2] = (v >> 8) & 0xff;
+        data[i*2+1] = v & 0xff;
+    }
+    write_zarr_file(zarr_frag_paths[1], "0/0/0", data, sizeof(data));
+}
+
+/* value of the Zarr aggregation at (t, y, x) */
+float
+expected_zarr_value(size_t t, size_t y, size_t x)
+{
+    return t == 1 && y == 2 ? -9.0f : expected_value(t, y, x);
+}
+
+void
+test_cfa_zarr(void)
+{
+    int nc_id = -1;
+    int cfa_id = -1;
+    int cfa_var_id = -1;
+    int cfa_dimids[3];
+
+    create_zarr_fragments();
+    int cfa_err = cfa_create(zarr_path, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "time", NT, CFA_DOUBLE, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "latitude", NY, CFA_DOUBLE, cfa_dimids+1);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_dim(cfa_id, "longitude", NX, CFA_DOUBLE, cfa_dimids+2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_def_var(cfa_id, "tas", CFA_FLOAT, &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_dims(cfa_id, cfa_var_id, 3, cfa_dimids);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "location",
+                                    "aggregation_location", false, CFA_INT);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "file",
+                                    "aggregation_file", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "format",
+                                    "aggregation_format", true, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_def_agg_instr(cfa_id, cfa_var_id, "address",
+                                    "aggregation_address", false, CFA_STRING);
+    assert(cfa_err == CFA_NOERR);
+    const int frags[3] = {2, 1, 1};
+    cfa_err = cfa_var_def_frag_num(cfa_id, cfa_var_id, frags);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t f=0; f<2; f++)
+    {
+        size_t frag_location[3] = {f, 0, 0};
+        size_t data_location[6] = {f*NT/2, (f+1)*NT/2, 0, NY, 0, NX};
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "file",
+                                           zarr_frag_files[f]);
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "format", "zarr");
+        assert(cfa_err == CFA_NOERR);
+        cfa_err = cfa_var_put1_frag_string(cfa_id, cfa_var_id, frag_location,
+                                           data_location, "address", "tas");
+        assert(cfa_err == CFA_NOERR);
+    }
+    cfa_err = nc_create(zarr_path, NC_NETCDF4|NC_CLOBBER, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_serialise(cfa_id, nc_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+
+    /* read the whole aggregation, and every other latitude and longitude, with
+    the chunks decompressed on three threads */
+    size_t meta_reads0 = 0;
+    size_t chunk_reads0 = 0;
+    cfa_err = cfa_inq_zarr_stats(&meta_reads0, &chunk_reads0);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_open(zarr_path, NC_NOWRITE, &nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_load(zarr_path, nc_id, CFA_NETCDF, &cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_var_id(cfa_id, "tas", &cfa_var_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_set_nthreads(3);
+    assert(cfa_err == CFA_NOERR);
+    float data[NT][NY][NX];
+    size_t start[3] = {0, 0, 0};
+    size_t count[3] = {NT, NY, NX};
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<NY; y++)
+            for (size_t x=0; x<NX; x++)
+                assert(data[t][y][x] == expected_zarr_value(t, y, x));
+    double sdata[NT][(NY+1)/2][(NX+1)/2];
+    size_t scount[3] = {NT, (NY+1)/2, (NX+1)/2};
+    size_t sstride[3] = {1, 2, 2};
+    cfa_err = cfa_var_get_vars(cfa_id, cfa_var_id, start, scount, sstride,
+                               CFA_DOUBLE, sdata);
+    assert(cfa_err == CFA_NOERR);
+    for (size_t t=0; t<NT; t++)
+        for (size_t y=0; y<(NY+1)/2; y++)
+            for (size_t x=0; x<(NX+1)/2; x++)
+                assert(sdata[t][y][x] == expected_zarr_value(t, y*2, x*2));
+    cfa_err = cfa_set_nthreads(1);
+    assert(cfa_err == CFA_NOERR);
+
+    /* the metadata of each array is read once */
+    size_t meta_reads = 0;
+    size_t chunk_reads = 0;
+    cfa_err = cfa_inq_zarr_stats(&meta_reads, &chunk_reads);
+    assert(cfa_err == CFA_NOERR);
+    assert(meta_reads - meta_reads0 == 2);
+    assert(chunk_reads - chunk_reads0 == 8);
+
+    /* and is kept when another container is closed */
+    int cfa_id2 = -1;
+    cfa_err = cfa_create("build/test_read_other.nc", CFA_NETCDF, &cfa_id2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_close(cfa_id2);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_var_get_vara(cfa_id, cfa_var_id, start, count, CFA_FLOAT,
+                               data);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = cfa_inq_zarr_stats(&meta_reads, &chunk_reads);
+    assert(cfa_err == CFA_NOERR);
+    assert(meta_reads - meta_reads0 == 2);
+
+    /* the driver cannot write */
+    float wdata = 0.0f;
+    size_t wcount[3] = {1, 1, 1};
+    cfa_err = cfa_var_put_vara(cfa_id, cfa_var_id, start, wcount, CFA_FLOAT,
+                               &wdata);
+    assert(cfa_err == CFA_FRAG_FORMAT_ERR);
+    cfa_err = cfa_close(cfa_id);
+    assert(cfa_err == CFA_NOERR);
+    cfa_err = nc_close(nc_id);
+    assert(cfa_err == NC_NOERR);
+    cfa_err = cfa_memcheck();
+    assert(cfa_err == CFA_NOERR);
+    printf("Completed test_cfa_zarr\n");
+}
+
+int
+main(void)
+{
+    create_fragments();
+    create_aggregation(agg_path, 0, 0, 0);
+    test_cfa_var_get_vara();
+    test_cfa_var_get_vara_threads();
+    test_cfa_handle_cache();
+    test_cfa_data_cache();
+    test_cfa_prefetch();
+    test_cfa_var_get_vara_async();
+    test_cfa_var_get_vars();
+    test_cfa_read_path();
+    test_cfa_read_convert();
+    test_cfa_unpack();
+    test_cfa_fill();
+    test_cfa_var_get_points();
+    test_cfa_var_get_series();
+    test_cfa_var_get_vara_multi();
+    test_cfa_var_get_vara_halo();
+    test_cfa_var_get_vara_perm();
+    test_cfa_var_put_vara();
+    test_cfa_frag_iter();
+    test_cfa_var_reduce();
+    test_cfa_frag_stats();
+    test_cfa_coord_range();
+    test_cfa_mmap();
+    test_cfa_raw();
+    test_cfa_uneven_frags();
+    test_cfa_format_driver();
+    test_cfa_zarr();
+}